@@ -9,7 +9,7 @@ use std::sync::{Arc, RwLock};
 use std::ptr;
 use std::collections::HashMap;
 use std::net::TcpStream;
-use atmosphere_core::{NodeId, Capability, CapabilityRegistry};
+use atmosphere_core::{NodeId, Capability, CapabilityRegistry, CostCollector, InferenceCapacity, PlatformMetrics};
 use tungstenite::{connect, Message, WebSocket};
 use tungstenite::stream::MaybeTlsStream;
 use url::Url;
@@ -75,6 +75,33 @@ impl MeshConnection {
     }
 }
 
+// ============================================================================
+// Device Metrics
+// ============================================================================
+
+/// The binding reads no device metrics itself (Kotlin's CostCollector
+/// gossips those), so the local cost sees neutral values and is decided by
+/// the inference capacity the app reports
+struct NeutralMetrics;
+
+impl PlatformMetrics for NeutralMetrics {
+    fn battery_percent(&self) -> Option<f32> {
+        None
+    }
+
+    fn is_on_battery(&self) -> bool {
+        false
+    }
+
+    fn cpu_load(&self) -> f32 {
+        0.5
+    }
+
+    fn available_memory_mb(&self) -> u64 {
+        0
+    }
+}
+
 // ============================================================================
 // Android Node Wrapper
 // ============================================================================
@@ -92,6 +119,10 @@ pub struct AndroidNode {
     mesh: Mutex<MeshConnection>,
     // Discovered/connected peers
     peers: RwLock<Vec<Peer>>,
+    // Local and peer costs, including measured inference capacity
+    costs: CostCollector,
+    // Mesh peer IDs (capability doc peer_id) to the IDs costs are kept under
+    cost_peer_ids: RwLock<HashMap<String, NodeId>>,
 }
 
 impl AndroidNode {
@@ -104,6 +135,8 @@ impl AndroidNode {
             cap_name_to_id: RwLock::new(HashMap::new()),
             mesh: Mutex::new(MeshConnection::new()),
             peers: RwLock::new(Vec::new()),
+            costs: CostCollector::new(Arc::new(NeutralMetrics)),
+            cost_peer_ids: RwLock::new(HashMap::new()),
         }
     }
     
@@ -375,6 +408,58 @@ impl AndroidNode {
         Ok(())
     }
     
+    /// Report the local inference engine's measured capacity (JSON as
+    /// written to a capability doc's `cost.inference`)
+    pub fn update_inference_capacity_json(&self, json: &str) -> Result<(), String> {
+        let capacity: InferenceCapacity = serde_json::from_str(json)
+            .map_err(|e| format!("Invalid JSON: {}", e))?;
+        self.costs.update_inference_capacity(capacity);
+        Ok(())
+    }
+    
+    /// Update peers' inference capacity from their capability documents
+    /// (a JSON array, as queried from `_capabilities`). Peers with no
+    /// `cost.inference` left lose theirs. Returns how many peers have one.
+    pub fn update_peer_capabilities_json(&self, json: &str) -> Result<usize, String> {
+        let docs: Vec<serde_json::Value> = serde_json::from_str(json)
+            .map_err(|e| format!("Invalid JSON: {}", e))?;
+        
+        let mut by_peer: HashMap<String, Vec<InferenceCapacity>> = HashMap::new();
+        for doc in &docs {
+            let peer_id = match doc["peer_id"].as_str().or_else(|| doc["source"].as_str()) {
+                Some(id) if id != self.node_id => id,
+                _ => continue,
+            };
+            if let Some(capacity) = InferenceCapacity::from_capability_json(doc) {
+                by_peer.entry(peer_id.to_string()).or_default().push(capacity);
+            }
+        }
+        
+        let mut ids = self.cost_peer_ids.write().unwrap();
+        for peer_id in by_peer.keys() {
+            ids.entry(peer_id.clone()).or_insert_with(NodeId::new);
+        }
+        for (peer_id, node_id) in ids.iter() {
+            let inference = by_peer.get(peer_id).cloned().unwrap_or_default();
+            self.costs.update_peer_inference(*node_id, inference);
+        }
+        Ok(by_peer.len())
+    }
+    
+    /// The peer expected to finish a request for `model` soonest, by its
+    /// measured capacity; None if no peer has measured the model
+    pub fn select_inference_peer(&self, model: &str, prompt_tokens: u32, max_tokens: u32) -> Option<String> {
+        let (node_id, _) = self.costs.find_fastest_peer_for_model(model, prompt_tokens, max_tokens)?;
+        self.cost_peer_ids.read().unwrap().iter()
+            .find(|(_, id)| **id == node_id)
+            .map(|(peer_id, _)| peer_id.clone())
+    }
+    
+    /// This node's current cost as JSON
+    pub fn local_cost_json(&self) -> String {
+        serde_json::to_string(&self.costs.calculate_local_cost()).unwrap_or_else(|_| "{}".to_string())
+    }
+    
     fn get_capability_names(&self) -> Vec<String> {
         self.cap_name_to_id.read().unwrap().keys().cloned().collect()
     }
@@ -787,6 +872,131 @@ pub extern "C" fn Java_com_llamafarm_atmosphere_bindings_AtmosphereNode_nativeSe
     }
 }
 
+// ============================================================================
+// Cost Functions
+// ============================================================================
+
+/// Report the local engine's measured inference capacity (JSON)
+/// Returns 0 on success, non-zero on error
+#[no_mangle]
+pub extern "C" fn Java_com_llamafarm_atmosphere_bindings_AtmosphereNode_nativeUpdateInferenceCapacity(
+    _env: *mut std::ffi::c_void,
+    _obj: *mut std::ffi::c_void,
+    handle: c_long,
+    json: *const c_char,
+) -> i32 {
+    let node = unsafe {
+        if handle == 0 {
+            return -1;
+        }
+        &*(handle as NodeHandle)
+    };
+    
+    let json_str = unsafe {
+        if json.is_null() {
+            return -2;
+        }
+        match CStr::from_ptr(json).to_str() {
+            Ok(s) => s,
+            Err(_) => return -3,
+        }
+    };
+    
+    match node.update_inference_capacity_json(json_str) {
+        Ok(_) => 0,
+        Err(_) => -4,
+    }
+}
+
+/// Update peers' inference capacity from capability documents (JSON array)
+/// Returns the number of peers with a measured capacity, negative on error
+#[no_mangle]
+pub extern "C" fn Java_com_llamafarm_atmosphere_bindings_AtmosphereNode_nativeUpdatePeerCapabilities(
+    _env: *mut std::ffi::c_void,
+    _obj: *mut std::ffi::c_void,
+    handle: c_long,
+    json: *const c_char,
+) -> i32 {
+    let node = unsafe {
+        if handle == 0 {
+            return -1;
+        }
+        &*(handle as NodeHandle)
+    };
+    
+    let json_str = unsafe {
+        if json.is_null() {
+            return -2;
+        }
+        match CStr::from_ptr(json).to_str() {
+            Ok(s) => s,
+            Err(_) => return -3,
+        }
+    };
+    
+    match node.update_peer_capabilities_json(json_str) {
+        Ok(count) => count as i32,
+        Err(_) => -4,
+    }
+}
+
+/// Select the peer expected to finish an inference request soonest
+/// Returns its peer ID, or null if no peer has measured the model
+#[no_mangle]
+pub extern "C" fn Java_com_llamafarm_atmosphere_bindings_AtmosphereNode_nativeSelectInferencePeer(
+    _env: *mut std::ffi::c_void,
+    _obj: *mut std::ffi::c_void,
+    handle: c_long,
+    model: *const c_char,
+    prompt_tokens: i32,
+    max_tokens: i32,
+) -> *mut c_char {
+    let node = unsafe {
+        if handle == 0 {
+            return ptr::null_mut();
+        }
+        &*(handle as NodeHandle)
+    };
+    
+    let model_str = unsafe {
+        if model.is_null() {
+            return ptr::null_mut();
+        }
+        match CStr::from_ptr(model).to_str() {
+            Ok(s) => s,
+            Err(_) => return ptr::null_mut(),
+        }
+    };
+    
+    match node.select_inference_peer(model_str, prompt_tokens.max(0) as u32, max_tokens.max(0) as u32) {
+        Some(peer_id) => match CString::new(peer_id) {
+            Ok(cstr) => cstr.into_raw(),
+            Err(_) => ptr::null_mut(),
+        },
+        None => ptr::null_mut(),
+    }
+}
+
+/// Get this node's current cost as JSON
+#[no_mangle]
+pub extern "C" fn Java_com_llamafarm_atmosphere_bindings_AtmosphereNode_nativeLocalCostJson(
+    _env: *mut std::ffi::c_void,
+    _obj: *mut std::ffi::c_void,
+    handle: c_long,
+) -> *mut c_char {
+    let node = unsafe {
+        if handle == 0 {
+            return ptr::null_mut();
+        }
+        &*(handle as NodeHandle)
+    };
+    
+    match CString::new(node.local_cost_json()) {
+        Ok(cstr) => cstr.into_raw(),
+        Err(_) => ptr::null_mut(),
+    }
+}
+
 /// Disconnect from mesh
 #[no_mangle]
 pub extern "C" fn Java_com_llamafarm_atmosphere_bindings_AtmosphereNode_nativeDisconnectMesh(
@@ -871,4 +1081,44 @@ mod tests {
         let json = node.get_peers_json();
         assert!(json.contains("192.168.1.1:11451"));
     }
+    
+    #[test]
+    fn test_select_inference_peer() {
+        let node = AndroidNode::new("test-node".to_string(), "/tmp".to_string());
+        let doc = |peer: &str, decode: f32| serde_json::json!({
+            "peer_id": peer,
+            "model": "llama",
+            "cost": {
+                "local": true,
+                "inference": {
+                    "model": "llama",
+                    "prefill_tokens_per_s": decode * 10.0,
+                    "decode_tokens_per_s": decode,
+                    "queue_depth": 0,
+                    "kv_headroom_tokens": 4096
+                }
+            }
+        });
+        
+        // No measurements yet
+        assert_eq!(node.select_inference_peer("llama", 100, 256), None);
+        
+        let docs = serde_json::json!([
+            doc("slow-peer", 4.0),
+            doc("fast-peer", 30.0),
+            doc("test-node", 90.0),
+            { "peer_id": "other-peer", "model": "llama" }
+        ]);
+        assert_eq!(node.update_peer_capabilities_json(&docs.to_string()).unwrap(), 2);
+        assert_eq!(node.select_inference_peer("llama", 100, 256).as_deref(), Some("fast-peer"));
+        assert_eq!(node.select_inference_peer("qwen", 100, 256), None);
+        
+        // The fast peer stopped publishing
+        let docs = serde_json::json!([doc("slow-peer", 4.0)]);
+        assert_eq!(node.update_peer_capabilities_json(&docs.to_string()).unwrap(), 1);
+        assert_eq!(node.select_inference_peer("llama", 100, 256).as_deref(), Some("slow-peer"));
+        
+        node.update_inference_capacity_json(&doc("test-node", 20.0)["cost"]["inference"].to_string()).unwrap();
+        assert!(node.local_cost_json().contains("\"decode_tokens_per_s\":20"));
+    }
 }
@@ -0,0 +1,171 @@
+package com.llamafarm.atmosphere.mesh
+
+import androidx.test.ext.junit.runners.AndroidJUnit4
+import kotlinx.coroutines.runBlocking
+import okhttp3.OkHttpClient
+import okhttp3.mockwebserver.Dispatcher
+import okhttp3.mockwebserver.MockResponse
+import okhttp3.mockwebserver.MockWebServer
+import okhttp3.mockwebserver.RecordedRequest
+import okhttp3.mockwebserver.SocketPolicy
+import okhttp3.tls.HandshakeCertificates
+import okhttp3.tls.HeldCertificate
+import okio.Buffer
+import org.junit.After
+import org.junit.Assert.assertArrayEquals
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertThrows
+import org.junit.Assume.assumeTrue
+import org.junit.Before
+import org.junit.Rule
+import org.junit.Test
+import org.junit.rules.TemporaryFolder
+import org.junit.runner.RunWith
+import java.io.IOException
+import java.net.InetAddress
+import java.security.MessageDigest
+import java.util.concurrent.atomic.AtomicInteger
+import kotlin.random.Random
+
+/**
+ * [ParallelRangeDownloader] and range_file.cpp against a local MockWebServer.
+ *
+ * Instrumented rather than a host JVM test: [RangeFileWriter] needs the
+ * device build of llama-jni. The server speaks TLS because the app does not
+ * allow cleartext traffic.
+ */
+@RunWith(AndroidJUnit4::class)
+class ParallelRangeDownloaderTest {
+
+    companion object {
+        private const val CHUNK_SIZE = 64 * 1024
+        private const val CHUNKS = 6
+        // Last chunk is short
+        private val DATA = Random(42).nextBytes((CHUNKS - 1) * CHUNK_SIZE + 1234)
+    }
+
+    @get:Rule
+    val tempFolder = TemporaryFolder()
+
+    private val dispatcher = RangeDispatcher(DATA)
+    private lateinit var server: MockWebServer
+    private lateinit var client: OkHttpClient
+
+    @Before
+    fun setUp() {
+        assumeTrue("llama-jni not available", RangeFileWriter.isAvailable)
+
+        val localhost = HeldCertificate.Builder()
+            .addSubjectAlternativeName("localhost")
+            .build()
+        val serverCertificates = HandshakeCertificates.Builder()
+            .heldCertificate(localhost)
+            .build()
+        val clientCertificates = HandshakeCertificates.Builder()
+            .addTrustedCertificate(localhost.certificate)
+            .build()
+
+        server = MockWebServer()
+        server.useHttps(serverCertificates.sslSocketFactory(), false)
+        server.dispatcher = dispatcher
+        server.start(InetAddress.getByName("localhost"), 0)
+
+        client = OkHttpClient.Builder()
+            .sslSocketFactory(clientCertificates.sslSocketFactory(), clientCertificates.trustManager)
+            .build()
+    }
+
+    @After
+    fun tearDown() {
+        if (::server.isInitialized) {
+            server.shutdown()
+        }
+    }
+
+    @Test
+    fun fetchesEveryChunkAsARange() = runBlocking {
+        val file = tempFolder.newFile("model.gguf")
+
+        val result = ParallelRangeDownloader(client, chunkSize = CHUNK_SIZE)
+            .download(url(), file, DATA.size.toLong())
+
+        assertArrayEquals(DATA, file.readBytes())
+        assertEquals(sha256(DATA), result.sha256)
+        assertEquals(DATA.size.toLong(), result.bytesFetched)
+        assertEquals(CHUNKS, dispatcher.rangeRequests.get())
+        for (chunk in 0 until CHUNKS) {
+            val start = chunk * CHUNK_SIZE
+            val end = minOf(start + CHUNK_SIZE, DATA.size)
+            assertEquals(sha256(DATA.copyOfRange(start, end)), result.chunkHashes[chunk])
+        }
+        assertFalse(RangeFileWriter.rangesFile(file).exists())
+    }
+
+    @Test
+    fun resumesOnlyTheMissingChunksAfterAnInterruption() = runBlocking {
+        val file = tempFolder.newFile("model.gguf")
+        // One stream, so chunks 0 and 1 complete before chunk 2 keeps dropping
+        val downloader = ParallelRangeDownloader(client, parallelism = 1, chunkSize = CHUNK_SIZE)
+
+        dispatcher.disconnectAtOffset = 2L * CHUNK_SIZE
+        assertThrows(IOException::class.java) {
+            runBlocking { downloader.download(url(), file, DATA.size.toLong()) }
+        }
+
+        dispatcher.disconnectAtOffset = null
+        dispatcher.rangeRequests.set(0)
+        val result = downloader.download(url(), file, DATA.size.toLong())
+
+        assertArrayEquals(DATA, file.readBytes())
+        assertEquals(sha256(DATA), result.sha256)
+        assertEquals(DATA.size.toLong() - 2L * CHUNK_SIZE, result.bytesFetched)
+        assertEquals(CHUNKS - 2, dispatcher.rangeRequests.get())
+    }
+
+    @Test
+    fun reportsAServerThatIgnoresRanges() {
+        val file = tempFolder.newFile("model.gguf")
+        dispatcher.honourRanges = false
+
+        assertThrows(RangeNotSupportedException::class.java) {
+            runBlocking {
+                ParallelRangeDownloader(client, chunkSize = CHUNK_SIZE)
+                    .download(url(), file, DATA.size.toLong())
+            }
+        }
+    }
+
+    private fun url(): String = server.url("/v1/models/download").toString()
+
+    private fun sha256(bytes: ByteArray): String =
+        MessageDigest.getInstance("SHA-256").digest(bytes).joinToString("") { "%02x".format(it) }
+
+    /**
+     * Serves [body] honouring single `Range: bytes=start-end` requests.
+     */
+    private class RangeDispatcher(private val body: ByteArray) : Dispatcher() {
+        @Volatile var honourRanges = true
+        // Chunk start whose responses drop the connection halfway through
+        @Volatile var disconnectAtOffset: Long? = null
+        val rangeRequests = AtomicInteger()
+
+        override fun dispatch(request: RecordedRequest): MockResponse {
+            val range = request.getHeader("Range")
+            if (!honourRanges || range == null) {
+                return MockResponse().setBody(Buffer().write(body))
+            }
+
+            val (start, end) = range.removePrefix("bytes=").split("-").map { it.toLong() }
+            rangeRequests.incrementAndGet()
+            val response = MockResponse()
+                .setResponseCode(206)
+                .setHeader("Content-Range", "bytes $start-$end/${body.size}")
+                .setBody(Buffer().write(body, start.toInt(), (end - start + 1).toInt()))
+            if (start == disconnectAtOffset) {
+                response.setSocketPolicy(SocketPolicy.DISCONNECT_DURING_RESPONSE_BODY)
+            }
+            return response
+        }
+    }
+}
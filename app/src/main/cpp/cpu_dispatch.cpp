@@ -0,0 +1,211 @@
+/**
+ * CPU feature detection and ggml CPU backend selection.
+ */
+
+#include "cpu_dispatch.h"
+
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#elif defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "ggml-backend.h"
+
+#define LOG_TAG "LlamaCpuDispatch"
+#include "llama_jni.h"
+
+// Older NDK headers lack the newer hwcap bits
+#if defined(__aarch64__)
+#ifndef HWCAP_ASIMDHP
+#define HWCAP_ASIMDHP (1 << 10)
+#endif
+#ifndef HWCAP_ASIMDDP
+#define HWCAP_ASIMDDP (1 << 20)
+#endif
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1 << 22)
+#endif
+#ifndef HWCAP2_SVE2
+#define HWCAP2_SVE2 (1 << 1)
+#endif
+#ifndef HWCAP2_I8MM
+#define HWCAP2_I8MM (1 << 13)
+#endif
+#ifndef HWCAP2_SME
+#define HWCAP2_SME (1 << 23)
+#endif
+#endif
+
+namespace {
+
+struct Variant {
+    const char* name;
+    bool (*supported)(const CpuFeatures&);
+};
+
+// Best first. Names match llama.cpp's GGML_CPU_ALL_VARIANTS targets.
+#if defined(__aarch64__)
+const Variant VARIANTS[] = {
+    {"android_armv9.2_2", [](const CpuFeatures& f) { return f.dotprod && f.fp16 && f.i8mm && f.sve && f.sme; }},
+    {"android_armv9.2_1", [](const CpuFeatures& f) { return f.dotprod && f.fp16 && f.i8mm && f.sme; }},
+    {"android_armv9.0_1", [](const CpuFeatures& f) { return f.dotprod && f.fp16 && f.i8mm && f.sve2; }},
+    {"android_armv8.6_1", [](const CpuFeatures& f) { return f.dotprod && f.fp16 && f.i8mm; }},
+    {"android_armv8.2_2", [](const CpuFeatures& f) { return f.dotprod && f.fp16; }},
+    {"android_armv8.2_1", [](const CpuFeatures& f) { return f.dotprod; }},
+    {"android_armv8.0_1", [](const CpuFeatures&) { return true; }},
+};
+#elif defined(__x86_64__)
+const Variant VARIANTS[] = {
+    {"icelake", [](const CpuFeatures& f) { return f.avx512 && f.avx512_vnni; }},
+    {"skylakex", [](const CpuFeatures& f) { return f.avx512; }},
+    {"alderlake", [](const CpuFeatures& f) { return f.avx2 && f.fma && f.f16c && f.avx_vnni; }},
+    {"haswell", [](const CpuFeatures& f) { return f.avx2 && f.fma && f.f16c; }},
+    {"sandybridge", [](const CpuFeatures& f) { return f.avx; }},
+    {"sse42", [](const CpuFeatures& f) { return f.sse42; }},
+    {"x64", [](const CpuFeatures&) { return true; }},
+};
+#else
+const Variant VARIANTS[] = {};
+#endif
+
+CpuFeatures detect_features() {
+    CpuFeatures f;
+#if defined(__aarch64__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    unsigned long hwcap2 = getauxval(AT_HWCAP2);
+    f.dotprod = hwcap & HWCAP_ASIMDDP;
+    f.fp16 = hwcap & HWCAP_ASIMDHP;
+    f.sve = hwcap & HWCAP_SVE;
+    f.sve2 = hwcap2 & HWCAP2_SVE2;
+    f.i8mm = hwcap2 & HWCAP2_I8MM;
+    f.sme = hwcap2 & HWCAP2_SME;
+#elif defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        f.sse42 = ecx & bit_SSE4_2;
+        f.fma = ecx & bit_FMA;
+        f.f16c = ecx & bit_F16C;
+        // AVX state must also be enabled by the OS (XCR0 bits 1 and 2)
+        bool os_avx = false;
+        bool os_avx512 = false;
+        if (ecx & bit_OSXSAVE) {
+            unsigned int xcr0_lo, xcr0_hi;
+            __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+            os_avx = (xcr0_lo & 0x6) == 0x6;
+            os_avx512 = (xcr0_lo & 0xe6) == 0xe6;
+        }
+        f.avx = os_avx && (ecx & bit_AVX);
+        f.fma = f.fma && os_avx;
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            f.avx2 = os_avx && (ebx & bit_AVX2);
+            f.avx512 = os_avx512 && (ebx & bit_AVX512F) && (ebx & bit_AVX512BW) && (ebx & bit_AVX512VL);
+            f.avx512_vnni = f.avx512 && (ecx & (1u << 11));
+        }
+        if (__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx)) {
+            f.avx_vnni = f.avx2 && (eax & (1u << 4));
+        }
+    }
+#endif
+    return f;
+}
+
+bool file_exists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+bool starts_with(const char* s, const char* prefix) {
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+bool ends_with(const char* s, const char* suffix) {
+    size_t len = strlen(s), n = strlen(suffix);
+    return len >= n && strcmp(s + len - n, suffix) == 0;
+}
+
+// Load the GPU/accelerator backends next to the CPU variants
+void load_other_backends(const std::string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    while (dirent* entry = readdir(d)) {
+        const char* name = entry->d_name;
+        if (!starts_with(name, "libggml-") || !ends_with(name, ".so") ||
+            starts_with(name, "libggml-cpu") || starts_with(name, "libggml-base")) {
+            continue;
+        }
+        if (ggml_backend_load((dir + "/" + name).c_str())) {
+            LOGI("Loaded backend %s", name);
+        }
+    }
+    closedir(d);
+}
+
+} // namespace
+
+const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = detect_features();
+    return features;
+}
+
+std::string cpu_features_string(const CpuFeatures& f) {
+    std::string out;
+    auto add = [&out](bool present, const char* name) {
+        if (!present) return;
+        if (!out.empty()) out += ' ';
+        out += name;
+    };
+#if defined(__aarch64__)
+    add(true, "neon");
+#endif
+    add(f.dotprod, "dotprod");
+    add(f.fp16, "fp16");
+    add(f.i8mm, "i8mm");
+    add(f.sve, "sve");
+    add(f.sve2, "sve2");
+    add(f.sme, "sme");
+    add(f.sse42, "sse4.2");
+    add(f.avx, "avx");
+    add(f.avx2, "avx2");
+    add(f.fma, "fma");
+    add(f.f16c, "f16c");
+    add(f.avx_vnni, "avx-vnni");
+    add(f.avx512, "avx512");
+    add(f.avx512_vnni, "avx512-vnni");
+    return out.empty() ? "baseline" : out;
+}
+
+std::string cpu_backend_load_best(const char* lib_dir) {
+    const CpuFeatures& features = cpu_features();
+    LOGI("CPU features: %s", cpu_features_string(features).c_str());
+
+#ifdef LLAMA_JNI_STATIC
+    // The CPU backend is compiled in and registered statically
+    return "static";
+#endif
+
+    std::string dir(lib_dir);
+    for (const Variant& variant : VARIANTS) {
+        if (!variant.supported(features)) continue;
+        std::string path = dir + "/libggml-cpu-" + variant.name + ".so";
+        if (!file_exists(path)) continue;
+        if (!ggml_backend_load(path.c_str())) {
+            LOGW("CPU backend %s failed to load, trying the next one", variant.name);
+            continue;
+        }
+        LOGI("CPU backend: %s", variant.name);
+        load_other_backends(dir);
+        return variant.name;
+    }
+
+    LOGI("No CPU backend variants in %s, loading all backends", lib_dir);
+    ggml_backend_load_all_from_path(lib_dir);
+    return "default";
+}
@@ -0,0 +1,44 @@
+/**
+ * CPU feature detection and ggml CPU backend selection.
+ *
+ * A GGML_CPU_ALL_VARIANTS build ships one libggml-cpu-<variant>.so per ISA
+ * level (baseline armv8, +dotprod, +fp16, +i8mm, SVE2/SME, and x86 levels
+ * for host builds). nativeInit loads the best one this CPU can run instead
+ * of a lowest-common-denominator build.
+ */
+
+#pragma once
+
+#include <string>
+
+struct CpuFeatures {
+    // aarch64
+    bool dotprod = false;
+    bool fp16 = false;     // FP16 vector arithmetic
+    bool i8mm = false;
+    bool sve = false;
+    bool sve2 = false;
+    bool sme = false;
+    // x86-64
+    bool sse42 = false;
+    bool avx = false;
+    bool avx2 = false;
+    bool fma = false;
+    bool f16c = false;
+    bool avx_vnni = false;
+    bool avx512 = false;   // F, BW and VL
+    bool avx512_vnni = false;
+};
+
+// Features of the running CPU (detected once).
+const CpuFeatures& cpu_features();
+
+// e.g. "dotprod fp16 i8mm"
+std::string cpu_features_string(const CpuFeatures& features);
+
+// Register the best CPU backend variant found in `lib_dir`, then every
+// other backend library there. Falls back to ggml_backend_load_all_from_path
+// when the directory holds no variants (a single prebuilt CPU backend).
+// Returns the variant loaded, "default" for the fallback, or "static" in a
+// LLAMA_JNI_STATIC build, where the CPU backend is compiled in.
+std::string cpu_backend_load_best(const char* lib_dir);
@@ -0,0 +1,467 @@
+/**
+ * GGUF header/metadata reader and its JNI surface for GgufInspector.
+ *
+ * The file is mmapped read-only and only the header, KV pairs and tensor
+ * table are walked, so just those pages are ever faulted in; tensor data is
+ * never read. Every read is bounds-checked against the mapping, a truncated
+ * or hostile file fails cleanly instead of faulting.
+ */
+
+#include "gguf_meta.h"
+
+#include <jni.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define LOG_TAG "LlamaGgufJNI"
+#include "llama_jni.h"
+
+namespace {
+
+constexpr uint32_t GGUF_MAGIC = 0x46554747; // "GGUF" little-endian
+constexpr uint32_t GGUF_DEFAULT_ALIGNMENT = 32;
+constexpr uint32_t GGUF_MAX_DIMS = 4;
+
+enum GgufType : uint32_t {
+    GGUF_TYPE_UINT8 = 0,
+    GGUF_TYPE_INT8 = 1,
+    GGUF_TYPE_UINT16 = 2,
+    GGUF_TYPE_INT16 = 3,
+    GGUF_TYPE_UINT32 = 4,
+    GGUF_TYPE_INT32 = 5,
+    GGUF_TYPE_FLOAT32 = 6,
+    GGUF_TYPE_BOOL = 7,
+    GGUF_TYPE_STRING = 8,
+    GGUF_TYPE_ARRAY = 9,
+    GGUF_TYPE_UINT64 = 10,
+    GGUF_TYPE_INT64 = 11,
+    GGUF_TYPE_FLOAT64 = 12,
+};
+
+size_t scalar_size(uint32_t type) {
+    switch (type) {
+        case GGUF_TYPE_UINT8: case GGUF_TYPE_INT8: case GGUF_TYPE_BOOL: return 1;
+        case GGUF_TYPE_UINT16: case GGUF_TYPE_INT16: return 2;
+        case GGUF_TYPE_UINT32: case GGUF_TYPE_INT32: case GGUF_TYPE_FLOAT32: return 4;
+        case GGUF_TYPE_UINT64: case GGUF_TYPE_INT64: case GGUF_TYPE_FLOAT64: return 8;
+        default: return 0;
+    }
+}
+
+struct Cursor {
+    const uint8_t* pos;
+    const uint8_t* end;
+    bool ok = true;
+
+    bool need(uint64_t n) {
+        if (!ok || n > (uint64_t)(end - pos)) {
+            ok = false;
+        }
+        return ok;
+    }
+
+    template <typename T>
+    T read() {
+        T value{};
+        if (need(sizeof(T))) {
+            memcpy(&value, pos, sizeof(T));
+            pos += sizeof(T);
+        }
+        return value;
+    }
+
+    std::string read_string() {
+        uint64_t len = read<uint64_t>();
+        if (!need(len)) return std::string();
+        std::string s((const char*)pos, (size_t)len);
+        pos += len;
+        return s;
+    }
+
+    void skip_string() {
+        uint64_t len = read<uint64_t>();
+        if (need(len)) pos += len;
+    }
+
+    // Numeric scalar of any integer/float type, widened
+    bool read_number(uint32_t type, int64_t& out) {
+        switch (type) {
+            case GGUF_TYPE_UINT8: out = read<uint8_t>(); break;
+            case GGUF_TYPE_INT8: out = read<int8_t>(); break;
+            case GGUF_TYPE_BOOL: out = read<uint8_t>(); break;
+            case GGUF_TYPE_UINT16: out = read<uint16_t>(); break;
+            case GGUF_TYPE_INT16: out = read<int16_t>(); break;
+            case GGUF_TYPE_UINT32: out = read<uint32_t>(); break;
+            case GGUF_TYPE_INT32: out = read<int32_t>(); break;
+            case GGUF_TYPE_UINT64: out = (int64_t)read<uint64_t>(); break;
+            case GGUF_TYPE_INT64: out = read<int64_t>(); break;
+            case GGUF_TYPE_FLOAT32: out = (int64_t)read<float>(); break;
+            case GGUF_TYPE_FLOAT64: out = (int64_t)read<double>(); break;
+            default: return false;
+        }
+        return ok;
+    }
+};
+
+struct KvValues {
+    std::unordered_map<std::string, int64_t> numbers;
+    std::unordered_map<std::string, std::string> strings;
+    std::unordered_map<std::string, uint64_t> array_lengths;
+
+    int64_t number(const std::string& key, int64_t fallback = 0) const {
+        auto it = numbers.find(key);
+        return it != numbers.end() ? it->second : fallback;
+    }
+
+    std::string string(const std::string& key) const {
+        auto it = strings.find(key);
+        return it != strings.end() ? it->second : std::string();
+    }
+};
+
+bool wanted_string(const std::string& key) {
+    return key.rfind("general.", 0) == 0 || key == "tokenizer.chat_template";
+}
+
+bool parse_kv(Cursor& c, KvValues& kv) {
+    std::string key = c.read_string();
+    uint32_t type = c.read<uint32_t>();
+    if (!c.ok) return false;
+
+    if (type == GGUF_TYPE_STRING) {
+        if (wanted_string(key)) {
+            kv.strings[key] = c.read_string();
+        } else {
+            c.skip_string();
+        }
+        return c.ok;
+    }
+
+    if (type == GGUF_TYPE_ARRAY) {
+        uint32_t elem_type = c.read<uint32_t>();
+        uint64_t count = c.read<uint64_t>();
+        if (!c.ok) return false;
+        kv.array_lengths[key] = count;
+
+        if (elem_type == GGUF_TYPE_STRING) {
+            // Vocab arrays: walk the lengths, never copy the strings
+            for (uint64_t i = 0; i < count && c.ok; i++) {
+                c.skip_string();
+            }
+            return c.ok;
+        }
+
+        size_t size = scalar_size(elem_type);
+        if (size == 0 || count > UINT64_MAX / size) return false;
+
+        // Per-layer hyperparameters (e.g. head_count_kv): keep the max
+        if (count <= 4096 && elem_type != GGUF_TYPE_FLOAT32 && elem_type != GGUF_TYPE_FLOAT64) {
+            int64_t max_value = 0;
+            for (uint64_t i = 0; i < count; i++) {
+                int64_t v;
+                if (!c.read_number(elem_type, v)) return false;
+                max_value = std::max(max_value, v);
+            }
+            kv.numbers[key] = max_value;
+            return true;
+        }
+
+        if (c.need(count * size)) c.pos += count * size;
+        return c.ok;
+    }
+
+    int64_t value;
+    if (!c.read_number(type, value)) return false;
+    kv.numbers[key] = value;
+    return true;
+}
+
+void json_append_escaped(std::string& out, const std::string& s) {
+    out += '"';
+    for (unsigned char ch : s) {
+        switch (ch) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (ch < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", ch);
+                    out += buf;
+                } else {
+                    out += (char)ch;
+                }
+        }
+    }
+    out += '"';
+}
+
+std::string info_to_json(const GgufInfo& info) {
+    std::string out = "{";
+    auto field_str = [&](const char* name, const std::string& value) {
+        if (out.size() > 1) out += ',';
+        json_append_escaped(out, name);
+        out += ':';
+        json_append_escaped(out, value);
+    };
+    auto field_num = [&](const char* name, int64_t value) {
+        if (out.size() > 1) out += ',';
+        json_append_escaped(out, name);
+        out += ':';
+        out += std::to_string(value);
+    };
+
+    field_num("version", info.version);
+    field_num("n_tensors", (int64_t)info.n_tensors);
+    field_str("architecture", info.architecture);
+    field_str("name", info.name);
+    field_str("size_label", info.size_label);
+    field_num("file_type", info.file_type);
+    field_str("quantization", info.quantization);
+    field_str("chat_template", info.chat_template);
+    field_num("context_length", info.context_length);
+    field_num("n_embd", info.n_embd);
+    field_num("n_layer", info.n_layer);
+    field_num("n_head", info.n_head);
+    field_num("n_head_kv", info.n_head_kv);
+    field_num("head_dim_k", info.head_dim_k);
+    field_num("head_dim_v", info.head_dim_v);
+    field_num("n_vocab", info.n_vocab);
+    field_num("parameter_count", (int64_t)info.parameter_count);
+    field_num("weights_bytes", (int64_t)info.weights_bytes());
+    field_num("file_size", (int64_t)info.file_size);
+    out += '}';
+    return out;
+}
+
+} // namespace
+
+const char* gguf_file_type_name(int32_t file_type) {
+    switch (file_type) {
+        case 0: return "F32";
+        case 1: return "F16";
+        case 2: return "Q4_0";
+        case 3: return "Q4_1";
+        case 7: return "Q8_0";
+        case 8: return "Q5_0";
+        case 9: return "Q5_1";
+        case 10: return "Q2_K";
+        case 11: return "Q3_K_S";
+        case 12: return "Q3_K_M";
+        case 13: return "Q3_K_L";
+        case 14: return "Q4_K_S";
+        case 15: return "Q4_K_M";
+        case 16: return "Q5_K_S";
+        case 17: return "Q5_K_M";
+        case 18: return "Q6_K";
+        case 19: return "IQ2_XXS";
+        case 20: return "IQ2_XS";
+        case 21: return "Q2_K_S";
+        case 22: return "IQ3_XS";
+        case 23: return "IQ3_XXS";
+        case 24: return "IQ1_S";
+        case 25: return "IQ4_NL";
+        case 26: return "IQ3_S";
+        case 27: return "IQ3_M";
+        case 28: return "IQ2_S";
+        case 29: return "IQ2_M";
+        case 30: return "IQ4_XS";
+        case 31: return "IQ1_M";
+        case 32: return "BF16";
+        case 36: return "TQ1_0";
+        case 37: return "TQ2_0";
+        default: return "unknown";
+    }
+}
+
+bool gguf_read_info(const char* path, GgufInfo& info, std::string& error) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = std::string("open failed: ") + strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 24) {
+        close(fd);
+        error = "not a GGUF file (too small)";
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        error = std::string("mmap failed: ") + strerror(errno);
+        return false;
+    }
+
+    const uint8_t* base = (const uint8_t*)map;
+    Cursor c{base, base + size};
+    info = GgufInfo();
+    info.file_size = size;
+
+    bool ok = false;
+    KvValues kv;
+
+    do {
+        if (c.read<uint32_t>() != GGUF_MAGIC) {
+            error = "bad magic";
+            break;
+        }
+        info.version = c.read<uint32_t>();
+        if (info.version < 2 || info.version > 3) {
+            error = "unsupported GGUF version " + std::to_string(info.version);
+            break;
+        }
+        info.n_tensors = c.read<uint64_t>();
+        info.n_kv = c.read<uint64_t>();
+
+        bool kv_ok = true;
+        for (uint64_t i = 0; i < info.n_kv && kv_ok; i++) {
+            kv_ok = parse_kv(c, kv);
+        }
+        if (!kv_ok || !c.ok) {
+            error = "truncated or malformed KV section";
+            break;
+        }
+
+        // Tensor table: parameter count from the shapes
+        uint64_t params = 0;
+        for (uint64_t i = 0; i < info.n_tensors && c.ok; i++) {
+            c.skip_string();
+            uint32_t n_dims = c.read<uint32_t>();
+            if (n_dims > GGUF_MAX_DIMS) {
+                c.ok = false;
+                break;
+            }
+            uint64_t elements = 1;
+            for (uint32_t d = 0; d < n_dims; d++) {
+                elements *= c.read<uint64_t>();
+            }
+            c.read<uint32_t>(); // ggml_type
+            c.read<uint64_t>(); // offset within data
+            params += elements;
+        }
+        if (!c.ok) {
+            error = "truncated or malformed tensor table";
+            break;
+        }
+        info.parameter_count = params;
+
+        uint64_t alignment = (uint64_t)kv.number("general.alignment", GGUF_DEFAULT_ALIGNMENT);
+        if (alignment == 0) alignment = GGUF_DEFAULT_ALIGNMENT;
+        uint64_t header_end = (uint64_t)(c.pos - base);
+        info.data_offset = (header_end + alignment - 1) / alignment * alignment;
+
+        ok = true;
+    } while (false);
+
+    munmap(map, size);
+    if (!ok) {
+        return false;
+    }
+
+    const std::string& arch = info.architecture = kv.string("general.architecture");
+    info.name = kv.string("general.name");
+    info.size_label = kv.string("general.size_label");
+    info.chat_template = kv.string("tokenizer.chat_template");
+    info.file_type = (int32_t)kv.number("general.file_type", -1);
+    info.quantization = info.file_type >= 0 ? gguf_file_type_name(info.file_type) : "";
+
+    info.context_length = (uint32_t)kv.number(arch + ".context_length");
+    info.n_embd = (uint32_t)kv.number(arch + ".embedding_length");
+    info.n_layer = (uint32_t)kv.number(arch + ".block_count");
+    info.n_head = (uint32_t)kv.number(arch + ".attention.head_count");
+    info.n_head_kv = (uint32_t)kv.number(arch + ".attention.head_count_kv", info.n_head);
+
+    uint32_t head_dim = info.n_head > 0 ? info.n_embd / info.n_head : 0;
+    info.head_dim_k = (uint32_t)kv.number(arch + ".attention.key_length", head_dim);
+    info.head_dim_v = (uint32_t)kv.number(arch + ".attention.value_length", head_dim);
+
+    auto vocab = kv.array_lengths.find("tokenizer.ggml.tokens");
+    info.n_vocab = (uint32_t)(vocab != kv.array_lengths.end()
+        ? vocab->second
+        : kv.number(arch + ".vocab_size"));
+
+    return true;
+}
+
+GgufMemoryEstimate gguf_estimate_memory(const GgufInfo& info, int n_ctx, int n_batch) {
+    GgufMemoryEstimate est;
+    uint64_t ctx = n_ctx > 0 ? (uint64_t)n_ctx : info.context_length;
+    uint64_t batch = n_batch > 0 ? std::min<uint64_t>((uint64_t)n_batch, ctx) : ctx;
+
+    est.weights_bytes = info.weights_bytes();
+
+    // F16 K and V per layer per position
+    est.kv_bytes = ctx * info.n_layer * info.n_head_kv *
+                   (uint64_t)(info.head_dim_k + info.head_dim_v) * 2;
+
+    // Without flash attention the largest scratch tensors are the F32
+    // KQ scores for one ubatch and the logits/activations for its tokens
+    est.compute_bytes = ctx * batch * info.n_head * 4 +
+                        batch * ((uint64_t)info.n_vocab + 4ull * info.n_embd) * 4;
+
+    est.total_bytes = est.weights_bytes + est.kv_bytes + est.compute_bytes;
+    return est;
+}
+
+extern "C" {
+
+JNIEXPORT jstring JNICALL
+Java_com_llamafarm_atmosphere_inference_GgufInspector_00024Companion_nativeReadMetadata(
+    JNIEnv* env, jobject thiz, jstring path) {
+
+    TRACE_SCOPE("nativeReadMetadata");
+    std::string file = jstring_to_std(env, path);
+    GgufInfo info;
+    std::string error;
+    if (!gguf_read_info(file.c_str(), info, error)) {
+        LOGW("Cannot read GGUF metadata from %s: %s", file.c_str(), error.c_str());
+        return nullptr;
+    }
+    return env->NewStringUTF(info_to_json(info).c_str());
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_com_llamafarm_atmosphere_inference_GgufInspector_00024Companion_nativeEstimateMemory(
+    JNIEnv* env, jobject thiz, jint n_layer, jint n_head, jint n_head_kv,
+    jint head_dim_k, jint head_dim_v, jint n_embd, jint n_vocab,
+    jlong weights_bytes, jint n_ctx, jint n_batch) {
+
+    TRACE_SCOPE("nativeEstimateMemory");
+    // Takes the fields rather than a path so peer-advertised metadata
+    // can be sized too, without the file
+    GgufInfo info;
+    info.n_layer = (uint32_t)n_layer;
+    info.n_head = (uint32_t)n_head;
+    info.n_head_kv = (uint32_t)n_head_kv;
+    info.head_dim_k = (uint32_t)head_dim_k;
+    info.head_dim_v = (uint32_t)head_dim_v;
+    info.n_embd = (uint32_t)n_embd;
+    info.n_vocab = (uint32_t)n_vocab;
+    info.file_size = (uint64_t)weights_bytes;
+
+    GgufMemoryEstimate est = gguf_estimate_memory(info, n_ctx, n_batch);
+    jlong values[4] = {
+        (jlong)est.weights_bytes, (jlong)est.kv_bytes,
+        (jlong)est.compute_bytes, (jlong)est.total_bytes,
+    };
+    jlongArray result = env->NewLongArray(4);
+    env->SetLongArrayRegion(result, 0, 4, values);
+    return result;
+}
+
+} // extern "C"
@@ -0,0 +1,58 @@
+/**
+ * GGUF header/metadata reader.
+ *
+ * Parses the header, KV section and tensor table of a GGUF file without
+ * touching tensor data, so a model can be inspected (and sized) before
+ * deciding whether to pay for llama_model_load_from_file.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct GgufInfo {
+    uint32_t version = 0;
+    uint64_t n_tensors = 0;
+    uint64_t n_kv = 0;
+
+    std::string architecture;
+    std::string name;
+    std::string size_label;
+    int32_t file_type = -1;      // llama_ftype, -1 if absent
+    std::string quantization;    // e.g. "Q4_K_M"
+    std::string chat_template;
+
+    uint32_t context_length = 0; // training context
+    uint32_t n_embd = 0;
+    uint32_t n_layer = 0;
+    uint32_t n_head = 0;
+    uint32_t n_head_kv = 0;      // max over layers when given per layer
+    uint32_t head_dim_k = 0;
+    uint32_t head_dim_v = 0;
+    uint32_t n_vocab = 0;
+
+    uint64_t parameter_count = 0;
+    uint64_t data_offset = 0;    // start of tensor data
+    uint64_t file_size = 0;
+
+    uint64_t weights_bytes() const {
+        return file_size > data_offset ? file_size - data_offset : 0;
+    }
+};
+
+struct GgufMemoryEstimate {
+    uint64_t weights_bytes = 0;
+    uint64_t kv_bytes = 0;       // F16 K and V cache for n_ctx
+    uint64_t compute_bytes = 0;  // scratch for one n_batch ubatch
+    uint64_t total_bytes = 0;
+};
+
+// Read metadata from `path`. On failure returns false and sets `error`.
+bool gguf_read_info(const char* path, GgufInfo& info, std::string& error);
+
+// Rough resident-memory estimate for running `info` at `n_ctx` / `n_batch`.
+GgufMemoryEstimate gguf_estimate_memory(const GgufInfo& info, int n_ctx, int n_batch);
+
+// Name of a llama_ftype value ("Q4_K_M"), or "unknown".
+const char* gguf_file_type_name(int32_t file_type);
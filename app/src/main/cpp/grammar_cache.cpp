@@ -0,0 +1,127 @@
+/**
+ * Compiled grammar cache: a small LRU of parsed grammar samplers, plus the
+ * JSON schema to GBNF conversion from llama.cpp's common library.
+ */
+
+#include "grammar_cache.h"
+
+#include <exception>
+#include <mutex>
+#include <unordered_map>
+
+#include <nlohmann/json.hpp>
+#include "json-schema-to-grammar.h"
+
+#define LOG_TAG "LlamaGrammar"
+#include "llama_jni.h"
+
+namespace {
+
+constexpr size_t MAX_CACHED_GRAMMARS = 16;
+
+struct CachedGrammar {
+    std::string gbnf;
+    const llama_model* model = nullptr;
+    uint32_t seed = 0;
+    common_sampler* prototype = nullptr;
+    uint64_t last_used = 0;
+};
+
+std::mutex g_grammar_mutex;
+std::unordered_map<uint64_t, CachedGrammar> g_grammars;
+uint64_t g_grammar_clock = 0;
+
+// Caller holds g_grammar_mutex
+void evict_oldest() {
+    auto oldest = g_grammars.begin();
+    for (auto it = g_grammars.begin(); it != g_grammars.end(); ++it) {
+        if (it->second.last_used < oldest->second.last_used) {
+            oldest = it;
+        }
+    }
+    common_sampler_free(oldest->second.prototype);
+    g_grammars.erase(oldest);
+}
+
+// A clone copies the prototype's RNG state. Reset draws a new random seed
+// for LLAMA_DEFAULT_SEED; a fixed seed keeps the reproducible stream.
+common_sampler* fresh_clone(common_sampler* prototype, uint32_t seed) {
+    common_sampler* sampler = common_sampler_clone(prototype);
+    if (sampler && seed == LLAMA_DEFAULT_SEED) {
+        common_sampler_reset(sampler);
+    }
+    return sampler;
+}
+
+} // namespace
+
+uint64_t grammar_hash(const std::string& text) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::string grammar_from_json_schema(const std::string& schema, std::string& error) {
+    try {
+        return json_schema_to_grammar(nlohmann::ordered_json::parse(schema));
+    } catch (const std::exception& e) {
+        error = e.what();
+        return std::string();
+    }
+}
+
+common_sampler* grammar_cache_sampler(const llama_model* model,
+                                      const std::string& gbnf,
+                                      const common_params_sampling& params) {
+    uint64_t key = grammar_hash(gbnf);
+
+    std::lock_guard<std::mutex> lock(g_grammar_mutex);
+    auto it = g_grammars.find(key);
+    if (it != g_grammars.end() && it->second.gbnf == gbnf && it->second.model == model &&
+        it->second.seed == params.seed) {
+        it->second.last_used = ++g_grammar_clock;
+        return fresh_clone(it->second.prototype, params.seed);
+    }
+
+    common_params_sampling grammar_params = params;
+    grammar_params.grammar = gbnf;
+    common_sampler* prototype = nullptr;
+    try {
+        prototype = common_sampler_init(model, grammar_params);
+    } catch (const std::exception& e) {
+        LOGE("Grammar rejected: %s", e.what());
+    }
+    if (!prototype) {
+        LOGE("Failed to compile grammar (%zu chars)", gbnf.size());
+        return nullptr;
+    }
+
+    if (it != g_grammars.end()) {
+        // Hash collision, a different model or a different seed: replace the old entry
+        common_sampler_free(it->second.prototype);
+        g_grammars.erase(it);
+    } else if (g_grammars.size() >= MAX_CACHED_GRAMMARS) {
+        evict_oldest();
+    }
+
+    CachedGrammar& entry = g_grammars[key];
+    entry.gbnf = gbnf;
+    entry.model = model;
+    entry.seed = params.seed;
+    entry.prototype = prototype;
+    entry.last_used = ++g_grammar_clock;
+    LOGI("Compiled grammar %016llx (%zu chars, %zu cached)",
+         (unsigned long long)key, gbnf.size(), g_grammars.size());
+    return fresh_clone(prototype, params.seed);
+}
+
+void grammar_cache_clear() {
+    std::lock_guard<std::mutex> lock(g_grammar_mutex);
+    for (auto& [key, entry] : g_grammars) {
+        common_sampler_free(entry.prototype);
+    }
+    g_grammars.clear();
+}
@@ -0,0 +1,33 @@
+/**
+ * Compiled grammars for constrained decoding.
+ *
+ * Parsing a GBNF grammar (and converting a JSON schema to one) costs far
+ * more than copying an already parsed one, and mesh consumers send the same
+ * few schemas over and over. Each grammar is compiled into a sampler once,
+ * keyed by a hash of its text, and every request gets a clone.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "llama.h"
+#include "sampling.h"
+
+// FNV-1a hash of a grammar's text, the cache key.
+uint64_t grammar_hash(const std::string& text);
+
+// GBNF for a JSON schema. On failure returns an empty string and sets `error`.
+std::string grammar_from_json_schema(const std::string& schema, std::string& error);
+
+// A fresh sampler with `params` constrained by `gbnf`, for `model`. The
+// grammar is parsed on the first request (per sampler seed) and cloned
+// after that; with LLAMA_DEFAULT_SEED each clone is reseeded randomly.
+// Returns nullptr if the grammar doesn't parse. The caller frees the sampler.
+common_sampler* grammar_cache_sampler(const llama_model* model,
+                                      const std::string& gbnf,
+                                      const common_params_sampling& params);
+
+// Drop every compiled grammar (they reference the model's vocab).
+void grammar_cache_clear();
@@ -6,10 +6,20 @@
  */
 
 #include <jni.h>
-#include <android/log.h>
 #include <string>
 #include <vector>
 #include <mutex>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
 #include <unistd.h>
 
 // llama.cpp headers
@@ -17,29 +27,260 @@
 #include "common.h"
 #include "sampling.h"
 
-#define LOG_TAG "LlamaCppJNI"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#include "llama_jni.h"
+#include "cpu_dispatch.h"
+#include "grammar_cache.h"
+#include "model_cache.h"
+#include "request_log.h"
+#include "thread_governor.h"
+#include "throughput.h"
+#include "trace.h"
 
-// Global state
+// Global state. The engine holds one model_cache reference on the model it
+// runs (g_model_handle); g_model borrows from it while that handle is held.
+static ModelHandle g_model_handle = 0;
 static llama_model* g_model = nullptr;
+// Published with std::atomic_load/store so tokenizer calls can pin the model
+// without taking g_mutex, even if the cache evicts it meanwhile.
+static std::shared_ptr<llama_model> g_model_ref;
 static llama_context* g_ctx = nullptr;
 static common_sampler* g_sampler = nullptr;
+// Grammar-constrained sampler for the current request, used instead of
+// g_sampler while set (nativeSetGrammar), and its GBNF
+static common_sampler* g_grammar_sampler = nullptr;
+static std::string g_grammar_text;
+// Sampler seed; LLAMA_DEFAULT_SEED draws a random one. A fixed seed
+// restarts the RNG at every generation, so a reply depends only on the
+// conversation and prompt (nativeSetSeed, request recording).
+static uint32_t g_seed = LLAMA_DEFAULT_SEED;
+// The seed was picked by nativeStartRecording and goes back to random after
+static bool g_seed_for_recording = false;
 static std::mutex g_mutex;
+// CPU backend variant nativeInit picked
+static std::string g_cpu_backend;
 
 // Chat state
 static std::vector<llama_token> g_input_tokens;
 static std::vector<llama_token> g_output_tokens;
 static int g_n_past = 0;
-static bool g_is_generating = false;
 static std::string g_system_prompt;
+// The tokens on sequence 0: always the first g_n_past of the conversation
+static std::vector<llama_token> g_history;
+
+// Conversation snapshots (nativeSnapshot), taken at turn boundaries. Each
+// records the tokens on sequence 0; rewinding keeps the longest prefix the
+// conversation still shares with it and decodes only the rest, so an edit or
+// regenerate costs the changed suffix instead of a replay. A snapshot may
+// also keep its KV alive in a spare sequence (cells are shared with
+// sequence 0 in the unified cache), so switching back to an abandoned
+// branch needs no decode at all.
+struct Snapshot {
+    std::vector<llama_token> tokens;
+    llama_seq_id seq = -1;
+};
+static std::map<int, Snapshot> g_snapshots;
+static int g_next_snapshot_id = 1;
+
+// Per-token log-probabilities for the current request (nativeSetLogprobs).
+// Packed as int32s, one record per generated token:
+//   [token, logprob bits, (alt token, alt logprob bits) x g_logprob_top_k]
+// so a whole generation crosses JNI as one array. -1 = not recording.
+static int g_logprob_top_k = -1;
+static std::vector<int32_t> g_logprob_records;
+
+// LoRA adapters loaded on g_model, by id. Each is loaded once and kept until
+// the model is released; attaching one to the context is cheap. The attached
+// set (id -> scale) is reapplied whenever the context is recreated.
+struct LoraAdapter {
+    std::string path;
+    llama_adapter_lora* adapter = nullptr;
+};
+static std::map<int64_t, LoraAdapter> g_loras;
+static std::map<int64_t, float> g_active_loras;
+static int64_t g_next_lora_id = 1;
+
+// Context size asked for at load, and the thread count. A memory trim may
+// run the engine on a smaller context (or none) until more room is needed.
+static int g_n_ctx_requested = 0;
+static int g_n_threads = 0;
+// Threads single-token decode steps run with now (thread_governor)
+static int g_decode_threads = 0;
+
+// Engine state machine. Published through an atomic so state queries never
+// contend with the decode path on g_mutex; transitions also notify
+// g_state_cv for nativeAwaitState.
+enum EngineState {
+    ENGINE_UNLOADED = 0,
+    ENGINE_LOADING = 1,
+    ENGINE_IDLE = 2,
+    ENGINE_PREFILL = 3,
+    ENGINE_DECODING = 4,
+    ENGINE_STOPPED = 5,
+};
+static std::atomic<int> g_state{ENGINE_UNLOADED};
+static std::mutex g_state_mutex;
+static std::condition_variable g_state_cv;
+
+// Cancellation, one flag per conversation (indexed by priority, below) so
+// stopping chat never cuts a parked or running background job short. Set
+// without g_mutex by nativeStopGeneration and polled by llama's abort
+// callback between graph nodes, so a running decode (including a long
+// prefill) returns early instead of finishing first.
+static std::atomic<bool> g_cancel_requested[2] = {{false}, {false}};
+static std::atomic<int64_t> g_cancel_requested_at_us[2] = {{0}, {0}};
+static std::atomic<int64_t> g_last_cancel_latency_us{-1};
+
+// Request priorities (nativeSchedule). Interactive chat owns the
+// conversation above; a background request (a mesh job) runs a
+// conversation of its own on the same context. Whichever is on sequence 0
+// lives in the globals; the other is parked in g_parked, its KV moved to
+// PARK_SEQ, so switching between them decodes nothing.
+enum RequestPriority {
+    PRIORITY_INTERACTIVE = 0,
+    PRIORITY_BACKGROUND = 1,
+};
+
+// A conversation's state while it is off sequence 0
+struct Conversation {
+    bool present = false;
+    std::vector<llama_token> input_tokens;
+    std::vector<llama_token> output_tokens;
+    std::vector<llama_token> history;
+    int n_past = 0;
+    std::string system_prompt;
+    common_sampler* sampler = nullptr;
+    common_sampler* grammar_sampler = nullptr;
+    std::string grammar_text;
+    int logprob_top_k = -1;
+    std::vector<int32_t> logprob_records;
+    int state = ENGINE_IDLE;
+};
+static Conversation g_parked;
+// Priority of the conversation on sequence 0
+static std::atomic<int> g_priority{PRIORITY_INTERACTIVE};
+// Interactive requests waiting for the engine (nativeAddInteractivePending).
+// Set without g_mutex: while nonzero a background prefill aborts, so they
+// wait for one decode step at most.
+static std::atomic<int> g_interactive_pending{0};
 
 // Configuration
 static constexpr int DEFAULT_N_CTX = 4096;
 static constexpr int DEFAULT_N_BATCH = 512;
 static constexpr int DEFAULT_N_THREADS = 4;
+// Sequence 0 is the conversation; 1..MAX_N_BEST are scratch branches
+static constexpr int MAX_N_BEST = 8;
+// ...and the next MAX_KV_SNAPSHOTS hold snapshot branches
+static constexpr int MAX_KV_SNAPSHOTS = 4;
+static constexpr int FIRST_SNAPSHOT_SEQ = MAX_N_BEST + 1;
+// ...then the parked conversation, and a scratch sequence to swap through
+static constexpr int PARK_SEQ = FIRST_SNAPSHOT_SEQ + MAX_KV_SNAPSHOTS;
+static constexpr int SWAP_SEQ = PARK_SEQ + 1;
+static constexpr int N_SEQ_MAX = SWAP_SEQ + 1;
+static constexpr int MAX_SNAPSHOTS = 64;
+static constexpr int MAX_LOGPROB_TOP_K = 20;
+static constexpr size_t MIN_TEXTS_PER_TOKENIZER_THREAD = 8;
+static constexpr int MIN_TRIMMED_N_CTX = 1024;
+static constexpr int TRIMMED_N_CTX_ALIGN = 256;
+
+// Levels from Android's ComponentCallbacks2.onTrimMemory
+static constexpr int TRIM_MEMORY_RUNNING_MODERATE = 5;
+static constexpr int TRIM_MEMORY_RUNNING_LOW = 10;
+static constexpr int TRIM_MEMORY_RUNNING_CRITICAL = 15;
+static constexpr int TRIM_MEMORY_BACKGROUND = 40;
+static constexpr int TRIM_MEMORY_COMPLETE = 80;
+
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Resident set size of the process, from /proc/self/statm
+static int64_t resident_bytes() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    long long size = 0, resident = 0;
+    int n = fscanf(f, "%lld %lld", &size, &resident);
+    fclose(f);
+    return n == 2 ? resident * (int64_t)sysconf(_SC_PAGESIZE) : 0;
+}
+
+// A background prompt is being prefilled while interactive requests wait
+static bool preempt_requested() {
+    return g_interactive_pending.load(std::memory_order_relaxed) > 0 &&
+           g_priority.load(std::memory_order_relaxed) == PRIORITY_BACKGROUND &&
+           g_state.load(std::memory_order_relaxed) == ENGINE_PREFILL;
+}
+
+// Stop requested for the conversation on sequence 0
+static bool cancel_requested() {
+    return g_cancel_requested[g_priority.load(std::memory_order_relaxed)].load(std::memory_order_relaxed);
+}
+
+static bool abort_callback(void* data) {
+    return cancel_requested() || preempt_requested();
+}
+
+static void set_state(EngineState state) {
+    {
+        std::lock_guard<std::mutex> lock(g_state_mutex);
+        g_state.store(state);
+    }
+    g_state_cv.notify_all();
+}
+
+static bool is_generating() {
+    return g_state.load() == ENGINE_DECODING;
+}
+
+// Drop a stale Stop for the conversation on sequence 0
+static void clear_cancel() {
+    int priority = g_priority.load();
+    g_cancel_requested[priority].store(false);
+    g_cancel_requested_at_us[priority].store(0);
+}
+
+// Time from the Stop of the conversation on sequence 0 to now, consuming it
+static void record_cancel_latency() {
+    int64_t requested = g_cancel_requested_at_us[g_priority.load()].exchange(0);
+    if (requested > 0) {
+        g_last_cancel_latency_us.store(now_us() - requested);
+    }
+}
+
+// Tokenize chat text for the engine's model, special tokens included
+static std::vector<llama_token> tokenize_prompt(const std::string& text) {
+    TRACE_SCOPE("tokenize");
+    return common_tokenize(llama_model_get_vocab(g_model), text, true, true);
+}
+
+// llama_decode that honors cancel_requested() (unless `honor_stop` is false,
+// for internal re-decodes a Stop must neither abort nor consume) and
+// preemption of a background prefill. On abort, the partially written KV
+// cells past g_n_past are dropped and the cancel latency recorded.
+// Returns 0 on success, 2 if cancelled, other values on failure.
+static int decode_cancellable(llama_batch& batch, bool honor_stop = true) {
+    TRACE_SCOPE("llama_decode", batch.n_tokens);
+    auto cancelled = [honor_stop]() {
+        return (honor_stop && cancel_requested()) || preempt_requested();
+    };
+    if (cancelled()) {
+        return 2;
+    }
+    
+    int ret = llama_decode(g_ctx, batch);
+    if (ret == 2 || (ret == 0 && cancelled())) {
+        llama_memory_seq_rm(llama_get_memory(g_ctx), 0, g_n_past, -1);
+        if (cancel_requested()) {
+            record_cancel_latency();
+        }
+        LOGI("Decode cancelled (%d tokens in batch, latency %lld us)",
+             batch.n_tokens, (long long)g_last_cancel_latency_us.load());
+        return 2;
+    }
+    return ret;
+}
 
 static void log_callback(ggml_log_level level, const char* text, void* user_data) {
     switch (level) {
@@ -58,13 +299,521 @@ static void log_callback(ggml_log_level level, const char* text, void* user_data
     }
 }
 
+// Snapshots fall back to decoding once their sequence is gone
+static void forget_snapshot_seqs() {
+    for (auto& [id, snapshot] : g_snapshots) {
+        snapshot.seq = -1;
+    }
+}
+
+// Free the engine's sampler and context (caller holds g_mutex).
+static void free_context() {
+    forget_snapshot_seqs();
+    if (g_grammar_sampler) {
+        common_sampler_free(g_grammar_sampler);
+        g_grammar_sampler = nullptr;
+        g_grammar_text.clear();
+    }
+    if (g_sampler) {
+        common_sampler_free(g_sampler);
+        g_sampler = nullptr;
+    }
+    if (g_ctx) {
+        llama_free(g_ctx);
+        g_ctx = nullptr;
+    }
+}
+
+// Attach g_active_loras to g_ctx, replacing whatever was attached
+static void apply_loras() {
+    llama_clear_adapter_lora(g_ctx);
+    for (const auto& [id, scale] : g_active_loras) {
+        if (llama_set_adapter_lora(g_ctx, g_loras[id].adapter, scale) != 0) {
+            LOGW("Failed to attach LoRA %lld", (long long)id);
+        }
+    }
+}
+
+// Adapters belong to the model they were loaded on and must be freed first
+static void free_loras() {
+    for (auto& [id, lora] : g_loras) {
+        llama_adapter_lora_free(lora.adapter);
+    }
+    g_loras.clear();
+    g_active_loras.clear();
+}
+
+// Forget the parked conversation: its samplers and KV (caller holds g_mutex)
+static void drop_parked() {
+    if (g_parked.grammar_sampler) {
+        common_sampler_free(g_parked.grammar_sampler);
+    }
+    if (g_parked.sampler) {
+        common_sampler_free(g_parked.sampler);
+    }
+    if (g_parked.present && g_ctx) {
+        llama_memory_seq_rm(llama_get_memory(g_ctx), PARK_SEQ, -1, -1);
+    }
+    g_parked = Conversation();
+}
+
+// Drop the engine's reference to the model (caller holds g_mutex and has
+// already freed the context). The model stays cached for a later switch back
+// unless `evict`; lock-free tokenizer calls may still hold it either way.
+// The conversation on sequence 0 is the interactive one from here on.
+static void release_model(bool evict) {
+    drop_parked();
+    g_priority.store(PRIORITY_INTERACTIVE);
+    throughput_set_kv_headroom(0);
+    free_loras();
+    grammar_cache_clear();
+    std::atomic_store(&g_model_ref, std::shared_ptr<llama_model>());
+    g_model = nullptr;
+    if (g_model_handle != 0) {
+        model_cache_release(g_model_handle, evict);
+        g_model_handle = 0;
+    }
+}
+
+static common_params_sampling default_sampling_params() {
+    common_params_sampling sparams;
+    sparams.temp = 0.7f;
+    sparams.top_p = 0.9f;
+    sparams.top_k = 40;
+    sparams.penalty_repeat = 1.1f;
+    sparams.seed = g_seed;
+    return sparams;
+}
+
+// Switch to `seed`, rebuilding the samplers around it (caller holds g_mutex)
+static void apply_seed(uint32_t seed) {
+    g_seed = seed;
+    if (!g_ctx) {
+        return;
+    }
+    if (g_sampler) {
+        common_sampler_free(g_sampler);
+    }
+    g_sampler = common_sampler_init(g_model, default_sampling_params());
+    if (g_grammar_sampler) {
+        common_sampler_free(g_grammar_sampler);
+        g_grammar_sampler = grammar_cache_sampler(g_model, g_grammar_text, default_sampling_params());
+        if (!g_grammar_sampler) {
+            g_grammar_text.clear();
+        }
+    }
+}
+
+// Record the model the engine now runs, if a request log is open
+static void log_session() {
+    if (!request_log_active() || !g_model) {
+        return;
+    }
+    LoggedSession session;
+    session.model_path = model_cache_path(g_model_handle);
+    session.n_ctx = g_n_ctx_requested;
+    session.n_threads = g_n_threads;
+    session.seed = g_seed;
+    session.cpu_backend = g_cpu_backend;
+    request_log_session(session);
+}
+
+// Publish the context cells neither conversation holds (throughput stats).
+// A trimmed context is regrown on demand, so count it at full size.
+static void publish_kv_headroom() {
+    int n_ctx = g_ctx ? (int)llama_n_ctx(g_ctx) : g_n_ctx_requested;
+    throughput_set_kv_headroom(std::max(0, n_ctx - g_n_past - g_parked.n_past));
+}
+
+// Create the context and sampler for g_model (caller holds g_mutex and has
+// freed any previous ones). Returns 0, -2 (context) or -3 (sampler).
+static int create_context(int n_ctx) {
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = n_ctx;
+    ctx_params.n_batch = DEFAULT_N_BATCH;
+    ctx_params.n_ubatch = DEFAULT_N_BATCH;
+    ctx_params.n_threads = g_n_threads;
+    ctx_params.n_threads_batch = g_n_threads;
+    // One KV pool shared by all sequences, so branches only use the cells
+    // they actually fill
+    ctx_params.n_seq_max = N_SEQ_MAX;
+    ctx_params.kv_unified = true;
+    
+    g_ctx = llama_init_from_model(g_model, ctx_params);
+    if (!g_ctx) {
+        LOGE("Failed to create context");
+        return -2;
+    }
+    g_decode_threads = g_n_threads;
+    llama_set_abort_callback(g_ctx, abort_callback, nullptr);
+    apply_loras();
+    
+    // Initialize sampler
+    g_sampler = common_sampler_init(g_model, default_sampling_params());
+    if (!g_sampler) {
+        LOGE("Failed to create sampler");
+        free_context();
+        return -3;
+    }
+    publish_kv_headroom();
+    return 0;
+}
+
+static size_t common_prefix(const std::vector<llama_token>& a, const std::vector<llama_token>& b) {
+    size_t n = 0;
+    while (n < a.size() && n < b.size() && a[n] == b[n]) {
+        n++;
+    }
+    return n;
+}
+
+// Make sequence 0 hold `tokens`: keep the first `from` cells, which must
+// already match, and decode the rest in n_batch chunks. Caller holds
+// g_mutex. Returns 0, 2 if cancelled, or another llama_decode error.
+static int decode_suffix(const std::vector<llama_token>& tokens, size_t from,
+                         bool honor_stop = true) {
+    llama_memory_seq_rm(llama_get_memory(g_ctx), 0, (llama_pos)from, -1);
+    g_n_past = (int)from;
+    g_history.resize(from);
+    
+    llama_batch batch = llama_batch_init(DEFAULT_N_BATCH, 0, 1);
+    int ret = 0;
+    for (size_t i = from; i < tokens.size() && ret == 0;) {
+        size_t end = std::min(tokens.size(), i + DEFAULT_N_BATCH);
+        common_batch_clear(batch);
+        for (size_t j = i; j < end; j++) {
+            common_batch_add(batch, tokens[j], (llama_pos)j, {0}, false);
+        }
+        ret = decode_cancellable(batch, honor_stop);
+        if (ret == 0) {
+            g_history.insert(g_history.end(), tokens.begin() + i, tokens.begin() + end);
+            g_n_past = (int)end;
+        }
+        i = end;
+    }
+    llama_batch_free(batch);
+    return ret;
+}
+
+// Append `tokens` to sequence 0 at `pos` in n_batch chunks, requesting
+// logits only for the last token; `batch` (capacity >= n_batch) is left
+// holding the last chunk. On failure every cell from `pos` is dropped.
+// Caller holds g_mutex. Returns 0, 2 if cancelled, or another llama_decode error.
+static int decode_prompt(llama_batch& batch, const std::vector<llama_token>& tokens, llama_pos pos) {
+    int ret = 0;
+    for (size_t i = 0; i < tokens.size() && ret == 0;) {
+        size_t end = std::min(tokens.size(), i + DEFAULT_N_BATCH);
+        common_batch_clear(batch);
+        for (size_t j = i; j < end; j++) {
+            common_batch_add(batch, tokens[j], pos + (llama_pos)j, {0}, j == tokens.size() - 1);
+        }
+        ret = decode_cancellable(batch);
+        i = end;
+    }
+    if (ret != 0) {
+        llama_memory_seq_rm(llama_get_memory(g_ctx), 0, pos, -1);
+    }
+    return ret;
+}
+
+// Clear the KV cache and prefill the system prompt again, dropping the rest
+// of the conversation. Caller holds g_mutex.
+static void restore_system_prompt() {
+    llama_memory_clear(llama_get_memory(g_ctx), false);
+    forget_snapshot_seqs();
+    // Not a user-visible decode: a pending Stop neither aborts it nor is consumed
+    if (decode_suffix(g_input_tokens, 0, false) != 0) {
+        LOGW("Failed to restore system prompt");
+    }
+}
+
+// Clear the KV cache and decode the conversation again, e.g. under a new
+// LoRA set; falls back to the system prompt if that fails. A parked
+// conversation is decoded again when it is switched back in. Caller holds g_mutex.
+static void redecode_conversation() {
+    TRACE_SCOPE("redecode_conversation", g_n_past);
+    std::vector<llama_token> tokens = g_history;
+    llama_memory_clear(llama_get_memory(g_ctx), false);
+    forget_snapshot_seqs();
+    if (decode_suffix(tokens, 0, false) != 0) {
+        LOGW("Failed to decode the conversation again, restarting from the system prompt");
+        restore_system_prompt();
+    }
+}
+
+// Recreate the context with `n_ctx` cells, carrying the conversation's KV
+// (sequence 0) across. If the copy fails the conversation restarts from the
+// system prompt. Caller holds g_mutex. Returns false if no context could be made.
+static bool resize_context(int n_ctx) {
+    std::vector<uint8_t> kv;
+    if (g_ctx && g_n_past > 0 && g_n_past <= n_ctx) {
+        kv.resize(llama_state_seq_get_size(g_ctx, 0));
+        kv.resize(llama_state_seq_get_data(g_ctx, kv.data(), kv.size(), 0));
+    }
+    
+    free_context();
+    if (create_context(n_ctx) != 0) {
+        return false;
+    }
+    
+    if (!kv.empty() && llama_state_seq_set_data(g_ctx, kv.data(), kv.size(), 0) != 0) {
+        return true;
+    }
+    
+    // Nothing carried over: rebuild the system prompt prefix
+    restore_system_prompt();
+    return true;
+}
+
+// Make sure a context exists with room for `n_tokens` more, growing back
+// toward the requested size after a trim. Caller holds g_mutex.
+static bool ensure_context(int n_tokens) {
+    int needed = g_n_past + n_tokens;
+    if (g_ctx && (int)llama_n_ctx(g_ctx) >= std::min(needed, g_n_ctx_requested)) {
+        return true;
+    }
+    LOGI("Restoring context to %d (need %d)", g_n_ctx_requested, needed);
+    return resize_context(g_n_ctx_requested);
+}
+
+// Exchange the KV of sequence 0 and PARK_SEQ. The cache is unified, so this
+// relabels cells rather than copying them.
+static void swap_parked_kv() {
+    llama_memory_t mem = llama_get_memory(g_ctx);
+    llama_memory_seq_rm(mem, SWAP_SEQ, -1, -1);
+    llama_memory_seq_cp(mem, 0, SWAP_SEQ, -1, -1);
+    llama_memory_seq_rm(mem, 0, -1, -1);
+    llama_memory_seq_cp(mem, PARK_SEQ, 0, -1, -1);
+    llama_memory_seq_rm(mem, PARK_SEQ, -1, -1);
+    llama_memory_seq_cp(mem, SWAP_SEQ, PARK_SEQ, -1, -1);
+    llama_memory_seq_rm(mem, SWAP_SEQ, -1, -1);
+}
+
+// Put the `priority` conversation on sequence 0 and park the other one,
+// mid-reply or not; a class with no conversation yet starts an empty one.
+// Caller holds g_mutex, so no decode is running. Returns 0, or -2 if the
+// incoming conversation's KV was lost and decoding it again failed.
+static int switch_conversation(int priority) {
+    if (g_priority.load() == priority) {
+        return 0;
+    }
+    TRACE_SCOPE("switch_conversation", priority);
+    
+    Conversation incoming = std::move(g_parked);
+    g_parked = Conversation();
+    g_parked.present = true;
+    g_parked.input_tokens.swap(g_input_tokens);
+    g_parked.output_tokens.swap(g_output_tokens);
+    g_parked.history.swap(g_history);
+    g_parked.n_past = g_n_past;
+    g_parked.system_prompt.swap(g_system_prompt);
+    g_parked.sampler = g_sampler;
+    g_parked.grammar_sampler = g_grammar_sampler;
+    g_parked.grammar_text.swap(g_grammar_text);
+    g_parked.logprob_top_k = g_logprob_top_k;
+    g_parked.logprob_records.swap(g_logprob_records);
+    g_parked.state = g_state.load();
+    if (g_ctx) {
+        swap_parked_kv();
+    }
+    
+    if (!incoming.present) {
+        incoming.sampler = common_sampler_init(g_model, default_sampling_params());
+    }
+    g_input_tokens.swap(incoming.input_tokens);
+    g_output_tokens.swap(incoming.output_tokens);
+    g_history.swap(incoming.history);
+    g_n_past = incoming.n_past;
+    g_system_prompt.swap(incoming.system_prompt);
+    g_sampler = incoming.sampler;
+    g_grammar_sampler = incoming.grammar_sampler;
+    g_grammar_text.swap(incoming.grammar_text);
+    g_logprob_top_k = incoming.logprob_top_k;
+    g_logprob_records.swap(incoming.logprob_records);
+    g_priority.store(priority);
+    set_state((EngineState)incoming.state);
+    LOGD("Switched to %s conversation (n_past %d)",
+         priority == PRIORITY_INTERACTIVE ? "interactive" : "background", g_n_past);
+    
+    // A context resize or a full KV clear while it was parked (new LoRA set,
+    // session load) took its cells along: decode it again
+    if (g_ctx && g_n_past > 0 &&
+        llama_memory_seq_pos_max(llama_get_memory(g_ctx), 0) != g_n_past - 1) {
+        LOGI("Parked conversation lost its KV, decoding %d tokens again", g_n_past);
+        std::vector<llama_token> tokens = g_history;
+        if (decode_suffix(tokens, 0, false) != 0) {
+            LOGE("Failed to restore conversation");
+            set_state(ENGINE_IDLE);
+            return -2;
+        }
+    }
+    publish_kv_headroom();
+    return g_sampler ? 0 : -2;
+}
+
+// Run the engine on cached model `handle`, whose reference passes to the
+// engine. Creates a fresh context and sampler (caller holds g_mutex and has
+// released the previous model). Returns 0 or the nativeLoadModel error codes.
+static int attach_model(ModelHandle handle, int n_ctx, int n_threads) {
+    std::shared_ptr<llama_model> model = model_cache_get(handle);
+    if (!model) {
+        model_cache_release(handle);
+        return -1;
+    }
+    g_model_handle = handle;
+    g_model = model.get();
+    std::atomic_store(&g_model_ref, model);
+    
+    g_n_ctx_requested = (n_ctx > 0) ? n_ctx : DEFAULT_N_CTX;
+    g_n_threads = (n_threads > 0) ? n_threads : 
+        std::min(DEFAULT_N_THREADS, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    thread_governor_reset(g_n_threads);
+    throughput_reset();
+    
+    int ret = create_context(g_n_ctx_requested);
+    if (ret != 0) {
+        release_model(false);
+        return ret;
+    }
+    
+    // Reset state
+    g_input_tokens.clear();
+    g_output_tokens.clear();
+    g_n_past = 0;
+    g_history.clear();
+    g_snapshots.clear();
+    g_system_prompt.clear();
+    publish_kv_headroom();
+    
+    char model_desc[256];
+    llama_model_desc(g_model, model_desc, sizeof(model_desc));
+    LOGI("Model ready: %s (handle %lld)", model_desc, (long long)handle);
+    LOGI("Context size: %d, Threads: %d", g_n_ctx_requested, g_n_threads);
+    log_session();
+    return 0;
+}
+
+// Start a generation record, if a request log is open. Tokens are added as
+// they are decoded; the record is written when the generation ends.
+static void log_generation(const std::string& prompt, int max_tokens, size_t n_prompt_tokens,
+                           int64_t start_us) {
+    if (!request_log_active() || g_priority.load() != PRIORITY_INTERACTIVE) {
+        return;
+    }
+    LoggedGeneration generation;
+    generation.prompt = prompt;
+    generation.grammar = g_grammar_text;
+    generation.max_tokens = max_tokens;
+    generation.seed = g_seed;
+    generation.n_prompt_tokens = (int32_t)n_prompt_tokens;
+    generation.prefill_us = now_us() - start_us;
+    request_log_generation_begin(generation);
+}
+
+// Background requests interleave with the conversation and are not
+// recorded; replay covers the interactive conversation only
+static void log_token(llama_token token, int64_t step_us) {
+    if (g_priority.load() == PRIORITY_INTERACTIVE) {
+        request_log_token(token, step_us);
+    }
+}
+
+static void log_generation_end(GenerationEnd end) {
+    if (g_priority.load() == PRIORITY_INTERACTIVE) {
+        request_log_generation_end(end);
+    }
+}
+
+static std::string format_user_prompt(const std::string& user_prompt) {
+    // Format with chat template if available
+    return "<|user|>\n" + user_prompt + "\n<|assistant|>\n";
+}
+
+// log(sum(exp(logits))), the log-softmax normalizer
+static float logsumexp(const float* logits, int n_vocab) {
+    float max_logit = *std::max_element(logits, logits + n_vocab);
+    double sum = 0.0;
+    for (int i = 0; i < n_vocab; i++) {
+        sum += std::exp((double)(logits[i] - max_logit));
+    }
+    return max_logit + (float)std::log(sum);
+}
+
+// Log-probability of `token` under the raw logits of batch output `idx`
+static float token_logprob(int idx, llama_token token) {
+    const float* logits = llama_get_logits_ith(g_ctx, idx);
+    int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(g_model));
+    return logits[token] - logsumexp(logits, n_vocab);
+}
+
+static int32_t float_bits(float value) {
+    int32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Append `token`'s record to g_logprob_records: its log-probability and the
+// g_logprob_top_k most likely tokens at batch output `idx`
+static void record_logprobs(int idx, llama_token token) {
+    const float* logits = llama_get_logits_ith(g_ctx, idx);
+    int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(g_model));
+    float norm = logsumexp(logits, n_vocab);
+    
+    g_logprob_records.push_back(token);
+    g_logprob_records.push_back(float_bits(logits[token] - norm));
+    if (g_logprob_top_k <= 0) {
+        return;
+    }
+    
+    // Insertion into a k-long list: one pass over the vocab, no allocation
+    llama_token top[MAX_LOGPROB_TOP_K];
+    int n_top = 0;
+    for (llama_token t = 0; t < n_vocab; t++) {
+        if (n_top == g_logprob_top_k && logits[t] <= logits[top[n_top - 1]]) {
+            continue;
+        }
+        int j = std::min(n_top, g_logprob_top_k - 1);
+        while (j > 0 && logits[top[j - 1]] < logits[t]) {
+            top[j] = top[j - 1];
+            j--;
+        }
+        top[j] = t;
+        n_top = std::min(n_top + 1, g_logprob_top_k);
+    }
+    for (int i = 0; i < g_logprob_top_k; i++) {
+        llama_token alt = i < n_top ? top[i] : -1;
+        g_logprob_records.push_back(alt);
+        g_logprob_records.push_back(float_bits(alt >= 0 ? logits[alt] - norm : -INFINITY));
+    }
+}
+
+static std::shared_ptr<llama_model> acquire_model() {
+    return std::atomic_load(&g_model_ref);
+}
+
+static int count_tokens(const llama_vocab* vocab, const std::string& text, bool add_special) {
+    // With no output buffer llama_tokenize returns the negated token count
+    int n = llama_tokenize(vocab, text.data(), (int32_t)text.size(),
+                           nullptr, 0, add_special, false);
+    return n < 0 ? -n : n;
+}
+
+int llama_jni_count_tokens(const std::string& text) {
+    std::shared_ptr<llama_model> model = acquire_model();
+    if (!model) {
+        return -1;
+    }
+    return count_tokens(llama_model_get_vocab(model.get()), text, false);
+}
+
 extern "C" {
 
 JNIEXPORT jint JNICALL
 Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeInit(
     JNIEnv* env, jobject thiz, jstring native_lib_dir) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
+    TRACE_SCOPE("nativeInit");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
     
     const char* lib_dir = env->GetStringUTFChars(native_lib_dir, nullptr);
     LOGI("Initializing llama.cpp from: %s", lib_dir);
@@ -72,8 +821,9 @@ Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeInit
     // Set log callback
     llama_log_set(log_callback, nullptr);
     
-    // Load backends from the native lib directory
-    ggml_backend_load_all_from_path(lib_dir);
+    // Load backends from the native lib directory, picking the CPU
+    // variant that matches this SoC
+    g_cpu_backend = cpu_backend_load_best(lib_dir);
     
     // Initialize backend
     llama_backend_init();
@@ -88,172 +838,398 @@ JNIEXPORT jint JNICALL
 Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeLoadModel(
     JNIEnv* env, jobject thiz, jstring model_path, jint n_ctx, jint n_threads) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
+    TRACE_SCOPE("nativeLoadModel");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    set_state(ENGINE_LOADING);
     
-    // Unload previous model if any
-    if (g_model != nullptr) {
-        if (g_sampler) {
-            common_sampler_free(g_sampler);
-            g_sampler = nullptr;
-        }
-        if (g_ctx) {
-            llama_free(g_ctx);
-            g_ctx = nullptr;
+    // The previous model stays cached, so switching back is cheap
+    free_context();
+    release_model(false);
+    
+    std::string path = jstring_to_std(env, model_path);
+    LOGI("Loading model: %s", path.c_str());
+    
+    ModelHandle handle = model_cache_acquire(path);
+    if (handle == 0) {
+        LOGE("Failed to load model");
+        set_state(ENGINE_UNLOADED);
+        return -1;
+    }
+    
+    int ret = attach_model(handle, n_ctx, n_threads);
+    set_state(ret == 0 ? ENGINE_IDLE : ENGINE_UNLOADED);
+    return ret;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeUseModel(
+    JNIEnv* env, jobject thiz, jlong handle, jint n_ctx, jint n_threads) {
+    
+    TRACE_SCOPE("nativeUseModel");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    // Take the engine's own reference first: the caller's may be its only one
+    if (!model_cache_retain((ModelHandle)handle)) {
+        LOGE("Unknown model handle %lld", (long long)handle);
+        return -1;
+    }
+    
+    set_state(ENGINE_LOADING);
+    free_context();
+    release_model(false);
+    
+    int ret = attach_model((ModelHandle)handle, n_ctx, n_threads);
+    set_state(ret == 0 ? ENGINE_IDLE : ENGINE_UNLOADED);
+    return ret;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGetModelHandle(
+    JNIEnv* env, jobject thiz) {
+    
+    TRACE_SCOPE("nativeGetModelHandle");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    return (jlong)g_model_handle;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeLoadLora(
+    JNIEnv* env, jobject thiz, jstring lora_path) {
+    
+    TRACE_SCOPE("nativeLoadLora");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    if (!g_model) {
+        LOGE("Model not loaded");
+        return -1;
+    }
+    
+    std::string path = jstring_to_std(env, lora_path);
+    for (const auto& [id, lora] : g_loras) {
+        if (lora.path == path) {
+            return id;
         }
-        llama_model_free(g_model);
-        g_model = nullptr;
     }
     
-    const char* path = env->GetStringUTFChars(model_path, nullptr);
-    LOGI("Loading model: %s", path);
+    int64_t start = now_us();
+    llama_adapter_lora* adapter = llama_adapter_lora_init(g_model, path.c_str());
+    if (!adapter) {
+        LOGE("Failed to load LoRA adapter: %s", path.c_str());
+        return -2;
+    }
     
-    // Model parameters
-    llama_model_params model_params = llama_model_default_params();
+    int64_t id = g_next_lora_id++;
+    g_loras[id] = LoraAdapter{path, adapter};
+    LOGI("LoRA adapter %lld loaded in %lld ms: %s",
+         (long long)id, (long long)((now_us() - start) / 1000), path.c_str());
+    return id;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSetLoras(
+    JNIEnv* env, jobject thiz, jlongArray ids, jfloatArray scales) {
     
-    // Load model
-    g_model = llama_model_load_from_file(path, model_params);
-    env->ReleaseStringUTFChars(model_path, path);
+    TRACE_SCOPE("nativeSetLoras");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
     
     if (!g_model) {
-        LOGE("Failed to load model");
+        LOGE("Model not loaded");
         return -1;
     }
+    int state = g_state.load();
+    if (state == ENGINE_PREFILL || state == ENGINE_DECODING) {
+        LOGE("Cannot change LoRA adapters during generation");
+        return -5;
+    }
     
-    // Context parameters
-    int actual_n_ctx = (n_ctx > 0) ? n_ctx : DEFAULT_N_CTX;
-    int actual_n_threads = (n_threads > 0) ? n_threads : 
-        std::min(DEFAULT_N_THREADS, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    jsize n = env->GetArrayLength(ids);
+    if (env->GetArrayLength(scales) != n) {
+        return -4;
+    }
+    std::vector<jlong> id_values(n);
+    std::vector<jfloat> scale_values(n);
+    env->GetLongArrayRegion(ids, 0, n, id_values.data());
+    env->GetFloatArrayRegion(scales, 0, n, scale_values.data());
+    
+    std::map<int64_t, float> active;
+    for (jsize i = 0; i < n; i++) {
+        if (g_loras.find(id_values[i]) == g_loras.end()) {
+            LOGE("Unknown LoRA adapter %lld", (long long)id_values[i]);
+            return -4;
+        }
+        if (scale_values[i] != 0.0f) {
+            active[id_values[i]] = scale_values[i];
+        }
+    }
     
-    llama_context_params ctx_params = llama_context_default_params();
-    ctx_params.n_ctx = actual_n_ctx;
-    ctx_params.n_batch = DEFAULT_N_BATCH;
-    ctx_params.n_ubatch = DEFAULT_N_BATCH;
-    ctx_params.n_threads = actual_n_threads;
-    ctx_params.n_threads_batch = actual_n_threads;
+    // Same set: nothing to do, and the KV cache stays valid
+    if (active == g_active_loras) {
+        return 0;
+    }
     
-    g_ctx = llama_init_from_model(g_model, ctx_params);
-    if (!g_ctx) {
-        LOGE("Failed to create context");
-        llama_model_free(g_model);
-        g_model = nullptr;
-        return -2;
+    g_active_loras = std::move(active);
+    if (g_ctx) {
+        // The cached KV was computed under the old adapters
+        apply_loras();
+        redecode_conversation();
     }
+    LOGI("%zu LoRA adapter(s) attached", g_active_loras.size());
+    return 0;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeUnloadLora(
+    JNIEnv* env, jobject thiz, jlong id) {
     
-    // Initialize sampler
-    common_params_sampling sparams;
-    sparams.temp = 0.7f;
-    sparams.top_p = 0.9f;
-    sparams.top_k = 40;
-    sparams.penalty_repeat = 1.1f;
+    TRACE_SCOPE("nativeUnloadLora");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
     
-    g_sampler = common_sampler_init(g_model, sparams);
-    if (!g_sampler) {
-        LOGE("Failed to create sampler");
-        llama_free(g_ctx);
-        g_ctx = nullptr;
-        llama_model_free(g_model);
-        g_model = nullptr;
-        return -3;
+    auto it = g_loras.find(id);
+    if (it == g_loras.end()) {
+        return false;
+    }
+    int state = g_state.load();
+    bool attached = g_active_loras.count(id) > 0;
+    if (attached && (state == ENGINE_PREFILL || state == ENGINE_DECODING)) {
+        LOGE("Cannot unload an attached LoRA adapter during generation");
+        return false;
     }
     
-    // Reset state
-    g_input_tokens.clear();
-    g_output_tokens.clear();
-    g_n_past = 0;
-    g_is_generating = false;
+    if (attached) {
+        g_active_loras.erase(id);
+        if (g_ctx) {
+            apply_loras();
+            redecode_conversation();
+        }
+    }
+    llama_adapter_lora_free(it->second.adapter);
+    g_loras.erase(it);
+    LOGI("LoRA adapter %lld unloaded", (long long)id);
+    return true;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSetSystemPrompt(
+    JNIEnv* env, jobject thiz, jstring prompt) {
     
-    char model_desc[256];
-    llama_model_desc(g_model, model_desc, sizeof(model_desc));
-    LOGI("Model loaded: %s", model_desc);
-    LOGI("Context size: %d, Threads: %d", actual_n_ctx, actual_n_threads);
+    TRACE_SCOPE("nativeSetSystemPrompt");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    if (!g_model) {
+        LOGE("Model not loaded");
+        return -1;
+    }
+    
+    clear_cancel();
+    int64_t start_us = now_us();
+    
+    const char* prompt_cstr = env->GetStringUTFChars(prompt, nullptr);
+    g_system_prompt = prompt_cstr;
+    env->ReleaseStringUTFChars(prompt, prompt_cstr);
+    
+    LOGI("System prompt set (%zu chars)", g_system_prompt.length());
+    
+    // Tokenize and process system prompt
+    g_input_tokens = tokenize_prompt(g_system_prompt);
+    
+    // Starting over anyway, so a trimmed context goes straight back to full size
+    if (!g_ctx || (int)llama_n_ctx(g_ctx) < g_n_ctx_requested) {
+        free_context();
+        g_n_past = 0;
+        g_history.clear();
+        if (create_context(g_n_ctx_requested) != 0) {
+            return -2;
+        }
+    }
+    
+    // Drop the conversation but keep the KV it shares with the new prompt:
+    // all of it when the system prompt is unchanged
+    set_state(ENGINE_PREFILL);
+    size_t reused = common_prefix(g_history, g_input_tokens);
+    int ret = decode_suffix(g_input_tokens, reused);
+    if (ret != 0) {
+        if (ret == 2) {
+            set_state(ENGINE_STOPPED);
+            return -3;
+        }
+        LOGE("Failed to process system prompt");
+        set_state(ENGINE_IDLE);
+        return -2;
+    }
+    set_state(ENGINE_IDLE);
+    publish_kv_headroom();
+    
+    if (request_log_active()) {
+        LoggedSystemPrompt logged;
+        logged.text = g_system_prompt;
+        logged.n_tokens = (int32_t)g_input_tokens.size();
+        logged.n_reused = (int32_t)reused;
+        logged.duration_us = now_us() - start_us;
+        request_log_system_prompt(logged);
+    }
     
+    LOGI("System prompt processed (%zu tokens, %zu reused)", g_input_tokens.size(), reused);
     return 0;
 }
 
 JNIEXPORT jint JNICALL
-Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSetSystemPrompt(
-    JNIEnv* env, jobject thiz, jstring prompt) {
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSetGrammar(
+    JNIEnv* env, jobject thiz, jstring grammar, jboolean is_json_schema) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
+    TRACE_SCOPE("nativeSetGrammar");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
     
-    if (!g_model || !g_ctx) {
+    if (!g_model) {
         LOGE("Model not loaded");
         return -1;
     }
+    if (is_generating()) {
+        LOGE("Cannot change grammar during generation");
+        return -5;
+    }
     
-    const char* prompt_cstr = env->GetStringUTFChars(prompt, nullptr);
-    g_system_prompt = prompt_cstr;
-    env->ReleaseStringUTFChars(prompt, prompt_cstr);
-    
-    LOGI("System prompt set (%zu chars)", g_system_prompt.length());
-    
-    // Tokenize and process system prompt
-    g_input_tokens = common_tokenize(g_ctx, g_system_prompt, true, true);
+    if (g_grammar_sampler) {
+        common_sampler_free(g_grammar_sampler);
+        g_grammar_sampler = nullptr;
+        g_grammar_text.clear();
+    }
     
-    // Clear past context
-    llama_memory_clear(llama_get_memory(g_ctx), false);
-    g_n_past = 0;
+    // Null or empty: unconstrained
+    std::string text = jstring_to_std(env, grammar);
+    if (text.empty()) {
+        return 0;
+    }
     
-    // Process system prompt tokens
-    llama_batch batch = llama_batch_init(g_input_tokens.size(), 0, 1);
-    for (size_t i = 0; i < g_input_tokens.size(); i++) {
-        common_batch_add(batch, g_input_tokens[i], g_n_past + i, {0}, false);
+    std::string gbnf = text;
+    if (is_json_schema) {
+        std::string error;
+        gbnf = grammar_from_json_schema(text, error);
+        if (gbnf.empty()) {
+            LOGE("Invalid JSON schema: %s", error.c_str());
+            return -4;
+        }
     }
     
-    if (llama_decode(g_ctx, batch) != 0) {
-        LOGE("Failed to process system prompt");
-        llama_batch_free(batch);
-        return -2;
+    g_grammar_sampler = grammar_cache_sampler(g_model, gbnf, default_sampling_params());
+    if (!g_grammar_sampler) {
+        return -4;
     }
+    g_grammar_text = gbnf;
+    return 0;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSetLogprobs(
+    JNIEnv* env, jobject thiz, jint top_k) {
     
-    g_n_past += g_input_tokens.size();
-    llama_batch_free(batch);
+    TRACE_SCOPE("nativeSetLogprobs");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    if (is_generating()) {
+        return -5;
+    }
     
-    LOGI("System prompt processed (%zu tokens)", g_input_tokens.size());
+    // Negative: off. Otherwise the chosen token plus top_k alternatives.
+    g_logprob_top_k = top_k < 0 ? -1 : std::min((int)top_k, MAX_LOGPROB_TOP_K);
+    g_logprob_records.clear();
     return 0;
 }
 
+JNIEXPORT jintArray JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeTakeLogprobs(
+    JNIEnv* env, jobject thiz) {
+    
+    TRACE_SCOPE("nativeTakeLogprobs");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    if (g_logprob_top_k < 0) {
+        return nullptr;
+    }
+    
+    // [top_k, records...]; taking them empties the buffer, so a caller
+    // can also drain it in chunks while generating
+    jsize size = (jsize)g_logprob_records.size() + 1;
+    jintArray result = env->NewIntArray(size);
+    jint top_k = g_logprob_top_k;
+    env->SetIntArrayRegion(result, 0, 1, &top_k);
+    env->SetIntArrayRegion(result, 1, size - 1, g_logprob_records.data());
+    g_logprob_records.clear();
+    return result;
+}
+
 JNIEXPORT jint JNICALL
 Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeStartGeneration(
     JNIEnv* env, jobject thiz, jstring prompt, jint max_tokens) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
+    TRACE_SCOPE("nativeStartGeneration");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
     
-    if (!g_model || !g_ctx) {
+    if (!g_model) {
         LOGE("Model not loaded");
         return -1;
     }
     
+    clear_cancel();
+    int64_t start_us = now_us();
+    
     const char* prompt_cstr = env->GetStringUTFChars(prompt, nullptr);
     std::string user_prompt(prompt_cstr);
     env->ReleaseStringUTFChars(prompt, prompt_cstr);
     
     LOGI("Starting generation for prompt (%zu chars)", user_prompt.length());
     
-    // Format with chat template if available
-    std::string formatted_prompt = "<|user|>\n" + user_prompt + "\n<|assistant|>\n";
+    std::string formatted_prompt = format_user_prompt(user_prompt);
     
     // Tokenize user prompt
-    auto user_tokens = common_tokenize(g_ctx, formatted_prompt, true, true);
+    auto user_tokens = tokenize_prompt(formatted_prompt);
     
-    // Process user prompt tokens
-    llama_batch batch = llama_batch_init(user_tokens.size(), 0, 1);
-    for (size_t i = 0; i < user_tokens.size(); i++) {
-        bool is_last = (i == user_tokens.size() - 1);
-        common_batch_add(batch, user_tokens[i], g_n_past + i, {0}, is_last);
+    // Regrow (or recreate) the context if a memory trim shrank it
+    if (!ensure_context((int)user_tokens.size() + max_tokens)) {
+        LOGE("No context available");
+        return -2;
     }
     
-    if (llama_decode(g_ctx, batch) != 0) {
-        LOGE("Failed to process user prompt");
+    // With a fixed seed every reply starts from the same RNG state (and an
+    // empty penalty window), independent of earlier turns
+    if (g_seed != LLAMA_DEFAULT_SEED) {
+        common_sampler_reset(g_grammar_sampler ? g_grammar_sampler : g_sampler);
+    }
+    
+    // Process user prompt tokens
+    set_state(ENGINE_PREFILL);
+    llama_batch batch = llama_batch_init(DEFAULT_N_BATCH, 0, 1);
+    int ret = decode_prompt(batch, user_tokens, g_n_past);
+    if (ret != 0) {
         llama_batch_free(batch);
+        log_generation(user_prompt, max_tokens, user_tokens.size(), start_us);
+        if (ret == 2 && !cancel_requested() && g_priority.load() == PRIORITY_BACKGROUND) {
+            // Nothing of the prompt was kept; the caller starts it again
+            // once the interactive requests are served
+            LOGI("Background prefill preempted");
+            set_state(ENGINE_IDLE);
+            return -6;
+        }
+        if (ret == 2) {
+            LOGI("Prefill cancelled");
+            log_generation_end(GENERATION_END_CANCELLED);
+            set_state(ENGINE_STOPPED);
+            return -3;
+        }
+        LOGE("Failed to process user prompt");
+        log_generation_end(GENERATION_END_ERROR);
+        set_state(ENGINE_IDLE);
         return -2;
     }
     
     g_n_past += user_tokens.size();
+    g_history.insert(g_history.end(), user_tokens.begin(), user_tokens.end());
     llama_batch_free(batch);
+    log_generation(user_prompt, max_tokens, user_tokens.size(), start_us);
+    throughput_record_prefill((int)user_tokens.size(), now_us() - start_us);
     
-    g_is_generating = true;
     g_output_tokens.clear();
+    publish_kv_headroom();
+    set_state(ENGINE_DECODING);
     
     LOGI("Ready to generate (user tokens: %zu, n_past: %d)", user_tokens.size(), g_n_past);
     return 0;
@@ -263,23 +1239,43 @@ JNIEXPORT jstring JNICALL
 Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGetNextToken(
     JNIEnv* env, jobject thiz) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
+    TRACE_SCOPE("nativeGetNextToken");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
     
     if (!g_model || !g_ctx || !g_sampler) {
         return nullptr;
     }
+    int64_t start_us = now_us();
     
-    if (!g_is_generating) {
+    if (cancel_requested()) {
+        record_cancel_latency();
+        if (is_generating()) {
+            log_generation_end(GENERATION_END_CANCELLED);
+            set_state(ENGINE_STOPPED);
+        }
+        return nullptr;
+    }
+    
+    if (!is_generating()) {
         return nullptr;
     }
     
     // Sample next token
-    llama_token new_token = common_sampler_sample(g_sampler, g_ctx, -1);
-    common_sampler_accept(g_sampler, new_token, true);
+    common_sampler* sampler = g_grammar_sampler ? g_grammar_sampler : g_sampler;
+    llama_token new_token;
+    {
+        TRACE_SCOPE("sample");
+        new_token = common_sampler_sample(sampler, g_ctx, -1);
+        common_sampler_accept(sampler, new_token, true);
+        if (g_logprob_top_k >= 0) {
+            record_logprobs(-1, new_token);
+        }
+    }
     
     // Check for end of generation
     if (llama_vocab_is_eog(llama_model_get_vocab(g_model), new_token)) {
-        g_is_generating = false;
+        log_generation_end(GENERATION_END_EOG);
+        set_state(ENGINE_STOPPED);
         LOGI("Generation complete (EOG token)");
         return nullptr;
     }
@@ -288,83 +1284,642 @@ Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGetN
     llama_batch batch = llama_batch_init(1, 0, 1);
     common_batch_add(batch, new_token, g_n_past, {0}, true);
     
-    if (llama_decode(g_ctx, batch) != 0) {
-        LOGE("Failed to decode token");
+    int64_t decode_start_us = now_us();
+    int ret = decode_cancellable(batch);
+    if (ret != 0) {
+        if (ret != 2) {
+            LOGE("Failed to decode token");
+        }
+        log_generation_end(ret == 2 ? GENERATION_END_CANCELLED : GENERATION_END_ERROR);
         llama_batch_free(batch);
-        g_is_generating = false;
+        set_state(ENGINE_STOPPED);
         return nullptr;
     }
     
+    // Prefill keeps g_n_threads; only single-token steps are governed
+    int threads = thread_governor_step(now_us() - decode_start_us);
+    if (threads != g_decode_threads) {
+        llama_set_n_threads(g_ctx, threads, g_n_threads);
+        g_decode_threads = threads;
+    }
+    
     g_n_past++;
+    g_history.push_back(new_token);
     llama_batch_free(batch);
+    publish_kv_headroom();
     
     g_output_tokens.push_back(new_token);
     
     // Convert token to text
-    std::string token_text = common_token_to_piece(g_ctx, new_token);
+    std::string token_text;
+    {
+        TRACE_SCOPE("detokenize");
+        token_text = common_token_to_piece(g_ctx, new_token);
+    }
     
+    int64_t step_us = now_us() - start_us;
+    throughput_record_decode(step_us);
+    log_token(new_token, step_us);
     return env->NewStringUTF(token_text.c_str());
 }
 
+JNIEXPORT jobjectArray JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGenerateNBest(
+    JNIEnv* env, jobject thiz, jstring prompt, jint n, jint max_tokens,
+    jfloat temperature, jfloatArray log_probs) {
+    
+    TRACE_SCOPE("nativeGenerateNBest");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    if (!g_model || n < 1 || n > MAX_N_BEST || env->GetArrayLength(log_probs) < n) {
+        return nullptr;
+    }
+    int state = g_state.load();
+    if (state == ENGINE_PREFILL || state == ENGINE_DECODING) {
+        LOGE("N-best requested during generation");
+        return nullptr;
+    }
+    
+    clear_cancel();
+    int64_t start_us = now_us();
+    
+    std::string user_prompt = jstring_to_std(env, prompt);
+    std::string formatted_prompt = format_user_prompt(user_prompt);
+    auto prompt_tokens = tokenize_prompt(formatted_prompt);
+    if (prompt_tokens.empty() || !ensure_context((int)prompt_tokens.size() + n * max_tokens)) {
+        return nullptr;
+    }
+    
+    // All branches share the context's cells; shorten them to fit
+    int room = (int)llama_n_ctx(g_ctx) - g_n_past - (int)prompt_tokens.size();
+    int n_predict = std::min((int)max_tokens, room / n);
+    if (n_predict < 1) {
+        LOGE("No room in context for %d branches", n);
+        return nullptr;
+    }
+    
+    // Prefill once, after the conversation on sequence 0. g_n_past is not
+    // advanced: the prompt and branches are dropped afterwards, so the
+    // conversation is left as it was.
+    set_state(ENGINE_PREFILL);
+    llama_batch batch = llama_batch_init(std::max(DEFAULT_N_BATCH, n), 0, 1);
+    llama_memory_t mem = llama_get_memory(g_ctx);
+    int ret = decode_prompt(batch, prompt_tokens, g_n_past);
+    
+    struct Branch {
+        common_sampler* sampler = nullptr;
+        uint32_t seed = LLAMA_DEFAULT_SEED;
+        std::string text;
+        float log_prob = 0.0f;
+        int logits_idx = 0;
+        bool done = false;
+    };
+    std::vector<Branch> branches(n);
+    
+    if (ret == 0) {
+        // Fork the prompt's KV into sequences 1..n
+        for (int b = 0; b < n; b++) {
+            llama_memory_seq_cp(mem, 0, b + 1, -1, -1);
+        }
+        
+        common_params_sampling sparams = default_sampling_params();
+        sparams.temp = temperature;
+        uint32_t seed = g_seed;
+        for (int b = 0; b < n; b++) {
+            // Every branch needs its own RNG stream. A fixed seed gives
+            // each the next seed after it, so the set is reproducible.
+            if (g_seed != LLAMA_DEFAULT_SEED) {
+                do {
+                    seed++;
+                } while (seed == LLAMA_DEFAULT_SEED);
+            }
+            sparams.seed = seed;
+            branches[b].seed = seed;
+            branches[b].sampler = common_sampler_init(g_model, sparams);
+            branches[b].logits_idx = batch.n_tokens - 1;
+        }
+        
+        set_state(ENGINE_DECODING);
+        const llama_vocab* vocab = llama_model_get_vocab(g_model);
+        llama_pos pos = g_n_past + (llama_pos)prompt_tokens.size();
+        
+        for (int step = 0; step < n_predict && ret == 0; step++) {
+            common_batch_clear(batch);
+            for (int b = 0; b < n; b++) {
+                Branch& branch = branches[b];
+                if (branch.done) continue;
+                
+                TRACE_SCOPE("sample", b);
+                llama_token token = common_sampler_sample(branch.sampler, g_ctx, branch.logits_idx);
+                common_sampler_accept(branch.sampler, token, true);
+                branch.log_prob += token_logprob(branch.logits_idx, token);
+                
+                if (llama_vocab_is_eog(vocab, token)) {
+                    branch.done = true;
+                    continue;
+                }
+                branch.text += common_token_to_piece(g_ctx, token);
+                branch.logits_idx = batch.n_tokens;
+                common_batch_add(batch, token, pos, {b + 1}, true);
+            }
+            if (batch.n_tokens == 0) {
+                break;
+            }
+            // One decode steps every live branch
+            ret = decode_cancellable(batch);
+            pos++;
+        }
+    }
+    
+    llama_batch_free(batch);
+    for (int b = 0; b < n; b++) {
+        llama_memory_seq_rm(mem, b + 1, -1, -1);
+        if (branches[b].sampler) {
+            common_sampler_free(branches[b].sampler);
+        }
+    }
+    llama_memory_seq_rm(mem, 0, g_n_past, -1);
+    
+    if (ret != 0) {
+        if (ret != 2) {
+            LOGE("N-best decode failed");
+        }
+        set_state(ret == 2 ? ENGINE_STOPPED : ENGINE_IDLE);
+        return nullptr;
+    }
+    set_state(ENGINE_IDLE);
+    
+    // Most likely first
+    std::sort(branches.begin(), branches.end(),
+              [](const Branch& a, const Branch& b) { return a.log_prob > b.log_prob; });
+    
+    std::vector<jfloat> scores(n);
+    jobjectArray result = env->NewObjectArray(n, env->FindClass("java/lang/String"), nullptr);
+    for (int b = 0; b < n; b++) {
+        jstring text = env->NewStringUTF(branches[b].text.c_str());
+        env->SetObjectArrayElement(result, b, text);
+        env->DeleteLocalRef(text);
+        scores[b] = branches[b].log_prob;
+    }
+    env->SetFloatArrayRegion(log_probs, 0, n, scores.data());
+    
+    if (request_log_active() && g_priority.load() == PRIORITY_INTERACTIVE) {
+        LoggedNBest logged;
+        logged.prompt = user_prompt;
+        logged.max_tokens = max_tokens;
+        logged.temperature = temperature;
+        logged.seed = g_seed;
+        for (const Branch& branch : branches) {
+            logged.seeds.push_back(branch.seed);
+            logged.texts.push_back(branch.text);
+        }
+        logged.duration_us = now_us() - start_us;
+        request_log_nbest(logged);
+    }
+    
+    LOGI("N-best: %d branches, up to %d tokens each", n, n_predict);
+    return result;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSnapshot(
+    JNIEnv* env, jobject thiz, jboolean keep_kv) {
+    
+    TRACE_SCOPE("nativeSnapshot");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    if (!g_model || !g_ctx) {
+        return -1;
+    }
+    if (is_generating()) {
+        return -5;
+    }
+    
+    if (g_snapshots.size() >= MAX_SNAPSHOTS) {
+        auto oldest = g_snapshots.begin();
+        if (oldest->second.seq >= 0) {
+            llama_memory_seq_rm(llama_get_memory(g_ctx), oldest->second.seq, -1, -1);
+        }
+        g_snapshots.erase(oldest);
+    }
+    
+    int id = g_next_snapshot_id++;
+    Snapshot& snapshot = g_snapshots[id];
+    snapshot.tokens = g_history;
+    
+    if (keep_kv) {
+        // A free spare sequence, else the one held by the oldest snapshot
+        bool used[MAX_KV_SNAPSHOTS] = {};
+        Snapshot* oldest = nullptr;
+        for (auto& [other_id, other] : g_snapshots) {
+            if (other.seq < 0) continue;
+            used[other.seq - FIRST_SNAPSHOT_SEQ] = true;
+            if (!oldest) oldest = &other;
+        }
+        llama_seq_id seq = -1;
+        for (int i = 0; i < MAX_KV_SNAPSHOTS && seq < 0; i++) {
+            if (!used[i]) seq = FIRST_SNAPSHOT_SEQ + i;
+        }
+        if (seq < 0) {
+            seq = oldest->seq;
+            oldest->seq = -1;
+        }
+        
+        llama_memory_t mem = llama_get_memory(g_ctx);
+        llama_memory_seq_rm(mem, seq, -1, -1);
+        llama_memory_seq_cp(mem, 0, seq, -1, -1);
+        snapshot.seq = seq;
+    }
+    
+    LOGI("Snapshot %d at %d tokens%s", id, g_n_past, keep_kv ? " (KV kept)" : "");
+    return id;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeRewind(
+    JNIEnv* env, jobject thiz, jint snapshot_id) {
+    
+    TRACE_SCOPE("nativeRewind");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    if (!g_model) {
+        return -1;
+    }
+    int state = g_state.load();
+    if (state == ENGINE_PREFILL || state == ENGINE_DECODING) {
+        return -5;
+    }
+    auto it = g_snapshots.find(snapshot_id);
+    if (it == g_snapshots.end()) {
+        return -4;
+    }
+    const Snapshot& snapshot = it->second;
+    
+    clear_cancel();
+    int needed = (int)snapshot.tokens.size() - g_n_past;
+    if ((int)snapshot.tokens.size() > g_n_ctx_requested || !ensure_context(std::max(needed, 0))) {
+        return -2;
+    }
+    
+    size_t shared = common_prefix(g_history, snapshot.tokens);
+    if (shared < snapshot.tokens.size() && snapshot.seq >= 0) {
+        // The branch's KV is still around: point sequence 0 at it
+        llama_memory_t mem = llama_get_memory(g_ctx);
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        llama_memory_seq_cp(mem, snapshot.seq, 0, -1, -1);
+        g_history = snapshot.tokens;
+        g_n_past = (int)g_history.size();
+        shared = g_history.size();
+    }
+    
+    // Truncate to the shared prefix and decode whatever the snapshot adds
+    set_state(ENGINE_PREFILL);
+    int ret = decode_suffix(snapshot.tokens, shared);
+    common_sampler_reset(g_sampler);
+    g_output_tokens.clear();
+    if (ret != 0) {
+        set_state(ret == 2 ? ENGINE_STOPPED : ENGINE_IDLE);
+        return ret == 2 ? -3 : -2;
+    }
+    set_state(ENGINE_IDLE);
+    
+    int decoded = (int)(snapshot.tokens.size() - shared);
+    LOGI("Rewound to snapshot %d (%d tokens, %d decoded)", snapshot_id, g_n_past, decoded);
+    return decoded;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeReleaseSnapshot(
+    JNIEnv* env, jobject thiz, jint snapshot_id) {
+    
+    TRACE_SCOPE("nativeReleaseSnapshot");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    auto it = g_snapshots.find(snapshot_id);
+    if (it == g_snapshots.end()) {
+        return;
+    }
+    if (it->second.seq >= 0 && g_ctx) {
+        llama_memory_seq_rm(llama_get_memory(g_ctx), it->second.seq, -1, -1);
+    }
+    g_snapshots.erase(it);
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSaveSession(
+    JNIEnv* env, jobject thiz, jstring path) {
+    
+    TRACE_SCOPE("nativeSaveSession");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    if (!g_ctx || is_generating()) {
+        return -1;
+    }
+    
+    // Sequence 0's KV slice plus its tokens
+    std::string file = jstring_to_std(env, path);
+    size_t written = llama_state_seq_save_file(g_ctx, file.c_str(), 0, g_history.data(), g_history.size());
+    if (written == 0) {
+        LOGE("Failed to save session to %s", file.c_str());
+        return -2;
+    }
+    LOGI("Session saved (%d tokens, %zu bytes)", g_n_past, written);
+    return (jlong)written;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeLoadSession(
+    JNIEnv* env, jobject thiz, jstring path) {
+    
+    TRACE_SCOPE("nativeLoadSession");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    if (!g_model) {
+        return -1;
+    }
+    int state = g_state.load();
+    if (state == ENGINE_PREFILL || state == ENGINE_DECODING) {
+        return -5;
+    }
+    if (!g_ctx || (int)llama_n_ctx(g_ctx) < g_n_ctx_requested) {
+        free_context();
+        g_n_past = 0;
+        g_history.clear();
+        if (create_context(g_n_ctx_requested) != 0) {
+            return -2;
+        }
+    }
+    
+    std::string file = jstring_to_std(env, path);
+    std::vector<llama_token> tokens(llama_n_ctx(g_ctx));
+    size_t n_tokens = 0;
+    llama_memory_seq_rm(llama_get_memory(g_ctx), 0, -1, -1);
+    size_t read = llama_state_seq_load_file(g_ctx, file.c_str(), 0, tokens.data(), tokens.size(), &n_tokens);
+    if (read == 0) {
+        LOGE("Failed to load session from %s", file.c_str());
+        restore_system_prompt();
+        return -2;
+    }
+    
+    tokens.resize(n_tokens);
+    g_history = std::move(tokens);
+    g_n_past = (int)n_tokens;
+    g_output_tokens.clear();
+    common_sampler_reset(g_sampler);
+    LOGI("Session loaded (%d tokens)", g_n_past);
+    return g_n_past;
+}
+
 JNIEXPORT void JNICALL
 Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeStopGeneration(
     JNIEnv* env, jobject thiz) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
-    g_is_generating = false;
+    TRACE_SCOPE("nativeStopGeneration");
+    // Lock-free: g_mutex may be held by a decode for the whole prefill.
+    // Only chat is stopped; background jobs end by finishing or being dropped.
+    if (!g_cancel_requested[PRIORITY_INTERACTIVE].exchange(true)) {
+        g_cancel_requested_at_us[PRIORITY_INTERACTIVE].store(now_us());
+    }
+    
+    // Between tokens nothing holds g_mutex and the transition can happen
+    // here; otherwise the in-flight decode publishes STOPPED when it aborts.
+    // A parked chat sees its flag when it is switched back in.
+    if (g_mutex.try_lock()) {
+        if (g_priority.load() == PRIORITY_INTERACTIVE && is_generating()) {
+            log_generation_end(GENERATION_END_CANCELLED);
+            set_state(ENGINE_STOPPED);
+        }
+        g_mutex.unlock();
+    }
     LOGI("Generation stopped by request");
 }
 
+// Make the `priority` conversation the one later calls act on. Called
+// between decode steps, so a background reply parks where it is (KV,
+// sampler and state kept) and resumes token for token after.
+// Returns 0, -1 if no model is loaded, -2 if it could not be restored.
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSchedule(
+    JNIEnv* env, jobject thiz, jint priority) {
+    
+    TRACE_SCOPE("nativeSchedule", priority);
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    if (!g_model) {
+        return -1;
+    }
+    return switch_conversation(priority == PRIORITY_BACKGROUND ? PRIORITY_BACKGROUND : PRIORITY_INTERACTIVE);
+}
+
+// End the background conversation, wherever it is, and put the
+// interactive one back on sequence 0
 JNIEXPORT void JNICALL
-Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeUnloadModel(
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeFinishBackground(
     JNIEnv* env, jobject thiz) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
+    TRACE_SCOPE("nativeFinishBackground");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    if (!g_model) {
+        return;
+    }
+    if (g_priority.load() == PRIORITY_BACKGROUND) {
+        switch_conversation(PRIORITY_INTERACTIVE);
+    }
+    drop_parked();
+}
+
+// Count interactive requests in (+1) or out (-1). Lock-free: an arrival has
+// to reach a background prefill that holds g_mutex. Returns the new count.
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeAddInteractivePending(
+    JNIEnv* env, jobject thiz, jint delta) {
+    
+    return g_interactive_pending.fetch_add(delta) + delta;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGetLastCancelLatencyUs(
+    JNIEnv* env, jobject thiz) {
     
-    g_is_generating = false;
+    TRACE_SCOPE("nativeGetLastCancelLatencyUs");
+    return g_last_cancel_latency_us.load();
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSetSeed(
+    JNIEnv* env, jobject thiz, jlong seed) {
     
-    if (g_sampler) {
-        common_sampler_free(g_sampler);
-        g_sampler = nullptr;
+    TRACE_SCOPE("nativeSetSeed");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    if (is_generating()) {
+        return -5;
     }
+    // Negative: back to a fresh random seed per sampler
+    apply_seed(seed < 0 ? LLAMA_DEFAULT_SEED : (uint32_t)seed);
+    g_seed_for_recording = false;
+    LOGI("Sampler seed: %s", seed < 0 ? "random" : std::to_string(g_seed).c_str());
+    return 0;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeStartRecording(
+    JNIEnv* env, jobject thiz, jstring path, jlong seed) {
     
-    if (g_ctx) {
-        llama_free(g_ctx);
-        g_ctx = nullptr;
+    TRACE_SCOPE("nativeStartRecording");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    if (is_generating()) {
+        return -5;
+    }
+    
+    // Replay needs a fixed seed; without one, pick a random seed for the
+    // length of the recording
+    uint32_t previous = g_seed;
+    bool picked = false;
+    if (seed >= 0) {
+        apply_seed((uint32_t)seed);
+    } else if (g_seed == LLAMA_DEFAULT_SEED) {
+        std::random_device rd;
+        uint32_t random_seed;
+        do {
+            random_seed = rd();
+        } while (random_seed == LLAMA_DEFAULT_SEED);
+        apply_seed(random_seed);
+        picked = true;
     }
     
-    if (g_model) {
-        llama_model_free(g_model);
-        g_model = nullptr;
+    if (!request_log_open(jstring_to_std(env, path))) {
+        apply_seed(previous);
+        return -1;
+    }
+    g_seed_for_recording = picked || (g_seed_for_recording && seed < 0);
+    log_session();
+    return 0;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeStopRecording(
+    JNIEnv* env, jobject thiz) {
+    
+    TRACE_SCOPE("nativeStopRecording");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    request_log_close();
+    if (g_seed_for_recording) {
+        apply_seed(LLAMA_DEFAULT_SEED);
+        g_seed_for_recording = false;
     }
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeUnloadModel(
+    JNIEnv* env, jobject thiz) {
+    
+    TRACE_SCOPE("nativeUnloadModel");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
+    
+    request_log_generation_end(GENERATION_END_STOPPED);
+    
+    // An explicit unload frees the memory unless someone else holds the model
+    free_context();
+    release_model(true);
     
     g_input_tokens.clear();
     g_output_tokens.clear();
     g_n_past = 0;
+    g_history.clear();
+    g_snapshots.clear();
     g_system_prompt.clear();
+    set_state(ENGINE_UNLOADED);
     
     LOGI("Model unloaded");
 }
 
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeTrimMemory(
+    JNIEnv* env, jobject thiz, jint level) {
+    
+    TRACE_SCOPE("nativeTrimMemory");
+    // Graded: each level also does everything the levels below it do.
+    // Never waits for the engine; if it's busy, only the caches are trimmed.
+    int64_t before = resident_bytes();
+    
+    if (level >= TRIM_MEMORY_RUNNING_MODERATE) {
+        // Models nobody is running, and the reranker's scratch context
+        uint64_t evicted = model_cache_trim(0);
+        bool reranker = llama_jni_release_reranker_context();
+        LOGI("Trim %d: evicted %llu MB of cached models%s", level,
+             (unsigned long long)(evicted >> 20), reranker ? ", released reranker context" : "");
+    }
+    
+    if (level >= TRIM_MEMORY_RUNNING_LOW) {
+        std::unique_lock<std::mutex> lock(g_mutex, std::try_to_lock);
+        int state = g_state.load();
+        // A parked conversation is still being served
+        bool idle = (state == ENGINE_IDLE || state == ENGINE_STOPPED) && !g_parked.present;
+        
+        if (!lock.owns_lock() || !g_model) {
+            LOGI("Trim %d: engine busy or empty, skipping context", level);
+        } else if (level >= TRIM_MEMORY_COMPLETE) {
+            // About to be killed anyway: give everything back
+            g_cancel_requested[PRIORITY_INTERACTIVE].store(true);
+            g_cancel_requested[PRIORITY_BACKGROUND].store(true);
+            free_context();
+            release_model(true);
+            g_input_tokens.clear();
+            g_output_tokens.clear();
+            g_n_past = 0;
+            g_history.clear();
+            g_snapshots.clear();
+            g_system_prompt.clear();
+            set_state(ENGINE_UNLOADED);
+            LOGI("Trim %d: model unloaded", level);
+        } else if (!idle) {
+            LOGI("Trim %d: generation in progress or parked, keeping context", level);
+        } else if (level == TRIM_MEMORY_RUNNING_CRITICAL || level >= TRIM_MEMORY_BACKGROUND) {
+            // KV cache and compute buffers go; the next generation recreates
+            // the context and re-prefills the system prompt
+            free_context();
+            g_n_past = 0;
+            g_history.clear();
+            LOGI("Trim %d: context released, model kept", level);
+        } else if (g_ctx) {
+            // Shrink the KV cache to the conversation so far plus a batch
+            int target = std::max(MIN_TRIMMED_N_CTX, g_n_past + DEFAULT_N_BATCH);
+            target = (target + TRIMMED_N_CTX_ALIGN - 1) / TRIMMED_N_CTX_ALIGN * TRIMMED_N_CTX_ALIGN;
+            int current = (int)llama_n_ctx(g_ctx);
+            if (target < current) {
+                if (resize_context(target)) {
+                    LOGI("Trim %d: context shrunk %d -> %d", level, current, target);
+                } else {
+                    LOGW("Trim %d: shrinking context failed, released it", level);
+                    g_n_past = 0;
+                    g_history.clear();
+                }
+            }
+        }
+    }
+    
+    int64_t freed = std::max<int64_t>(0, before - resident_bytes());
+    LOGI("Trim %d freed %lld KB", level, (long long)(freed >> 10));
+    return freed;
+}
+
 JNIEXPORT void JNICALL
 Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeShutdown(
     JNIEnv* env, jobject thiz) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
+    TRACE_SCOPE("nativeShutdown");
+    TraceLockGuard lock(g_mutex, "g_mutex wait");
     
-    // Unload model first
-    if (g_sampler) {
-        common_sampler_free(g_sampler);
-        g_sampler = nullptr;
-    }
-    if (g_ctx) {
-        llama_free(g_ctx);
-        g_ctx = nullptr;
-    }
-    if (g_model) {
-        llama_model_free(g_model);
-        g_model = nullptr;
+    request_log_close();
+    
+    // Unload models first; the reranker borrows one from the cache too
+    free_context();
+    release_model(true);
+    llama_jni_unload_reranker();
+    size_t kept = model_cache_clear();
+    if (kept > 0) {
+        LOGW("%zu cached models still referenced at shutdown", kept);
     }
+    set_state(ENGINE_UNLOADED);
     
     llama_backend_free();
     LOGI("llama.cpp shutdown complete");
@@ -374,24 +1929,124 @@ JNIEXPORT jstring JNICALL
 Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGetSystemInfo(
     JNIEnv* env, jobject thiz) {
     
-    const char* info = llama_print_system_info();
-    return env->NewStringUTF(info);
+    TRACE_SCOPE("nativeGetSystemInfo");
+    std::string info = llama_print_system_info();
+    info += "CPU_FEATURES = " + cpu_features_string(cpu_features()) + " | ";
+    info += "CPU_BACKEND = " + (g_cpu_backend.empty() ? std::string("none") : g_cpu_backend) + " | ";
+    return env->NewStringUTF(info.c_str());
 }
 
 JNIEXPORT jboolean JNICALL
 Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeIsModelLoaded(
     JNIEnv* env, jobject thiz) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
-    return (g_model != nullptr && g_ctx != nullptr);
+    TRACE_SCOPE("nativeIsModelLoaded");
+    int state = g_state.load();
+    return state != ENGINE_UNLOADED && state != ENGINE_LOADING;
 }
 
 JNIEXPORT jboolean JNICALL
 Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeIsGenerating(
     JNIEnv* env, jobject thiz) {
     
-    std::lock_guard<std::mutex> lock(g_mutex);
-    return g_is_generating;
+    TRACE_SCOPE("nativeIsGenerating");
+    return is_generating();
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGetState(
+    JNIEnv* env, jobject thiz) {
+    
+    TRACE_SCOPE("nativeGetState");
+    return g_state.load();
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeAwaitState(
+    JNIEnv* env, jobject thiz, jint state_mask, jlong timeout_ms) {
+    
+    TRACE_SCOPE("nativeAwaitState");
+    // Blocks on g_state_cv, never on g_mutex. Returns the state that ended the
+    // wait, which is outside state_mask if the timeout expired first.
+    std::unique_lock<std::mutex> lock(g_state_mutex);
+    auto matches = [state_mask]() { return ((1 << g_state.load()) & state_mask) != 0; };
+    
+    if (timeout_ms < 0) {
+        g_state_cv.wait(lock, matches);
+    } else {
+        g_state_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), matches);
+    }
+    return g_state.load();
+}
+
+JNIEXPORT jintArray JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeTokenize(
+    JNIEnv* env, jobject thiz, jstring text, jboolean add_special) {
+    
+    TRACE_SCOPE("nativeTokenize");
+    // Vocab only: no context, no g_mutex, safe while generation runs
+    std::shared_ptr<llama_model> model = acquire_model();
+    if (!model) {
+        return nullptr;
+    }
+    
+    std::string str = jstring_to_std(env, text);
+    std::vector<llama_token> tokens =
+        common_tokenize(llama_model_get_vocab(model.get()), str, add_special, false);
+    
+    jintArray result = env->NewIntArray((jsize)tokens.size());
+    env->SetIntArrayRegion(result, 0, (jsize)tokens.size(), tokens.data());
+    return result;
+}
+
+JNIEXPORT jintArray JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeCountTokens(
+    JNIEnv* env, jobject thiz, jobjectArray texts, jboolean add_special) {
+    
+    TRACE_SCOPE("nativeCountTokens");
+    std::shared_ptr<llama_model> model = acquire_model();
+    if (!model) {
+        return nullptr;
+    }
+    const llama_vocab* vocab = llama_model_get_vocab(model.get());
+    
+    jsize n = env->GetArrayLength(texts);
+    std::vector<std::string> strs(n);
+    for (jsize i = 0; i < n; i++) {
+        jstring s = (jstring)env->GetObjectArrayElement(texts, i);
+        strs[i] = jstring_to_std(env, s);
+        env->DeleteLocalRef(s);
+    }
+    
+    // Fan out over cores; tokenization only reads the shared vocab
+    std::vector<jint> counts(n, 0);
+    size_t n_workers = std::min<size_t>(
+        std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)),
+        (strs.size() + MIN_TEXTS_PER_TOKENIZER_THREAD - 1) / MIN_TEXTS_PER_TOKENIZER_THREAD);
+    
+    auto work = [&](size_t worker) {
+        for (size_t i = worker; i < strs.size(); i += n_workers) {
+            counts[i] = count_tokens(vocab, strs[i], add_special);
+        }
+    };
+    
+    if (n_workers <= 1) {
+        n_workers = 1;
+        work(0);
+    } else {
+        std::vector<std::thread> threads;
+        for (size_t w = 1; w < n_workers; w++) {
+            threads.emplace_back(work, w);
+        }
+        work(0);
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+    
+    jintArray result = env->NewIntArray(n);
+    env->SetIntArrayRegion(result, 0, n, counts.data());
+    return result;
 }
 
 } // extern "C"
@@ -0,0 +1,73 @@
+/**
+ * Shared internals of the llama.cpp JNI bindings.
+ *
+ * Everything the JNI translation units need from each other lives here:
+ * logging macros, small JNI helpers, and the engine hooks exported by
+ * llama_jni.cpp for the auxiliary native modules.
+ */
+
+#pragma once
+
+#include <jni.h>
+#include <string>
+#include <vector>
+
+#ifndef LOG_TAG
+#define LOG_TAG "LlamaCppJNI"
+#endif
+
+#ifdef __ANDROID__
+#include <android/log.h>
+
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#else
+// Host builds (tools, tests): warnings and errors to stderr, the rest only
+// with LLAMA_JNI_VERBOSE set
+#include <cstdio>
+#include <cstdlib>
+
+inline bool llama_jni_verbose() {
+    static const bool verbose = getenv("LLAMA_JNI_VERBOSE") != nullptr;
+    return verbose;
+}
+
+#define LLAMA_JNI_LOG(level, ...) \
+    do { fprintf(stderr, level "/" LOG_TAG ": " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define LOGI(...) do { if (llama_jni_verbose()) LLAMA_JNI_LOG("I", __VA_ARGS__); } while (0)
+#define LOGW(...) LLAMA_JNI_LOG("W", __VA_ARGS__)
+#define LOGE(...) LLAMA_JNI_LOG("E", __VA_ARGS__)
+#define LOGD(...) do { if (llama_jni_verbose()) LLAMA_JNI_LOG("D", __VA_ARGS__); } while (0)
+#endif
+
+// Copy a Java string into a std::string (empty for null).
+inline std::string jstring_to_std(JNIEnv* env, jstring str) {
+    if (str == nullptr) {
+        return std::string();
+    }
+    const char* chars = env->GetStringUTFChars(str, nullptr);
+    std::string result(chars);
+    env->ReleaseStringUTFChars(str, chars);
+    return result;
+}
+
+// Count tokens in `text` with the loaded model's vocab.
+// Returns -1 when no model is loaded.
+int llama_jni_count_tokens(const std::string& text);
+
+// Score (query, passage) pairs with the loaded reranker (rerank_native.cpp).
+// Pairs left unscored when `time_budget_ms` runs out are NaN.
+// Returns the number of pairs scored, or -1 when no reranker is loaded.
+int llama_jni_rerank(const std::string& query,
+                     const std::vector<std::string>& passages,
+                     std::vector<float>& scores,
+                     int time_budget_ms);
+
+// Free the reranker's context but keep its model; the next rerank
+// recreates it. Returns false if there was none or a rerank is running.
+bool llama_jni_release_reranker_context();
+
+// Free the reranker and evict its model, waiting for a running rerank.
+void llama_jni_unload_reranker();
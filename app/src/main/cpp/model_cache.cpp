@@ -0,0 +1,315 @@
+/**
+ * Resident llama_model cache with LRU eviction under a RAM budget, and its
+ * JNI surface on LlamaCppEngine.
+ *
+ * Loads run outside the cache lock (serialized by their own mutex) so
+ * lookups, releases and stats never wait on a multi-second load.
+ */
+
+#include "model_cache.h"
+
+#include <jni.h>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gguf_meta.h"
+#include "trace.h"
+
+#define LOG_TAG "LlamaModelCache"
+#include "llama_jni.h"
+
+namespace {
+
+struct CacheEntry {
+    std::string path;
+    std::shared_ptr<llama_model> model;
+    uint64_t bytes = 0;
+    int refs = 0;
+    bool pinned = false;
+    uint64_t last_used = 0;
+};
+
+std::mutex g_cache_mutex;
+std::mutex g_load_mutex;
+std::unordered_map<ModelHandle, CacheEntry> g_entries;
+ModelHandle g_next_handle = 1;
+uint64_t g_clock = 0;
+uint64_t g_budget_bytes = 0;
+uint64_t g_resident_bytes = 0;
+uint64_t g_hits = 0;
+uint64_t g_misses = 0;
+uint64_t g_evictions = 0;
+
+uint64_t default_budget() {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) {
+        return 2ull << 30;
+    }
+    return (uint64_t)pages * (uint64_t)page_size / 2;
+}
+
+uint64_t budget() {
+    if (g_budget_bytes == 0) {
+        g_budget_bytes = default_budget();
+    }
+    return g_budget_bytes;
+}
+
+// Size to make room for before loading: the GGUF tensor data, else the file
+uint64_t estimate_model_bytes(const std::string& path) {
+    GgufInfo info;
+    std::string error;
+    if (gguf_read_info(path.c_str(), info, error)) {
+        return info.weights_bytes();
+    }
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// Caller holds g_cache_mutex
+ModelHandle find_by_path(const std::string& path) {
+    for (const auto& [handle, entry] : g_entries) {
+        if (entry.path == path) return handle;
+    }
+    return 0;
+}
+
+// Caller holds g_cache_mutex
+void evict(std::unordered_map<ModelHandle, CacheEntry>::iterator it) {
+    LOGI("Evicting %s (%llu MB)", it->second.path.c_str(),
+         (unsigned long long)(it->second.bytes >> 20));
+    g_resident_bytes -= it->second.bytes;
+    g_evictions++;
+    g_entries.erase(it);
+}
+
+// Caller holds g_cache_mutex
+uint64_t evict_until(uint64_t limit) {
+    uint64_t freed = 0;
+    while (g_resident_bytes > limit) {
+        auto victim = g_entries.end();
+        for (auto it = g_entries.begin(); it != g_entries.end(); ++it) {
+            if (it->second.refs > 0 || it->second.pinned) continue;
+            if (victim == g_entries.end() || it->second.last_used < victim->second.last_used) {
+                victim = it;
+            }
+        }
+        if (victim == g_entries.end()) {
+            break;
+        }
+        freed += victim->second.bytes;
+        evict(victim);
+    }
+    return freed;
+}
+
+// Caller holds g_cache_mutex
+ModelHandle take_hit(ModelHandle handle) {
+    CacheEntry& entry = g_entries[handle];
+    entry.refs++;
+    entry.last_used = ++g_clock;
+    g_hits++;
+    return handle;
+}
+
+} // namespace
+
+ModelHandle model_cache_acquire(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(g_cache_mutex);
+        if (ModelHandle handle = find_by_path(path)) {
+            return take_hit(handle);
+        }
+    }
+
+    // One load at a time; a concurrent acquire of the same path finds the
+    // model once the first load finishes
+    std::lock_guard<std::mutex> load_lock(g_load_mutex);
+    uint64_t needed = estimate_model_bytes(path);
+    {
+        std::lock_guard<std::mutex> lock(g_cache_mutex);
+        if (ModelHandle handle = find_by_path(path)) {
+            return take_hit(handle);
+        }
+        uint64_t limit = budget();
+        evict_until(limit > needed ? limit - needed : 0);
+        g_misses++;
+    }
+
+    int64_t start = (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    llama_model* model = llama_model_load_from_file(path.c_str(), llama_model_default_params());
+    if (!model) {
+        LOGE("Failed to load %s", path.c_str());
+        return 0;
+    }
+    int64_t elapsed = (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count() - start;
+
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    ModelHandle handle = g_next_handle++;
+    CacheEntry& entry = g_entries[handle];
+    entry.path = path;
+    entry.model = std::shared_ptr<llama_model>(model, llama_model_free);
+    entry.bytes = llama_model_size(model);
+    entry.refs = 1;
+    entry.last_used = ++g_clock;
+    g_resident_bytes += entry.bytes;
+
+    evict_until(budget());
+    if (g_resident_bytes > budget()) {
+        LOGW("Model cache over budget: %llu/%llu MB (all resident models in use or pinned)",
+             (unsigned long long)(g_resident_bytes >> 20), (unsigned long long)(budget() >> 20));
+    }
+
+    LOGI("Loaded %s as handle %lld in %lld ms (%llu MB, %zu models resident)",
+         path.c_str(), (long long)handle, (long long)elapsed,
+         (unsigned long long)(entry.bytes >> 20), g_entries.size());
+    return handle;
+}
+
+bool model_cache_retain(ModelHandle handle) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    if (g_entries.find(handle) == g_entries.end()) {
+        return false;
+    }
+    take_hit(handle);
+    return true;
+}
+
+void model_cache_release(ModelHandle handle, bool evict_if_unused) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    auto it = g_entries.find(handle);
+    if (it == g_entries.end()) {
+        return;
+    }
+    if (it->second.refs > 0) {
+        it->second.refs--;
+    }
+    if (it->second.refs == 0 && !it->second.pinned && evict_if_unused) {
+        evict(it);
+        return;
+    }
+    evict_until(budget());
+}
+
+std::shared_ptr<llama_model> model_cache_get(ModelHandle handle) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    auto it = g_entries.find(handle);
+    if (it == g_entries.end()) {
+        return nullptr;
+    }
+    it->second.last_used = ++g_clock;
+    return it->second.model;
+}
+
+std::string model_cache_path(ModelHandle handle) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    auto it = g_entries.find(handle);
+    return it != g_entries.end() ? it->second.path : std::string();
+}
+
+bool model_cache_pin(ModelHandle handle, bool pinned) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    auto it = g_entries.find(handle);
+    if (it == g_entries.end()) {
+        return false;
+    }
+    it->second.pinned = pinned;
+    if (!pinned) {
+        evict_until(budget());
+    }
+    return true;
+}
+
+void model_cache_set_budget(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    g_budget_bytes = bytes > 0 ? bytes : default_budget();
+    evict_until(g_budget_bytes);
+    LOGI("Model cache budget: %llu MB", (unsigned long long)(g_budget_bytes >> 20));
+}
+
+uint64_t model_cache_trim(uint64_t target_bytes) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    return evict_until(target_bytes);
+}
+
+size_t model_cache_clear() {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    for (auto it = g_entries.begin(); it != g_entries.end();) {
+        if (it->second.refs > 0) {
+            ++it;
+            continue;
+        }
+        g_resident_bytes -= it->second.bytes;
+        it = g_entries.erase(it);
+    }
+    return g_entries.size();
+}
+
+ModelCacheStats model_cache_stats() {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    ModelCacheStats stats;
+    stats.n_models = g_entries.size();
+    stats.resident_bytes = g_resident_bytes;
+    stats.budget_bytes = budget();
+    stats.hits = g_hits;
+    stats.misses = g_misses;
+    stats.evictions = g_evictions;
+    return stats;
+}
+
+extern "C" {
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeAcquireModel(
+    JNIEnv* env, jobject thiz, jstring model_path) {
+
+    TRACE_SCOPE("nativeAcquireModel");
+    return (jlong)model_cache_acquire(jstring_to_std(env, model_path));
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeReleaseModel(
+    JNIEnv* env, jobject thiz, jlong handle) {
+
+    TRACE_SCOPE("nativeReleaseModel");
+    model_cache_release((ModelHandle)handle);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativePinModel(
+    JNIEnv* env, jobject thiz, jlong handle, jboolean pinned) {
+
+    TRACE_SCOPE("nativePinModel");
+    return model_cache_pin((ModelHandle)handle, pinned);
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSetModelCacheBudget(
+    JNIEnv* env, jobject thiz, jlong bytes) {
+
+    TRACE_SCOPE("nativeSetModelCacheBudget");
+    model_cache_set_budget(bytes > 0 ? (uint64_t)bytes : 0);
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGetModelCacheStats(
+    JNIEnv* env, jobject thiz) {
+
+    TRACE_SCOPE("nativeGetModelCacheStats");
+    ModelCacheStats stats = model_cache_stats();
+    jlong values[6] = {
+        (jlong)stats.n_models, (jlong)stats.resident_bytes, (jlong)stats.budget_bytes,
+        (jlong)stats.hits, (jlong)stats.misses, (jlong)stats.evictions,
+    };
+    jlongArray result = env->NewLongArray(6);
+    env->SetLongArrayRegion(result, 0, 6, values);
+    return result;
+}
+
+} // extern "C"
@@ -0,0 +1,63 @@
+/**
+ * Resident llama_model cache shared by the chat engine and the reranker.
+ *
+ * Models are addressed by handle. Each acquire takes a reference; models
+ * that are unreferenced and unpinned stay resident until the RAM budget
+ * needs their space, then go least recently used first. Switching back to
+ * a cached model costs a lookup instead of a multi-second load.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "llama.h"
+
+// 0 is never a valid handle
+using ModelHandle = int64_t;
+
+struct ModelCacheStats {
+    uint64_t n_models = 0;
+    uint64_t resident_bytes = 0;
+    uint64_t budget_bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+// Return the cached model for `path`, loading it (and evicting others to
+// make room) if needed. Takes one reference. Returns 0 if loading failed.
+ModelHandle model_cache_acquire(const std::string& path);
+
+// Take another reference on an already cached model. False if unknown.
+bool model_cache_retain(ModelHandle handle);
+
+// Drop a reference. With `evict_if_unused` the model is freed right away
+// when nothing else references or pins it, instead of staying cached.
+void model_cache_release(ModelHandle handle, bool evict_if_unused = false);
+
+// Owning pointer to the model. It stays valid after eviction until the
+// last holder drops it. Empty if the handle is unknown.
+std::shared_ptr<llama_model> model_cache_get(ModelHandle handle);
+
+// File the model was loaded from, empty if the handle is unknown.
+std::string model_cache_path(ModelHandle handle);
+
+// Pinned models are never evicted. False if the handle is unknown.
+bool model_cache_pin(ModelHandle handle, bool pinned);
+
+// Change the budget (0 = half of physical RAM) and evict down to it.
+void model_cache_set_budget(uint64_t bytes);
+
+// Evict unreferenced, unpinned models, LRU first, until resident bytes are
+// at most `target_bytes`. Returns the bytes released.
+uint64_t model_cache_trim(uint64_t target_bytes);
+
+// Drop every model nothing references (engine shutdown). Referenced models
+// keep their handles; they are freed by their last release. Returns the
+// number of models kept.
+size_t model_cache_clear();
+
+ModelCacheStats model_cache_stats();
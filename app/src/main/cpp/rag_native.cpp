@@ -0,0 +1,525 @@
+/**
+ * Native hybrid retrieval for LocalRagStore
+ *
+ * Keeps a BM25 term index (and optional dense vectors) per RAG index and
+ * answers a query in a single JNI call: BM25 and vector search run on
+ * separate threads, results are fused with reciprocal-rank fusion (or a
+ * weighted score blend), deduplicated by document ID, and packed into a
+ * context string that fits the caller's token budget as measured by the
+ * loaded model's tokenizer. When a reranker is loaded the fused candidates
+ * can be rescored by the cross-encoder before packing.
+ */
+
+#include <jni.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "trace.h"
+
+#define LOG_TAG "LlamaRagJNI"
+#include "llama_jni.h"
+
+namespace {
+
+// BM25 parameters (must match LocalRagStore)
+constexpr double BM25_K1 = 1.2;
+constexpr double BM25_B = 0.75;
+
+// Standard RRF damping constant
+constexpr double RRF_K = 60.0;
+
+// Each retriever contributes this many candidates to the fusion
+constexpr int CANDIDATE_MULTIPLIER = 4;
+
+// Don't bother packing a truncated document smaller than this
+constexpr int MIN_TRUNCATED_TOKENS = 32;
+
+constexpr const char* DOC_SEPARATOR = "\n\n---\n\n";
+
+enum FusionMode {
+    FUSION_RRF = 0,
+    FUSION_WEIGHTED = 1,
+};
+
+// Same list as LocalRagStore.STOPWORDS
+const std::unordered_set<std::string> STOPWORDS = {
+    "the", "be", "to", "of", "and", "a", "in", "that", "have", "i",
+    "it", "for", "not", "on", "with", "he", "as", "you", "do", "at",
+    "this", "but", "his", "by", "from", "they", "we", "say", "her",
+    "she", "or", "an", "will", "my", "one", "all", "would", "there",
+    "their", "what", "so", "up", "out", "if", "about", "who", "get",
+    "which", "go", "me", "when", "make", "can", "like", "time", "no",
+    "just", "him", "know", "take", "people", "into", "year", "your",
+    "good", "some", "could", "them", "see", "other", "than", "then",
+    "now", "look", "only", "come", "its", "over", "think", "also",
+    "back", "after", "use", "two", "how", "our", "work", "first",
+    "well", "way", "even", "new", "want", "because", "any", "these",
+    "give", "day", "most", "us", "is", "are", "was", "were", "been",
+    "has", "had", "did", "does", "doing", "am",
+};
+
+struct RagDoc {
+    std::string id;
+    std::string content;
+    std::unordered_map<std::string, int> term_freqs;
+    int length = 0;
+};
+
+struct RagIndex {
+    std::vector<RagDoc> docs;
+    std::unordered_map<std::string, int> doc_freqs;
+    double avg_doc_length = 0.0;
+
+    // Row-major, L2-normalized; empty when the index has no embeddings
+    std::vector<float> embeddings;
+    int dim = 0;
+};
+
+struct Hit {
+    int doc;
+    double score;
+};
+
+std::mutex g_rag_mutex;
+std::unordered_map<std::string, std::shared_ptr<const RagIndex>> g_rag_indexes;
+
+bool ends_with(const std::string& s, const char* suffix) {
+    size_t n = std::char_traits<char>::length(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// Port of LocalRagStore.stemWord
+std::string stem_word(std::string w) {
+    size_t n = w.size();
+    if (ends_with(w, "ing") && n > 5) {
+        w.resize(n - 3);
+    } else if (ends_with(w, "ed") && n > 4) {
+        w.resize(n - 2);
+    } else if (ends_with(w, "ly") && n > 4) {
+        w.resize(n - 2);
+    } else if (ends_with(w, "tion") && n > 5) {
+        w.resize(n - 4);
+        w += 't';
+    } else if ((ends_with(w, "ness") || ends_with(w, "ment") ||
+                ends_with(w, "able") || ends_with(w, "ible")) && n > 5) {
+        w.resize(n - 4);
+    } else if (ends_with(w, "ies") && n > 4) {
+        w.resize(n - 3);
+        w += 'y';
+    } else if (ends_with(w, "es") && n > 4) {
+        w.resize(n - 2);
+    } else if (ends_with(w, "s") && n > 3 && !ends_with(w, "ss")) {
+        w.resize(n - 1);
+    }
+    return w;
+}
+
+// Port of LocalRagStore.tokenize
+std::vector<std::string> tokenize_terms(const std::string& text) {
+    std::vector<std::string> terms;
+    std::string cur;
+
+    auto flush = [&]() {
+        if (cur.size() > 2 && STOPWORDS.find(cur) == STOPWORDS.end()) {
+            terms.push_back(stem_word(cur));
+        }
+        cur.clear();
+    };
+
+    for (unsigned char c : text) {
+        if (c >= 'A' && c <= 'Z') {
+            cur += (char)(c - 'A' + 'a');
+        } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '\'') {
+            cur += (char)c;
+        } else {
+            flush();
+        }
+    }
+    flush();
+    return terms;
+}
+
+void l2_normalize(float* v, int dim) {
+    double norm = 0.0;
+    for (int i = 0; i < dim; i++) {
+        norm += (double)v[i] * v[i];
+    }
+    if (norm <= 0.0) {
+        return;
+    }
+    float inv = (float)(1.0 / std::sqrt(norm));
+    for (int i = 0; i < dim; i++) {
+        v[i] *= inv;
+    }
+}
+
+void keep_top(std::vector<Hit>& hits, int k) {
+    auto by_score = [](const Hit& a, const Hit& b) { return a.score > b.score; };
+    if ((int)hits.size() > k) {
+        std::partial_sort(hits.begin(), hits.begin() + k, hits.end(), by_score);
+        hits.resize(k);
+    } else {
+        std::sort(hits.begin(), hits.end(), by_score);
+    }
+}
+
+std::vector<Hit> search_bm25(const RagIndex& index, const std::string& query, int k) {
+    TRACE_SCOPE("rag bm25");
+    std::vector<std::string> terms = tokenize_terms(query);
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+    std::vector<Hit> hits;
+    if (terms.empty() || index.docs.empty()) {
+        return hits;
+    }
+
+    const double num_docs = (double)index.docs.size();
+    std::vector<double> idf(terms.size(), 0.0);
+    for (size_t t = 0; t < terms.size(); t++) {
+        auto it = index.doc_freqs.find(terms[t]);
+        if (it != index.doc_freqs.end()) {
+            double df = it->second;
+            idf[t] = std::log((num_docs - df + 0.5) / (df + 0.5) + 1.0);
+        }
+    }
+
+    for (size_t d = 0; d < index.docs.size(); d++) {
+        const RagDoc& doc = index.docs[d];
+        double length_norm = 1.0 - BM25_B + BM25_B * (doc.length / index.avg_doc_length);
+        double score = 0.0;
+        for (size_t t = 0; t < terms.size(); t++) {
+            if (idf[t] == 0.0) continue;
+            auto it = doc.term_freqs.find(terms[t]);
+            if (it == doc.term_freqs.end()) continue;
+            double tf = it->second;
+            score += idf[t] * (tf * (BM25_K1 + 1)) / (tf + BM25_K1 * length_norm);
+        }
+        if (score > 0.0) {
+            hits.push_back({(int)d, score});
+        }
+    }
+
+    keep_top(hits, k);
+    return hits;
+}
+
+std::vector<Hit> search_vector(const RagIndex& index, const std::vector<float>& query, int k) {
+    std::vector<Hit> hits;
+    if (index.embeddings.empty() || (int)query.size() != index.dim) {
+        return hits;
+    }
+
+    // Query is normalized by the caller, so the dot product is the cosine
+    hits.reserve(index.docs.size());
+    for (size_t d = 0; d < index.docs.size(); d++) {
+        const float* row = index.embeddings.data() + d * index.dim;
+        float dot = 0.0f;
+        for (int i = 0; i < index.dim; i++) {
+            dot += row[i] * query[i];
+        }
+        hits.push_back({(int)d, dot});
+    }
+
+    keep_top(hits, k);
+    return hits;
+}
+
+// Min-max scale scores into [0, 1] so BM25 and cosine can be blended
+void min_max_scale(std::vector<Hit>& hits) {
+    if (hits.empty()) return;
+    double lo = hits.back().score;
+    double hi = hits.front().score;
+    double range = hi - lo;
+    for (Hit& h : hits) {
+        h.score = range > 0.0 ? (h.score - lo) / range : 1.0;
+    }
+}
+
+std::vector<Hit> fuse(const RagIndex& index,
+                      std::vector<Hit> bm25,
+                      std::vector<Hit> dense,
+                      int mode,
+                      float bm25_weight,
+                      int k) {
+    if (mode == FUSION_WEIGHTED) {
+        min_max_scale(bm25);
+        min_max_scale(dense);
+    }
+
+    // Keyed by document ID so duplicate chunks of one document collapse
+    std::unordered_map<std::string, Hit> by_id;
+    auto add = [&](const std::vector<Hit>& hits, double weight) {
+        for (size_t rank = 0; rank < hits.size(); rank++) {
+            const Hit& h = hits[rank];
+            double contrib = (mode == FUSION_WEIGHTED)
+                ? weight * h.score
+                : weight / (RRF_K + rank + 1);
+            auto it = by_id.find(index.docs[h.doc].id);
+            if (it == by_id.end()) {
+                by_id.emplace(index.docs[h.doc].id, Hit{h.doc, contrib});
+            } else {
+                it->second.score += contrib;
+            }
+        }
+    };
+
+    double w = std::min(1.0f, std::max(0.0f, bm25_weight));
+    if (dense.empty()) {
+        w = 1.0;
+    } else if (bm25.empty()) {
+        w = 0.0;
+    }
+    add(bm25, (mode == FUSION_WEIGHTED) ? w : 1.0);
+    add(dense, (mode == FUSION_WEIGHTED) ? 1.0 - w : 1.0);
+
+    std::vector<Hit> fused;
+    fused.reserve(by_id.size());
+    for (auto& entry : by_id) {
+        fused.push_back(entry.second);
+    }
+    keep_top(fused, k);
+    return fused;
+}
+
+// Reorder hits by cross-encoder score; pairs the reranker didn't reach keep
+// their fused order behind the scored ones
+void rerank_hits(const RagIndex& index, const std::string& query,
+                 std::vector<Hit>& hits, int budget_ms) {
+    TRACE_SCOPE("rag rerank", (int32_t)hits.size());
+    std::vector<std::string> passages;
+    passages.reserve(hits.size());
+    for (const Hit& h : hits) {
+        passages.push_back(index.docs[h.doc].content);
+    }
+
+    std::vector<float> scores;
+    if (llama_jni_rerank(query, passages, scores, budget_ms) <= 0) {
+        return;
+    }
+
+    std::vector<Hit> scored;
+    std::vector<Hit> unscored;
+    for (size_t i = 0; i < hits.size(); i++) {
+        if (std::isnan(scores[i])) {
+            unscored.push_back(hits[i]);
+        } else {
+            scored.push_back({hits[i].doc, scores[i]});
+        }
+    }
+    std::stable_sort(scored.begin(), scored.end(),
+                     [](const Hit& a, const Hit& b) { return a.score > b.score; });
+    scored.insert(scored.end(), unscored.begin(), unscored.end());
+    hits.swap(scored);
+}
+
+int count_tokens(const std::string& text) {
+    int n = llama_jni_count_tokens(text);
+    if (n >= 0) return n;
+
+    // No model loaded: ~4 bytes per token is close enough for English
+    return (int)((text.size() + 3) / 4);
+}
+
+// Longest UTF-8-safe prefix of `text` that fits in `budget` tokens
+std::string truncate_to_tokens(const std::string& text, int budget) {
+    size_t lo = 0;
+    size_t hi = text.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        while (mid > lo && mid < text.size() && ((unsigned char)text[mid] & 0xC0) == 0x80) {
+            mid--;
+        }
+        if (mid == lo) break;
+        if (count_tokens(text.substr(0, mid)) <= budget) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return text.substr(0, lo);
+}
+
+std::string pack_context(const RagIndex& index, const std::vector<Hit>& hits, int token_budget) {
+    TRACE_SCOPE("rag pack");
+    std::string packed;
+    int used = 0;
+    const int sep_tokens = count_tokens(DOC_SEPARATOR);
+
+    for (size_t i = 0; i < hits.size(); i++) {
+        char header[64];
+        snprintf(header, sizeof(header), "Document %zu (relevance: %.2f):\n", i + 1, hits[i].score);
+
+        std::string entry = header + index.docs[hits[i].doc].content;
+        int overhead = packed.empty() ? 0 : sep_tokens;
+        int entry_tokens = count_tokens(entry);
+
+        if (token_budget > 0 && used + overhead + entry_tokens > token_budget) {
+            int remaining = token_budget - used - overhead;
+            if (remaining >= MIN_TRUNCATED_TOKENS) {
+                if (!packed.empty()) packed += DOC_SEPARATOR;
+                packed += truncate_to_tokens(entry, remaining);
+            }
+            break;
+        }
+
+        if (!packed.empty()) packed += DOC_SEPARATOR;
+        packed += entry;
+        used += overhead + entry_tokens;
+    }
+    return packed;
+}
+
+} // namespace
+
+extern "C" {
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_rag_LocalRagStore_00024Companion_nativeCreateIndex(
+    JNIEnv* env, jobject thiz, jstring index_id, jobjectArray doc_ids,
+    jobjectArray contents, jfloatArray embeddings, jint dim) {
+
+    TRACE_SCOPE("nativeCreateIndex");
+    jsize n_docs = env->GetArrayLength(doc_ids);
+    if (env->GetArrayLength(contents) != n_docs) {
+        LOGE("Document ID/content count mismatch");
+        return -1;
+    }
+
+    auto index = std::make_shared<RagIndex>();
+    index->docs.resize(n_docs);
+
+    long total_length = 0;
+    for (jsize i = 0; i < n_docs; i++) {
+        RagDoc& doc = index->docs[i];
+
+        jstring id = (jstring)env->GetObjectArrayElement(doc_ids, i);
+        jstring content = (jstring)env->GetObjectArrayElement(contents, i);
+        doc.id = jstring_to_std(env, id);
+        doc.content = jstring_to_std(env, content);
+        env->DeleteLocalRef(id);
+        env->DeleteLocalRef(content);
+
+        std::vector<std::string> terms = tokenize_terms(doc.content);
+        doc.length = (int)terms.size();
+        total_length += doc.length;
+        for (const std::string& term : terms) {
+            doc.term_freqs[term]++;
+        }
+        for (const auto& entry : doc.term_freqs) {
+            index->doc_freqs[entry.first]++;
+        }
+    }
+
+    if (n_docs > 0) {
+        index->avg_doc_length = (double)total_length / n_docs;
+    }
+
+    if (embeddings != nullptr && dim > 0) {
+        jsize n_floats = env->GetArrayLength(embeddings);
+        if (n_floats != (jsize)(n_docs * dim)) {
+            LOGE("Embedding size mismatch: %d floats for %d docs x %d dims", n_floats, n_docs, dim);
+            return -2;
+        }
+        index->dim = dim;
+        index->embeddings.resize(n_floats);
+        env->GetFloatArrayRegion(embeddings, 0, n_floats, index->embeddings.data());
+        for (jsize i = 0; i < n_docs; i++) {
+            l2_normalize(index->embeddings.data() + (size_t)i * dim, dim);
+        }
+    }
+
+    std::string id = jstring_to_std(env, index_id);
+    {
+        std::lock_guard<std::mutex> lock(g_rag_mutex);
+        g_rag_indexes[id] = index;
+    }
+
+    LOGI("RAG index '%s' created: %d docs, %zu terms, dim %d",
+         id.c_str(), n_docs, index->doc_freqs.size(), index->dim);
+    return 0;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_rag_LocalRagStore_00024Companion_nativeDeleteIndex(
+    JNIEnv* env, jobject thiz, jstring index_id) {
+
+    TRACE_SCOPE("nativeDeleteIndex");
+    std::string id = jstring_to_std(env, index_id);
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+    g_rag_indexes.erase(id);
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_llamafarm_atmosphere_rag_LocalRagStore_00024Companion_nativeQueryForContext(
+    JNIEnv* env, jobject thiz, jstring index_id, jstring query, jfloatArray query_embedding,
+    jint top_k, jint fusion_mode, jfloat bm25_weight, jint token_budget, jint rerank_budget_ms) {
+
+    TRACE_SCOPE("nativeQueryForContext");
+    std::string id = jstring_to_std(env, index_id);
+    std::shared_ptr<const RagIndex> index;
+    {
+        std::lock_guard<std::mutex> lock(g_rag_mutex);
+        auto it = g_rag_indexes.find(id);
+        if (it != g_rag_indexes.end()) {
+            index = it->second;
+        }
+    }
+    if (!index) {
+        LOGE("RAG index not found: %s", id.c_str());
+        return nullptr;
+    }
+
+    std::string query_text = jstring_to_std(env, query);
+    std::vector<float> query_vec;
+    if (query_embedding != nullptr) {
+        query_vec.resize(env->GetArrayLength(query_embedding));
+        env->GetFloatArrayRegion(query_embedding, 0, (jsize)query_vec.size(), query_vec.data());
+        l2_normalize(query_vec.data(), (int)query_vec.size());
+    }
+
+    const int k = std::max(1, (int)top_k);
+    const int candidates = k * CANDIDATE_MULTIPLIER;
+
+    // Dense search on a worker thread while BM25 runs here
+    std::future<std::vector<Hit>> dense_future;
+    bool run_dense = !index->embeddings.empty() && (int)query_vec.size() == index->dim;
+    if (run_dense) {
+        dense_future = std::async(std::launch::async, [&index, &query_vec, candidates]() {
+            return search_vector(*index, query_vec, candidates);
+        });
+    }
+
+    std::vector<Hit> bm25 = search_bm25(*index, query_text, candidates);
+    std::vector<Hit> dense;
+    if (run_dense) {
+        TRACE_SCOPE("rag dense wait");
+        dense = dense_future.get();
+    }
+
+    // Keep the wider candidate pool when a rerank stage will narrow it down
+    bool rerank = rerank_budget_ms > 0;
+    std::vector<Hit> fused = fuse(*index, std::move(bm25), std::move(dense),
+                                  fusion_mode, bm25_weight, rerank ? candidates : k);
+    if (rerank) {
+        rerank_hits(*index, query_text, fused, rerank_budget_ms);
+        if ((int)fused.size() > k) {
+            fused.resize(k);
+        }
+    }
+
+    std::string packed = pack_context(*index, fused, token_budget);
+    LOGD("RAG query on '%s': %zu results, %zu chars packed", id.c_str(), fused.size(), packed.size());
+
+    return env->NewStringUTF(packed.c_str());
+}
+
+} // extern "C"
@@ -0,0 +1,423 @@
+/**
+ * Parallel ranged download target for ModelTransferService
+ *
+ * The file is preallocated with fallocate and split into fixed-size chunks.
+ * Workers fetch chunks concurrently (one HTTP range each) and hand the bytes
+ * to this module, which pwrites them at their offsets and hashes each chunk
+ * as it streams in. Completed chunks are recorded in a sidecar bitmap
+ * (<file>.ranges) together with their SHA-256, so an interrupted transfer
+ * resumes with only the missing chunks. A whole-file SHA-256 follows the
+ * contiguous completed prefix, reading back chunks that are still in the
+ * page cache, so it is ready as soon as the last chunk lands.
+ */
+
+#include <jni.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sha256.h"
+
+#define LOG_TAG "LlamaRangeFileJNI"
+#include "llama_jni.h"
+
+namespace {
+
+constexpr char RANGES_MAGIC[8] = {'A', 'T', 'M', 'R', 'N', 'G', '1', '\0'};
+constexpr size_t READBACK_BUFFER = 1u << 20;
+
+struct RangesHeader {
+    char magic[8];
+    uint64_t total_bytes;
+    uint32_t chunk_size;
+    uint32_t n_chunks;
+};
+
+struct Chunk {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    uint32_t written = 0;
+    bool done = false;
+    std::unique_ptr<Sha256> hasher;
+    uint8_t digest[Sha256::DIGEST_SIZE] = {};
+};
+
+struct RangeFile {
+    std::string path;
+    std::string ranges_path;
+    int fd = -1;
+    int ranges_fd = -1;
+    uint64_t total_bytes = 0;
+    uint32_t chunk_size = 0;
+    std::vector<Chunk> chunks;
+
+    // Guards chunk done flags, the sidecar, and writes to Chunk::written
+    // (its owning worker may read it without the lock)
+    std::mutex state_mutex;
+
+    // Whole-file hash over the contiguous completed prefix
+    std::mutex frontier_mutex;
+    Sha256 file_hasher;
+    size_t frontier = 0;
+
+    ~RangeFile() {
+        if (fd >= 0) close(fd);
+        if (ranges_fd >= 0) close(ranges_fd);
+    }
+};
+
+bool pwrite_all(int fd, const uint8_t* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+bool pread_all(int fd, uint8_t* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, data, len, (off_t)offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+size_t bitmap_bytes(size_t n_chunks) {
+    return (n_chunks + 7) / 8;
+}
+
+// Persist header + bitmap + chunk digests (caller holds state_mutex)
+bool save_ranges(RangeFile& rf) {
+    const size_t n = rf.chunks.size();
+    std::vector<uint8_t> buf(sizeof(RangesHeader) + bitmap_bytes(n) + n * Sha256::DIGEST_SIZE, 0);
+
+    RangesHeader header;
+    memcpy(header.magic, RANGES_MAGIC, sizeof(RANGES_MAGIC));
+    header.total_bytes = rf.total_bytes;
+    header.chunk_size = rf.chunk_size;
+    header.n_chunks = (uint32_t)n;
+    memcpy(buf.data(), &header, sizeof(header));
+
+    uint8_t* bitmap = buf.data() + sizeof(RangesHeader);
+    uint8_t* digests = bitmap + bitmap_bytes(n);
+    for (size_t i = 0; i < n; i++) {
+        if (rf.chunks[i].done) {
+            bitmap[i / 8] |= (uint8_t)(1u << (i % 8));
+            memcpy(digests + i * Sha256::DIGEST_SIZE, rf.chunks[i].digest, Sha256::DIGEST_SIZE);
+        }
+    }
+
+    return pwrite_all(rf.ranges_fd, buf.data(), buf.size(), 0) && fdatasync(rf.ranges_fd) == 0;
+}
+
+// Restore completed chunks from a sidecar that matches this transfer
+void load_ranges(RangeFile& rf) {
+    RangesHeader header;
+    if (!pread_all(rf.ranges_fd, (uint8_t*)&header, sizeof(header), 0)) {
+        return;
+    }
+    if (memcmp(header.magic, RANGES_MAGIC, sizeof(RANGES_MAGIC)) != 0 ||
+        header.total_bytes != rf.total_bytes ||
+        header.chunk_size != rf.chunk_size ||
+        header.n_chunks != rf.chunks.size()) {
+        LOGW("Ignoring stale range map for %s", rf.path.c_str());
+        return;
+    }
+
+    const size_t n = rf.chunks.size();
+    std::vector<uint8_t> rest(bitmap_bytes(n) + n * Sha256::DIGEST_SIZE);
+    if (!pread_all(rf.ranges_fd, rest.data(), rest.size(), sizeof(header))) {
+        return;
+    }
+
+    const uint8_t* digests = rest.data() + bitmap_bytes(n);
+    size_t restored = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (rest[i / 8] & (1u << (i % 8))) {
+            rf.chunks[i].done = true;
+            rf.chunks[i].written = rf.chunks[i].length;
+            memcpy(rf.chunks[i].digest, digests + i * Sha256::DIGEST_SIZE, Sha256::DIGEST_SIZE);
+            restored++;
+        }
+    }
+    LOGI("Resuming %s: %zu/%zu chunks already present", rf.path.c_str(), restored, n);
+}
+
+// Fold newly contiguous completed chunks into the whole-file hash
+void advance_frontier(RangeFile& rf) {
+    std::lock_guard<std::mutex> lock(rf.frontier_mutex);
+    std::vector<uint8_t> buf;
+
+    while (true) {
+        size_t next;
+        {
+            std::lock_guard<std::mutex> state_lock(rf.state_mutex);
+            if (rf.frontier >= rf.chunks.size() || !rf.chunks[rf.frontier].done) {
+                return;
+            }
+            next = rf.frontier;
+        }
+
+        // Freshly written, so this normally comes straight from the page cache
+        const Chunk& chunk = rf.chunks[next];
+        buf.resize(std::min<size_t>(READBACK_BUFFER, chunk.length));
+        for (uint32_t pos = 0; pos < chunk.length;) {
+            size_t n = std::min<size_t>(buf.size(), chunk.length - pos);
+            if (!pread_all(rf.fd, buf.data(), n, chunk.offset + pos)) {
+                LOGE("Read-back failed at chunk %zu: %s", next, strerror(errno));
+                return;
+            }
+            rf.file_hasher.update(buf.data(), n);
+            pos += (uint32_t)n;
+        }
+
+        std::lock_guard<std::mutex> state_lock(rf.state_mutex);
+        rf.frontier = next + 1;
+    }
+}
+
+std::string digest_hex(const uint8_t digest[Sha256::DIGEST_SIZE]) {
+    static const char HEX[] = "0123456789abcdef";
+    std::string hex(Sha256::DIGEST_SIZE * 2, '0');
+    for (size_t i = 0; i < Sha256::DIGEST_SIZE; i++) {
+        hex[i * 2] = HEX[digest[i] >> 4];
+        hex[i * 2 + 1] = HEX[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+RangeFile* from_handle(jlong handle) {
+    return (RangeFile*)(intptr_t)handle;
+}
+
+} // namespace
+
+extern "C" {
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeOpen(
+    JNIEnv* env, jobject thiz, jstring path, jlong total_bytes, jint chunk_size) {
+
+    if (total_bytes <= 0 || chunk_size <= 0) {
+        return 0;
+    }
+
+    auto rf = std::make_unique<RangeFile>();
+    rf->path = jstring_to_std(env, path);
+    rf->ranges_path = rf->path + ".ranges";
+    rf->total_bytes = (uint64_t)total_bytes;
+    rf->chunk_size = (uint32_t)chunk_size;
+
+    rf->fd = open(rf->path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    rf->ranges_fd = open(rf->ranges_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (rf->fd < 0 || rf->ranges_fd < 0) {
+        LOGE("Failed to open %s: %s", rf->path.c_str(), strerror(errno));
+        return 0;
+    }
+
+    // Reserve the blocks up front: no fragmentation, and ENOSPC now rather
+    // than halfway through a multi-GB transfer
+    int err = posix_fallocate(rf->fd, 0, (off_t)total_bytes);
+    if (err != 0) {
+        if (err == ENOSPC) {
+            LOGE("Not enough space for %lld bytes", (long long)total_bytes);
+            return 0;
+        }
+        // Filesystem without fallocate support: fall back to a sparse file
+        if (ftruncate(rf->fd, (off_t)total_bytes) != 0) {
+            LOGE("Failed to size %s: %s", rf->path.c_str(), strerror(errno));
+            return 0;
+        }
+    }
+
+    size_t n_chunks = (size_t)((rf->total_bytes + rf->chunk_size - 1) / rf->chunk_size);
+    rf->chunks.resize(n_chunks);
+    for (size_t i = 0; i < n_chunks; i++) {
+        Chunk& c = rf->chunks[i];
+        c.offset = (uint64_t)i * rf->chunk_size;
+        c.length = (uint32_t)std::min<uint64_t>(rf->chunk_size, rf->total_bytes - c.offset);
+    }
+
+    load_ranges(*rf);
+    advance_frontier(*rf);
+
+    LOGI("Opened %s for ranged download: %zu chunks of %d bytes",
+         rf->path.c_str(), n_chunks, chunk_size);
+    return (jlong)(intptr_t)rf.release();
+}
+
+JNIEXPORT jintArray JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeMissingChunks(
+    JNIEnv* env, jobject thiz, jlong handle) {
+
+    RangeFile* rf = from_handle(handle);
+    std::vector<jint> missing;
+    {
+        std::lock_guard<std::mutex> lock(rf->state_mutex);
+        for (size_t i = 0; i < rf->chunks.size(); i++) {
+            if (!rf->chunks[i].done) missing.push_back((jint)i);
+        }
+    }
+
+    jintArray result = env->NewIntArray((jsize)missing.size());
+    env->SetIntArrayRegion(result, 0, (jsize)missing.size(), missing.data());
+    return result;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeChunkOffset(
+    JNIEnv* env, jobject thiz, jlong handle, jint chunk) {
+
+    return (jlong)from_handle(handle)->chunks[chunk].offset;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeChunkLength(
+    JNIEnv* env, jobject thiz, jlong handle, jint chunk) {
+
+    return (jint)from_handle(handle)->chunks[chunk].length;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeBeginChunk(
+    JNIEnv* env, jobject thiz, jlong handle, jint chunk) {
+
+    // Each chunk is owned by one worker at a time; only `written` is also
+    // read by others (nativeBytesDone)
+    RangeFile* rf = from_handle(handle);
+    Chunk& c = rf->chunks[chunk];
+    c.hasher = std::make_unique<Sha256>();
+    std::lock_guard<std::mutex> lock(rf->state_mutex);
+    c.written = 0;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeWrite(
+    JNIEnv* env, jobject thiz, jlong handle, jint chunk, jobject buffer, jint length) {
+
+    RangeFile* rf = from_handle(handle);
+    Chunk& c = rf->chunks[chunk];
+    if (!c.hasher || c.written + (uint32_t)length > c.length) {
+        LOGE("Write past end of chunk %d (%u + %d > %u)", chunk, c.written, length, c.length);
+        return -1;
+    }
+
+    // Direct ByteBuffer: written straight from the network buffer, no copy
+    auto* data = (const uint8_t*)env->GetDirectBufferAddress(buffer);
+    if (!pwrite_all(rf->fd, data, (size_t)length, c.offset + c.written)) {
+        LOGE("pwrite failed at chunk %d: %s", chunk, strerror(errno));
+        return -2;
+    }
+    c.hasher->update(data, (size_t)length);
+    std::lock_guard<std::mutex> lock(rf->state_mutex);
+    c.written += (uint32_t)length;
+    return 0;
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeCompleteChunk(
+    JNIEnv* env, jobject thiz, jlong handle, jint chunk) {
+
+    RangeFile* rf = from_handle(handle);
+    Chunk& c = rf->chunks[chunk];
+    if (!c.hasher || c.written != c.length) {
+        LOGE("Chunk %d incomplete (%u/%u bytes)", chunk, c.written, c.length);
+        return nullptr;
+    }
+
+    c.hasher->finish(c.digest);
+    c.hasher.reset();
+
+    // Data must be durable before the bitmap says it's there
+    if (fdatasync(rf->fd) != 0) {
+        LOGE("fdatasync failed: %s", strerror(errno));
+        return nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(rf->state_mutex);
+        c.done = true;
+        if (!save_ranges(*rf)) {
+            LOGW("Failed to persist range map: %s", strerror(errno));
+        }
+    }
+
+    advance_frontier(*rf);
+    return env->NewStringUTF(digest_hex(c.digest).c_str());
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeChunkHashes(
+    JNIEnv* env, jobject thiz, jlong handle) {
+
+    RangeFile* rf = from_handle(handle);
+    std::lock_guard<std::mutex> lock(rf->state_mutex);
+
+    jclass string_class = env->FindClass("java/lang/String");
+    jobjectArray result = env->NewObjectArray((jsize)rf->chunks.size(), string_class, nullptr);
+    for (size_t i = 0; i < rf->chunks.size(); i++) {
+        if (!rf->chunks[i].done) continue;
+        jstring hex = env->NewStringUTF(digest_hex(rf->chunks[i].digest).c_str());
+        env->SetObjectArrayElement(result, (jsize)i, hex);
+        env->DeleteLocalRef(hex);
+    }
+    return result;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeBytesDone(
+    JNIEnv* env, jobject thiz, jlong handle) {
+
+    RangeFile* rf = from_handle(handle);
+    std::lock_guard<std::mutex> lock(rf->state_mutex);
+    uint64_t done = 0;
+    for (const Chunk& c : rf->chunks) {
+        done += c.done ? c.length : c.written;
+    }
+    return (jlong)done;
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeFinish(
+    JNIEnv* env, jobject thiz, jlong handle) {
+
+    RangeFile* rf = from_handle(handle);
+    advance_frontier(*rf);
+
+    std::lock_guard<std::mutex> lock(rf->frontier_mutex);
+    if (rf->frontier != rf->chunks.size()) {
+        LOGE("Finish with %zu/%zu chunks hashed", rf->frontier, rf->chunks.size());
+        return nullptr;
+    }
+
+    std::string hex = rf->file_hasher.finish_hex();
+    unlink(rf->ranges_path.c_str());
+    return env->NewStringUTF(hex.c_str());
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_mesh_RangeFileWriter_00024Companion_nativeClose(
+    JNIEnv* env, jobject thiz, jlong handle) {
+
+    delete from_handle(handle);
+}
+
+} // extern "C"
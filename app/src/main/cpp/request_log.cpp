@@ -0,0 +1,347 @@
+/**
+ * Request log writer and reader. See request_log.h for the format.
+ *
+ * A generation is buffered until it ends and written as one record, so a
+ * log only ever holds complete records (short of a crash mid-write, which
+ * the reader reports as truncation after the last good record).
+ */
+
+#include "request_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#define LOG_TAG "LlamaRequestLog"
+#include "llama_jni.h"
+
+namespace {
+
+const char MAGIC[4] = {'L', 'J', 'R', 'L'};
+constexpr uint8_t VERSION = 1;
+
+std::mutex g_log_mutex;
+FILE* g_log = nullptr;
+std::atomic<bool> g_log_active{false};
+std::chrono::steady_clock::time_point g_log_opened;
+bool g_generation_open = false;
+LoggedGeneration g_generation;
+int64_t g_generation_at_us = 0;
+uint64_t g_records = 0;
+
+int64_t elapsed_us() {
+    return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - g_log_opened).count();
+}
+
+class Encoder {
+public:
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            buf_ += (char)((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        buf_ += (char)value;
+    }
+
+    void string(const std::string& value) {
+        varint(value.size());
+        buf_ += value;
+    }
+
+    const std::string& data() const { return buf_; }
+
+private:
+    std::string buf_;
+};
+
+class Decoder {
+public:
+    Decoder(const char* data, size_t size) : p_(data), end_(data + size) {}
+
+    bool varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p_ >= end_) return false;
+            uint8_t byte = (uint8_t)*p_++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (byte < 0x80) return true;
+        }
+        return false;
+    }
+
+    template <typename T>
+    bool number(T& value) {
+        uint64_t v;
+        if (!varint(v)) return false;
+        value = (T)v;
+        return true;
+    }
+
+    bool string(std::string& value) {
+        uint64_t size;
+        if (!varint(size) || size > (uint64_t)(end_ - p_)) return false;
+        value.assign(p_, size);
+        p_ += size;
+        return true;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+// Caller holds g_log_mutex
+void write_record(RequestLogType type, int64_t at_us, const Encoder& payload) {
+    Encoder stamp;
+    stamp.varint((uint64_t)std::max<int64_t>(at_us, 0));
+    // The length covers the timestamp too
+    Encoder record;
+    record.varint(type);
+    record.varint(stamp.data().size() + payload.data().size());
+    fwrite(record.data().data(), 1, record.data().size(), g_log);
+    fwrite(stamp.data().data(), 1, stamp.data().size(), g_log);
+    fwrite(payload.data().data(), 1, payload.data().size(), g_log);
+    fflush(g_log);
+    g_records++;
+}
+
+// Caller holds g_log_mutex
+void flush_generation(GenerationEnd end) {
+    if (!g_generation_open) return;
+    g_generation_open = false;
+    const LoggedGeneration& g = g_generation;
+    Encoder payload;
+    payload.string(g.prompt);
+    payload.string(g.grammar);
+    payload.varint((uint64_t)g.max_tokens);
+    payload.varint(g.seed);
+    payload.varint((uint64_t)g.n_prompt_tokens);
+    payload.varint((uint64_t)g.prefill_us);
+    payload.varint(end);
+    payload.varint(g.tokens.size());
+    for (int32_t token : g.tokens) payload.varint((uint32_t)token);
+    for (int32_t us : g.token_us) payload.varint((uint32_t)us);
+    write_record(REQUEST_LOG_GENERATION, g_generation_at_us, payload);
+}
+
+uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float bits_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+bool parse_record(uint8_t type, Decoder& in, LoggedRequest& request) {
+    request.type = (RequestLogType)type;
+    if (!in.number(request.at_us)) return false;
+    switch (type) {
+        case REQUEST_LOG_SESSION: {
+            LoggedSession& s = request.session;
+            return in.string(s.model_path) && in.number(s.n_ctx) && in.number(s.n_threads) &&
+                   in.number(s.seed) && in.string(s.cpu_backend);
+        }
+        case REQUEST_LOG_SYSTEM_PROMPT: {
+            LoggedSystemPrompt& p = request.system_prompt;
+            return in.string(p.text) && in.number(p.n_tokens) && in.number(p.n_reused) &&
+                   in.number(p.duration_us);
+        }
+        case REQUEST_LOG_GENERATION: {
+            LoggedGeneration& g = request.generation;
+            uint64_t n_tokens;
+            if (!(in.string(g.prompt) && in.string(g.grammar) && in.number(g.max_tokens) &&
+                  in.number(g.seed) && in.number(g.n_prompt_tokens) && in.number(g.prefill_us) &&
+                  in.number(g.end) && in.varint(n_tokens))) {
+                return false;
+            }
+            g.tokens.resize(n_tokens);
+            g.token_us.resize(n_tokens);
+            for (auto& token : g.tokens) {
+                if (!in.number(token)) return false;
+            }
+            for (auto& us : g.token_us) {
+                if (!in.number(us)) return false;
+            }
+            return true;
+        }
+        case REQUEST_LOG_NBEST: {
+            LoggedNBest& b = request.nbest;
+            uint32_t temperature_bits;
+            uint64_t n;
+            if (!(in.string(b.prompt) && in.number(b.max_tokens) && in.number(temperature_bits) &&
+                  in.number(b.seed) && in.number(b.duration_us) && in.varint(n))) {
+                return false;
+            }
+            b.temperature = bits_float(temperature_bits);
+            b.seeds.resize(n);
+            b.texts.resize(n);
+            for (auto& seed : b.seeds) {
+                if (!in.number(seed)) return false;
+            }
+            for (auto& text : b.texts) {
+                if (!in.string(text)) return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+bool request_log_open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (g_log) {
+        flush_generation(GENERATION_END_STOPPED);
+        fclose(g_log);
+    }
+    g_log = fopen(path.c_str(), "wb");
+    if (!g_log) {
+        LOGE("Cannot open request log %s", path.c_str());
+        g_log_active.store(false);
+        return false;
+    }
+    fwrite(MAGIC, 1, sizeof(MAGIC), g_log);
+    fwrite(&VERSION, 1, 1, g_log);
+    fflush(g_log);
+    g_log_opened = std::chrono::steady_clock::now();
+    g_generation_open = false;
+    g_records = 0;
+    g_log_active.store(true);
+    LOGI("Recording requests to %s", path.c_str());
+    return true;
+}
+
+void request_log_close() {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (!g_log) return;
+    flush_generation(GENERATION_END_STOPPED);
+    fclose(g_log);
+    g_log = nullptr;
+    g_log_active.store(false);
+    LOGI("Request log closed (%llu records)", (unsigned long long)g_records);
+}
+
+bool request_log_active() {
+    return g_log_active.load(std::memory_order_relaxed);
+}
+
+void request_log_session(const LoggedSession& session) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (!g_log) return;
+    flush_generation(GENERATION_END_STOPPED);
+    Encoder payload;
+    payload.string(session.model_path);
+    payload.varint((uint64_t)session.n_ctx);
+    payload.varint((uint64_t)session.n_threads);
+    payload.varint(session.seed);
+    payload.string(session.cpu_backend);
+    write_record(REQUEST_LOG_SESSION, elapsed_us(), payload);
+}
+
+void request_log_system_prompt(const LoggedSystemPrompt& prompt) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (!g_log) return;
+    flush_generation(GENERATION_END_STOPPED);
+    Encoder payload;
+    payload.string(prompt.text);
+    payload.varint((uint64_t)prompt.n_tokens);
+    payload.varint((uint64_t)prompt.n_reused);
+    payload.varint((uint64_t)prompt.duration_us);
+    // Stamped at arrival, like generations
+    write_record(REQUEST_LOG_SYSTEM_PROMPT, elapsed_us() - prompt.duration_us, payload);
+}
+
+void request_log_generation_begin(const LoggedGeneration& generation) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (!g_log) return;
+    flush_generation(GENERATION_END_STOPPED);
+    g_generation = generation;
+    g_generation.tokens.clear();
+    g_generation.token_us.clear();
+    g_generation_at_us = elapsed_us() - generation.prefill_us;
+    g_generation_open = true;
+}
+
+void request_log_token(int32_t token, int64_t step_us) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (!g_generation_open) return;
+    g_generation.tokens.push_back(token);
+    g_generation.token_us.push_back((int32_t)step_us);
+}
+
+void request_log_generation_end(GenerationEnd end) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (!g_log) return;
+    flush_generation(end);
+}
+
+void request_log_nbest(const LoggedNBest& nbest) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (!g_log) return;
+    flush_generation(GENERATION_END_STOPPED);
+    Encoder payload;
+    payload.string(nbest.prompt);
+    payload.varint((uint64_t)nbest.max_tokens);
+    payload.varint(float_bits(nbest.temperature));
+    payload.varint(nbest.seed);
+    payload.varint((uint64_t)nbest.duration_us);
+    payload.varint(nbest.seeds.size());
+    for (uint32_t seed : nbest.seeds) payload.varint(seed);
+    for (const std::string& text : nbest.texts) payload.string(text);
+    // Stamped at arrival, like generations
+    write_record(REQUEST_LOG_NBEST, elapsed_us() - nbest.duration_us, payload);
+}
+
+bool request_log_read(const std::string& path, std::vector<LoggedRequest>& requests, std::string& error) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string data;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.append(chunk, n);
+    }
+    fclose(f);
+
+    if (data.size() < sizeof(MAGIC) + 1 || data.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0) {
+        error = "not a request log";
+        return false;
+    }
+    if ((uint8_t)data[sizeof(MAGIC)] != VERSION) {
+        error = "unsupported request log version " + std::to_string((uint8_t)data[sizeof(MAGIC)]);
+        return false;
+    }
+
+    Decoder in(data.data() + sizeof(MAGIC) + 1, data.size() - sizeof(MAGIC) - 1);
+    uint64_t type;
+    while (in.varint(type)) {
+        std::string payload;
+        if (!in.string(payload)) {
+            error = "truncated after " + std::to_string(requests.size()) + " records";
+            return !requests.empty();
+        }
+        Decoder record(payload.data(), payload.size());
+        LoggedRequest request;
+        if (type < REQUEST_LOG_SESSION || type > REQUEST_LOG_NBEST) {
+            continue;
+        }
+        if (!parse_record((uint8_t)type, record, request)) {
+            error = "malformed record " + std::to_string(requests.size());
+            return false;
+        }
+        requests.push_back(std::move(request));
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+/**
+ * Compact binary log of engine requests, for deterministic replay.
+ *
+ * While a log is open the engine appends one record per model load,
+ * system prompt, generation and n-best request: inputs (prompt, grammar,
+ * max_tokens, sampler seeds), outputs (token ids, n-best texts) and timing
+ * (arrival, prefill, each decode step). llama-jni-replay re-runs a log against any build with the
+ * same seeds and compares the two token-for-token and by latency.
+ *
+ * Layout: "LJRL", a version byte, then records of
+ *   [type varint][payload length varint][payload]
+ * with varint integers and varint-length strings in the payload. Readers
+ * skip record types they don't know.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum RequestLogType : uint8_t {
+    REQUEST_LOG_SESSION = 1,
+    REQUEST_LOG_SYSTEM_PROMPT = 2,
+    REQUEST_LOG_GENERATION = 3,
+    REQUEST_LOG_NBEST = 4,
+};
+
+// How a generation ended
+enum GenerationEnd : uint8_t {
+    GENERATION_END_EOG = 0,        // end-of-generation token
+    GENERATION_END_STOPPED = 1,    // caller stopped asking for tokens (max_tokens, next request)
+    GENERATION_END_CANCELLED = 2,
+    GENERATION_END_ERROR = 3,
+};
+
+// A model was loaded (or the log was opened with one loaded)
+struct LoggedSession {
+    std::string model_path;
+    int32_t n_ctx = 0;
+    int32_t n_threads = 0;
+    uint32_t seed = 0;
+    std::string cpu_backend;
+};
+
+struct LoggedSystemPrompt {
+    std::string text;
+    int32_t n_tokens = 0;
+    int32_t n_reused = 0;          // cells kept from the previous conversation
+    int64_t duration_us = 0;
+};
+
+struct LoggedGeneration {
+    std::string prompt;            // as passed to nativeStartGeneration
+    std::string grammar;           // GBNF, empty if unconstrained
+    int32_t max_tokens = 0;
+    uint32_t seed = 0;
+    int32_t n_prompt_tokens = 0;
+    int64_t prefill_us = 0;
+    std::vector<int32_t> tokens;
+    std::vector<int32_t> token_us; // per decode step, parallel to tokens
+    GenerationEnd end = GENERATION_END_STOPPED;
+};
+
+// nativeGenerateNBest; texts are in the order returned (most likely first)
+struct LoggedNBest {
+    std::string prompt;
+    int32_t max_tokens = 0;
+    float temperature = 0.0f;
+    uint32_t seed = 0;             // engine seed; branches derive theirs from it
+    std::vector<uint32_t> seeds;   // per branch, as sampled
+    std::vector<std::string> texts;
+    int64_t duration_us = 0;
+};
+
+struct LoggedRequest {
+    RequestLogType type = REQUEST_LOG_SESSION;
+    int64_t at_us = 0;             // since the log was opened
+    LoggedSession session;
+    LoggedSystemPrompt system_prompt;
+    LoggedGeneration generation;
+    LoggedNBest nbest;
+};
+
+// Writer. Every call below is a no-op while no log is open.
+bool request_log_open(const std::string& path);
+void request_log_close();
+bool request_log_active();
+
+void request_log_session(const LoggedSession& session);
+void request_log_system_prompt(const LoggedSystemPrompt& prompt);
+
+// Start buffering a generation; an unfinished previous one is written as
+// GENERATION_END_STOPPED first. The record is written at its end.
+void request_log_generation_begin(const LoggedGeneration& generation);
+void request_log_token(int32_t token, int64_t step_us);
+void request_log_generation_end(GenerationEnd end);
+
+void request_log_nbest(const LoggedNBest& nbest);
+
+// Reader. On failure returns false and sets `error`.
+bool request_log_read(const std::string& path, std::vector<LoggedRequest>& requests, std::string& error);
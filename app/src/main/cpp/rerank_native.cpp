@@ -0,0 +1,287 @@
+/**
+ * Cross-encoder reranking for LlamaCppEngine
+ *
+ * Loads a reranker GGUF (e.g. bge-reranker) into its own model/context so it
+ * never contends with the chat model. All (query, passage) pairs of a request
+ * are packed into as few batches as possible, one KV sequence per pair, and
+ * the rank-pooled output of each sequence is its relevance score.
+ */
+
+#include <jni.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "llama.h"
+#include "common.h"
+#include "model_cache.h"
+#include "trace.h"
+
+#define LOG_TAG "LlamaRerankJNI"
+#include "llama_jni.h"
+
+namespace {
+
+constexpr int RERANK_N_CTX = 4096;
+constexpr int RERANK_MAX_SEQ = 32;
+constexpr int RERANK_MAX_QUERY_TOKENS = 64;
+constexpr int RERANK_MAX_PASSAGE_TOKENS = 384;
+constexpr int RERANK_DEFAULT_THREADS = 4;
+
+// Borrowed from the model cache while g_rerank_handle is held; the
+// shared_ptr keeps it alive even if the cache drops its entry
+ModelHandle g_rerank_handle = 0;
+std::shared_ptr<llama_model> g_rerank_model;
+llama_context* g_rerank_ctx = nullptr;
+int g_rerank_threads = RERANK_DEFAULT_THREADS;
+std::mutex g_rerank_mutex;
+
+// Non-causal rerankers must see a whole sequence in one ubatch
+bool create_rerank_context() {
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = RERANK_N_CTX;
+    ctx_params.n_batch = RERANK_N_CTX;
+    ctx_params.n_ubatch = RERANK_N_CTX;
+    ctx_params.n_seq_max = RERANK_MAX_SEQ;
+    ctx_params.n_threads = g_rerank_threads;
+    ctx_params.n_threads_batch = g_rerank_threads;
+    ctx_params.embeddings = true;
+    ctx_params.pooling_type = LLAMA_POOLING_TYPE_RANK;
+
+    g_rerank_ctx = llama_init_from_model(g_rerank_model.get(), ctx_params);
+    return g_rerank_ctx != nullptr;
+}
+
+// The model stays cached unless `evict` (an explicit unload)
+void free_reranker(bool evict = false) {
+    if (g_rerank_ctx) {
+        llama_free(g_rerank_ctx);
+        g_rerank_ctx = nullptr;
+    }
+    g_rerank_model.reset();
+    if (g_rerank_handle != 0) {
+        model_cache_release(g_rerank_handle, evict);
+        g_rerank_handle = 0;
+    }
+}
+
+// BOS query EOS SEP passage EOS, the layout BERT-style rerankers are trained on
+std::vector<llama_token> format_pair(const llama_vocab* vocab,
+                                     const std::vector<llama_token>& query,
+                                     const std::string& passage) {
+    std::vector<llama_token> doc = common_tokenize(vocab, passage, false, false);
+    if ((int)doc.size() > RERANK_MAX_PASSAGE_TOKENS) {
+        doc.resize(RERANK_MAX_PASSAGE_TOKENS);
+    }
+
+    std::vector<llama_token> out;
+    out.reserve(query.size() + doc.size() + 4);
+    auto push_special = [&](llama_token t) {
+        if (t >= 0) out.push_back(t);
+    };
+
+    push_special(llama_vocab_bos(vocab));
+    out.insert(out.end(), query.begin(), query.end());
+    push_special(llama_vocab_eos(vocab));
+    push_special(llama_vocab_sep(vocab));
+    out.insert(out.end(), doc.begin(), doc.end());
+    push_special(llama_vocab_eos(vocab));
+    return out;
+}
+
+// Decode the pending sequences and read back one score per sequence
+bool flush_batch(llama_batch& batch, const std::vector<int>& seq_to_pair, std::vector<float>& scores) {
+    if (batch.n_tokens == 0) {
+        return true;
+    }
+
+    llama_memory_clear(llama_get_memory(g_rerank_ctx), true);
+    if (llama_decode(g_rerank_ctx, batch) != 0) {
+        LOGE("Rerank decode failed (%d tokens, %zu seqs)", batch.n_tokens, seq_to_pair.size());
+        return false;
+    }
+
+    for (size_t s = 0; s < seq_to_pair.size(); s++) {
+        const float* out = llama_get_embeddings_seq(g_rerank_ctx, (llama_seq_id)s);
+        if (out) {
+            scores[seq_to_pair[s]] = out[0];
+        }
+    }
+    common_batch_clear(batch);
+    return true;
+}
+
+} // namespace
+
+bool llama_jni_release_reranker_context() {
+    // Skip rather than wait if a rerank is running
+    std::unique_lock<std::mutex> lock(g_rerank_mutex, std::try_to_lock);
+    if (!lock.owns_lock() || !g_rerank_ctx) {
+        return false;
+    }
+    llama_free(g_rerank_ctx);
+    g_rerank_ctx = nullptr;
+    LOGI("Reranker context released");
+    return true;
+}
+
+void llama_jni_unload_reranker() {
+    std::lock_guard<std::mutex> lock(g_rerank_mutex);
+    free_reranker(true);
+}
+
+int llama_jni_rerank(const std::string& query,
+                     const std::vector<std::string>& passages,
+                     std::vector<float>& scores,
+                     int time_budget_ms) {
+    std::lock_guard<std::mutex> lock(g_rerank_mutex);
+
+    if (!g_rerank_model) {
+        return -1;
+    }
+    // Released by a memory trim; the model is still held, so rebuild it
+    if (!g_rerank_ctx && !create_rerank_context()) {
+        LOGE("Failed to recreate reranker context");
+        return -1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const llama_vocab* vocab = llama_model_get_vocab(g_rerank_model.get());
+    const int n_batch = (int)llama_n_batch(g_rerank_ctx);
+    const int n_seq_max = std::min((int)llama_n_seq_max(g_rerank_ctx), RERANK_MAX_SEQ);
+
+    // Unscored pairs stay NaN so callers can keep their retrieval order
+    scores.assign(passages.size(), NAN);
+
+    std::vector<llama_token> query_tokens = common_tokenize(vocab, query, false, false);
+    if ((int)query_tokens.size() > RERANK_MAX_QUERY_TOKENS) {
+        query_tokens.resize(RERANK_MAX_QUERY_TOKENS);
+    }
+
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+    std::vector<int> seq_to_pair;
+    int scored = 0;
+    bool ok = true;
+
+    for (size_t i = 0; i < passages.size(); i++) {
+        std::vector<llama_token> pair = format_pair(vocab, query_tokens, passages[i]);
+        if ((int)pair.size() > n_batch) {
+            pair.resize(n_batch);
+        }
+
+        bool full = batch.n_tokens + (int)pair.size() > n_batch ||
+                    (int)seq_to_pair.size() >= n_seq_max;
+        if (full) {
+            ok = flush_batch(batch, seq_to_pair, scores);
+            if (!ok) break;
+            scored += (int)seq_to_pair.size();
+            seq_to_pair.clear();
+
+            if (time_budget_ms > 0) {
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+                if (elapsed >= time_budget_ms) {
+                    LOGW("Rerank budget of %d ms exhausted after %d/%zu pairs",
+                         time_budget_ms, scored, passages.size());
+                    break;
+                }
+            }
+        }
+
+        llama_seq_id seq = (llama_seq_id)seq_to_pair.size();
+        for (size_t p = 0; p < pair.size(); p++) {
+            common_batch_add(batch, pair[p], (llama_pos)p, {seq}, true);
+        }
+        seq_to_pair.push_back((int)i);
+    }
+
+    if (ok && !seq_to_pair.empty() && flush_batch(batch, seq_to_pair, scores)) {
+        scored += (int)seq_to_pair.size();
+    }
+    llama_batch_free(batch);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    LOGD("Reranked %d/%zu pairs in %lld ms", scored, passages.size(), (long long)elapsed);
+    return scored;
+}
+
+extern "C" {
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeLoadReranker(
+    JNIEnv* env, jobject thiz, jstring model_path, jint n_threads) {
+
+    TRACE_SCOPE("nativeLoadReranker");
+    std::lock_guard<std::mutex> lock(g_rerank_mutex);
+    free_reranker();
+
+    std::string path = jstring_to_std(env, model_path);
+    LOGI("Loading reranker: %s", path.c_str());
+
+    g_rerank_handle = model_cache_acquire(path);
+    g_rerank_model = model_cache_get(g_rerank_handle);
+    if (!g_rerank_model) {
+        LOGE("Failed to load reranker model");
+        return -1;
+    }
+
+    g_rerank_threads = (n_threads > 0) ? n_threads :
+        std::min(RERANK_DEFAULT_THREADS, (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    if (!create_rerank_context()) {
+        LOGE("Failed to create reranker context");
+        free_reranker();
+        return -2;
+    }
+
+    if (llama_pooling_type(g_rerank_ctx) != LLAMA_POOLING_TYPE_RANK) {
+        LOGE("Model does not support rank pooling; not a reranker");
+        free_reranker();
+        return -3;
+    }
+
+    LOGI("Reranker loaded (threads: %d, max seqs: %d)", g_rerank_threads, RERANK_MAX_SEQ);
+    return 0;
+}
+
+JNIEXPORT jfloatArray JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeRerank(
+    JNIEnv* env, jobject thiz, jstring query, jobjectArray candidates, jint time_budget_ms) {
+
+    TRACE_SCOPE("nativeRerank");
+    std::string query_str = jstring_to_std(env, query);
+
+    jsize n = env->GetArrayLength(candidates);
+    std::vector<std::string> passages(n);
+    for (jsize i = 0; i < n; i++) {
+        jstring s = (jstring)env->GetObjectArrayElement(candidates, i);
+        passages[i] = jstring_to_std(env, s);
+        env->DeleteLocalRef(s);
+    }
+
+    std::vector<float> scores;
+    if (llama_jni_rerank(query_str, passages, scores, time_budget_ms) < 0) {
+        LOGE("Reranker not loaded");
+        return nullptr;
+    }
+
+    jfloatArray result = env->NewFloatArray(n);
+    env->SetFloatArrayRegion(result, 0, n, scores.data());
+    return result;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeUnloadReranker(
+    JNIEnv* env, jobject thiz) {
+
+    TRACE_SCOPE("nativeUnloadReranker");
+    llama_jni_unload_reranker();
+    LOGI("Reranker unloaded");
+}
+
+} // extern "C"
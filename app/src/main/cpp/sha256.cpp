@@ -0,0 +1,291 @@
+/**
+ * Streaming SHA-256 (portable kernel, CPU dispatch, mmap file hashing)
+ * and its JNI surface for Sha256Verifier.
+ */
+
+#include "sha256.h"
+
+#include <jni.h>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#elif defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#define LOG_TAG "LlamaSha256JNI"
+#include "llama_jni.h"
+
+const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+namespace {
+
+// Advise the kernel every 64 MB while hashing an mmapped file
+constexpr size_t MMAP_WINDOW = 64u << 20;
+
+using BlockFn = void (*)(uint32_t*, const uint8_t*, size_t);
+
+inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t load_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+struct Backend {
+    BlockFn fn;
+    const char* name;
+};
+
+Backend detect_backend() {
+#if defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_SHA2) {
+        return {sha256_blocks_armv8, "armv8-sha2"};
+    }
+#elif defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    bool sse41 = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1);
+    bool sha = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1u << 29));
+    if (sse41 && sha) {
+        return {sha256_blocks_shani, "x86-sha-ni"};
+    }
+#endif
+    return {sha256_blocks_portable, "portable"};
+}
+
+const Backend& backend_for_cpu() {
+    static const Backend backend = detect_backend();
+    return backend;
+}
+
+} // namespace
+
+void sha256_blocks_portable(uint32_t state[8], const uint8_t* data, size_t n_blocks) {
+    uint32_t w[64];
+    for (size_t blk = 0; blk < n_blocks; blk++, data += Sha256::BLOCK_SIZE) {
+        for (int i = 0; i < 16; i++) {
+            w[i] = load_be32(data + i * 4);
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + SHA256_K[i] + w[i];
+            uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+Sha256::Sha256() {
+    static const uint32_t INIT[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(state_, INIT, sizeof(state_));
+}
+
+const char* Sha256::backend() {
+    return backend_for_cpu().name;
+}
+
+void Sha256::update(const uint8_t* data, size_t len) {
+    BlockFn blocks = backend_for_cpu().fn;
+    total_ += len;
+
+    if (buffered_ > 0) {
+        size_t take = std::min(len, BLOCK_SIZE - buffered_);
+        memcpy(buffer_ + buffered_, data, take);
+        buffered_ += take;
+        data += take;
+        len -= take;
+        if (buffered_ < BLOCK_SIZE) {
+            return;
+        }
+        blocks(state_, buffer_, 1);
+        buffered_ = 0;
+    }
+
+    size_t n_blocks = len / BLOCK_SIZE;
+    if (n_blocks > 0) {
+        blocks(state_, data, n_blocks);
+        data += n_blocks * BLOCK_SIZE;
+        len -= n_blocks * BLOCK_SIZE;
+    }
+
+    if (len > 0) {
+        memcpy(buffer_, data, len);
+        buffered_ = len;
+    }
+}
+
+void Sha256::finish(uint8_t out[DIGEST_SIZE]) {
+    uint64_t bit_len = total_ * 8;
+
+    uint8_t pad[BLOCK_SIZE * 2] = {0x80};
+    size_t pad_len = (buffered_ < 56) ? (56 - buffered_) : (120 - buffered_);
+    for (int i = 0; i < 8; i++) {
+        pad[pad_len + i] = (uint8_t)(bit_len >> (56 - 8 * i));
+    }
+    update(pad, pad_len + 8);
+
+    for (int i = 0; i < 8; i++) {
+        out[i * 4 + 0] = (uint8_t)(state_[i] >> 24);
+        out[i * 4 + 1] = (uint8_t)(state_[i] >> 16);
+        out[i * 4 + 2] = (uint8_t)(state_[i] >> 8);
+        out[i * 4 + 3] = (uint8_t)(state_[i]);
+    }
+}
+
+std::string Sha256::finish_hex() {
+    static const char HEX[] = "0123456789abcdef";
+    uint8_t digest[DIGEST_SIZE];
+    finish(digest);
+
+    std::string hex(DIGEST_SIZE * 2, '0');
+    for (size_t i = 0; i < DIGEST_SIZE; i++) {
+        hex[i * 2] = HEX[digest[i] >> 4];
+        hex[i * 2 + 1] = HEX[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+bool sha256_update_from_file(Sha256& hasher, const char* path, int64_t length) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (length < 0 || length > st.st_size) ? (size_t)st.st_size : (size_t)length;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    // Sequential readahead, and drop each window once hashed so a
+    // multi-GB model doesn't evict everything else from the page cache
+    const uint8_t* base = (const uint8_t*)map;
+    madvise(map, size, MADV_SEQUENTIAL);
+    for (size_t off = 0; off < size; off += MMAP_WINDOW) {
+        size_t n = std::min(MMAP_WINDOW, size - off);
+        hasher.update(base + off, n);
+        madvise((void*)(base + off), n, MADV_DONTNEED);
+    }
+
+    munmap(map, size);
+    return true;
+}
+
+extern "C" {
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_mesh_Sha256Verifier_00024Companion_nativeCreate(
+    JNIEnv* env, jobject thiz) {
+
+    return (jlong)(intptr_t)new Sha256();
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_mesh_Sha256Verifier_00024Companion_nativeUpdate(
+    JNIEnv* env, jobject thiz, jlong handle, jbyteArray data, jint offset, jint length) {
+
+    auto* hasher = (Sha256*)(intptr_t)handle;
+    // Critical access avoids copying each download chunk
+    auto* bytes = (uint8_t*)env->GetPrimitiveArrayCritical(data, nullptr);
+    hasher->update(bytes + offset, (size_t)length);
+    env->ReleasePrimitiveArrayCritical(data, bytes, JNI_ABORT);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_llamafarm_atmosphere_mesh_Sha256Verifier_00024Companion_nativeUpdateFromFile(
+    JNIEnv* env, jobject thiz, jlong handle, jstring path, jlong length) {
+
+    auto* hasher = (Sha256*)(intptr_t)handle;
+    std::string file = jstring_to_std(env, path);
+    if (!sha256_update_from_file(*hasher, file.c_str(), length)) {
+        LOGE("Failed to hash %s", file.c_str());
+        return JNI_FALSE;
+    }
+    return JNI_TRUE;
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_llamafarm_atmosphere_mesh_Sha256Verifier_00024Companion_nativeFinish(
+    JNIEnv* env, jobject thiz, jlong handle) {
+
+    auto* hasher = (Sha256*)(intptr_t)handle;
+    std::string hex = hasher->finish_hex();
+    return env->NewStringUTF(hex.c_str());
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_mesh_Sha256Verifier_00024Companion_nativeFree(
+    JNIEnv* env, jobject thiz, jlong handle) {
+
+    delete (Sha256*)(intptr_t)handle;
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_llamafarm_atmosphere_mesh_Sha256Verifier_00024Companion_nativeHashFile(
+    JNIEnv* env, jobject thiz, jstring path) {
+
+    std::string file = jstring_to_std(env, path);
+    Sha256 hasher;
+    if (!sha256_update_from_file(hasher, file.c_str(), -1)) {
+        LOGE("Failed to hash %s", file.c_str());
+        return nullptr;
+    }
+    LOGD("Hashed %s (%s)", file.c_str(), Sha256::backend());
+    return env->NewStringUTF(hasher.finish_hex().c_str());
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_llamafarm_atmosphere_mesh_Sha256Verifier_00024Companion_nativeBackend(
+    JNIEnv* env, jobject thiz) {
+
+    return env->NewStringUTF(Sha256::backend());
+}
+
+} // extern "C"
@@ -0,0 +1,50 @@
+/**
+ * Streaming SHA-256 with hardware acceleration
+ *
+ * Uses the ARMv8 SHA2 instructions or x86 SHA-NI when the CPU reports them
+ * at runtime, and a portable implementation otherwise. Used to verify model
+ * transfers while the bytes are being written, and to hash existing files
+ * through mmap.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Sha256 {
+public:
+    static constexpr size_t DIGEST_SIZE = 32;
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    Sha256();
+
+    void update(const uint8_t* data, size_t len);
+    void finish(uint8_t out[DIGEST_SIZE]);
+    std::string finish_hex();
+
+    // Name of the compression kernel picked for this CPU
+    static const char* backend();
+
+private:
+    uint32_t state_[8];
+    uint8_t buffer_[BLOCK_SIZE];
+    size_t buffered_ = 0;
+    uint64_t total_ = 0;
+};
+
+// Feed `length` bytes of the file at `path` (the whole file if length < 0)
+// into `hasher` through mmap. Returns false if the file can't be read.
+bool sha256_update_from_file(Sha256& hasher, const char* path, int64_t length);
+
+// Block kernels: process `n_blocks` consecutive 64-byte blocks.
+void sha256_blocks_portable(uint32_t state[8], const uint8_t* data, size_t n_blocks);
+#if defined(__aarch64__)
+void sha256_blocks_armv8(uint32_t state[8], const uint8_t* data, size_t n_blocks);
+#endif
+#if defined(__x86_64__)
+void sha256_blocks_shani(uint32_t state[8], const uint8_t* data, size_t n_blocks);
+#endif
+
+extern const uint32_t SHA256_K[64];
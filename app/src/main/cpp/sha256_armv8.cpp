@@ -0,0 +1,45 @@
+/**
+ * SHA-256 block kernel using the ARMv8 Cryptography Extensions.
+ *
+ * Built with -march=armv8-a+crypto; only called after sha256.cpp has
+ * confirmed HWCAP_SHA2.
+ */
+
+#include "sha256.h"
+
+#if defined(__aarch64__)
+
+#include <arm_neon.h>
+
+void sha256_blocks_armv8(uint32_t state[8], const uint8_t* data, size_t n_blocks) {
+    uint32x4_t state0 = vld1q_u32(&state[0]);
+    uint32x4_t state1 = vld1q_u32(&state[4]);
+
+    for (size_t blk = 0; blk < n_blocks; blk++, data += Sha256::BLOCK_SIZE) {
+        const uint32x4_t abcd_save = state0;
+        const uint32x4_t efgh_save = state1;
+
+        // w[g] holds message words 4g..4g+3
+        uint32x4_t w[16];
+        for (int g = 0; g < 16; g++) {
+            if (g < 4) {
+                w[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + g * 16)));
+            } else {
+                w[g] = vsha256su1q_u32(vsha256su0q_u32(w[g - 4], w[g - 3]), w[g - 2], w[g - 1]);
+            }
+
+            uint32x4_t msg = vaddq_u32(w[g], vld1q_u32(&SHA256_K[g * 4]));
+            uint32x4_t prev = state0;
+            state0 = vsha256hq_u32(state0, state1, msg);
+            state1 = vsha256h2q_u32(state1, prev, msg);
+        }
+
+        state0 = vaddq_u32(state0, abcd_save);
+        state1 = vaddq_u32(state1, efgh_save);
+    }
+
+    vst1q_u32(&state[0], state0);
+    vst1q_u32(&state[4], state1);
+}
+
+#endif // __aarch64__
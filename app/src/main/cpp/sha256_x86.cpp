@@ -0,0 +1,58 @@
+/**
+ * SHA-256 block kernel using the x86 SHA extensions (SHA-NI).
+ *
+ * Built with -msha -msse4.1; only called after sha256.cpp has confirmed
+ * CPU support.
+ */
+
+#include "sha256.h"
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+void sha256_blocks_shani(uint32_t state[8], const uint8_t* data, size_t n_blocks) {
+    const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // Repack ABCD/EFGH into the ABEF/CDGH layout the instructions expect
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (size_t blk = 0; blk < n_blocks; blk++, data += Sha256::BLOCK_SIZE) {
+        const __m128i abef_save = state0;
+        const __m128i cdgh_save = state1;
+
+        // w[g] holds message words 4g..4g+3
+        __m128i w[16];
+        for (int g = 0; g < 16; g++) {
+            if (g < 4) {
+                w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + g * 16)), BSWAP);
+            } else {
+                __m128i t = _mm_sha256msg1_epu32(w[g - 4], w[g - 3]);
+                t = _mm_add_epi32(t, _mm_alignr_epi8(w[g - 1], w[g - 2], 4));
+                w[g] = _mm_sha256msg2_epu32(t, w[g - 1]);
+            }
+
+            __m128i msg = _mm_add_epi32(w[g], _mm_loadu_si128((const __m128i*)&SHA256_K[g * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+#endif // __x86_64__
@@ -0,0 +1,303 @@
+/**
+ * Adaptive decode thread count, and its JNI surface on LlamaCppEngine.
+ * See thread_governor.h.
+ *
+ * Each window is WINDOW decode steps at one thread count; its median step
+ * time gives tokens/s. A probe runs one window at the neighbouring count
+ * and is adopted only if it beats the incumbent's latest window by
+ * PROBE_GAIN, so noise doesn't make the count wander.
+ */
+
+#include "thread_governor.h"
+
+#include <jni.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define LOG_TAG "LlamaThreadGovernor"
+#include "llama_jni.h"
+
+namespace {
+
+constexpr int WINDOW = 16;               // decode steps per measurement
+constexpr int PROBE_EVERY = 8;           // windows between routine probes
+constexpr double PROBE_GAIN = 1.03;
+constexpr double SLOWDOWN = 0.85;        // of the previous window at the same count
+constexpr int FREQ_SHIFT_PERMILLE = 150;
+constexpr int TEMP_SHIFT_MC = 8000;
+constexpr size_t MAX_THERMAL_ZONES = 16;
+
+std::mutex g_governor_mutex;
+bool g_enabled = true;
+int g_max_threads = 0;
+int g_threads = 0;
+int g_incumbent = 0;
+bool g_probing = false;
+int g_probe_dir = -1;
+int g_windows_since_probe = 0;
+std::vector<int64_t> g_window;
+// Latest window's tokens/s per thread count (index = threads), 0 = unknown
+std::vector<double> g_rate;
+// CPU conditions g_rate was measured under
+int g_rate_freq = -1;
+int g_rate_temp = -1;
+ThreadGovernorStats g_stats;
+
+std::vector<std::string> g_thermal_zones;
+std::vector<std::pair<std::string, long>> g_cpufreq; // scaling_cur_freq, cpuinfo_max_freq
+
+long read_long(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return -1;
+    long value = -1;
+    if (fscanf(f, "%ld", &value) != 1) value = -1;
+    fclose(f);
+    return value;
+}
+
+std::string read_line(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return std::string();
+    char buf[64] = {};
+    if (!fgets(buf, sizeof(buf), f)) buf[0] = '\0';
+    fclose(f);
+    std::string line(buf);
+    while (!line.empty() && isspace((unsigned char)line.back())) line.pop_back();
+    return line;
+}
+
+// CPU thermal zones if they are labelled, else every readable zone
+void discover_sensors() {
+    g_thermal_zones.clear();
+    std::vector<std::string> all;
+    if (DIR* dir = opendir("/sys/class/thermal")) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.rfind("thermal_zone", 0) != 0) continue;
+            std::string base = "/sys/class/thermal/" + name;
+            if (read_long(base + "/temp") < 0) continue;
+            std::string type = read_line(base + "/type");
+            std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+            all.push_back(base + "/temp");
+            if (type.find("cpu") != std::string::npos && g_thermal_zones.size() < MAX_THERMAL_ZONES) {
+                g_thermal_zones.push_back(base + "/temp");
+            }
+        }
+        closedir(dir);
+    }
+    if (g_thermal_zones.empty()) {
+        all.resize(std::min(all.size(), MAX_THERMAL_ZONES));
+        g_thermal_zones = all;
+    }
+
+    g_cpufreq.clear();
+    long n_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (long cpu = 0; cpu < n_cpus; cpu++) {
+        std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/";
+        long max_freq = read_long(base + "cpuinfo_max_freq");
+        if (max_freq > 0) {
+            g_cpufreq.emplace_back(base + "scaling_cur_freq", max_freq);
+        }
+    }
+    LOGD("Governor sensors: %zu thermal zones, %zu cpufreq policies",
+         g_thermal_zones.size(), g_cpufreq.size());
+}
+
+int hottest_zone_mc() {
+    long hottest = -1;
+    for (const auto& path : g_thermal_zones) {
+        hottest = std::max(hottest, read_long(path));
+    }
+    return (int)hottest;
+}
+
+int mean_freq_permille() {
+    long sum = 0;
+    int n = 0;
+    for (const auto& [path, max_freq] : g_cpufreq) {
+        long cur = read_long(path);
+        if (cur > 0) {
+            sum += std::min(1000L, cur * 1000 / max_freq);
+            n++;
+        }
+    }
+    return n > 0 ? (int)(sum / n) : -1;
+}
+
+void set_threads(int threads, GovernorReason reason) {
+    if (threads != g_threads) {
+        LOGD("Decode threads %d -> %d (reason %d, %.1f tok/s)",
+             g_threads, threads, reason, g_stats.tokens_per_s);
+    }
+    g_threads = threads;
+    g_stats.reason = reason;
+}
+
+// Rates measured at other clocks or temperatures no longer compare
+bool conditions_shifted(int freq, int temp) {
+    bool shifted = (freq >= 0 && g_rate_freq >= 0 && abs(freq - g_rate_freq) > FREQ_SHIFT_PERMILLE) ||
+                   (temp >= 0 && g_rate_temp >= 0 && abs(temp - g_rate_temp) > TEMP_SHIFT_MC);
+    if (shifted || g_rate_freq < 0) g_rate_freq = freq;
+    if (shifted || g_rate_temp < 0) g_rate_temp = temp;
+    return shifted;
+}
+
+void end_window(double rate) {
+    int freq = mean_freq_permille();
+    int temp = hottest_zone_mc();
+    g_stats.windows++;
+    g_stats.tokens_per_s = rate;
+    g_stats.freq_permille = freq;
+    g_stats.temp_mc = temp;
+
+    if (conditions_shifted(freq, temp)) {
+        // This window straddled the shift: drop it and everything before,
+        // measure the incumbent afresh, then probe downward
+        std::fill(g_rate.begin(), g_rate.end(), 0.0);
+        g_probing = false;
+        g_probe_dir = -1;
+        g_windows_since_probe = PROBE_EVERY - 1;
+        set_threads(g_incumbent, GOVERNOR_THERMAL);
+        return;
+    }
+
+    if (g_probing) {
+        g_probing = false;
+        g_rate[g_threads] = rate;
+        if (rate > g_rate[g_incumbent] * PROBE_GAIN) {
+            LOGI("Decode threads %d -> %d adopted (%.1f vs %.1f tok/s)",
+                 g_incumbent, g_threads, rate, g_rate[g_incumbent]);
+            g_incumbent = g_threads;
+            g_stats.changes++;
+            g_stats.reason = GOVERNOR_ADOPT;
+            // Keep going the same way right after the next window
+            g_windows_since_probe = PROBE_EVERY - 1;
+        } else {
+            set_threads(g_incumbent, GOVERNOR_REVERT);
+            g_probe_dir = -g_probe_dir;
+            g_windows_since_probe = 0;
+        }
+        return;
+    }
+
+    double previous = g_rate[g_threads];
+    g_rate[g_threads] = rate;
+    if (previous > 0.0 && rate < previous * SLOWDOWN) {
+        g_stats.reason = GOVERNOR_SLOWDOWN;
+        g_probe_dir = -1;
+        g_windows_since_probe = PROBE_EVERY;
+    }
+
+    if (++g_windows_since_probe < PROBE_EVERY) {
+        return;
+    }
+    int candidate = g_threads + g_probe_dir;
+    if (candidate < 1 || candidate > g_max_threads) {
+        g_probe_dir = -g_probe_dir;
+        candidate = g_threads + g_probe_dir;
+    }
+    if (candidate < 1 || candidate > g_max_threads) {
+        return;
+    }
+    g_probing = true;
+    g_windows_since_probe = 0;
+    g_stats.probes++;
+    set_threads(candidate, GOVERNOR_PROBE);
+}
+
+} // namespace
+
+void thread_governor_reset(int max_threads) {
+    std::lock_guard<std::mutex> lock(g_governor_mutex);
+    g_max_threads = std::max(1, max_threads);
+    g_threads = g_max_threads;
+    g_incumbent = g_max_threads;
+    g_probing = false;
+    g_probe_dir = -1;
+    g_windows_since_probe = 0;
+    g_window.clear();
+    g_window.reserve(WINDOW);
+    g_rate.assign(g_max_threads + 1, 0.0);
+    g_rate_freq = -1;
+    g_rate_temp = -1;
+    g_stats = ThreadGovernorStats();
+    discover_sensors();
+}
+
+void thread_governor_set_enabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(g_governor_mutex);
+    if (enabled == g_enabled) return;
+    g_enabled = enabled;
+    // Start from the configured count either way
+    g_threads = g_incumbent = g_max_threads;
+    g_probing = false;
+    g_windows_since_probe = 0;
+    g_window.clear();
+    std::fill(g_rate.begin(), g_rate.end(), 0.0);
+    g_rate_freq = -1;
+    g_rate_temp = -1;
+    LOGI("Thread governor %s", enabled ? "enabled" : "disabled");
+}
+
+int thread_governor_step(int64_t step_us) {
+    std::lock_guard<std::mutex> lock(g_governor_mutex);
+    if (!g_enabled || g_max_threads <= 1) {
+        return g_max_threads;
+    }
+    g_window.push_back(step_us);
+    if ((int)g_window.size() >= WINDOW) {
+        // Median: a GC pause or a page fault shouldn't decide anything
+        std::nth_element(g_window.begin(), g_window.begin() + WINDOW / 2, g_window.end());
+        int64_t median_us = std::max<int64_t>(g_window[WINDOW / 2], 1);
+        g_window.clear();
+        TRACE_SCOPE("governor", g_threads);
+        end_window(1e6 / (double)median_us);
+    }
+    return g_threads;
+}
+
+ThreadGovernorStats thread_governor_stats() {
+    std::lock_guard<std::mutex> lock(g_governor_mutex);
+    ThreadGovernorStats stats = g_stats;
+    stats.enabled = g_enabled;
+    stats.threads = g_enabled ? g_threads : g_max_threads;
+    stats.max_threads = g_max_threads;
+    return stats;
+}
+
+extern "C" {
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSetThreadGovernor(
+    JNIEnv* env, jobject thiz, jboolean enabled) {
+
+    TRACE_SCOPE("nativeSetThreadGovernor");
+    thread_governor_set_enabled(enabled);
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGetThreadGovernorStats(
+    JNIEnv* env, jobject thiz) {
+
+    TRACE_SCOPE("nativeGetThreadGovernorStats");
+    ThreadGovernorStats stats = thread_governor_stats();
+    jlong values[10] = {
+        stats.enabled ? 1 : 0, stats.threads, stats.max_threads,
+        (jlong)stats.windows, (jlong)stats.probes, (jlong)stats.changes,
+        (jlong)(stats.tokens_per_s * 1000.0), stats.temp_mc, stats.freq_permille, stats.reason,
+    };
+    jlongArray result = env->NewLongArray(10);
+    env->SetLongArrayRegion(result, 0, 10, values);
+    return result;
+}
+
+} // extern "C"
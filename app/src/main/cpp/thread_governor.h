@@ -0,0 +1,52 @@
+/**
+ * Adaptive decode thread count.
+ *
+ * A fixed n_threads stops being right once a phone heats up: throttled or
+ * busy cores make every decode step wait on the slowest thread. The
+ * governor times decode steps in windows, and between windows probes one
+ * thread fewer or more, keeping whichever sustains more tokens/s. When the
+ * CPU clocks or temperatures (sysfs) shift, or throughput drops sharply,
+ * earlier measurements are dropped and it probes downward first.
+ *
+ * Prefill is left at the configured count; only single-token decode steps
+ * (llama_set_n_threads' n_threads) are governed. Not thread-safe apart
+ * from thread_governor_stats(); the engine calls it under its lock.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Why the thread count last changed (or didn't)
+enum GovernorReason : int32_t {
+    GOVERNOR_NONE = 0,
+    GOVERNOR_PROBE = 1,     // trying a neighbouring count for one window
+    GOVERNOR_ADOPT = 2,     // the probe was faster and became the count
+    GOVERNOR_REVERT = 3,    // the probe was not faster
+    GOVERNOR_THERMAL = 4,   // clocks or temperature shifted; re-measuring
+    GOVERNOR_SLOWDOWN = 5,  // throughput fell sharply at the same count
+};
+
+struct ThreadGovernorStats {
+    bool enabled = false;
+    int32_t threads = 0;           // decode threads now
+    int32_t max_threads = 0;       // configured n_threads
+    uint64_t windows = 0;
+    uint64_t probes = 0;
+    uint64_t changes = 0;          // adopted probes
+    double tokens_per_s = 0.0;     // last window
+    int32_t temp_mc = -1;          // hottest CPU thermal zone, millidegrees C
+    int32_t freq_permille = -1;    // mean scaling_cur_freq / cpuinfo_max_freq
+    GovernorReason reason = GOVERNOR_NONE;
+};
+
+// Start over for a new context decoding with up to `max_threads`
+void thread_governor_reset(int max_threads);
+
+// While disabled the count stays at max_threads
+void thread_governor_set_enabled(bool enabled);
+
+// Record one decode step. Returns the thread count for the next step.
+int thread_governor_step(int64_t step_us);
+
+ThreadGovernorStats thread_governor_stats();
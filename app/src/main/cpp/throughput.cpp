@@ -0,0 +1,108 @@
+/**
+ * Prefill and decode rate tracking, and its JNI surface on LlamaCppEngine.
+ * See throughput.h.
+ */
+
+#include "throughput.h"
+
+#include <jni.h>
+#include <mutex>
+
+#include "trace.h"
+
+#define LOG_TAG "LlamaThroughput"
+#include "llama_jni.h"
+
+namespace {
+
+// Prefills are few and vary in length; decode steps are many and alike
+constexpr double PREFILL_ALPHA = 0.25;
+constexpr double DECODE_ALPHA = 1.0 / 32;
+
+std::mutex g_throughput_mutex;
+double g_prefill_us_per_token = 0.0;
+double g_decode_us_per_token = 0.0;
+uint64_t g_prefills = 0;
+uint64_t g_decode_steps = 0;
+int g_kv_headroom_tokens = 0;
+
+void update(double& average, double sample, double alpha, uint64_t n) {
+    average = n == 0 ? sample : average + alpha * (sample - average);
+}
+
+double per_second(double us_per_token) {
+    return us_per_token > 0.0 ? 1e6 / us_per_token : 0.0;
+}
+
+} // namespace
+
+void throughput_reset() {
+    std::lock_guard<std::mutex> lock(g_throughput_mutex);
+    g_prefill_us_per_token = 0.0;
+    g_decode_us_per_token = 0.0;
+    g_prefills = 0;
+    g_decode_steps = 0;
+    g_kv_headroom_tokens = 0;
+}
+
+void throughput_record_prefill(int n_tokens, int64_t us) {
+    if (n_tokens <= 0 || us <= 0) return;
+    std::lock_guard<std::mutex> lock(g_throughput_mutex);
+    update(g_prefill_us_per_token, (double)us / n_tokens, PREFILL_ALPHA, g_prefills++);
+}
+
+void throughput_record_decode(int64_t us) {
+    if (us <= 0) return;
+    std::lock_guard<std::mutex> lock(g_throughput_mutex);
+    update(g_decode_us_per_token, (double)us, DECODE_ALPHA, g_decode_steps++);
+}
+
+void throughput_set_kv_headroom(int tokens) {
+    std::lock_guard<std::mutex> lock(g_throughput_mutex);
+    g_kv_headroom_tokens = tokens;
+}
+
+ThroughputStats throughput_stats() {
+    std::lock_guard<std::mutex> lock(g_throughput_mutex);
+    ThroughputStats stats;
+    stats.prefill_tokens_per_s = per_second(g_prefill_us_per_token);
+    stats.decode_tokens_per_s = per_second(g_decode_us_per_token);
+    stats.prefills = g_prefills;
+    stats.decode_steps = g_decode_steps;
+    stats.kv_headroom_tokens = g_kv_headroom_tokens;
+    return stats;
+}
+
+int64_t throughput_estimate_us(int64_t prefill_tokens, int64_t decode_tokens) {
+    std::lock_guard<std::mutex> lock(g_throughput_mutex);
+    if (g_prefills == 0 || g_decode_steps == 0) {
+        return -1;
+    }
+    return (int64_t)(prefill_tokens * g_prefill_us_per_token + decode_tokens * g_decode_us_per_token);
+}
+
+extern "C" {
+
+JNIEXPORT jlongArray JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeGetThroughputStats(
+    JNIEnv* env, jobject thiz) {
+
+    TRACE_SCOPE("nativeGetThroughputStats");
+    ThroughputStats stats = throughput_stats();
+    jlong values[5] = {
+        (jlong)(stats.prefill_tokens_per_s * 1000.0), (jlong)(stats.decode_tokens_per_s * 1000.0),
+        (jlong)stats.prefills, (jlong)stats.decode_steps, stats.kv_headroom_tokens,
+    };
+    jlongArray result = env->NewLongArray(5);
+    env->SetLongArrayRegion(result, 0, 5, values);
+    return result;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeEstimateCompletionUs(
+    JNIEnv* env, jobject thiz, jlong prefill_tokens, jlong decode_tokens) {
+
+    return throughput_estimate_us(prefill_tokens, decode_tokens);
+}
+
+} // extern "C"
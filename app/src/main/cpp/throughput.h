@@ -0,0 +1,37 @@
+/**
+ * Measured prefill and decode rates of the running model, and its free KV
+ * room, for completion time estimates (mesh admission control, peer cost).
+ *
+ * Both are exponential moving averages of the time per token, so they
+ * follow throttling and background load within a few requests. They
+ * start over when a model is attached. Thread-safe.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+struct ThroughputStats {
+    double prefill_tokens_per_s = 0.0;  // 0 until measured
+    double decode_tokens_per_s = 0.0;
+    uint64_t prefills = 0;
+    uint64_t decode_steps = 0;
+    int32_t kv_headroom_tokens = 0;     // free context cells, as last published
+};
+
+void throughput_reset();
+
+// A prompt of `n_tokens` was prefilled in `us`
+void throughput_record_prefill(int n_tokens, int64_t us);
+
+// One token was sampled and decoded in `us`
+void throughput_record_decode(int64_t us);
+
+// Context cells not taken by a conversation
+void throughput_set_kv_headroom(int tokens);
+
+ThroughputStats throughput_stats();
+
+// Time to prefill `prefill_tokens` and then decode `decode_tokens`, in
+// microseconds, or -1 until both rates have been measured
+int64_t throughput_estimate_us(int64_t prefill_tokens, int64_t decode_tokens);
@@ -0,0 +1,309 @@
+/**
+ * JNIEnv backed by a plain C++ arena. See jni_shim.h.
+ *
+ * Handles are pointers to Ref objects reinterpreted as the JNI handle
+ * types; native code only ever passes them back to the env, so they are
+ * never dereferenced as _jobject.
+ */
+
+#include "jni_shim.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+struct Ref {
+    virtual ~Ref() = default;
+};
+
+struct StringRef : Ref {
+    std::string value;
+};
+
+struct ArrayRef : Ref {
+    virtual jsize length() const = 0;
+    virtual void* data() = 0;
+};
+
+template <typename T>
+struct PrimitiveArray : ArrayRef {
+    std::vector<T> values;
+    jsize length() const override { return (jsize)values.size(); }
+    void* data() override { return values.data(); }
+};
+
+struct ObjectArray : ArrayRef {
+    std::vector<jobject> values;
+    jsize length() const override { return (jsize)values.size(); }
+    void* data() override { return values.data(); }
+};
+
+struct DirectBuffer : Ref {
+    void* address = nullptr;
+    size_t capacity = 0;
+};
+
+struct ClassRef : Ref {
+    std::string name;
+};
+
+std::mutex g_mutex;
+std::vector<std::unique_ptr<Ref>> g_arena;
+std::string g_exception;
+
+template <typename R>
+R* make_ref() {
+    auto ref = std::make_unique<R>();
+    R* raw = ref.get();
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_arena.push_back(std::move(ref));
+    return raw;
+}
+
+template <typename H>
+H handle(Ref* ref) {
+    return reinterpret_cast<H>(ref);
+}
+
+template <typename R>
+R* deref(jobject object) {
+    return dynamic_cast<R*>(reinterpret_cast<Ref*>(object));
+}
+
+template <typename T, typename H>
+H new_array(jsize length) {
+    auto* array = make_ref<PrimitiveArray<T>>();
+    array->values.resize(length > 0 ? length : 0);
+    return handle<H>(array);
+}
+
+template <typename T>
+void get_region(jarray object, jsize start, jsize length, T* out) {
+    auto* array = deref<PrimitiveArray<T>>(object);
+    if (!array || start < 0 || length < 0 || start + length > array->length()) {
+        fprintf(stderr, "jni_shim: bad array region %d+%d\n", start, length);
+        return;
+    }
+    memcpy(out, array->values.data() + start, sizeof(T) * length);
+}
+
+template <typename T>
+void set_region(jarray object, jsize start, jsize length, const T* in) {
+    auto* array = deref<PrimitiveArray<T>>(object);
+    if (!array || start < 0 || length < 0 || start + length > array->length()) {
+        fprintf(stderr, "jni_shim: bad array region %d+%d\n", start, length);
+        return;
+    }
+    memcpy(array->values.data() + start, in, sizeof(T) * length);
+}
+
+const char* get_string_utf_chars(JNIEnv*, jstring object, jboolean* is_copy) {
+    if (is_copy) *is_copy = JNI_FALSE;
+    auto* string = deref<StringRef>(object);
+    return string ? string->value.c_str() : nullptr;
+}
+
+void release_string_utf_chars(JNIEnv*, jstring, const char*) {}
+
+jsize get_string_utf_length(JNIEnv*, jstring object) {
+    auto* string = deref<StringRef>(object);
+    return string ? (jsize)string->value.size() : 0;
+}
+
+jstring new_string_utf(JNIEnv*, const char* utf) {
+    if (!utf) return nullptr;
+    auto* string = make_ref<StringRef>();
+    string->value = utf;
+    return handle<jstring>(string);
+}
+
+jsize get_array_length(JNIEnv*, jarray object) {
+    auto* array = deref<ArrayRef>(object);
+    return array ? array->length() : 0;
+}
+
+jobject get_object_array_element(JNIEnv*, jobjectArray object, jsize index) {
+    auto* array = deref<ObjectArray>(object);
+    if (!array || index < 0 || index >= array->length()) return nullptr;
+    return array->values[index];
+}
+
+void set_object_array_element(JNIEnv*, jobjectArray object, jsize index, jobject value) {
+    auto* array = deref<ObjectArray>(object);
+    if (!array || index < 0 || index >= array->length()) return;
+    array->values[index] = value;
+}
+
+jobjectArray new_object_array(JNIEnv*, jsize length, jclass, jobject initial) {
+    auto* array = make_ref<ObjectArray>();
+    array->values.assign(length > 0 ? length : 0, initial);
+    return handle<jobjectArray>(array);
+}
+
+jclass find_class(JNIEnv*, const char* name) {
+    auto* cls = make_ref<ClassRef>();
+    cls->name = name ? name : "";
+    return handle<jclass>(cls);
+}
+
+// The arena owns everything, so local refs outlive DeleteLocalRef
+void delete_local_ref(JNIEnv*, jobject) {}
+
+jfloatArray new_float_array(JNIEnv*, jsize length) { return new_array<jfloat, jfloatArray>(length); }
+jintArray new_int_array(JNIEnv*, jsize length) { return new_array<jint, jintArray>(length); }
+jlongArray new_long_array(JNIEnv*, jsize length) { return new_array<jlong, jlongArray>(length); }
+
+void get_float_region(JNIEnv*, jfloatArray a, jsize s, jsize n, jfloat* out) { get_region(a, s, n, out); }
+void set_float_region(JNIEnv*, jfloatArray a, jsize s, jsize n, const jfloat* in) { set_region(a, s, n, in); }
+void get_int_region(JNIEnv*, jintArray a, jsize s, jsize n, jint* out) { get_region(a, s, n, out); }
+void set_int_region(JNIEnv*, jintArray a, jsize s, jsize n, const jint* in) { set_region(a, s, n, in); }
+void get_long_region(JNIEnv*, jlongArray a, jsize s, jsize n, jlong* out) { get_region(a, s, n, out); }
+void set_long_region(JNIEnv*, jlongArray a, jsize s, jsize n, const jlong* in) { set_region(a, s, n, in); }
+
+void* get_primitive_array_critical(JNIEnv*, jarray object, jboolean* is_copy) {
+    if (is_copy) *is_copy = JNI_FALSE;
+    auto* array = deref<ArrayRef>(object);
+    return array ? array->data() : nullptr;
+}
+
+void release_primitive_array_critical(JNIEnv*, jarray, void*, jint) {}
+
+void* get_direct_buffer_address(JNIEnv*, jobject object) {
+    auto* buffer = deref<DirectBuffer>(object);
+    return buffer ? buffer->address : nullptr;
+}
+
+jlong get_direct_buffer_capacity(JNIEnv*, jobject object) {
+    auto* buffer = deref<DirectBuffer>(object);
+    return buffer ? (jlong)buffer->capacity : -1;
+}
+
+jint throw_new(JNIEnv*, jclass cls, const char* message) {
+    auto* class_ref = deref<ClassRef>(cls);
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_exception = (class_ref ? class_ref->name + ": " : std::string()) + (message ? message : "");
+    fprintf(stderr, "jni_shim: exception %s\n", g_exception.c_str());
+    return 0;
+}
+
+jboolean exception_check(JNIEnv*) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_exception.empty() ? JNI_FALSE : JNI_TRUE;
+}
+
+JNINativeInterface make_table() {
+    JNINativeInterface table;
+    memset(&table, 0, sizeof(table));
+    table.GetStringUTFChars = get_string_utf_chars;
+    table.ReleaseStringUTFChars = release_string_utf_chars;
+    table.GetStringUTFLength = get_string_utf_length;
+    table.NewStringUTF = new_string_utf;
+    table.GetArrayLength = get_array_length;
+    table.GetObjectArrayElement = get_object_array_element;
+    table.SetObjectArrayElement = set_object_array_element;
+    table.NewObjectArray = new_object_array;
+    table.FindClass = find_class;
+    table.DeleteLocalRef = delete_local_ref;
+    table.NewFloatArray = new_float_array;
+    table.GetFloatArrayRegion = get_float_region;
+    table.SetFloatArrayRegion = set_float_region;
+    table.NewIntArray = new_int_array;
+    table.GetIntArrayRegion = get_int_region;
+    table.SetIntArrayRegion = set_int_region;
+    table.NewLongArray = new_long_array;
+    table.GetLongArrayRegion = get_long_region;
+    table.SetLongArrayRegion = set_long_region;
+    table.GetPrimitiveArrayCritical = get_primitive_array_critical;
+    table.ReleasePrimitiveArrayCritical = release_primitive_array_critical;
+    table.GetDirectBufferAddress = get_direct_buffer_address;
+    table.GetDirectBufferCapacity = get_direct_buffer_capacity;
+    table.ThrowNew = throw_new;
+    table.ExceptionCheck = exception_check;
+    return table;
+}
+
+} // namespace
+
+JNIEnv* jni_shim_env() {
+    static const JNINativeInterface table = make_table();
+    static JNIEnv env = [] {
+        JNIEnv e;
+        e.functions = &table;
+        return e;
+    }();
+    return &env;
+}
+
+jstring jni_shim_string(const std::string& value) {
+    auto* string = make_ref<StringRef>();
+    string->value = value;
+    return handle<jstring>(string);
+}
+
+std::string jni_shim_to_string(jstring value) {
+    auto* string = deref<StringRef>(value);
+    return string ? string->value : std::string();
+}
+
+jobjectArray jni_shim_string_array(const std::vector<std::string>& values) {
+    auto* array = make_ref<ObjectArray>();
+    array->values.reserve(values.size());
+    for (const std::string& value : values) {
+        array->values.push_back(jni_shim_string(value));
+    }
+    return handle<jobjectArray>(array);
+}
+
+std::vector<std::string> jni_shim_to_strings(jobjectArray values) {
+    std::vector<std::string> result;
+    if (auto* array = deref<ObjectArray>(values)) {
+        for (jobject value : array->values) {
+            result.push_back(jni_shim_to_string(reinterpret_cast<jstring>(value)));
+        }
+    }
+    return result;
+}
+
+jfloatArray jni_shim_float_array(const std::vector<float>& values) {
+    auto* array = make_ref<PrimitiveArray<jfloat>>();
+    array->values = values;
+    return handle<jfloatArray>(array);
+}
+
+std::vector<float> jni_shim_to_floats(jfloatArray values) {
+    auto* array = deref<PrimitiveArray<jfloat>>(values);
+    return array ? array->values : std::vector<float>();
+}
+
+std::vector<int32_t> jni_shim_to_ints(jintArray values) {
+    auto* array = deref<PrimitiveArray<jint>>(values);
+    return array ? std::vector<int32_t>(array->values.begin(), array->values.end()) : std::vector<int32_t>();
+}
+
+std::vector<int64_t> jni_shim_to_longs(jlongArray values) {
+    auto* array = deref<PrimitiveArray<jlong>>(values);
+    return array ? std::vector<int64_t>(array->values.begin(), array->values.end()) : std::vector<int64_t>();
+}
+
+jobject jni_shim_direct_buffer(void* address, size_t capacity) {
+    auto* buffer = make_ref<DirectBuffer>();
+    buffer->address = address;
+    buffer->capacity = capacity;
+    return handle<jobject>(buffer);
+}
+
+std::string jni_shim_take_exception() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::string message;
+    message.swap(g_exception);
+    return message;
+}
+
+void jni_shim_release_all() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_arena.clear();
+    g_exception.clear();
+}
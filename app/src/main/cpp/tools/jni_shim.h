@@ -0,0 +1,40 @@
+/**
+ * In-process stand-in for the JVM side of JNI, so native tools can call
+ * llama-jni's Java_* entry points directly (benchmarks, PGO training runs)
+ * without an app or ART.
+ *
+ * Only the JNIEnv functions llama-jni actually uses are filled in; the rest
+ * of the table is null. Objects handed out (strings, arrays, direct
+ * buffers) live in an arena until jni_shim_release_all().
+ */
+
+#pragma once
+
+#include <jni.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The shared JNIEnv. All shim objects are valid with it on any thread.
+JNIEnv* jni_shim_env();
+
+jstring jni_shim_string(const std::string& value);
+// "" for null
+std::string jni_shim_to_string(jstring value);
+
+jobjectArray jni_shim_string_array(const std::vector<std::string>& values);
+std::vector<std::string> jni_shim_to_strings(jobjectArray values);
+
+jfloatArray jni_shim_float_array(const std::vector<float>& values);
+std::vector<float> jni_shim_to_floats(jfloatArray values);
+std::vector<int32_t> jni_shim_to_ints(jintArray values);
+std::vector<int64_t> jni_shim_to_longs(jlongArray values);
+
+// Wraps caller-owned memory, like NewDirectByteBuffer
+jobject jni_shim_direct_buffer(void* address, size_t capacity);
+
+// Message of the last ThrowNew since the previous call, "" if none
+std::string jni_shim_take_exception();
+
+// Free every object created through the shim or by native code via the env
+void jni_shim_release_all();
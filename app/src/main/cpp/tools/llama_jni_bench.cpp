@@ -0,0 +1,326 @@
+/**
+ * llama-jni-bench: drives libllama-jni.so through its JNI entry points the
+ * way the app does (via jni_shim), on a fixed prefill / decode / RAG
+ * workload. It is the training run for PGO builds and the yardstick for
+ * comparing them.
+ *
+ *   llama-jni-bench --model tiny.gguf [--lib-dir DIR] [--threads N]
+ *                   [--runs N] [--gen N] [--rag-docs N] [--rag-queries N]
+ *                   [--out metrics.txt] [--trace trace.json|trace.pftrace]
+ *
+ * Results go to stdout and, with --out, to a "name value" per line file
+ * that scripts/pgo-llama-jni.sh turns into its speedup report. --trace
+ * records the run with the native tracer (Chrome JSON for *.json, else
+ * Perfetto protobuf).
+ */
+
+#include <jni.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "jni_shim.h"
+
+#define ENGINE(name) Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_##name
+#define RAG(name) Java_com_llamafarm_atmosphere_rag_LocalRagStore_00024Companion_##name
+
+extern "C" {
+jint ENGINE(nativeInit)(JNIEnv*, jobject, jstring);
+jint ENGINE(nativeLoadModel)(JNIEnv*, jobject, jstring, jint, jint);
+jint ENGINE(nativeSetSystemPrompt)(JNIEnv*, jobject, jstring);
+jint ENGINE(nativeStartGeneration)(JNIEnv*, jobject, jstring, jint);
+jstring ENGINE(nativeGetNextToken)(JNIEnv*, jobject);
+jintArray ENGINE(nativeTokenize)(JNIEnv*, jobject, jstring, jboolean);
+jstring ENGINE(nativeGetSystemInfo)(JNIEnv*, jobject);
+void ENGINE(nativeUnloadModel)(JNIEnv*, jobject);
+void ENGINE(nativeShutdown)(JNIEnv*, jobject);
+void ENGINE(nativeSetTracing)(JNIEnv*, jobject, jboolean, jboolean);
+jint ENGINE(nativeDumpTrace)(JNIEnv*, jobject, jstring, jint);
+
+jint RAG(nativeCreateIndex)(JNIEnv*, jobject, jstring, jobjectArray, jobjectArray, jfloatArray, jint);
+void RAG(nativeDeleteIndex)(JNIEnv*, jobject, jstring);
+jstring RAG(nativeQueryForContext)(JNIEnv*, jobject, jstring, jstring, jfloatArray,
+                                   jint, jint, jfloat, jint, jint);
+}
+
+namespace {
+
+constexpr int RAG_DIM = 64;
+constexpr int RAG_TOP_K = 5;
+constexpr int RAG_TOKEN_BUDGET = 512;
+
+const char* SYSTEM_PROMPT =
+    "You are a helpful assistant running on a phone. Answer briefly and accurately.";
+
+// Short, medium and long turns, so prefill sees more than one batch shape
+const char* PROMPTS[] = {
+    "What is the capital of France?",
+    "Summarize the main causes of the first world war in three sentences, "
+    "and name one historian who has written about them.",
+    "Here is a list of groceries: apples, bread, milk, eggs, cheese, rice, "
+    "beans, tomatoes, onions, garlic, olive oil, pasta, chicken, yogurt, "
+    "spinach, carrots, potatoes and coffee. Group them by store aisle, "
+    "suggest three dinners that use most of them, and point out anything "
+    "a vegetarian would need to swap out.",
+};
+
+const char* WORDS[] = {
+    "mesh", "node", "battery", "model", "latency", "token", "cache", "router",
+    "signal", "peer", "offline", "sync", "river", "garden", "engine", "thermal",
+    "camera", "weather", "recipe", "music", "travel", "health", "budget", "report",
+    "network", "storage", "privacy", "update", "planet", "history", "science", "market",
+};
+constexpr size_t N_WORDS = sizeof(WORDS) / sizeof(WORDS[0]);
+
+struct Options {
+    std::string model;
+    std::string lib_dir = ".";
+    std::string out;
+    std::string trace;
+    int threads = 4;
+    int n_ctx = 2048;
+    int runs = 3;
+    int gen = 64;
+    int rag_docs = 2000;
+    int rag_queries = 200;
+};
+
+double now_ms() {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Fixed-seed LCG, so every build sees the same RAG corpus and queries
+struct Rng {
+    uint64_t state;
+    explicit Rng(uint64_t seed) : state(seed) {}
+    uint32_t next() {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return (uint32_t)(state >> 33);
+    }
+    float unit() { return (next() & 0xffffff) / float(0x1000000) * 2.0f - 1.0f; }
+};
+
+std::string random_text(Rng& rng, int n_words) {
+    std::string text;
+    for (int i = 0; i < n_words; i++) {
+        if (i > 0) text += ' ';
+        text += WORDS[rng.next() % N_WORDS];
+    }
+    return text;
+}
+
+std::vector<float> random_vector(Rng& rng, size_t n) {
+    std::vector<float> values(n);
+    for (float& v : values) v = rng.unit();
+    return values;
+}
+
+bool parse_args(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--model") options.model = value;
+        else if (arg == "--lib-dir") options.lib_dir = value;
+        else if (arg == "--out") options.out = value;
+        else if (arg == "--trace") options.trace = value;
+        else if (arg == "--threads") options.threads = atoi(value);
+        else if (arg == "--ctx") options.n_ctx = atoi(value);
+        else if (arg == "--runs") options.runs = atoi(value);
+        else if (arg == "--gen") options.gen = atoi(value);
+        else if (arg == "--rag-docs") options.rag_docs = atoi(value);
+        else if (arg == "--rag-queries") options.rag_queries = atoi(value);
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    if (options.model.empty()) {
+        fprintf(stderr, "--model is required\n");
+        return false;
+    }
+    return true;
+}
+
+class Metrics {
+public:
+    void add(const std::string& name, double value) {
+        values_.emplace_back(name, value);
+        printf("%-28s %12.3f\n", name.c_str(), value);
+    }
+
+    bool write(const std::string& path) const {
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f) return false;
+        for (const auto& [name, value] : values_) {
+            fprintf(f, "%s %.6f\n", name.c_str(), value);
+        }
+        return fclose(f) == 0;
+    }
+
+private:
+    std::vector<std::pair<std::string, double>> values_;
+};
+
+double median(std::vector<double> values) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2.0;
+}
+
+// Prefill and decode, one conversation turn per prompt per run. The system
+// prompt is re-set between turns, which drops the turn but keeps the
+// system prompt's KV.
+bool bench_generation(JNIEnv* env, const Options& options, Metrics& metrics) {
+    std::vector<double> prefill_tps, decode_tps, prefill_ms;
+    int total_generated = 0;
+
+    for (int run = 0; run < options.runs; run++) {
+        for (const char* prompt : PROMPTS) {
+            if (ENGINE(nativeSetSystemPrompt)(env, nullptr, jni_shim_string(SYSTEM_PROMPT)) != 0) {
+                fprintf(stderr, "nativeSetSystemPrompt failed\n");
+                return false;
+            }
+            jintArray tokens = ENGINE(nativeTokenize)(env, nullptr, jni_shim_string(prompt), JNI_FALSE);
+            int n_prompt = std::max(1, (int)env->GetArrayLength(tokens));
+
+            double start = now_ms();
+            if (ENGINE(nativeStartGeneration)(env, nullptr, jni_shim_string(prompt), options.gen) != 0) {
+                fprintf(stderr, "nativeStartGeneration failed\n");
+                return false;
+            }
+            double prefilled = now_ms();
+
+            int generated = 0;
+            while (generated < options.gen && ENGINE(nativeGetNextToken)(env, nullptr) != nullptr) {
+                generated++;
+            }
+            double decoded = now_ms();
+
+            prefill_ms.push_back(prefilled - start);
+            prefill_tps.push_back(n_prompt * 1000.0 / std::max(prefilled - start, 1e-3));
+            if (generated > 0) {
+                decode_tps.push_back(generated * 1000.0 / std::max(decoded - prefilled, 1e-3));
+            }
+            total_generated += generated;
+            jni_shim_release_all();
+        }
+    }
+
+    metrics.add("prefill_ms", median(prefill_ms));
+    metrics.add("prefill_tokens_per_s", median(prefill_tps));
+    metrics.add("decode_tokens_per_s", median(decode_tps));
+    metrics.add("generated_tokens", total_generated);
+    return true;
+}
+
+// Hybrid BM25 + dense retrieval with context packing over a synthetic corpus
+bool bench_rag(JNIEnv* env, const Options& options, Metrics& metrics) {
+    Rng rng(42);
+    std::vector<std::string> ids, contents;
+    for (int i = 0; i < options.rag_docs; i++) {
+        ids.push_back("doc-" + std::to_string(i));
+        contents.push_back(random_text(rng, 40 + (int)(rng.next() % 160)));
+    }
+    std::vector<float> embeddings = random_vector(rng, (size_t)options.rag_docs * RAG_DIM);
+
+    jstring index = jni_shim_string("bench");
+    double start = now_ms();
+    jint ret = RAG(nativeCreateIndex)(env, nullptr, index, jni_shim_string_array(ids),
+                                      jni_shim_string_array(contents),
+                                      jni_shim_float_array(embeddings), RAG_DIM);
+    double built = now_ms();
+    if (ret != 0) {
+        fprintf(stderr, "nativeCreateIndex failed: %d\n", ret);
+        return false;
+    }
+
+    std::vector<double> query_ms;
+    for (int i = 0; i < options.rag_queries; i++) {
+        jstring query = jni_shim_string(random_text(rng, 4 + (int)(rng.next() % 8)));
+        jfloatArray query_vec = jni_shim_float_array(random_vector(rng, RAG_DIM));
+        // Alternate fusion modes so both paths get profiled
+        double t0 = now_ms();
+        jstring packed = RAG(nativeQueryForContext)(env, nullptr, index, query, query_vec,
+                                                    RAG_TOP_K, i % 2, 0.5f, RAG_TOKEN_BUDGET, 0);
+        query_ms.push_back(now_ms() - t0);
+        if (!packed) {
+            fprintf(stderr, "nativeQueryForContext failed\n");
+            return false;
+        }
+    }
+    RAG(nativeDeleteIndex)(env, nullptr, index);
+    jni_shim_release_all();
+
+    metrics.add("rag_index_ms", built - start);
+    metrics.add("rag_query_ms", median(query_ms));
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        return 2;
+    }
+
+    JNIEnv* env = jni_shim_env();
+    Metrics metrics;
+
+    if (ENGINE(nativeInit)(env, nullptr, jni_shim_string(options.lib_dir)) != 0) {
+        fprintf(stderr, "nativeInit failed\n");
+        return 1;
+    }
+    printf("%s\n", jni_shim_to_string(ENGINE(nativeGetSystemInfo)(env, nullptr)).c_str());
+
+    double start = now_ms();
+    if (ENGINE(nativeLoadModel)(env, nullptr, jni_shim_string(options.model),
+                                options.n_ctx, options.threads) != 0) {
+        fprintf(stderr, "Failed to load %s\n", options.model.c_str());
+        return 1;
+    }
+    metrics.add("load_ms", now_ms() - start);
+
+    if (!options.trace.empty()) {
+        ENGINE(nativeSetTracing)(env, nullptr, JNI_TRUE, JNI_TRUE);
+    }
+
+    double total = now_ms();
+    bool ok = bench_generation(env, options, metrics) && bench_rag(env, options, metrics);
+    metrics.add("total_ms", now_ms() - total);
+
+    if (!options.trace.empty()) {
+        const std::string& path = options.trace;
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        // 0 = Chrome JSON, 1 = Perfetto (TraceFormat in trace.h)
+        if (ENGINE(nativeDumpTrace)(env, nullptr, jni_shim_string(path), json ? 0 : 1) < 0) {
+            fprintf(stderr, "Failed to write %s\n", path.c_str());
+        }
+        ENGINE(nativeSetTracing)(env, nullptr, JNI_FALSE, JNI_TRUE);
+    }
+
+    ENGINE(nativeUnloadModel)(env, nullptr);
+    ENGINE(nativeShutdown)(env, nullptr);
+    jni_shim_release_all();
+
+    if (!ok) {
+        return 1;
+    }
+    if (!options.out.empty() && !metrics.write(options.out)) {
+        fprintf(stderr, "Failed to write %s\n", options.out.c_str());
+        return 1;
+    }
+    return 0;
+}
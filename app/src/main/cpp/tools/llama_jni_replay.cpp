@@ -0,0 +1,339 @@
+/**
+ * llama-jni-replay: re-runs a request log (see request_log.h) through
+ * libllama-jni.so's JNI entry points, recording the replay into a second
+ * log, and compares the two: token streams request by request, n-best
+ * texts, then prefill and per-token latency percentiles.
+ *
+ *   llama-jni-replay --log recorded.ljrl [--model other.gguf] [--lib-dir DIR]
+ *                    [--threads N] [--out replayed.ljrl] [--report report.md]
+ *
+ * Logs are recorded with a fixed sampler seed, so the same build on the
+ * same model reproduces them exactly; a token mismatch after a change
+ * means the change altered the model's output, not just its speed.
+ * Exits 1 on any mismatch.
+ */
+
+#include <jni.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "jni_shim.h"
+#include "../request_log.h"
+
+#define ENGINE(name) Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_##name
+
+extern "C" {
+jint ENGINE(nativeInit)(JNIEnv*, jobject, jstring);
+jint ENGINE(nativeLoadModel)(JNIEnv*, jobject, jstring, jint, jint);
+jint ENGINE(nativeSetSystemPrompt)(JNIEnv*, jobject, jstring);
+jint ENGINE(nativeSetGrammar)(JNIEnv*, jobject, jstring, jboolean);
+jint ENGINE(nativeSetSeed)(JNIEnv*, jobject, jlong);
+jint ENGINE(nativeStartGeneration)(JNIEnv*, jobject, jstring, jint);
+jstring ENGINE(nativeGetNextToken)(JNIEnv*, jobject);
+jobjectArray ENGINE(nativeGenerateNBest)(JNIEnv*, jobject, jstring, jint, jint, jfloat, jfloatArray);
+void ENGINE(nativeStopGeneration)(JNIEnv*, jobject);
+jint ENGINE(nativeStartRecording)(JNIEnv*, jobject, jstring, jlong);
+void ENGINE(nativeStopRecording)(JNIEnv*, jobject);
+jstring ENGINE(nativeGetSystemInfo)(JNIEnv*, jobject);
+void ENGINE(nativeUnloadModel)(JNIEnv*, jobject);
+void ENGINE(nativeShutdown)(JNIEnv*, jobject);
+}
+
+namespace {
+
+// LLAMA_DEFAULT_SEED, i.e. no fixed seed
+constexpr uint32_t RANDOM_SEED = 0xFFFFFFFF;
+
+struct Options {
+    std::string log;
+    std::string model;
+    std::string lib_dir = ".";
+    std::string out = "replay.ljrl";
+    std::string report;
+    int threads = 0;
+};
+
+bool parse_args(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--log") options.log = value;
+        else if (arg == "--model") options.model = value;
+        else if (arg == "--lib-dir") options.lib_dir = value;
+        else if (arg == "--out") options.out = value;
+        else if (arg == "--report") options.report = value;
+        else if (arg == "--threads") options.threads = atoi(value);
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    if (options.log.empty()) {
+        fprintf(stderr, "--log is required\n");
+        return false;
+    }
+    return true;
+}
+
+jlong seed_arg(uint32_t seed) {
+    return seed == RANDOM_SEED ? -1 : (jlong)seed;
+}
+
+// Feed every recorded request to the engine again. The engine records
+// the replay itself, into options.out.
+bool replay(JNIEnv* env, const Options& options, const std::vector<LoggedRequest>& requests) {
+    uint32_t seed = RANDOM_SEED;
+    for (const LoggedRequest& r : requests) {
+        if (r.type == REQUEST_LOG_SESSION) {
+            seed = r.session.seed;
+            break;
+        }
+    }
+    if (ENGINE(nativeStartRecording)(env, nullptr, jni_shim_string(options.out), seed_arg(seed)) != 0) {
+        fprintf(stderr, "Cannot record to %s\n", options.out.c_str());
+        return false;
+    }
+
+    bool loaded = false;
+    for (const LoggedRequest& r : requests) {
+        switch (r.type) {
+            case REQUEST_LOG_SESSION: {
+                const LoggedSession& s = r.session;
+                const std::string& model = options.model.empty() ? s.model_path : options.model;
+                int threads = options.threads > 0 ? options.threads : s.n_threads;
+                if (ENGINE(nativeLoadModel)(env, nullptr, jni_shim_string(model), s.n_ctx, threads) != 0) {
+                    fprintf(stderr, "Failed to load %s\n", model.c_str());
+                    return false;
+                }
+                ENGINE(nativeSetSeed)(env, nullptr, seed_arg(s.seed));
+                seed = s.seed;
+                loaded = true;
+                break;
+            }
+            case REQUEST_LOG_SYSTEM_PROMPT:
+                if (loaded) {
+                    ENGINE(nativeSetSystemPrompt)(env, nullptr, jni_shim_string(r.system_prompt.text));
+                }
+                break;
+            case REQUEST_LOG_GENERATION: {
+                const LoggedGeneration& g = r.generation;
+                if (!loaded) break;
+                if (g.seed != seed) {
+                    ENGINE(nativeSetSeed)(env, nullptr, seed_arg(g.seed));
+                    seed = g.seed;
+                }
+                ENGINE(nativeSetGrammar)(env, nullptr,
+                                         g.grammar.empty() ? nullptr : jni_shim_string(g.grammar),
+                                         JNI_FALSE);
+                if (ENGINE(nativeStartGeneration)(env, nullptr, jni_shim_string(g.prompt), g.max_tokens) != 0) {
+                    break;
+                }
+                // Pull as many tokens as the app did: all of them when the
+                // model ended the reply, otherwise as many as it consumed
+                size_t limit = g.end == GENERATION_END_EOG ? (size_t)std::max(g.max_tokens, 0) : g.tokens.size();
+                size_t pulled = 0;
+                while (pulled < limit && ENGINE(nativeGetNextToken)(env, nullptr) != nullptr) {
+                    pulled++;
+                }
+                if (g.end == GENERATION_END_CANCELLED) {
+                    ENGINE(nativeStopGeneration)(env, nullptr);
+                }
+                break;
+            }
+            case REQUEST_LOG_NBEST: {
+                const LoggedNBest& b = r.nbest;
+                if (!loaded) break;
+                if (b.seed != seed) {
+                    ENGINE(nativeSetSeed)(env, nullptr, seed_arg(b.seed));
+                    seed = b.seed;
+                }
+                int n = (int)b.texts.size();
+                ENGINE(nativeGenerateNBest)(env, nullptr, jni_shim_string(b.prompt), n, b.max_tokens,
+                                            b.temperature, jni_shim_float_array(std::vector<float>(n)));
+                break;
+            }
+        }
+        jni_shim_release_all();
+    }
+
+    ENGINE(nativeStopRecording)(env, nullptr);
+    return true;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t i = (size_t)(p * (values.size() - 1) + 0.5);
+    return values[std::min(i, values.size() - 1)];
+}
+
+struct Timings {
+    std::vector<double> prefill_ms;
+    std::vector<double> token_ms;
+    int64_t tokens = 0;
+    int64_t decode_us = 0;
+
+    void add(const LoggedGeneration& g) {
+        prefill_ms.push_back(g.prefill_us / 1000.0);
+        for (int32_t us : g.token_us) {
+            token_ms.push_back(us / 1000.0);
+            decode_us += us;
+        }
+        tokens += (int64_t)g.tokens.size();
+    }
+
+    double decode_tokens_per_s() const {
+        return decode_us > 0 ? tokens * 1e6 / decode_us : 0.0;
+    }
+};
+
+std::vector<const LoggedGeneration*> generations(const std::vector<LoggedRequest>& requests) {
+    std::vector<const LoggedGeneration*> out;
+    for (const LoggedRequest& r : requests) {
+        if (r.type == REQUEST_LOG_GENERATION) {
+            out.push_back(&r.generation);
+        }
+    }
+    return out;
+}
+
+std::vector<const LoggedNBest*> nbests(const std::vector<LoggedRequest>& requests) {
+    std::vector<const LoggedNBest*> out;
+    for (const LoggedRequest& r : requests) {
+        if (r.type == REQUEST_LOG_NBEST) {
+            out.push_back(&r.nbest);
+        }
+    }
+    return out;
+}
+
+// Markdown report on stdout (and --report); returns the mismatch count
+int compare(const Options& options, const std::vector<LoggedRequest>& recorded,
+            const std::vector<LoggedRequest>& replayed) {
+    std::vector<const LoggedGeneration*> a = generations(recorded);
+    std::vector<const LoggedGeneration*> b = generations(replayed);
+
+    std::string report = "# Replay of " + options.log + "\n\n";
+    int mismatches = 0;
+    char line[256];
+
+    if (a.size() != b.size()) {
+        snprintf(line, sizeof(line), "Recorded %zu generations, replayed %zu.\n\n", a.size(), b.size());
+        report += line;
+        mismatches++;
+    }
+
+    Timings ta, tb;
+    for (size_t i = 0; i < std::min(a.size(), b.size()); i++) {
+        const LoggedGeneration& ga = *a[i];
+        const LoggedGeneration& gb = *b[i];
+        ta.add(ga);
+        tb.add(gb);
+        if (ga.tokens == gb.tokens) {
+            continue;
+        }
+        size_t at = 0;
+        while (at < ga.tokens.size() && at < gb.tokens.size() && ga.tokens[at] == gb.tokens[at]) {
+            at++;
+        }
+        snprintf(line, sizeof(line),
+                 "- generation %zu: diverges at token %zu (%zu recorded, %zu replayed)\n",
+                 i, at, ga.tokens.size(), gb.tokens.size());
+        report += line;
+        mismatches++;
+    }
+
+    std::vector<const LoggedNBest*> na = nbests(recorded);
+    std::vector<const LoggedNBest*> nb = nbests(replayed);
+    if (na.size() != nb.size()) {
+        snprintf(line, sizeof(line), "Recorded %zu n-best requests, replayed %zu.\n", na.size(), nb.size());
+        report += line;
+        mismatches++;
+    }
+    for (size_t i = 0; i < std::min(na.size(), nb.size()); i++) {
+        if (na[i]->texts != nb[i]->texts) {
+            snprintf(line, sizeof(line), "- n-best %zu: branch texts differ\n", i);
+            report += line;
+            mismatches++;
+        }
+    }
+
+    if (mismatches == 0) {
+        snprintf(line, sizeof(line), "All %zu generations match token for token, and all %zu n-best requests.\n",
+                 a.size(), na.size());
+        report += line;
+    }
+
+    report += "\n| metric | recorded | replayed |\n|---|---:|---:|\n";
+    auto row = [&](const char* name, double recorded_value, double replayed_value) {
+        snprintf(line, sizeof(line), "| %s | %.2f | %.2f |\n", name, recorded_value, replayed_value);
+        report += line;
+    };
+    row("prefill p50 (ms)", percentile(ta.prefill_ms, 0.50), percentile(tb.prefill_ms, 0.50));
+    row("prefill p90 (ms)", percentile(ta.prefill_ms, 0.90), percentile(tb.prefill_ms, 0.90));
+    row("prefill p99 (ms)", percentile(ta.prefill_ms, 0.99), percentile(tb.prefill_ms, 0.99));
+    row("token p50 (ms)", percentile(ta.token_ms, 0.50), percentile(tb.token_ms, 0.50));
+    row("token p90 (ms)", percentile(ta.token_ms, 0.90), percentile(tb.token_ms, 0.90));
+    row("token p99 (ms)", percentile(ta.token_ms, 0.99), percentile(tb.token_ms, 0.99));
+    row("decode tokens/s", ta.decode_tokens_per_s(), tb.decode_tokens_per_s());
+
+    fputs(report.c_str(), stdout);
+    if (!options.report.empty()) {
+        FILE* f = fopen(options.report.c_str(), "w");
+        if (!f || fputs(report.c_str(), f) < 0) {
+            fprintf(stderr, "Failed to write %s\n", options.report.c_str());
+        }
+        if (f) fclose(f);
+    }
+    return mismatches;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        return 2;
+    }
+
+    std::vector<LoggedRequest> recorded;
+    std::string error;
+    if (!request_log_read(options.log, recorded, error)) {
+        fprintf(stderr, "%s: %s\n", options.log.c_str(), error.c_str());
+        return 2;
+    }
+    if (!error.empty()) {
+        fprintf(stderr, "%s: %s, replaying what was read\n", options.log.c_str(), error.c_str());
+    }
+
+    JNIEnv* env = jni_shim_env();
+    if (ENGINE(nativeInit)(env, nullptr, jni_shim_string(options.lib_dir)) != 0) {
+        fprintf(stderr, "nativeInit failed\n");
+        return 1;
+    }
+    printf("%s\n", jni_shim_to_string(ENGINE(nativeGetSystemInfo)(env, nullptr)).c_str());
+
+    bool ok = replay(env, options, recorded);
+    ENGINE(nativeUnloadModel)(env, nullptr);
+    ENGINE(nativeShutdown)(env, nullptr);
+    jni_shim_release_all();
+    if (!ok) {
+        return 1;
+    }
+
+    std::vector<LoggedRequest> replayed;
+    error.clear();
+    if (!request_log_read(options.out, replayed, error)) {
+        fprintf(stderr, "%s: %s\n", options.out.c_str(), error.c_str());
+        return 1;
+    }
+    return compare(options, recorded, replayed) == 0 ? 0 : 1;
+}
@@ -0,0 +1,575 @@
+/**
+ * llama-jni-tiny-gguf: writes a small random-weight GGUF that llama.cpp
+ * loads like a real model, so engine benchmarks and tests run offline in
+ * seconds instead of on a multi-GB download.
+ *
+ *   llama-jni-tiny-gguf --out tiny.gguf [--arch llama|qwen2|qwen3]
+ *                       [--layers N] [--embd N] [--ff N] [--heads N]
+ *                       [--heads-kv N] [--vocab N] [--ctx N]
+ *                       [--type f32|f16|q8_0|q4_0] [--seed N]
+ *
+ * llama gets a SentencePiece vocab with byte fallback, qwen2/qwen3 a
+ * byte-level BPE vocab with merges, so tokenization takes the same paths
+ * as with real models. Weights are uniform in +-1/sqrt(fan-in) from a
+ * fixed-seed generator: the same arguments always give the same file, and
+ * the output is gibberish but finite. Needs nothing but a C++ compiler.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t GGUF_MAGIC = 0x46554747; // "GGUF" little-endian
+constexpr uint32_t GGUF_VERSION = 3;
+constexpr uint64_t GGUF_ALIGNMENT = 32;
+
+enum GgufType : uint32_t {
+    GGUF_TYPE_UINT32 = 4,
+    GGUF_TYPE_INT32 = 5,
+    GGUF_TYPE_FLOAT32 = 6,
+    GGUF_TYPE_BOOL = 7,
+    GGUF_TYPE_STRING = 8,
+    GGUF_TYPE_ARRAY = 9,
+};
+
+// ggml_type ids and the matching llama_ftype ("general.file_type")
+struct TensorType {
+    const char* name;
+    uint32_t ggml_type;
+    uint32_t file_type;
+    uint32_t block;       // values per block
+    uint32_t block_bytes;
+};
+
+const TensorType TYPE_F32 = {"f32", 0, 0, 1, 4};
+const TensorType TENSOR_TYPES[] = {
+    TYPE_F32,
+    {"f16", 1, 1, 1, 2},
+    {"q4_0", 2, 2, 32, 18},
+    {"q8_0", 8, 7, 32, 34},
+};
+
+// SentencePiece / llama token types
+enum TokenType : int32_t {
+    TOKEN_NORMAL = 1,
+    TOKEN_UNKNOWN = 2,
+    TOKEN_CONTROL = 3,
+    TOKEN_BYTE = 6,
+};
+
+struct Options {
+    std::string out;
+    std::string arch = "llama";
+    int layers = 2;
+    int embd = 128;
+    int ff = 384;
+    int heads = 4;
+    int heads_kv = 2;
+    int vocab = 1024;
+    int ctx = 2048;
+    const TensorType* type = &TENSOR_TYPES[3];
+    uint64_t seed = 42;
+};
+
+// splitmix64: fixed output on every platform, unlike <random> distributions
+struct Rng {
+    uint64_t state;
+    explicit Rng(uint64_t seed) : state(seed) {}
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    // Uniform in [-1, 1)
+    float unit() { return (float)((next() >> 40) / double(1ull << 24) * 2.0 - 1.0); }
+};
+
+uint16_t fp32_to_fp16(float value) {
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t exp = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+    if (exp >= 31) {
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (exp <= 0) {
+        if (exp < -10) return (uint16_t)sign;
+        // Subnormal: shift in the implicit bit, round to nearest even
+        mant |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exp);
+        uint32_t half = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rest > mid || (rest == mid && (half & 1))) half++;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = sign | ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rest = mant & 0x1fff;
+    // A carry out of the mantissa correctly bumps the exponent
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+    return (uint16_t)half;
+}
+
+void append_bytes(std::string& out, const void* data, size_t size) {
+    out.append((const char*)data, size);
+}
+
+template <typename T>
+void append(std::string& out, T value) {
+    append_bytes(out, &value, sizeof(value));
+}
+
+void append_string(std::string& out, const std::string& value) {
+    append<uint64_t>(out, value.size());
+    out += value;
+}
+
+// Row-major values in ggml's block layouts (see ggml-quants.c)
+std::string encode(const std::vector<float>& values, const TensorType& type) {
+    std::string out;
+    const size_t n = values.size();
+    switch (type.ggml_type) {
+        case 0:
+            append_bytes(out, values.data(), n * sizeof(float));
+            break;
+        case 1:
+            for (float v : values) append<uint16_t>(out, fp32_to_fp16(v));
+            break;
+        case 2:
+            for (size_t b = 0; b < n; b += 32) {
+                const float* x = &values[b];
+                float amax = 0.0f, max = 0.0f;
+                for (int j = 0; j < 32; j++) {
+                    if (fabsf(x[j]) > amax) {
+                        amax = fabsf(x[j]);
+                        max = x[j];
+                    }
+                }
+                const float d = max / -8;
+                const float id = d ? 1.0f / d : 0.0f;
+                append<uint16_t>(out, fp32_to_fp16(d));
+                for (int j = 0; j < 16; j++) {
+                    uint8_t lo = (uint8_t)std::min(15, (int)(x[j] * id + 8.5f));
+                    uint8_t hi = (uint8_t)std::min(15, (int)(x[j + 16] * id + 8.5f));
+                    append<uint8_t>(out, (uint8_t)(lo | (hi << 4)));
+                }
+            }
+            break;
+        case 8:
+            for (size_t b = 0; b < n; b += 32) {
+                const float* x = &values[b];
+                float amax = 0.0f;
+                for (int j = 0; j < 32; j++) amax = std::max(amax, fabsf(x[j]));
+                const float d = amax / 127;
+                const float id = d ? 1.0f / d : 0.0f;
+                append<uint16_t>(out, fp32_to_fp16(d));
+                for (int j = 0; j < 32; j++) {
+                    append<int8_t>(out, (int8_t)roundf(x[j] * id));
+                }
+            }
+            break;
+    }
+    return out;
+}
+
+class GgufWriter {
+public:
+    void add_u32(const std::string& key, uint32_t value) {
+        begin_kv(key, GGUF_TYPE_UINT32);
+        append(kv_, value);
+    }
+
+    void add_f32(const std::string& key, float value) {
+        begin_kv(key, GGUF_TYPE_FLOAT32);
+        append(kv_, value);
+    }
+
+    void add_bool(const std::string& key, bool value) {
+        begin_kv(key, GGUF_TYPE_BOOL);
+        append<uint8_t>(kv_, value ? 1 : 0);
+    }
+
+    void add_string(const std::string& key, const std::string& value) {
+        begin_kv(key, GGUF_TYPE_STRING);
+        append_string(kv_, value);
+    }
+
+    void add_strings(const std::string& key, const std::vector<std::string>& values) {
+        begin_array(key, GGUF_TYPE_STRING, values.size());
+        for (const auto& v : values) append_string(kv_, v);
+    }
+
+    void add_floats(const std::string& key, const std::vector<float>& values) {
+        begin_array(key, GGUF_TYPE_FLOAT32, values.size());
+        append_bytes(kv_, values.data(), values.size() * sizeof(float));
+    }
+
+    void add_ints(const std::string& key, const std::vector<int32_t>& values) {
+        begin_array(key, GGUF_TYPE_INT32, values.size());
+        append_bytes(kv_, values.data(), values.size() * sizeof(int32_t));
+    }
+
+    // dims are ggml ne[]: the row length first
+    void add_tensor(const std::string& name, std::vector<uint64_t> dims,
+                    const TensorType& type, std::string data) {
+        tensors_.push_back({name, std::move(dims), type.ggml_type, std::move(data)});
+    }
+
+    bool write(const std::string& path) const {
+        std::string header;
+        append(header, GGUF_MAGIC);
+        append(header, GGUF_VERSION);
+        append<uint64_t>(header, tensors_.size());
+        append<uint64_t>(header, n_kv_);
+        header += kv_;
+
+        uint64_t offset = 0;
+        for (const Tensor& t : tensors_) {
+            append_string(header, t.name);
+            append<uint32_t>(header, (uint32_t)t.dims.size());
+            for (uint64_t d : t.dims) append(header, d);
+            append(header, t.type);
+            append(header, offset);
+            offset = pad(offset + t.data.size());
+        }
+        header.resize(pad(header.size()), '\0');
+
+        FILE* f = fopen(path.c_str(), "wb");
+        if (!f) return false;
+        bool ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+        for (const Tensor& t : tensors_) {
+            std::string padding(pad(t.data.size()) - t.data.size(), '\0');
+            ok = ok && fwrite(t.data.data(), 1, t.data.size(), f) == t.data.size();
+            ok = ok && fwrite(padding.data(), 1, padding.size(), f) == padding.size();
+        }
+        return fclose(f) == 0 && ok;
+    }
+
+private:
+    struct Tensor {
+        std::string name;
+        std::vector<uint64_t> dims;
+        uint32_t type;
+        std::string data;
+    };
+
+    static uint64_t pad(uint64_t n) {
+        return (n + GGUF_ALIGNMENT - 1) / GGUF_ALIGNMENT * GGUF_ALIGNMENT;
+    }
+
+    void begin_kv(const std::string& key, uint32_t type) {
+        append_string(kv_, key);
+        append(kv_, type);
+        n_kv_++;
+    }
+
+    void begin_array(const std::string& key, uint32_t elem_type, uint64_t count) {
+        begin_kv(key, GGUF_TYPE_ARRAY);
+        append(kv_, elem_type);
+        append(kv_, count);
+    }
+
+    std::string kv_;
+    uint64_t n_kv_ = 0;
+    std::vector<Tensor> tensors_;
+};
+
+// Lowercase letters, most frequent first, for made-up vocab pieces
+const char ALPHABET[] = "etaoinshrdlucmfwypvbgkjqxz";
+constexpr int N_ALPHABET = sizeof(ALPHABET) - 1;
+
+// Calls emit(piece) for every letter string of length 1, 2, ... in order
+// until it returns false
+template <typename F>
+void for_each_piece(F emit) {
+    for (int len = 1;; len++) {
+        std::vector<int> digits(len, 0);
+        while (true) {
+            std::string piece;
+            for (int d : digits) piece += ALPHABET[d];
+            if (!emit(piece)) return;
+            int i = len - 1;
+            while (i >= 0 && ++digits[i] == N_ALPHABET) digits[i--] = 0;
+            if (i < 0) break;
+        }
+    }
+}
+
+// SentencePiece: <unk> <s> </s>, the 256 byte-fallback tokens, then
+// pieces scored so that longer ones lose to shorter ones
+void add_spm_vocab(GgufWriter& gguf, int n_vocab) {
+    std::vector<std::string> tokens = {"<unk>", "<s>", "</s>"};
+    std::vector<int32_t> types = {TOKEN_UNKNOWN, TOKEN_CONTROL, TOKEN_CONTROL};
+    for (int b = 0; b < 256; b++) {
+        char piece[8];
+        snprintf(piece, sizeof(piece), "<0x%02X>", b);
+        tokens.push_back(piece);
+        types.push_back(TOKEN_BYTE);
+    }
+    const std::string space = "\xe2\x96\x81"; // U+2581, SentencePiece's space
+    tokens.push_back(space);
+    types.push_back(TOKEN_NORMAL);
+    for_each_piece([&](const std::string& piece) {
+        for (const std::string& p : {space + piece, piece}) {
+            if ((int)tokens.size() >= n_vocab) return false;
+            tokens.push_back(p);
+            types.push_back(TOKEN_NORMAL);
+        }
+        return true;
+    });
+
+    std::vector<float> scores(tokens.size(), 0.0f);
+    for (size_t i = 0; i < tokens.size(); i++) {
+        if (types[i] == TOKEN_NORMAL) scores[i] = -(float)i;
+    }
+
+    gguf.add_string("tokenizer.ggml.model", "llama");
+    gguf.add_strings("tokenizer.ggml.tokens", tokens);
+    gguf.add_floats("tokenizer.ggml.scores", scores);
+    gguf.add_ints("tokenizer.ggml.token_type", types);
+    gguf.add_u32("tokenizer.ggml.unknown_token_id", 0);
+    gguf.add_u32("tokenizer.ggml.bos_token_id", 1);
+    gguf.add_u32("tokenizer.ggml.eos_token_id", 2);
+    gguf.add_bool("tokenizer.ggml.add_bos_token", true);
+}
+
+std::string utf8(uint32_t cp) {
+    std::string out;
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xc0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3f));
+    } else {
+        out += (char)(0xe0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
+    }
+    return out;
+}
+
+// GPT-2 byte-level BPE as Qwen uses it: the 256 byte symbols, merged
+// pieces (with and without a leading space, "Ġ"), then the chat specials
+void add_bpe_vocab(GgufWriter& gguf, int n_vocab) {
+    // bytes_to_unicode(): printable Latin-1 maps to itself, the rest to U+0100+
+    std::vector<std::string> byte_symbol(256);
+    uint32_t next = 256;
+    for (int b = 0; b < 256; b++) {
+        bool printable = (b >= '!' && b <= '~') || (b >= 0xa1 && b <= 0xac) || (b >= 0xae && b <= 0xff);
+        byte_symbol[b] = utf8(printable ? (uint32_t)b : next++);
+    }
+
+    const std::vector<std::string> specials = {"<|endoftext|>", "<|im_start|>", "<|im_end|>"};
+    const int n_pieces = n_vocab - (int)specials.size();
+
+    std::vector<std::string> tokens(byte_symbol);
+    std::vector<std::string> merges;
+    const std::string space = byte_symbol[' '];
+    for_each_piece([&](const std::string& piece) {
+        // "ab" merges as "a b", "Ġab" as "Ġa b"; shorter ones came first
+        std::string head = piece.substr(0, piece.size() - 1);
+        std::string tail = piece.substr(piece.size() - 1);
+        if (!head.empty()) {
+            if ((int)tokens.size() >= n_pieces) return false;
+            tokens.push_back(piece);
+            merges.push_back(head + " " + tail);
+        }
+        if ((int)tokens.size() >= n_pieces) return false;
+        tokens.push_back(space + piece);
+        merges.push_back(space + head + " " + tail);
+        return true;
+    });
+
+    std::vector<int32_t> types(tokens.size(), TOKEN_NORMAL);
+    for (const std::string& s : specials) {
+        tokens.push_back(s);
+        types.push_back(TOKEN_CONTROL);
+    }
+    const uint32_t endoftext = (uint32_t)n_pieces;
+
+    gguf.add_string("tokenizer.ggml.model", "gpt2");
+    gguf.add_string("tokenizer.ggml.pre", "qwen2");
+    gguf.add_strings("tokenizer.ggml.tokens", tokens);
+    gguf.add_ints("tokenizer.ggml.token_type", types);
+    gguf.add_strings("tokenizer.ggml.merges", merges);
+    gguf.add_u32("tokenizer.ggml.bos_token_id", endoftext);
+    gguf.add_u32("tokenizer.ggml.eos_token_id", endoftext + 2);
+    gguf.add_u32("tokenizer.ggml.padding_token_id", endoftext);
+    gguf.add_bool("tokenizer.ggml.add_bos_token", false);
+}
+
+class Weights {
+public:
+    Weights(GgufWriter& gguf, const Options& options) : gguf_(gguf), options_(options), rng_(options.seed) {}
+
+    // [n_in, n_out] in ne[] order, in the quant type
+    void matrix(const std::string& name, int n_in, int n_out) {
+        std::vector<float> values((size_t)n_in * n_out);
+        const float scale = 1.0f / sqrtf((float)n_in);
+        for (float& v : values) v = rng_.unit() * scale;
+        gguf_.add_tensor(name, {(uint64_t)n_in, (uint64_t)n_out}, *options_.type,
+                         encode(values, *options_.type));
+        n_params_ += values.size();
+    }
+
+    // Norm weights (ones) and biases (small), always f32
+    void vector(const std::string& name, int n, float base, float jitter) {
+        std::vector<float> values(n);
+        for (float& v : values) v = base + rng_.unit() * jitter;
+        gguf_.add_tensor(name, {(uint64_t)n}, TYPE_F32, encode(values, TYPE_F32));
+        n_params_ += values.size();
+    }
+
+    uint64_t n_params() const { return n_params_; }
+
+private:
+    GgufWriter& gguf_;
+    const Options& options_;
+    Rng rng_;
+    uint64_t n_params_ = 0;
+};
+
+bool parse_args(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--out") options.out = value;
+        else if (arg == "--arch") options.arch = value;
+        else if (arg == "--layers") options.layers = atoi(value);
+        else if (arg == "--embd") options.embd = atoi(value);
+        else if (arg == "--ff") options.ff = atoi(value);
+        else if (arg == "--heads") options.heads = atoi(value);
+        else if (arg == "--heads-kv") options.heads_kv = atoi(value);
+        else if (arg == "--vocab") options.vocab = atoi(value);
+        else if (arg == "--ctx") options.ctx = atoi(value);
+        else if (arg == "--seed") options.seed = strtoull(value, nullptr, 10);
+        else if (arg == "--type") {
+            options.type = nullptr;
+            for (const TensorType& t : TENSOR_TYPES) {
+                if (t.name == std::string(value)) options.type = &t;
+            }
+            if (!options.type) {
+                fprintf(stderr, "Unknown --type %s (f32, f16, q8_0, q4_0)\n", value);
+                return false;
+            }
+        } else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if (options.arch == "qwen") options.arch = "qwen2";
+    if (options.arch != "llama" && options.arch != "qwen2" && options.arch != "qwen3") {
+        fprintf(stderr, "Unknown --arch %s (llama, qwen2, qwen3)\n", options.arch.c_str());
+        return false;
+    }
+    if (options.out.empty()) {
+        fprintf(stderr, "--out is required\n");
+        return false;
+    }
+    if (options.layers < 1 || options.heads < 1 || options.heads_kv < 1 || options.ctx < 1 ||
+        options.heads % options.heads_kv != 0 || options.embd % options.heads != 0) {
+        fprintf(stderr, "Need layers, heads, heads-kv >= 1, heads a multiple of heads-kv "
+                        "and embd a multiple of heads\n");
+        return false;
+    }
+    // Quantized rows are whole blocks; ffn_down's rows are n_ff long
+    const int block = (int)options.type->block;
+    if (options.embd % block != 0 || options.ff % block != 0 || options.ff < 1) {
+        fprintf(stderr, "--embd and --ff must be multiples of %d for %s\n", block, options.type->name);
+        return false;
+    }
+    if (options.vocab < 512) {
+        fprintf(stderr, "--vocab must be at least 512 (256 byte tokens plus pieces)\n");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        return 2;
+    }
+
+    const std::string& arch = options.arch;
+    const int head_dim = options.embd / options.heads;
+    const int n_embd_kv = head_dim * options.heads_kv;
+
+    GgufWriter gguf;
+    gguf.add_string("general.architecture", arch);
+    gguf.add_string("general.name", "tiny-" + arch + "-" + options.type->name);
+    gguf.add_u32("general.file_type", options.type->file_type);
+    gguf.add_u32("general.alignment", (uint32_t)GGUF_ALIGNMENT);
+    gguf.add_u32(arch + ".context_length", (uint32_t)options.ctx);
+    gguf.add_u32(arch + ".embedding_length", (uint32_t)options.embd);
+    gguf.add_u32(arch + ".block_count", (uint32_t)options.layers);
+    gguf.add_u32(arch + ".feed_forward_length", (uint32_t)options.ff);
+    gguf.add_u32(arch + ".attention.head_count", (uint32_t)options.heads);
+    gguf.add_u32(arch + ".attention.head_count_kv", (uint32_t)options.heads_kv);
+    gguf.add_u32(arch + ".rope.dimension_count", (uint32_t)head_dim);
+    gguf.add_f32(arch + ".rope.freq_base", arch == "llama" ? 10000.0f : 1000000.0f);
+    gguf.add_f32(arch + ".attention.layer_norm_rms_epsilon", 1e-6f);
+    gguf.add_u32(arch + ".vocab_size", (uint32_t)options.vocab);
+    if (arch == "qwen3") {
+        gguf.add_u32(arch + ".attention.key_length", (uint32_t)head_dim);
+        gguf.add_u32(arch + ".attention.value_length", (uint32_t)head_dim);
+    }
+
+    if (arch == "llama") {
+        add_spm_vocab(gguf, options.vocab);
+    } else {
+        add_bpe_vocab(gguf, options.vocab);
+    }
+
+    Weights weights(gguf, options);
+    weights.matrix("token_embd.weight", options.embd, options.vocab);
+    for (int il = 0; il < options.layers; il++) {
+        const std::string blk = "blk." + std::to_string(il) + ".";
+        weights.vector(blk + "attn_norm.weight", options.embd, 1.0f, 0.0f);
+        weights.matrix(blk + "attn_q.weight", options.embd, options.embd);
+        weights.matrix(blk + "attn_k.weight", options.embd, n_embd_kv);
+        weights.matrix(blk + "attn_v.weight", options.embd, n_embd_kv);
+        weights.matrix(blk + "attn_output.weight", options.embd, options.embd);
+        if (arch == "qwen2") {
+            weights.vector(blk + "attn_q.bias", options.embd, 0.0f, 0.02f);
+            weights.vector(blk + "attn_k.bias", n_embd_kv, 0.0f, 0.02f);
+            weights.vector(blk + "attn_v.bias", n_embd_kv, 0.0f, 0.02f);
+        }
+        if (arch == "qwen3") {
+            weights.vector(blk + "attn_q_norm.weight", head_dim, 1.0f, 0.0f);
+            weights.vector(blk + "attn_k_norm.weight", head_dim, 1.0f, 0.0f);
+        }
+        weights.vector(blk + "ffn_norm.weight", options.embd, 1.0f, 0.0f);
+        weights.matrix(blk + "ffn_gate.weight", options.embd, options.ff);
+        weights.matrix(blk + "ffn_down.weight", options.ff, options.embd);
+        weights.matrix(blk + "ffn_up.weight", options.embd, options.ff);
+    }
+    weights.vector("output_norm.weight", options.embd, 1.0f, 0.0f);
+    weights.matrix("output.weight", options.embd, options.vocab);
+
+    if (!gguf.write(options.out)) {
+        fprintf(stderr, "Failed to write %s\n", options.out.c_str());
+        return 1;
+    }
+    printf("%s: %s, %d layers, embd %d, ff %d, heads %d/%d, vocab %d, %s, %.2fM params\n",
+           options.out.c_str(), arch.c_str(), options.layers, options.embd, options.ff,
+           options.heads, options.heads_kv, options.vocab, options.type->name,
+           weights.n_params() / 1e6);
+    return 0;
+}
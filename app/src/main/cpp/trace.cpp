@@ -0,0 +1,355 @@
+/**
+ * Per-thread trace ring buffers, their Chrome JSON / Perfetto exporters,
+ * and the JNI surface on LlamaCppEngine.
+ *
+ * Each thread owns one single-writer ring. A writer fills a slot, then
+ * publishes it by bumping `head` with release order. The dumper reads head,
+ * copies the ring, reads head again and keeps only slots the writer cannot
+ * have touched in between, so dumping never blocks inference threads.
+ * Buffers of exited threads are handed to new threads instead of freed.
+ */
+
+#include "trace.h"
+
+#include <jni.h>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOG_TAG "LlamaTrace"
+#include "llama_jni.h"
+
+std::atomic<bool> g_trace_enabled{false};
+
+namespace {
+
+// 32 bytes per slot: 256 KB per tracing thread
+constexpr uint64_t RING_SIZE = 8192;
+
+struct TraceEvent {
+    const char* name;
+    int64_t start_ns;
+    int64_t dur_ns;
+    int32_t tid;
+    int32_t arg;
+};
+
+struct ThreadRing {
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> cleared{0};  // slots below this were dropped
+    std::atomic<bool> retired{false};
+    TraceEvent slots[RING_SIZE];
+};
+
+struct Snapshot {
+    std::vector<TraceEvent> events;
+    std::unordered_map<int32_t, std::string> thread_names;
+};
+
+std::mutex g_rings_mutex;
+std::vector<std::unique_ptr<ThreadRing>> g_rings;
+std::unordered_map<int32_t, std::string> g_thread_names;
+
+int32_t current_tid() {
+    return (int32_t)syscall(SYS_gettid);
+}
+
+// Retires the thread's ring when the thread exits
+struct RingOwner {
+    ThreadRing* ring = nullptr;
+    ~RingOwner() {
+        if (ring) ring->retired.store(true, std::memory_order_release);
+    }
+};
+
+thread_local RingOwner t_owner;
+thread_local int32_t t_tid = 0;
+
+ThreadRing* acquire_ring() {
+    char name[17] = {};
+    prctl(PR_GET_NAME, name, 0, 0, 0);
+
+    std::lock_guard<std::mutex> lock(g_rings_mutex);
+    g_thread_names[t_tid] = name;
+    for (auto& ring : g_rings) {
+        bool retired = true;
+        if (ring->retired.compare_exchange_strong(retired, false)) {
+            return ring.get();
+        }
+    }
+    g_rings.push_back(std::make_unique<ThreadRing>());
+    return g_rings.back().get();
+}
+
+Snapshot snapshot() {
+    Snapshot snap;
+    std::lock_guard<std::mutex> lock(g_rings_mutex);
+    snap.thread_names = g_thread_names;
+    for (auto& ring : g_rings) {
+        uint64_t end = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = std::max(end > RING_SIZE ? end - RING_SIZE : 0,
+                                  ring->cleared.load(std::memory_order_relaxed));
+        if (begin >= end) continue;
+        std::vector<TraceEvent> copy;
+        copy.reserve(end - begin);
+        for (uint64_t i = begin; i < end; i++) {
+            copy.push_back(ring->slots[i % RING_SIZE]);
+        }
+        // Slots below this may have been rewritten (or be mid-write) during the copy
+        uint64_t after = ring->head.load(std::memory_order_acquire);
+        uint64_t valid = after + 1 > RING_SIZE ? after + 1 - RING_SIZE : 0;
+        for (uint64_t i = std::max(begin, valid); i < end; i++) {
+            snap.events.push_back(copy[i - begin]);
+        }
+    }
+    return snap;
+}
+
+std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+bool write_chrome_json(FILE* f, const Snapshot& snap, int pid) {
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto& [tid, name] : snap.thread_names) {
+        fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", pid, tid, json_escape(name).c_str());
+        first = false;
+    }
+    for (const TraceEvent& e : snap.events) {
+        fprintf(f, "%s{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                first ? "" : ",\n", json_escape(e.name).c_str(), pid, e.tid,
+                e.start_ns / 1000.0, e.dur_ns / 1000.0);
+        if (e.arg >= 0) {
+            fprintf(f, ",\"args\":{\"n\":%d}", e.arg);
+        }
+        fputc('}', f);
+        first = false;
+    }
+    fprintf(f, "\n]}\n");
+    return !ferror(f);
+}
+
+// Just enough protobuf encoding for perfetto.protos.Trace
+class Proto {
+public:
+    void varint(int field, uint64_t value) {
+        put_varint((uint64_t)field << 3);
+        put_varint(value);
+    }
+
+    void bytes(int field, const std::string& value) {
+        put_varint(((uint64_t)field << 3) | 2);
+        put_varint(value.size());
+        buf_ += value;
+    }
+
+    void message(int field, const Proto& value) { bytes(field, value.buf_); }
+
+    const std::string& data() const { return buf_; }
+
+private:
+    void put_varint(uint64_t value) {
+        while (value >= 0x80) {
+            buf_ += (char)((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        buf_ += (char)value;
+    }
+
+    std::string buf_;
+};
+
+// perfetto.protos field numbers
+constexpr int TRACE_PACKET = 1;
+constexpr int PACKET_TIMESTAMP = 8;
+constexpr int PACKET_SEQUENCE_ID = 10;
+constexpr int PACKET_TRACK_EVENT = 11;
+constexpr int PACKET_SEQUENCE_FLAGS = 13;
+constexpr int PACKET_TRACK_DESCRIPTOR = 60;
+constexpr int TRACK_UUID = 1;
+constexpr int TRACK_THREAD = 4;
+constexpr int THREAD_PID = 1;
+constexpr int THREAD_TID = 2;
+constexpr int THREAD_NAME = 5;
+constexpr int EVENT_DEBUG_ANNOTATIONS = 4;
+constexpr int EVENT_TYPE = 9;
+constexpr int EVENT_TRACK_UUID = 11;
+constexpr int EVENT_NAME = 23;
+constexpr int ANNOTATION_INT_VALUE = 4;
+constexpr int ANNOTATION_NAME = 10;
+constexpr int TYPE_SLICE_BEGIN = 1;
+constexpr int TYPE_SLICE_END = 2;
+constexpr int SEQ_INCREMENTAL_STATE_CLEARED = 1;
+constexpr uint32_t SEQUENCE_ID = 1;
+
+uint64_t track_uuid(int32_t tid) {
+    return 0x6c6c616d61000000ull | (uint32_t)tid;
+}
+
+bool write_perfetto(FILE* f, const Snapshot& snap, int pid) {
+    Proto trace;
+    bool first = true;
+    auto add_packet = [&](Proto& packet) {
+        packet.varint(PACKET_SEQUENCE_ID, SEQUENCE_ID);
+        if (first) {
+            packet.varint(PACKET_SEQUENCE_FLAGS, SEQ_INCREMENTAL_STATE_CLEARED);
+            first = false;
+        }
+        trace.message(TRACE_PACKET, packet);
+    };
+
+    std::unordered_map<int32_t, bool> tids;
+    for (const TraceEvent& e : snap.events) tids[e.tid] = true;
+    for (const auto& entry : tids) {
+        int32_t tid = entry.first;
+        Proto thread;
+        thread.varint(THREAD_PID, (uint64_t)pid);
+        thread.varint(THREAD_TID, (uint64_t)tid);
+        auto name = snap.thread_names.find(tid);
+        if (name != snap.thread_names.end()) {
+            thread.bytes(THREAD_NAME, name->second);
+        }
+        Proto track;
+        track.varint(TRACK_UUID, track_uuid(tid));
+        track.message(TRACK_THREAD, thread);
+        Proto packet;
+        packet.message(PACKET_TRACK_DESCRIPTOR, track);
+        add_packet(packet);
+    }
+
+    // Slices become begin/end pairs, which must nest properly per track:
+    // at equal timestamps ends go first, outer slices open first and close last
+    struct Edge {
+        int64_t ts;
+        bool begin;
+        const TraceEvent* event;
+    };
+    std::vector<Edge> edges;
+    edges.reserve(snap.events.size() * 2);
+    for (const TraceEvent& e : snap.events) {
+        edges.push_back({e.start_ns, true, &e});
+        edges.push_back({e.start_ns + e.dur_ns, false, &e});
+    }
+    std::stable_sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) {
+        if (a.ts != b.ts) return a.ts < b.ts;
+        if (a.begin != b.begin) return !a.begin;
+        if (a.begin) return a.event->dur_ns > b.event->dur_ns;
+        return a.event->start_ns > b.event->start_ns;
+    });
+
+    for (const Edge& edge : edges) {
+        Proto event;
+        event.varint(EVENT_TYPE, edge.begin ? TYPE_SLICE_BEGIN : TYPE_SLICE_END);
+        event.varint(EVENT_TRACK_UUID, track_uuid(edge.event->tid));
+        if (edge.begin) {
+            event.bytes(EVENT_NAME, edge.event->name);
+            if (edge.event->arg >= 0) {
+                Proto annotation;
+                annotation.bytes(ANNOTATION_NAME, "n");
+                annotation.varint(ANNOTATION_INT_VALUE, (uint64_t)edge.event->arg);
+                event.message(EVENT_DEBUG_ANNOTATIONS, annotation);
+            }
+        }
+        Proto packet;
+        packet.varint(PACKET_TIMESTAMP, (uint64_t)edge.ts);
+        packet.message(PACKET_TRACK_EVENT, event);
+        add_packet(packet);
+    }
+
+    return fwrite(trace.data().data(), 1, trace.data().size(), f) == trace.data().size();
+}
+
+} // namespace
+
+int64_t trace_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+void trace_set_enabled(bool enabled) {
+    g_trace_enabled.store(enabled, std::memory_order_relaxed);
+    LOGI("Tracing %s", enabled ? "enabled" : "disabled");
+}
+
+void trace_clear() {
+    std::lock_guard<std::mutex> lock(g_rings_mutex);
+    // Only the owning thread may move head, so mark the cut instead
+    for (auto& ring : g_rings) {
+        ring->cleared.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+void trace_record(const char* name, int64_t start_ns, int64_t end_ns, int32_t arg) {
+    if (!t_owner.ring) {
+        t_tid = current_tid();
+        t_owner.ring = acquire_ring();
+    }
+    ThreadRing* ring = t_owner.ring;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->slots[head % RING_SIZE] = {name, start_ns, end_ns - start_ns, t_tid, arg};
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+int trace_write(const std::string& path, TraceFormat format) {
+    Snapshot snap = snapshot();
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        LOGE("Cannot open %s", path.c_str());
+        return -1;
+    }
+    int pid = (int)getpid();
+    bool ok = format == TRACE_FORMAT_PERFETTO
+        ? write_perfetto(f, snap, pid)
+        : write_chrome_json(f, snap, pid);
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        LOGE("Failed to write trace to %s", path.c_str());
+        return -1;
+    }
+    LOGI("Wrote %zu trace events to %s", snap.events.size(), path.c_str());
+    return (int)snap.events.size();
+}
+
+extern "C" {
+
+JNIEXPORT void JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeSetTracing(
+    JNIEnv* env, jobject thiz, jboolean enabled, jboolean clear) {
+
+    if (clear) {
+        trace_clear();
+    }
+    trace_set_enabled(enabled);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamafarm_atmosphere_inference_LlamaCppEngine_00024Companion_nativeDumpTrace(
+    JNIEnv* env, jobject thiz, jstring path, jint format) {
+
+    return trace_write(jstring_to_std(env, path),
+                       format == TRACE_FORMAT_PERFETTO ? TRACE_FORMAT_PERFETTO : TRACE_FORMAT_CHROME_JSON);
+}
+
+} // extern "C"
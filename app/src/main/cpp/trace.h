@@ -0,0 +1,93 @@
+/**
+ * Scoped trace events for the native inference pipeline.
+ *
+ * TRACE_SCOPE("name") records a slice from construction to end of scope
+ * into a per-thread ring buffer. Writers never lock; the only shared state
+ * they touch is their own buffer. While tracing is off a scope costs one
+ * relaxed atomic load. Slices are dumped on demand as Chrome trace JSON
+ * (chrome://tracing, ui.perfetto.dev) or Perfetto protobuf.
+ *
+ * Names must be string literals (only the pointer is stored).
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+extern std::atomic<bool> g_trace_enabled;
+
+inline bool trace_enabled() {
+    return g_trace_enabled.load(std::memory_order_relaxed);
+}
+
+// CLOCK_BOOTTIME, the clock Perfetto's system traces use
+int64_t trace_now_ns();
+
+// Turn recording on/off. Events already recorded are kept.
+void trace_set_enabled(bool enabled);
+
+// Drop every recorded event
+void trace_clear();
+
+void trace_record(const char* name, int64_t start_ns, int64_t end_ns, int32_t arg);
+
+enum TraceFormat {
+    TRACE_FORMAT_CHROME_JSON = 0,
+    TRACE_FORMAT_PERFETTO = 1,
+};
+
+// Write the recorded events to `path`. Returns the event count, or -1 if
+// the file couldn't be written.
+int trace_write(const std::string& path, TraceFormat format);
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, int32_t arg = -1)
+        : name_(name), arg_(arg), start_(trace_enabled() ? trace_now_ns() : 0) {}
+
+    ~TraceScope() {
+        if (start_ != 0) {
+            trace_record(name_, start_, trace_now_ns(), arg_);
+        }
+    }
+
+    // Attach a value known only later, e.g. the tokens a step produced
+    void set_arg(int32_t arg) { arg_ = arg; }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;
+    int32_t arg_;
+    int64_t start_;
+};
+
+// lock_guard that records the time spent waiting for the lock
+class TraceLockGuard {
+public:
+    TraceLockGuard(std::mutex& mutex, const char* name) : mutex_(mutex) {
+        if (!trace_enabled()) {
+            mutex_.lock();
+            return;
+        }
+        int64_t start = trace_now_ns();
+        mutex_.lock();
+        trace_record(name, start, trace_now_ns(), -1);
+    }
+
+    ~TraceLockGuard() { mutex_.unlock(); }
+
+    TraceLockGuard(const TraceLockGuard&) = delete;
+    TraceLockGuard& operator=(const TraceLockGuard&) = delete;
+
+private:
+    std::mutex& mutex_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
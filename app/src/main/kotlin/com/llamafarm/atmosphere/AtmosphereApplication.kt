@@ -8,6 +8,7 @@ import android.util.Log
 import com.llamafarm.atmosphere.router.SemanticRouter
 import com.llamafarm.atmosphere.router.DefaultCapabilities
 import com.llamafarm.atmosphere.cost.CostCollector
+import com.llamafarm.atmosphere.inference.LlamaCppEngine
 import com.llamafarm.atmosphere.inference.LocalInferenceEngine
 import com.llamafarm.atmosphere.inference.ModelManager
 import com.llamafarm.atmosphere.auth.IdentityManager
@@ -118,6 +119,14 @@ class AtmosphereApplication : Application() {
         Log.i(TAG, "Atmosphere application initialized (node: ${identityManager.nodeId})")
     }
     
+    override fun onTrimMemory(level: Int) {
+        super.onTrimMemory(level)
+        
+        // Only an engine that already exists has anything to give back
+        val freed = LlamaCppEngine.peekInstance()?.trimMemory(level) ?: return
+        Log.i(TAG, "onTrimMemory($level): native engine freed ${freed / 1024} KB")
+    }
+    
     private fun initializeServices() {
         // Initialize semantic router with default capabilities
         semanticRouter = SemanticRouter.getInstance(this)
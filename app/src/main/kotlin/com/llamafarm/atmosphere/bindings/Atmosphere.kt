@@ -271,6 +271,59 @@ class AtmosphereNode private constructor(private val handle: Long) {
         }
     }
     
+    // ========================================================================
+    // Cost Functions
+    // ========================================================================
+    
+    /**
+     * Report the local inference engine's measured capacity, as written to
+     * a capability document's `cost.inference`.
+     *
+     * @param capacityJson JSON of LlamaCppEngine.InferenceCapacity
+     * @throws AtmosphereException if the JSON is invalid
+     */
+    @Throws(AtmosphereException::class)
+    fun updateInferenceCapacity(capacityJson: String) {
+        val result = nativeUpdateInferenceCapacity(handle, capacityJson)
+        if (result != 0) {
+            throw AtmosphereException.SerializationError("Invalid inference capacity JSON")
+        }
+    }
+    
+    /**
+     * Update peers' measured inference capacity from their capability
+     * documents (`cost.inference`).
+     *
+     * @param capabilitiesJson JSON array of capability documents
+     * @return Number of peers with a measured capacity
+     * @throws AtmosphereException if the JSON is invalid
+     */
+    @Throws(AtmosphereException::class)
+    fun updatePeerCapabilities(capabilitiesJson: String): Int {
+        val result = nativeUpdatePeerCapabilities(handle, capabilitiesJson)
+        if (result < 0) {
+            throw AtmosphereException.SerializationError("Invalid capabilities JSON")
+        }
+        return result
+    }
+    
+    /**
+     * Select the peer expected to finish an inference request soonest, by
+     * the capacity peers have published.
+     *
+     * @return The peer ID, or null if no peer has measured [model]
+     */
+    fun selectInferencePeer(model: String, promptTokens: Int, maxTokens: Int): String? {
+        return nativeSelectInferencePeer(handle, model, promptTokens, maxTokens)
+    }
+    
+    /**
+     * Get this node's current cost (NodeCost) as a JSON string.
+     */
+    fun localCostJson(): String {
+        return nativeLocalCostJson(handle)
+    }
+    
     /**
      * Release native resources.
      */
@@ -312,4 +365,10 @@ class AtmosphereNode private constructor(private val handle: Long) {
     private external fun nativeConnectToPeer(handle: Long, address: String): Int
     private external fun nativeGetPeers(handle: Long): String
     private external fun nativeSendGossip(handle: Long, message: String): Int
+    
+    // Native instance methods - cost
+    private external fun nativeUpdateInferenceCapacity(handle: Long, json: String): Int
+    private external fun nativeUpdatePeerCapabilities(handle: Long, json: String): Int
+    private external fun nativeSelectInferencePeer(handle: Long, model: String, promptTokens: Int, maxTokens: Int): String?
+    private external fun nativeLocalCostJson(handle: Long): String
 }
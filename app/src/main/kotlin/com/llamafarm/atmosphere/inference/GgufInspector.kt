@@ -0,0 +1,175 @@
+package com.llamafarm.atmosphere.inference
+
+import android.app.ActivityManager
+import android.content.Context
+import android.util.Log
+import org.json.JSONObject
+import java.io.File
+
+/**
+ * Metadata read from a GGUF header, without loading the model.
+ */
+data class GgufMetadata(
+    val architecture: String,
+    val name: String,
+    val sizeLabel: String,
+    val quantization: String,
+    val chatTemplate: String,
+    val contextLength: Int,
+    val embeddingLength: Int,
+    val layerCount: Int,
+    val headCount: Int,
+    val headCountKv: Int,
+    val headDimK: Int,
+    val headDimV: Int,
+    val vocabSize: Int,
+    val parameterCount: Long,
+    val weightsBytes: Long
+) {
+    /**
+     * Parameter count for display, e.g. "1.2B".
+     */
+    val parameterLabel: String
+        get() = when {
+            sizeLabel.isNotEmpty() -> sizeLabel
+            parameterCount >= 1_000_000_000L -> "%.1fB".format(parameterCount / 1e9)
+            else -> "%dM".format(parameterCount / 1_000_000L)
+        }
+
+    /**
+     * Estimate resident memory for running at [nCtx] with [nBatch].
+     */
+    fun estimateMemory(
+        nCtx: Int,
+        nBatch: Int = GgufInspector.DEFAULT_N_BATCH
+    ): GgufInspector.MemoryEstimate? = GgufInspector.estimateMemory(this, nCtx, nBatch)
+
+    fun toJson(): JSONObject = JSONObject().apply {
+        put("architecture", architecture)
+        put("name", name)
+        put("size_label", sizeLabel)
+        put("quantization", quantization)
+        put("chat_template", chatTemplate)
+        put("context_length", contextLength)
+        put("n_embd", embeddingLength)
+        put("n_layer", layerCount)
+        put("n_head", headCount)
+        put("n_head_kv", headCountKv)
+        put("head_dim_k", headDimK)
+        put("head_dim_v", headDimV)
+        put("n_vocab", vocabSize)
+        put("parameter_count", parameterCount)
+        put("weights_bytes", weightsBytes)
+    }
+
+    companion object {
+        fun fromJson(json: JSONObject): GgufMetadata = GgufMetadata(
+            architecture = json.optString("architecture", ""),
+            name = json.optString("name", ""),
+            sizeLabel = json.optString("size_label", ""),
+            quantization = json.optString("quantization", ""),
+            chatTemplate = json.optString("chat_template", ""),
+            contextLength = json.optInt("context_length", 0),
+            embeddingLength = json.optInt("n_embd", 0),
+            layerCount = json.optInt("n_layer", 0),
+            headCount = json.optInt("n_head", 0),
+            headCountKv = json.optInt("n_head_kv", 0),
+            headDimK = json.optInt("head_dim_k", 0),
+            headDimV = json.optInt("head_dim_v", 0),
+            vocabSize = json.optInt("n_vocab", 0),
+            parameterCount = json.optLong("parameter_count", 0),
+            weightsBytes = json.optLong("weights_bytes", 0)
+        )
+    }
+}
+
+/**
+ * Reads GGUF metadata through gguf_meta.cpp in llama-jni.
+ *
+ * Only the header, KV section and tensor table are touched, so inspecting
+ * a multi-GB model takes well under a millisecond once its header pages
+ * are cached. Use [fitsInMemory] to turn down a model before paying
+ * for a full load.
+ */
+class GgufInspector private constructor() {
+
+    /**
+     * Estimated resident memory, in bytes.
+     */
+    data class MemoryEstimate(
+        val weightsBytes: Long,
+        val kvCacheBytes: Long,
+        val computeBytes: Long,
+        val totalBytes: Long
+    )
+
+    companion object {
+        private const val TAG = "GgufInspector"
+
+        // Matches the engine's prefill batch (DEFAULT_N_BATCH in llama_jni.cpp)
+        const val DEFAULT_N_BATCH = 512
+
+        // Leave room for the app and the rest of the system
+        private const val MEMORY_HEADROOM_BYTES = 512L * 1024 * 1024
+
+        private val nativeAvailable: Boolean by lazy {
+            try {
+                System.loadLibrary("llama-jni")
+                true
+            } catch (e: UnsatisfiedLinkError) {
+                Log.i(TAG, "llama-jni not available, GGUF inspection disabled")
+                false
+            }
+        }
+
+        /**
+         * Read metadata from a GGUF file, or null if it isn't one.
+         */
+        fun read(file: File): GgufMetadata? {
+            if (!nativeAvailable || !file.exists()) return null
+            val json = nativeReadMetadata(file.absolutePath) ?: return null
+            return try {
+                GgufMetadata.fromJson(JSONObject(json))
+            } catch (e: Exception) {
+                Log.e(TAG, "Bad metadata for ${file.name}: ${e.message}")
+                null
+            }
+        }
+
+        /**
+         * Estimate resident memory for [metadata] at [nCtx] (0 = the
+         * model's training context).
+         */
+        fun estimateMemory(metadata: GgufMetadata, nCtx: Int, nBatch: Int = DEFAULT_N_BATCH): MemoryEstimate? {
+            if (!nativeAvailable) return null
+            val ctx = if (nCtx > 0) nCtx else metadata.contextLength
+            val values = nativeEstimateMemory(
+                metadata.layerCount, metadata.headCount, metadata.headCountKv,
+                metadata.headDimK, metadata.headDimV, metadata.embeddingLength,
+                metadata.vocabSize, metadata.weightsBytes, ctx, nBatch
+            )
+            return MemoryEstimate(values[0], values[1], values[2], values[3])
+        }
+
+        /**
+         * Whether a model needing [estimate] fits in currently available RAM.
+         */
+        fun fitsInMemory(context: Context, estimate: MemoryEstimate): Boolean {
+            val activityManager = context.getSystemService(Context.ACTIVITY_SERVICE) as ActivityManager
+            val memInfo = ActivityManager.MemoryInfo()
+            activityManager.getMemoryInfo(memInfo)
+            return estimate.totalBytes + MEMORY_HEADROOM_BYTES <= memInfo.availMem
+        }
+
+        // Native methods - gguf_meta.cpp in llama-jni
+        @JvmStatic
+        private external fun nativeReadMetadata(path: String): String?
+
+        @JvmStatic
+        private external fun nativeEstimateMemory(
+            nLayer: Int, nHead: Int, nHeadKv: Int,
+            headDimK: Int, headDimV: Int, nEmbd: Int, nVocab: Int,
+            weightsBytes: Long, nCtx: Int, nBatch: Int
+        ): LongArray
+    }
+}
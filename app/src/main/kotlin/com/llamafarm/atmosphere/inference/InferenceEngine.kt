@@ -54,7 +54,9 @@ interface InferenceEngine {
         val topP: Float = 0.9f,
         val topK: Int = 40,
         val repeatPenalty: Float = 1.1f,
-        val stopSequences: List<String> = emptyList()
+        val stopSequences: List<String> = emptyList(),
+        val grammar: String? = null,     // GBNF
+        val jsonSchema: String? = null   // JSON schema the output must match
     )
     
     /**
@@ -248,7 +250,9 @@ class LlamaCppEngineAdapter(
             topP = params.topP,
             topK = params.topK,
             repeatPenalty = params.repeatPenalty,
-            stopSequences = params.stopSequences
+            stopSequences = params.stopSequences,
+            grammar = params.grammar,
+            jsonSchema = params.jsonSchema
         )
         return engine.generate(userPrompt, engineParams)
     }
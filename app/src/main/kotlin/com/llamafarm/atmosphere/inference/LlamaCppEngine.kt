@@ -2,19 +2,31 @@ package com.llamafarm.atmosphere.inference
 
 import android.content.Context
 import android.util.Log
+import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.ExperimentalCoroutinesApi
 import kotlinx.coroutines.SupervisorJob
 import kotlinx.coroutines.cancel
+import kotlinx.coroutines.ensureActive
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
+import kotlinx.coroutines.flow.emitAll
+import kotlinx.coroutines.flow.first
 import kotlinx.coroutines.flow.flow
 import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.flow.onEach
+import kotlinx.coroutines.flow.update
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.withLock
 import kotlinx.coroutines.withContext
+import org.json.JSONObject
 import java.io.File
+import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.atomic.AtomicInteger
+import java.util.concurrent.atomic.AtomicLong
 
 /**
  * Direct llama.cpp engine that bypasses the ARM AiChat wrapper.
@@ -39,8 +51,11 @@ class LlamaCppEngine private constructor(
 ) {
     companion object {
         private const val TAG = "LlamaCppEngine"
-        private const val DEFAULT_CONTEXT_SIZE = 4096
+        const val DEFAULT_CONTEXT_SIZE = 4096
         private const val DEFAULT_PREDICT_LENGTH = 512
+        private const val DEFAULT_RERANK_BUDGET_MS = 250
+        // Longest single native wait in awaitNativeState between cancellation checks
+        private const val AWAIT_STATE_SLICE_MS = 100L
         
         @Volatile
         private var instance: LlamaCppEngine? = null
@@ -57,6 +72,11 @@ class LlamaCppEngine private constructor(
             }
         }
         
+        /**
+         * The instance if one has been created, without creating it.
+         */
+        fun peekInstance(): LlamaCppEngine? = instance
+        
         /**
          * Check if native library is available.
          */
@@ -69,21 +89,92 @@ class LlamaCppEngine private constructor(
         @JvmStatic
         private external fun nativeLoadModel(modelPath: String, nCtx: Int, nThreads: Int): Int
         
+        @JvmStatic
+        private external fun nativeUseModel(handle: Long, nCtx: Int, nThreads: Int): Int
+        
+        @JvmStatic
+        private external fun nativeGetModelHandle(): Long
+        
+        @JvmStatic
+        private external fun nativeAcquireModel(modelPath: String): Long
+        
+        @JvmStatic
+        private external fun nativeReleaseModel(handle: Long)
+        
+        @JvmStatic
+        private external fun nativePinModel(handle: Long, pinned: Boolean): Boolean
+        
+        @JvmStatic
+        private external fun nativeSetModelCacheBudget(bytes: Long)
+        
+        @JvmStatic
+        private external fun nativeGetModelCacheStats(): LongArray
+        
+        @JvmStatic
+        private external fun nativeSetThreadGovernor(enabled: Boolean)
+        
+        @JvmStatic
+        private external fun nativeGetThreadGovernorStats(): LongArray
+        
+        @JvmStatic
+        private external fun nativeLoadLora(loraPath: String): Long
+        
+        @JvmStatic
+        private external fun nativeSetLoras(ids: LongArray, scales: FloatArray): Int
+        
+        @JvmStatic
+        private external fun nativeUnloadLora(id: Long): Boolean
+        
         @JvmStatic
         private external fun nativeSetSystemPrompt(prompt: String): Int
         
+        @JvmStatic
+        private external fun nativeSetGrammar(grammar: String?, isJsonSchema: Boolean): Int
+        
+        @JvmStatic
+        private external fun nativeSetLogprobs(topK: Int): Int
+        
+        @JvmStatic
+        private external fun nativeTakeLogprobs(): IntArray?
+        
         @JvmStatic
         private external fun nativeStartGeneration(prompt: String, maxTokens: Int): Int
         
         @JvmStatic
         private external fun nativeGetNextToken(): String?
         
+        @JvmStatic
+        private external fun nativeGenerateNBest(
+            prompt: String, n: Int, maxTokens: Int, temperature: Float, logProbs: FloatArray
+        ): Array<String>?
+        
+        @JvmStatic
+        private external fun nativeSnapshot(keepKv: Boolean): Int
+        
+        @JvmStatic
+        private external fun nativeRewind(snapshotId: Int): Int
+        
+        @JvmStatic
+        private external fun nativeReleaseSnapshot(snapshotId: Int)
+        
+        @JvmStatic
+        private external fun nativeSaveSession(path: String): Long
+        
+        @JvmStatic
+        private external fun nativeLoadSession(path: String): Int
+        
         @JvmStatic
         private external fun nativeStopGeneration()
         
+        @JvmStatic
+        private external fun nativeGetLastCancelLatencyUs(): Long
+        
         @JvmStatic
         private external fun nativeUnloadModel()
         
+        @JvmStatic
+        private external fun nativeTrimMemory(level: Int): Long
+        
         @JvmStatic
         private external fun nativeShutdown()
         
@@ -95,6 +186,57 @@ class LlamaCppEngine private constructor(
         
         @JvmStatic
         private external fun nativeIsGenerating(): Boolean
+        
+        @JvmStatic
+        private external fun nativeGetState(): Int
+        
+        @JvmStatic
+        private external fun nativeAwaitState(stateMask: Int, timeoutMs: Long): Int
+        
+        @JvmStatic
+        private external fun nativeLoadReranker(modelPath: String, nThreads: Int): Int
+        
+        @JvmStatic
+        private external fun nativeRerank(query: String, candidates: Array<String>, timeBudgetMs: Int): FloatArray?
+        
+        @JvmStatic
+        private external fun nativeUnloadReranker()
+        
+        @JvmStatic
+        private external fun nativeTokenize(text: String, addSpecial: Boolean): IntArray?
+        
+        @JvmStatic
+        private external fun nativeCountTokens(texts: Array<String>, addSpecial: Boolean): IntArray?
+        
+        @JvmStatic
+        private external fun nativeSetTracing(enabled: Boolean, clear: Boolean)
+        
+        @JvmStatic
+        private external fun nativeDumpTrace(path: String, format: Int): Int
+        
+        @JvmStatic
+        private external fun nativeSetSeed(seed: Long): Int
+        
+        @JvmStatic
+        private external fun nativeStartRecording(path: String, seed: Long): Int
+        
+        @JvmStatic
+        private external fun nativeStopRecording()
+        
+        @JvmStatic
+        private external fun nativeSchedule(priority: Int): Int
+        
+        @JvmStatic
+        private external fun nativeFinishBackground()
+        
+        @JvmStatic
+        private external fun nativeAddInteractivePending(delta: Int): Int
+        
+        @JvmStatic
+        private external fun nativeGetThroughputStats(): LongArray
+        
+        @JvmStatic
+        private external fun nativeEstimateCompletionUs(prefillTokens: Long, decodeTokens: Long): Long
     }
     
     /**
@@ -120,6 +262,34 @@ class LlamaCppEngine private constructor(
             get() = this is ModelReady
     }
     
+    /**
+     * State of the native engine, mirroring EngineState in llama_jni.cpp.
+     * 
+     * Read lock-free from an atomic, so polling it never contends with the
+     * inference thread.
+     */
+    enum class NativeState {
+        UNLOADED, LOADING, IDLE, PREFILL, DECODING, STOPPED;
+        
+        val mask: Int get() = 1 shl ordinal
+        
+        companion object {
+            fun fromInt(value: Int): NativeState = values().getOrElse(value) { UNLOADED }
+        }
+    }
+    
+    /**
+     * Request priority, matching RequestPriority in llama_jni.cpp.
+     * 
+     * Interactive requests act on the chat conversation. A background
+     * request (a mesh job) gets a conversation of its own and gives way to
+     * interactive ones: it is parked between decode steps, KV cache kept,
+     * and resumes once they are done.
+     */
+    enum class Priority {
+        INTERACTIVE, BACKGROUND
+    }
+    
     /**
      * Model information after loading.
      */
@@ -127,7 +297,101 @@ class LlamaCppEngine private constructor(
         val path: String,
         val contextSize: Int,
         val vocabSize: Int = 0,
-        val nParams: Long = 0
+        val nParams: Long = 0,
+        val handle: Long = 0  // model cache handle (direct JNI only)
+    )
+    
+    /**
+     * File format for [dumpTrace], matching TraceFormat in trace.h.
+     */
+    enum class TraceFormat {
+        /** Chrome trace JSON, for chrome://tracing or ui.perfetto.dev */
+        CHROME_JSON,
+        /** Perfetto protobuf, mergeable with a system trace */
+        PERFETTO
+    }
+    
+    /**
+     * Native model cache counters.
+     */
+    data class ModelCacheStats(
+        val modelCount: Int,
+        val residentBytes: Long,
+        val budgetBytes: Long,
+        val hits: Long,
+        val misses: Long,
+        val evictions: Long
+    )
+    
+    /**
+     * Decode thread governor state. [reason] is why the thread count last
+     * changed: 0 none, 1 probing a neighbour, 2 probe adopted, 3 probe
+     * reverted, 4 CPU clocks or temperature shifted, 5 throughput dropped.
+     * [temperatureMilliC] and [cpuFreqPermille] are -1 where sysfs hides them.
+     */
+    data class ThreadGovernorStats(
+        val enabled: Boolean,
+        val threads: Int,
+        val maxThreads: Int,
+        val windows: Long,
+        val probes: Long,
+        val changes: Long,
+        val tokensPerSecond: Double,
+        val temperatureMilliC: Int,
+        val cpuFreqPermille: Int,
+        val reason: Int
+    )
+    
+    /**
+     * Measured prefill and decode rates of the loaded model (moving
+     * averages; 0 until measured), and the context cells still free.
+     */
+    data class ThroughputStats(
+        val prefillTokensPerSecond: Double,
+        val decodeTokensPerSecond: Double,
+        val prefills: Long,
+        val decodeSteps: Long,
+        val kvHeadroomTokens: Int
+    )
+    
+    /**
+     * What this node can currently serve of its loaded model, for mesh
+     * routing. [toJson] matches InferenceCapacity in core/src/cost.rs.
+     */
+    data class InferenceCapacity(
+        val model: String,
+        val prefillTokensPerSecond: Double,
+        val decodeTokensPerSecond: Double,
+        val queueDepth: Int,
+        val kvHeadroomTokens: Int
+    ) {
+        fun toJson(): JSONObject = JSONObject().apply {
+            put("model", model)
+            put("prefill_tokens_per_s", prefillTokensPerSecond)
+            put("decode_tokens_per_s", decodeTokensPerSecond)
+            put("queue_depth", queueDepth)
+            put("kv_headroom_tokens", kvHeadroomTokens)
+            put("timestamp_ms", System.currentTimeMillis())
+        }
+    }
+    
+    /**
+     * When a request would complete, from [estimateCompletion]: after the
+     * work already queued on the engine, then its own prefill and decode.
+     */
+    data class CompletionEstimate(
+        val queuedMs: Double,
+        val requestMs: Double
+    ) {
+        val totalMs: Double get() = queuedMs + requestMs
+    }
+    
+    /**
+     * One completion from [generateNBest], with its cumulative log-probability.
+     */
+    data class Candidate(
+        val text: String,
+        val logProb: Float
     )
     
     /**
@@ -139,9 +403,51 @@ class LlamaCppEngine private constructor(
         val topP: Float = 0.9f,
         val topK: Int = 40,
         val repeatPenalty: Float = 1.1f,
-        val stopSequences: List<String> = emptyList()
+        val stopSequences: List<String> = emptyList(),
+        // LoRA adapter id -> scale for this request; null keeps the attached set
+        val loraAdapters: Map<Long, Float>? = null,
+        // Constrain output to a GBNF grammar, or to JSON matching a JSON
+        // schema (grammar wins if both are set). Compiled grammars are cached.
+        val grammar: String? = null,
+        val jsonSchema: String? = null,
+        // Record each token's log-probability plus this many top alternatives
+        // (-1 = off); read them with takeTokenLogprobs()
+        val logprobTopK: Int = -1,
+        val priority: Priority = Priority.INTERACTIVE
     )
     
+    /**
+     * Per-token log-probabilities recorded during generation.
+     * 
+     * A view over the packed native buffer (one int array for the whole
+     * generation, floats stored as bits), so no per-token objects.
+     */
+    class TokenLogprobs(private val packed: IntArray) {
+        /** Alternatives recorded per token. */
+        val topK: Int = packed[0]
+        
+        private val stride = 2 + 2 * topK
+        
+        /** Number of generated tokens. */
+        val size: Int = (packed.size - 1) / stride
+        
+        fun token(i: Int): Int = packed[1 + i * stride]
+        
+        fun logprob(i: Int): Float = Float.fromBits(packed[2 + i * stride])
+        
+        /** Token id of the [rank]-th most likely alternative at [i] (-1 if none). */
+        fun alternative(i: Int, rank: Int): Int = packed[3 + i * stride + 2 * rank]
+        
+        fun alternativeLogprob(i: Int, rank: Int): Float = Float.fromBits(packed[4 + i * stride + 2 * rank])
+        
+        /** Sum of the chosen tokens' log-probabilities. */
+        fun totalLogprob(): Float {
+            var total = 0f
+            for (i in 0 until size) total += logprob(i)
+            return total
+        }
+    }
+    
     // Internal state
     private val _state = MutableStateFlow<State>(State.Uninitialized)
     val state: StateFlow<State> = _state.asStateFlow()
@@ -155,10 +461,25 @@ class LlamaCppEngine private constructor(
     
     private var currentSystemPrompt: String? = null
     
+    // Paths of models handed out by preloadModel, for switchModel's ModelInfo
+    private val cachedModelPaths = ConcurrentHashMap<Long, String>()
+    
     @OptIn(ExperimentalCoroutinesApi::class)
     private val llamaDispatcher = Dispatchers.IO.limitedParallelism(1)
     private val engineScope = CoroutineScope(llamaDispatcher + SupervisorJob())
     
+    // Interactive requests started but not finished; background generation
+    // stays parked while nonzero
+    private val interactivePending = MutableStateFlow(0)
+    // One background conversation at a time
+    private val backgroundMutex = Mutex()
+    
+    // Tokens still to prefill and decode for generations started but not
+    // finished, counting each at its full max tokens
+    private val queuedPrefillTokens = AtomicLong()
+    private val queuedDecodeTokens = AtomicLong()
+    private val activeGenerations = AtomicInteger()
+    
     // Fallback to ARM AiChat if direct JNI isn't available
     private var useArmFallback = false
     private var armEngine: com.arm.aichat.InferenceEngine? = null
@@ -186,6 +507,9 @@ class LlamaCppEngine private constructor(
     
     /**
      * Load a model from the given path.
+     * 
+     * Fails fast with [InsufficientMemoryException] when the GGUF memory
+     * estimate at [contextSize] doesn't fit in available RAM.
      */
     suspend fun loadModel(
         modelPath: String,
@@ -207,6 +531,14 @@ class LlamaCppEngine private constructor(
                 return@withContext Result.failure(error)
             }
             
+            // A model that's already loaded is resident in availMem's numbers
+            if (currentModel?.path != resolvedPath) {
+                checkFitsInMemory(resolvedPath, contextSize)?.let { error ->
+                    _state.value = State.Error(error)
+                    return@withContext Result.failure(error)
+                }
+            }
+            
             Log.i(TAG, "Loading model: $resolvedPath")
             
             if (useArmFallback) {
@@ -248,7 +580,8 @@ class LlamaCppEngine private constructor(
             
             currentModel = ModelInfo(
                 path = resolvedPath,
-                contextSize = contextSize
+                contextSize = contextSize,
+                handle = if (useArmFallback) 0L else nativeGetModelHandle()
             )
             
             _state.value = State.ModelReady
@@ -262,6 +595,277 @@ class LlamaCppEngine private constructor(
         }
     }
     
+    /**
+     * Error if the model at [path] is estimated not to fit in available RAM
+     * at [contextSize]; null if it fits or there's no GGUF estimate.
+     */
+    private fun checkFitsInMemory(path: String, contextSize: Int): InsufficientMemoryException? {
+        val metadata = GgufInspector.read(File(path)) ?: return null
+        val estimate = metadata.estimateMemory(contextSize) ?: return null
+        if (GgufInspector.fitsInMemory(context, estimate)) {
+            return null
+        }
+        val neededMb = estimate.totalBytes / (1024 * 1024)
+        Log.w(TAG, "${File(path).name} needs ~$neededMb MB at n_ctx=$contextSize, not loading")
+        return InsufficientMemoryException(
+            "Not enough memory: ${metadata.name.ifEmpty { File(path).name }} needs ~$neededMb MB",
+            estimate
+        )
+    }
+    
+    /**
+     * Load a model into the native model cache without switching to it, e.g.
+     * a small utility model next to the chat model.
+     * 
+     * Returns a handle holding one reference; the model can't be evicted
+     * until [releaseModel]. Loading the same path again is a cache hit.
+     * Runs off the inference dispatcher, so generation continues meanwhile.
+     */
+    suspend fun preloadModel(modelPath: String): Long? = withContext(Dispatchers.IO) {
+        if (!nativeLoaded || useArmFallback) return@withContext null
+        
+        val resolvedPath = resolveModelPath(modelPath)
+        val handle = nativeAcquireModel(resolvedPath)
+        if (handle == 0L) {
+            Log.e(TAG, "Failed to preload model: $resolvedPath")
+            return@withContext null
+        }
+        cachedModelPaths[handle] = resolvedPath
+        handle
+    }
+    
+    /**
+     * Drop a reference taken by [preloadModel]. The model stays cached
+     * until the cache needs its memory.
+     */
+    fun releaseModel(handle: Long) {
+        if (nativeLoaded && !useArmFallback) {
+            nativeReleaseModel(handle)
+        }
+    }
+    
+    /**
+     * Pin a cached model so it's never evicted, or unpin it.
+     */
+    fun pinModel(handle: Long, pinned: Boolean = true): Boolean {
+        if (!nativeLoaded || useArmFallback) return false
+        return nativePinModel(handle, pinned)
+    }
+    
+    /**
+     * Run the engine on a cached model. Only a new context is created, so
+     * this takes milliseconds instead of a full load.
+     */
+    suspend fun switchModel(
+        handle: Long,
+        contextSize: Int = DEFAULT_CONTEXT_SIZE,
+        nThreads: Int = 0
+    ): Result<ModelInfo> = withContext(llamaDispatcher) {
+        if (!nativeLoaded || useArmFallback) {
+            return@withContext Result.failure(IllegalStateException("Model cache requires direct llama.cpp JNI bindings"))
+        }
+        
+        _state.value = State.LoadingModel
+        val result = nativeUseModel(handle, contextSize, nThreads)
+        if (result != 0) {
+            val error = RuntimeException(
+                if (result == -1) "Unknown model handle: $handle" else "Failed to create context: $result"
+            )
+            _state.value = State.Error(error)
+            return@withContext Result.failure(error)
+        }
+        
+        currentModel = ModelInfo(
+            path = cachedModelPaths[handle] ?: "",
+            contextSize = contextSize,
+            handle = handle
+        )
+        currentSystemPrompt = null
+        _state.value = State.ModelReady
+        Result.success(currentModel!!)
+    }
+    
+    /**
+     * Cap the RAM used by cached models (0 = half of physical RAM). Evicts
+     * unreferenced models, least recently used first, to get under it.
+     */
+    fun setModelCacheBudget(bytes: Long) {
+        if (nativeLoaded && !useArmFallback) {
+            nativeSetModelCacheBudget(bytes)
+        }
+    }
+    
+    fun getModelCacheStats(): ModelCacheStats? {
+        if (!nativeLoaded || useArmFallback) return null
+        val values = nativeGetModelCacheStats()
+        return ModelCacheStats(
+            modelCount = values[0].toInt(),
+            residentBytes = values[1],
+            budgetBytes = values[2],
+            hits = values[3],
+            misses = values[4],
+            evictions = values[5]
+        )
+    }
+    
+    /**
+     * Let the decode thread count follow sustained throughput (on by
+     * default). It starts at the count given to [loadModel] and never goes
+     * above it; off pins it there.
+     */
+    fun setThreadGovernor(enabled: Boolean) {
+        if (nativeLoaded && !useArmFallback) {
+            nativeSetThreadGovernor(enabled)
+        }
+    }
+    
+    fun getThreadGovernorStats(): ThreadGovernorStats? {
+        if (!nativeLoaded || useArmFallback) return null
+        val values = nativeGetThreadGovernorStats()
+        return ThreadGovernorStats(
+            enabled = values[0] != 0L,
+            threads = values[1].toInt(),
+            maxThreads = values[2].toInt(),
+            windows = values[3],
+            probes = values[4],
+            changes = values[5],
+            tokensPerSecond = values[6] / 1000.0,
+            temperatureMilliC = values[7].toInt(),
+            cpuFreqPermille = values[8].toInt(),
+            reason = values[9].toInt()
+        )
+    }
+    
+    /**
+     * Load a LoRA adapter onto the current model. Adapters are loaded once
+     * (loading the same path again returns the same id) and freed with the
+     * model, so several fine-tunes share one copy of the base weights.
+     * 
+     * @return Adapter id for [setLoraAdapters] and [GenerationParams.loraAdapters]
+     */
+    suspend fun loadLoraAdapter(path: String): Result<Long> = withContext(llamaDispatcher) {
+        if (!nativeLoaded || useArmFallback) {
+            return@withContext Result.failure(IllegalStateException("LoRA adapters require direct llama.cpp JNI bindings"))
+        }
+        val id = nativeLoadLora(resolveModelPath(path))
+        when {
+            id > 0 -> Result.success(id)
+            id == -1L -> Result.failure(IllegalStateException("No model loaded"))
+            else -> Result.failure(RuntimeException("Failed to load LoRA adapter: $path"))
+        }
+    }
+    
+    /**
+     * Attach exactly [adapters] (id -> scale) to the engine; an empty map
+     * runs the base model. Switching is just a graph change, but the
+     * conversation's KV cache was computed under the old adapters, so it is
+     * decoded again (a prefill of the whole history). Attaching the current
+     * set is free.
+     */
+    suspend fun setLoraAdapters(adapters: Map<Long, Float>): Boolean = withContext(llamaDispatcher) {
+        if (!nativeLoaded || useArmFallback) return@withContext adapters.isEmpty()
+        applyLoraAdapters(adapters) == 0
+    }
+    
+    /**
+     * Free a LoRA adapter, detaching it first if attached.
+     */
+    suspend fun unloadLoraAdapter(id: Long): Boolean = withContext(llamaDispatcher) {
+        if (!nativeLoaded || useArmFallback) return@withContext false
+        nativeUnloadLora(id)
+    }
+    
+    private fun applyLoraAdapters(adapters: Map<Long, Float>): Int {
+        val ids = adapters.keys.toLongArray()
+        val scales = FloatArray(ids.size) { adapters.getValue(ids[it]) }
+        val result = nativeSetLoras(ids, scales)
+        if (result != 0) {
+            Log.e(TAG, "Failed to attach LoRA adapters ${adapters.keys}: $result")
+        }
+        return result
+    }
+    
+    /**
+     * Shed memory for an onTrimMemory [level] (ComponentCallbacks2.TRIM_MEMORY_*).
+     * Idle cached models and the reranker's context go first, then the KV
+     * cache is shrunk, released, and at TRIM_MEMORY_COMPLETE the model is
+     * unloaded. A running generation is left alone. Returns bytes freed.
+     */
+    fun trimMemory(level: Int): Long {
+        if (!nativeLoaded || useArmFallback) return 0
+        val freed = nativeTrimMemory(level)
+        if (currentModel != null && !nativeIsModelLoaded()) {
+            currentModel = null
+            currentSystemPrompt = null
+            _state.value = State.Initialized
+            Log.i(TAG, "Model unloaded by memory trim (level $level)")
+        }
+        return freed
+    }
+    
+    /**
+     * Start or stop recording native trace events: every JNI call, lock
+     * waits on the engine, tokenization, each llama_decode (prefill chunk or
+     * decode step), sampling, detokenization and the RAG stages. Off by
+     * default; while off the probes cost next to nothing.
+     * 
+     * @param clear Drop events recorded so far
+     */
+    fun setTracing(enabled: Boolean, clear: Boolean = false) {
+        if (nativeLoaded && !useArmFallback) {
+            nativeSetTracing(enabled, clear)
+        }
+    }
+    
+    /**
+     * Write the recorded trace events (the most recent 8192 per thread) to
+     * [file]. Doesn't stop recording or block inference.
+     * 
+     * @return Number of events written, or null on failure
+     */
+    fun dumpTrace(file: File, format: TraceFormat = TraceFormat.PERFETTO): Int? {
+        if (!nativeLoaded || useArmFallback) return null
+        val count = nativeDumpTrace(file.absolutePath, format.ordinal)
+        if (count < 0) {
+            Log.e(TAG, "Failed to write trace to ${file.absolutePath}")
+            return null
+        }
+        Log.i(TAG, "Wrote $count trace events to ${file.name}")
+        return count
+    }
+    
+    /**
+     * Fix the sampler seed, or go back to a random one with a negative
+     * [seed]. With a fixed seed each reply depends only on the conversation
+     * so far, the prompt and the seed. Fails while generating.
+     */
+    fun setSeed(seed: Long): Boolean {
+        if (!nativeLoaded || useArmFallback) return false
+        return nativeSetSeed(seed) == 0
+    }
+    
+    /**
+     * Record every model load, system prompt and generation (inputs, output
+     * tokens and timing) to [file] until [stopRecording], for replay with
+     * llama-jni-replay. Replay needs a fixed seed: [seed] if given, else the
+     * one set with [setSeed], else a random one kept until recording stops.
+     */
+    fun startRecording(file: File, seed: Long = -1): Boolean {
+        if (!nativeLoaded || useArmFallback) return false
+        val result = nativeStartRecording(file.absolutePath, seed)
+        if (result != 0) {
+            Log.e(TAG, "Failed to start recording to ${file.absolutePath}: $result")
+            return false
+        }
+        return true
+    }
+    
+    fun stopRecording() {
+        if (nativeLoaded && !useArmFallback) {
+            nativeStopRecording()
+        }
+    }
+    
     private fun resolveModelPath(path: String): String {
         // Check if it's an absolute path
         if (File(path).exists()) return path
@@ -281,9 +885,9 @@ class LlamaCppEngine private constructor(
     /**
      * Set system prompt (alias for processSystemPrompt).
      */
-    suspend fun setSystemPrompt(prompt: String): Result<Unit> = withContext(llamaDispatcher) {
+    suspend fun setSystemPrompt(prompt: String): Result<Unit> = withInteractive {
         if (!nativeLoaded) {
-            return@withContext Result.failure(IllegalStateException("Native library not available"))
+            return@withInteractive Result.failure(IllegalStateException("Native library not available"))
         }
         
         try {
@@ -298,7 +902,7 @@ class LlamaCppEngine private constructor(
                     if (e.message?.contains("RIGHT AFTER") == true && currentSystemPrompt != null) {
                         Log.i(TAG, "System prompt already set from previous load, skipping")
                         _state.value = State.ModelReady
-                        return@withContext Result.success(Unit)
+                        return@withInteractive Result.success(Unit)
                     }
                     throw e
                 }
@@ -322,10 +926,106 @@ class LlamaCppEngine private constructor(
     
     /**
      * Generate completion for user input, streaming tokens.
+     * 
+     * A [Priority.BACKGROUND] request runs in a conversation of its own and
+     * pauses between tokens while interactive requests are served, so chat's
+     * time to first token stays bounded by one decode step however much
+     * background work is queued.
      */
     fun generate(
         userPrompt: String,
         params: GenerationParams = GenerationParams()
+    ): Flow<String> = flow {
+        val work = QueuedWork(countTokens(userPrompt) ?: 0, params.maxTokens)
+        try {
+            if (params.priority == Priority.BACKGROUND && nativeLoaded && !useArmFallback) {
+                emitAll(generateBackground(userPrompt, params).onEach { work.tokenDone() })
+            } else {
+                trackInteractive { emitAll(generateInteractive(userPrompt, params).onEach { work.tokenDone() }) }
+            }
+        } finally {
+            work.finish()
+        }
+    }
+    
+    // One generation's share of queuedPrefillTokens / queuedDecodeTokens
+    private inner class QueuedWork(private var prefillTokens: Int, private var decodeTokens: Int) {
+        init {
+            queuedPrefillTokens.addAndGet(prefillTokens.toLong())
+            queuedDecodeTokens.addAndGet(decodeTokens.toLong())
+            activeGenerations.incrementAndGet()
+        }
+        
+        fun tokenDone() {
+            queuedPrefillTokens.addAndGet(-prefillTokens.toLong())
+            prefillTokens = 0
+            if (decodeTokens > 0) {
+                queuedDecodeTokens.decrementAndGet()
+                decodeTokens--
+            }
+        }
+        
+        fun finish() {
+            activeGenerations.decrementAndGet()
+            queuedPrefillTokens.addAndGet(-prefillTokens.toLong())
+            queuedDecodeTokens.addAndGet(-decodeTokens.toLong())
+            prefillTokens = 0
+            decodeTokens = 0
+        }
+    }
+    
+    /**
+     * Estimate when a request for [prompt] with up to [maxTokens] would
+     * complete if submitted now, from the measured prefill and decode rates.
+     * Generations already running or waiting are counted at their full max
+     * tokens, so this errs late.
+     * 
+     * @return Null until the loaded model has prefilled and decoded at least once
+     */
+    fun estimateCompletion(prompt: String, maxTokens: Int): CompletionEstimate? {
+        if (!nativeLoaded || useArmFallback) return null
+        val promptTokens = countTokens(prompt) ?: return null
+        val queuedUs = nativeEstimateCompletionUs(queuedPrefillTokens.get(), queuedDecodeTokens.get())
+        val requestUs = nativeEstimateCompletionUs(promptTokens.toLong(), maxTokens.toLong())
+        if (queuedUs < 0 || requestUs < 0) return null
+        return CompletionEstimate(queuedMs = queuedUs / 1000.0, requestMs = requestUs / 1000.0)
+    }
+    
+    /**
+     * Measured prefill and decode rates, or null without direct JNI.
+     */
+    fun getThroughputStats(): ThroughputStats? {
+        if (!nativeLoaded || useArmFallback) return null
+        val values = nativeGetThroughputStats()
+        return ThroughputStats(
+            prefillTokensPerSecond = values[0] / 1000.0,
+            decodeTokensPerSecond = values[1] / 1000.0,
+            prefills = values[2],
+            decodeSteps = values[3],
+            kvHeadroomTokens = values[4].toInt()
+        )
+    }
+    
+    /**
+     * Measured capacity for the loaded model, or null if none is loaded
+     * (or without direct JNI). Queue depth counts generations running or
+     * waiting, interactive and background alike.
+     */
+    fun getInferenceCapacity(): InferenceCapacity? {
+        val model = currentModel ?: return null
+        val stats = getThroughputStats() ?: return null
+        return InferenceCapacity(
+            model = File(model.path).nameWithoutExtension,
+            prefillTokensPerSecond = stats.prefillTokensPerSecond,
+            decodeTokensPerSecond = stats.decodeTokensPerSecond,
+            queueDepth = activeGenerations.get(),
+            kvHeadroomTokens = stats.kvHeadroomTokens
+        )
+    }
+    
+    private fun generateInteractive(
+        userPrompt: String,
+        params: GenerationParams
     ): Flow<String> = flow {
         if (!nativeLoaded) {
             throw IllegalStateException("Native library not available")
@@ -334,6 +1034,9 @@ class LlamaCppEngine private constructor(
         _state.value = State.ProcessingUserPrompt
         
         if (useArmFallback) {
+            if (params.grammar != null || params.jsonSchema != null) {
+                Log.w(TAG, "Grammar constraints need direct JNI, generating unconstrained")
+            }
             // Use ARM AiChat flow
             armEngine?.sendUserPrompt(userPrompt, params.maxTokens)?.collect { token ->
                 _state.value = State.Generating
@@ -341,7 +1044,21 @@ class LlamaCppEngine private constructor(
             }
         } else {
             // Use direct JNI
+            scheduleInteractive()
+            try {
+                applyRequestParams(params)
+            } catch (e: Exception) {
+                _state.value = State.Error(e)
+                throw e
+            }
+            
             val startResult = nativeStartGeneration(userPrompt, params.maxTokens)
+            if (startResult == -3) {
+                // Cancelled during prefill
+                Log.i(TAG, "Generation cancelled before first token")
+                _state.value = State.ModelReady
+                return@flow
+            }
             if (startResult != 0) {
                 _state.value = State.Error(RuntimeException("Failed to start generation: $startResult"))
                 throw RuntimeException("Failed to start generation: $startResult")
@@ -363,8 +1080,216 @@ class LlamaCppEngine private constructor(
         _state.value = State.ModelReady
     }.flowOn(llamaDispatcher)
     
+    private fun generateBackground(
+        userPrompt: String,
+        params: GenerationParams
+    ): Flow<String> = flow {
+        backgroundMutex.withLock {
+            try {
+                resumeBackground()
+                applyRequestParams(params)
+                
+                var startResult = nativeStartGeneration(userPrompt, params.maxTokens)
+                while (startResult == -6) {
+                    // Preempted during prefill: prompt again once chat is served
+                    resumeBackground()
+                    startResult = nativeStartGeneration(userPrompt, params.maxTokens)
+                }
+                if (startResult == -3) {
+                    Log.i(TAG, "Background generation cancelled before first token")
+                    return@withLock
+                }
+                if (startResult != 0) {
+                    throw RuntimeException("Failed to start generation: $startResult")
+                }
+                
+                var tokenCount = 0
+                while (tokenCount < params.maxTokens) {
+                    resumeBackground()
+                    if (!nativeIsGenerating()) {
+                        break
+                    }
+                    val token = nativeGetNextToken() ?: break
+                    emit(token)
+                    tokenCount++
+                }
+            } finally {
+                nativeFinishBackground()
+            }
+        }
+    }.flowOn(llamaDispatcher)
+    
+    // LoRA set, grammar and logprobs for one request (on llamaDispatcher)
+    private fun applyRequestParams(params: GenerationParams) {
+        params.loraAdapters?.let { adapters ->
+            val loraResult = applyLoraAdapters(adapters)
+            if (loraResult != 0) {
+                throw RuntimeException("Failed to attach LoRA adapters: $loraResult")
+            }
+        }
+        
+        // Always set, so a previous request's grammar never carries over
+        val grammarResult = when {
+            params.grammar != null -> nativeSetGrammar(params.grammar, false)
+            params.jsonSchema != null -> nativeSetGrammar(params.jsonSchema, true)
+            else -> nativeSetGrammar(null, false)
+        }
+        if (grammarResult != 0) {
+            throw IllegalArgumentException(
+                if (grammarResult == -4) "Invalid grammar or JSON schema" else "Failed to set grammar: $grammarResult"
+            )
+        }
+        
+        nativeSetLogprobs(params.logprobTopK)
+    }
+    
+    // Count an interactive request as waiting for as long as [block] runs.
+    // The native count aborts a background prefill; this one parks
+    // background generation at its next token.
+    private suspend fun <T> trackInteractive(block: suspend () -> T): T {
+        if (!nativeLoaded || useArmFallback) return block()
+        nativeAddInteractivePending(1)
+        interactivePending.update { it + 1 }
+        try {
+            return block()
+        } finally {
+            nativeAddInteractivePending(-1)
+            interactivePending.update { it - 1 }
+        }
+    }
+    
+    // Run [block] on the engine against the interactive conversation
+    private suspend fun <T> withInteractive(block: suspend CoroutineScope.() -> T): T = trackInteractive {
+        withContext(llamaDispatcher) {
+            scheduleInteractive()
+            block()
+        }
+    }
+    
+    // Put the interactive conversation on the engine (on llamaDispatcher)
+    private fun scheduleInteractive() {
+        if (!nativeLoaded || useArmFallback) return
+        val result = nativeSchedule(Priority.INTERACTIVE.ordinal)
+        if (result != 0) {
+            Log.w(TAG, "Failed to switch to the interactive conversation: $result")
+        }
+    }
+    
+    // Put the background conversation on the engine, first waiting out any
+    // interactive requests with it parked; suspending frees llamaDispatcher
+    // for them
+    private suspend fun resumeBackground() {
+        if (interactivePending.value > 0) {
+            nativeSchedule(Priority.INTERACTIVE.ordinal)
+            interactivePending.first { it == 0 }
+        }
+        val result = nativeSchedule(Priority.BACKGROUND.ordinal)
+        if (result != 0) {
+            throw RuntimeException("Failed to resume background generation: $result")
+        }
+    }
+    
+    /**
+     * Log-probabilities recorded since the last call, for a generation run
+     * with [GenerationParams.logprobTopK] >= 0. Null when not recording.
+     * Can be called between tokens to drain them in chunks.
+     */
+    suspend fun takeTokenLogprobs(): TokenLogprobs? = withInteractive {
+        if (!nativeLoaded || useArmFallback) return@withInteractive null
+        nativeTakeLogprobs()?.let { TokenLogprobs(it) }
+    }
+    
+    /**
+     * Snapshot the conversation, typically at a turn boundary (before
+     * generating a reply). [rewind] to it later to regenerate or edit from
+     * that point. With [keepKv] the snapshot also holds on to its KV cache,
+     * so returning to it after the conversation has moved on to another
+     * branch decodes nothing; only a few snapshots can do so at once.
+     * 
+     * @return Snapshot id, or null if no model is ready
+     */
+    suspend fun snapshot(keepKv: Boolean = false): Int? = withInteractive {
+        if (!nativeLoaded || useArmFallback) return@withInteractive null
+        nativeSnapshot(keepKv).takeIf { it > 0 }
+    }
+    
+    /**
+     * Return the conversation to snapshot [snapshotId] and continue from
+     * there. The KV cache is truncated to what the conversation still
+     * shares with the snapshot and only the remainder is decoded.
+     * 
+     * @return Number of tokens that had to be decoded
+     */
+    suspend fun rewind(snapshotId: Int): Result<Int> = withInteractive {
+        if (!nativeLoaded || useArmFallback) {
+            return@withInteractive Result.failure(IllegalStateException("Snapshots require direct llama.cpp JNI bindings"))
+        }
+        val result = nativeRewind(snapshotId)
+        when {
+            result >= 0 -> Result.success(result)
+            result == -4 -> Result.failure(IllegalArgumentException("Unknown snapshot: $snapshotId"))
+            result == -3 -> Result.failure(CancellationException("Rewind cancelled"))
+            else -> Result.failure(RuntimeException("Failed to rewind: $result"))
+        }
+    }
+    
+    fun releaseSnapshot(snapshotId: Int) {
+        if (nativeLoaded && !useArmFallback) {
+            nativeReleaseSnapshot(snapshotId)
+        }
+    }
+    
+    /**
+     * Write the conversation's KV cache and tokens to [file], to resume it
+     * with [loadSession] without replaying it.
+     */
+    suspend fun saveSession(file: File): Boolean = withInteractive {
+        if (!nativeLoaded || useArmFallback) return@withInteractive false
+        nativeSaveSession(file.absolutePath) > 0
+    }
+    
+    /**
+     * Replace the conversation with one saved by [saveSession] for the same model.
+     */
+    suspend fun loadSession(file: File): Boolean = withInteractive {
+        if (!nativeLoaded || useArmFallback || !file.exists()) return@withInteractive false
+        nativeLoadSession(file.absolutePath) >= 0
+    }
+    
+    /**
+     * Generate [n] independent completions of [userPrompt] (at most 8).
+     * 
+     * The prompt is prefilled once and its KV cache forked to one sequence
+     * per candidate; every step decodes all live candidates in one batch.
+     * The conversation is left unchanged. Candidates come back most likely
+     * first, scored by the sum of their tokens' log-probabilities.
+     */
+    suspend fun generateNBest(
+        userPrompt: String,
+        n: Int,
+        params: GenerationParams = GenerationParams()
+    ): Result<List<Candidate>> = withInteractive {
+        if (!nativeLoaded || useArmFallback) {
+            return@withInteractive Result.failure(IllegalStateException("N-best generation requires direct llama.cpp JNI bindings"))
+        }
+        
+        _state.value = State.Generating
+        val logProbs = FloatArray(n)
+        val texts = nativeGenerateNBest(userPrompt, n, params.maxTokens, params.temperature, logProbs)
+        _state.value = State.ModelReady
+        
+        if (texts == null) {
+            return@withInteractive Result.failure(RuntimeException("N-best generation failed or was cancelled"))
+        }
+        Result.success(texts.mapIndexed { i, text -> Candidate(text, logProbs[i]) })
+    }
+    
     /**
-     * Cancel ongoing generation.
+     * Cancel ongoing interactive generation. [Priority.BACKGROUND] requests
+     * are not affected; they end when their flow's collector is cancelled.
+     * 
+     * Does not wait for the engine lock: the native abort callback interrupts
+     * a running decode (including a long prefill) between graph nodes.
      */
     fun cancelGeneration() {
         if (!useArmFallback) {
@@ -374,6 +1299,48 @@ class LlamaCppEngine private constructor(
         Log.i(TAG, "Generation cancelled")
     }
     
+    /**
+     * Current native engine state (lock-free).
+     */
+    fun nativeState(): NativeState {
+        if (!nativeLoaded || useArmFallback) return NativeState.UNLOADED
+        return NativeState.fromInt(nativeGetState())
+    }
+    
+    /**
+     * Suspend until the native engine reaches one of [states] or [timeoutMs]
+     * elapses (negative waits forever). Waits on a condition variable instead
+     * of polling, so it doesn't compete with the decode loop. The native wait
+     * is split into short slices so cancelling the caller frees the IO thread.
+     * 
+     * @return The state that ended the wait; not in [states] on timeout.
+     */
+    suspend fun awaitNativeState(
+        vararg states: NativeState,
+        timeoutMs: Long = -1
+    ): NativeState = withContext(Dispatchers.IO) {
+        if (!nativeLoaded || useArmFallback) return@withContext NativeState.UNLOADED
+        val mask = states.fold(0) { acc, state -> acc or state.mask }
+        val deadline = if (timeoutMs >= 0) System.currentTimeMillis() + timeoutMs else Long.MAX_VALUE
+        var state: NativeState
+        do {
+            ensureActive()
+            val remaining = (deadline - System.currentTimeMillis()).coerceAtLeast(0)
+            state = NativeState.fromInt(nativeAwaitState(mask, minOf(AWAIT_STATE_SLICE_MS, remaining)))
+        } while ((state.mask and mask) == 0 && remaining > AWAIT_STATE_SLICE_MS)
+        state
+    }
+    
+    /**
+     * Time from the most recent [cancelGeneration] until the native decode
+     * actually stopped, in milliseconds, or null if nothing was cancelled yet.
+     */
+    fun getLastCancelLatencyMs(): Double? {
+        if (!nativeLoaded || useArmFallback) return null
+        val us = nativeGetLastCancelLatencyUs()
+        return if (us >= 0) us / 1000.0 else null
+    }
+    
     /**
      * Unload the current model.
      */
@@ -421,6 +1388,86 @@ class LlamaCppEngine private constructor(
         }
     }
     
+    /**
+     * Tokenize [text] with the loaded model's vocab.
+     * 
+     * Lock-free on the native side and independent of the inference context,
+     * so it can be called from any thread while generation is running.
+     * Returns null if no model is loaded.
+     */
+    fun tokenize(text: String, addSpecial: Boolean = false): IntArray? {
+        if (!nativeLoaded || useArmFallback) return null
+        return nativeTokenize(text, addSpecial)
+    }
+    
+    /**
+     * Count tokens in [text] for prompt budgeting. Returns null if no model is loaded.
+     */
+    fun countTokens(text: String): Int? = countTokens(listOf(text))?.firstOrNull()
+    
+    /**
+     * Count tokens for many strings at once; the native side tokenizes them in
+     * parallel. Returns null if no model is loaded.
+     */
+    fun countTokens(texts: List<String>, addSpecial: Boolean = false): IntArray? {
+        if (!nativeLoaded || useArmFallback) return null
+        return nativeCountTokens(texts.toTypedArray(), addSpecial)
+    }
+    
+    /**
+     * Load a cross-encoder reranker GGUF (e.g. bge-reranker).
+     * 
+     * The reranker has its own model and context, so it can score passages
+     * while the chat model is generating.
+     */
+    suspend fun loadReranker(modelPath: String, nThreads: Int = 0): Result<Unit> = withContext(Dispatchers.IO) {
+        if (!nativeLoaded || useArmFallback) {
+            return@withContext Result.failure(
+                IllegalStateException("Reranking requires direct llama.cpp JNI bindings")
+            )
+        }
+        
+        val resolvedPath = resolveModelPath(modelPath)
+        val result = nativeLoadReranker(resolvedPath, nThreads)
+        if (result != 0) {
+            val errorMsg = when (result) {
+                -1 -> "Failed to load reranker file"
+                -2 -> "Failed to create reranker context"
+                -3 -> "Model is not a reranker"
+                else -> "Unknown error: $result"
+            }
+            return@withContext Result.failure(RuntimeException(errorMsg))
+        }
+        Log.i(TAG, "Reranker loaded: $resolvedPath")
+        Result.success(Unit)
+    }
+    
+    /**
+     * Score each candidate passage against [query] in one batched decode.
+     * 
+     * Returns one score per candidate (higher is more relevant), or null if no
+     * reranker is loaded. Candidates not reached within [timeBudgetMs] are NaN.
+     */
+    suspend fun rerank(
+        query: String,
+        candidates: List<String>,
+        timeBudgetMs: Int = DEFAULT_RERANK_BUDGET_MS
+    ): FloatArray? = withContext(Dispatchers.Default) {
+        if (!nativeLoaded || useArmFallback || candidates.isEmpty()) {
+            return@withContext null
+        }
+        nativeRerank(query, candidates.toTypedArray(), timeBudgetMs)
+    }
+    
+    /**
+     * Release the reranker model.
+     */
+    fun unloadReranker() {
+        if (nativeLoaded && !useArmFallback) {
+            nativeUnloadReranker()
+        }
+    }
+    
     /**
      * Get current model info.
      */
@@ -458,3 +1505,11 @@ class UnsupportedModelException(
     message: String,
     cause: Throwable? = null
 ) : Exception(message, cause)
+
+/**
+ * Exception thrown when a model is estimated not to fit in available RAM.
+ */
+class InsufficientMemoryException(
+    message: String,
+    val estimate: GgufInspector.MemoryEstimate
+) : Exception(message)
@@ -9,6 +9,7 @@ import org.json.JSONArray
 import org.json.JSONObject
 import java.io.File
 import java.util.UUID
+import java.util.concurrent.ConcurrentHashMap
 
 private const val TAG = "ModelRegistry"
 
@@ -239,6 +240,10 @@ class ModelRegistry(private val context: Context) {
     private val _selectedPersonaId = MutableStateFlow<String>("default")
     val selectedPersonaId: StateFlow<String> = _selectedPersonaId.asStateFlow()
     
+    // GGUF metadata by model file version, so a re-downloaded file is read again
+    private data class MetadataKey(val path: String, val lastModified: Long, val size: Long)
+    private val metadataCache = ConcurrentHashMap<MetadataKey, GgufMetadata>()
+    
     // Expose ModelManager states
     val downloadState = modelManager.downloadState
     val currentDownloadModel = modelManager.currentDownloadModel
@@ -518,6 +523,41 @@ class ModelRegistry(private val context: Context) {
         return getModelPath(modelId) != null
     }
     
+    /**
+     * Read architecture, context length, quantization etc. from the model's
+     * GGUF header without loading it. Null if not downloaded or not GGUF.
+     */
+    fun getModelMetadata(modelId: String): GgufMetadata? {
+        val file = File(getModelPath(modelId) ?: return null)
+        val key = MetadataKey(file.absolutePath, file.lastModified(), file.length())
+        metadataCache[key]?.let { return it }
+        val metadata = GgufInspector.read(file) ?: return null
+        metadataCache.keys.removeIf { it.path == key.path }
+        metadataCache[key] = metadata
+        return metadata
+    }
+    
+    /**
+     * Check that a downloaded model will fit in available RAM at [nCtx]
+     * before loading it. Fails with the estimate in the message if not.
+     * [LlamaCppEngine.loadModel] runs the same check itself; this is for
+     * callers that want to warn before starting a load.
+     */
+    fun checkModelFits(modelId: String, nCtx: Int): Result<GgufInspector.MemoryEstimate> {
+        val metadata = getModelMetadata(modelId)
+            ?: return Result.failure(Exception("No GGUF metadata for model: $modelId"))
+        val estimate = metadata.estimateMemory(nCtx)
+            ?: return Result.failure(Exception("Memory estimate unavailable"))
+        
+        if (!GgufInspector.fitsInMemory(context, estimate)) {
+            Log.w(TAG, "$modelId needs ~${estimate.totalBytes / (1024 * 1024)} MB at n_ctx=$nCtx")
+            return Result.failure(Exception(
+                "Not enough memory: ${metadata.name.ifEmpty { modelId }} needs ~${estimate.totalBytes / (1024 * 1024)} MB"
+            ))
+        }
+        return Result.success(estimate)
+    }
+    
     /**
      * Get storage usage info.
      */
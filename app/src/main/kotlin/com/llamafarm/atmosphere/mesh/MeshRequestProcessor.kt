@@ -14,6 +14,11 @@ import java.io.File
 /**
  * Processes incoming mesh inference requests targeting this phone's local Llama 3.2 model.
  * Polls the _requests CRDT collection and runs on-device inference for matching requests.
+ *
+ * Requests that name a deadline (deadline_ms or timeout_ms) and that the
+ * engine's completion estimate says would miss it are rejected up front,
+ * with the estimate in the response, so the requester fails fast instead
+ * of timing out. Requests without one are always admitted.
  */
 class MeshRequestProcessor(
     private val atmosphereHandle: Long,
@@ -22,14 +27,20 @@ class MeshRequestProcessor(
     companion object {
         private const val TAG = "MeshRequestProcessor"
         private const val POLL_INTERVAL_MS = 3000L
+        // Peers ignore capacity older than 30 s (INFERENCE_CAPACITY_TTL_MS in core/src/cost.rs)
+        private const val CAPACITY_PUBLISH_INTERVAL_MS = 10_000L
         private const val TARGET_CAPABILITY = "local:llama-3.2-1b:default"
         private const val MODEL_FILENAME = "Llama-3.2-1B-Instruct-Q4_K_M.gguf"
         private const val MODEL_NAME = "Llama-3.2-1B-Instruct-Q4_K_M"
+        private const val DEFAULT_MAX_TOKENS = 512
+        // Estimates are for the full max_tokens; still leave some slack
+        private const val ESTIMATE_MARGIN = 1.2
     }
 
     private val scope = CoroutineScope(SupervisorJob() + Dispatchers.IO)
     private val processedRequests = HashSet<String>()
     private var pollingJob: Job? = null
+    private var capacityJob: Job? = null
     private var isProcessing = false
     private var modelLoaded = false
     private var myPeerId: String? = null
@@ -52,12 +63,22 @@ class MeshRequestProcessor(
                 delay(POLL_INTERVAL_MS)
             }
         }
+        // Separate from polling, which is blocked while a request runs: the
+        // queue and KV headroom peers see stay current mid-generation
+        capacityJob = scope.launch {
+            while (isActive) {
+                publishInferenceCapacity()
+                delay(CAPACITY_PUBLISH_INTERVAL_MS)
+            }
+        }
     }
 
     fun stop() {
         Log.i(TAG, "Stopping mesh request processor")
         pollingJob?.cancel()
         pollingJob = null
+        capacityJob?.cancel()
+        capacityJob = null
         scope.cancel()
     }
 
@@ -106,6 +127,9 @@ class MeshRequestProcessor(
             val target = doc.optString("target", "")
             val targetCapability = doc.optString("target_capability", "")
             if (target != TARGET_CAPABILITY && targetCapability != TARGET_CAPABILITY) continue
+            // Addressed to one peer (e.g. re-routed to the fastest one): leave it to that peer
+            val targetNodeId = doc.optString("target_node_id", "")
+            if (targetNodeId.isNotEmpty() && targetNodeId != myPeerId) continue
 
             Log.i(TAG, "📥 Found matching request: $requestId")
             processedRequests.add(requestId)
@@ -116,6 +140,7 @@ class MeshRequestProcessor(
     }
 
     private suspend fun processRequest(requestId: String, doc: JSONObject) {
+        val receivedMs = System.currentTimeMillis()
         isProcessing = true
         try {
             // Mark as processing
@@ -131,6 +156,13 @@ class MeshRequestProcessor(
             }
             Log.i(TAG, "Prompt (${prompt.length} chars): ${prompt.take(100)}...")
 
+            val maxTokens = doc.optInt("max_tokens", DEFAULT_MAX_TOKENS).coerceAtLeast(1)
+            val deadlineMs = requestDeadlineMs(doc, receivedMs)
+            if (deadlineMs != null && deadlineMs <= System.currentTimeMillis()) {
+                rejectRequest(requestId, doc, "Deadline already passed", null, deadlineMs)
+                return
+            }
+
             // Ensure model is loaded
             if (!ensureModelLoaded()) {
                 Log.e(TAG, "Failed to load model for request $requestId")
@@ -139,13 +171,34 @@ class MeshRequestProcessor(
                 return
             }
 
-            // Run inference
+            // Admission: null until this model has run once, then admit
+            // only what should finish in time
             val engine = LlamaCppEngine.getInstance(context)
+            val estimate = engine.estimateCompletion(prompt, maxTokens)
+            if (estimate != null && deadlineMs != null) {
+                val remainingMs = deadlineMs - System.currentTimeMillis()
+                if (estimate.totalMs * ESTIMATE_MARGIN > remainingMs) {
+                    rejectRequest(
+                        requestId, doc,
+                        "Estimated ${estimate.totalMs.toLong()}ms exceeds the ${remainingMs}ms left",
+                        estimate, deadlineMs
+                    )
+                    return
+                }
+            }
+
+            // Run inference
             val response = StringBuilder()
             val startTime = System.currentTimeMillis()
 
+            // Background priority: its own conversation, paused whenever
+            // the user is chatting
+            val params = LlamaCppEngine.GenerationParams(
+                maxTokens = maxTokens,
+                priority = LlamaCppEngine.Priority.BACKGROUND
+            )
             withContext(Dispatchers.Default) {
-                engine.generate(prompt).collect { token ->
+                engine.generate(prompt, params).collect { token ->
                     response.append(token)
                 }
             }
@@ -155,7 +208,7 @@ class MeshRequestProcessor(
             Log.i(TAG, "✅ Inference complete: ${content.length} chars in ${inferenceMs}ms")
 
             // Write response
-            writeSuccessResponse(requestId, content, inferenceMs)
+            writeSuccessResponse(requestId, content, inferenceMs, estimate)
             updateRequestStatus(requestId, doc, "completed")
 
         } catch (e: Exception) {
@@ -164,7 +217,73 @@ class MeshRequestProcessor(
             try { updateRequestStatus(requestId, doc, "error") } catch (_: Exception) {}
         } finally {
             isProcessing = false
+            publishInferenceCapacity()
+        }
+    }
+
+    // Refresh this node's measured capacity on its capability doc
+    // (cost.inference), where peers' cost models read it; see
+    // InferenceCapacity in core/src/cost.rs. Every phone writes the same
+    // key, so the synced doc may be another peer's: stamp it as ours.
+    private fun publishInferenceCapacity() {
+        val capacity = LlamaCppEngine.getInstance(context).getInferenceCapacity() ?: return
+        val peerId = myPeerId ?: return
+        try {
+            val existing = AtmosphereNative.get(atmosphereHandle, "_capabilities", TARGET_CAPABILITY)
+            if (existing == "null") return
+            val doc = JSONObject(existing)
+            if (doc.optString("peer_id") != peerId) {
+                doc.put("peer_id", peerId)
+                doc.put("peer_name", android.os.Build.MODEL ?: "Android")
+                doc.remove("device_info")
+            }
+            val cost = doc.optJSONObject("cost") ?: JSONObject()
+            cost.put("inference", capacity.toJson())
+            doc.put("cost", cost)
+            AtmosphereNative.insert(atmosphereHandle, "_capabilities", TARGET_CAPABILITY, doc.toString())
+            Log.d(TAG, "Published capacity: ${"%.1f".format(capacity.decodeTokensPerSecond)} tok/s, " +
+                    "queue ${capacity.queueDepth}, ${capacity.kvHeadroomTokens} KV cells free")
+        } catch (e: Exception) {
+            Log.w(TAG, "Failed to publish inference capacity: ${e.message}")
+        }
+    }
+
+    // When the requester stops waiting, in epoch ms, or null if it didn't
+    // say (no admission check then). timeout_ms counts from when this node
+    // picked the request up, so it never compares the two devices' clocks;
+    // deadline_ms is the requester's own absolute bound.
+    private fun requestDeadlineMs(doc: JSONObject, receivedMs: Long): Long? = when {
+        doc.has("deadline_ms") -> doc.optLong("deadline_ms")
+        doc.has("timeout_ms") -> receivedMs + doc.optLong("timeout_ms")
+        else -> null
+    }
+
+    private fun rejectRequest(
+        requestId: String,
+        doc: JSONObject,
+        reason: String,
+        estimate: LlamaCppEngine.CompletionEstimate?,
+        deadlineMs: Long
+    ) {
+        Log.i(TAG, "⏱️ Rejecting $requestId: $reason")
+        try {
+            val responseDoc = JSONObject().apply {
+                put("_id", requestId)
+                put("request_id", requestId)
+                put("peer_id", myPeerId ?: "unknown")
+                put("content", reason)
+                put("model", MODEL_NAME)
+                put("inference_ms", 0)
+                if (estimate != null) put("estimated_ms", estimate.totalMs.toLong())
+                put("deadline_ms", deadlineMs)
+                put("timestamp", System.currentTimeMillis() / 1000)
+                put("status", "rejected")
+            }
+            AtmosphereNative.insert(atmosphereHandle, "_responses", requestId, responseDoc.toString())
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to write rejection: ${e.message}")
         }
+        updateRequestStatus(requestId, doc, "rejected")
     }
 
     private fun extractPrompt(doc: JSONObject): String? {
@@ -235,7 +354,12 @@ class MeshRequestProcessor(
         }
     }
 
-    private fun writeSuccessResponse(requestId: String, content: String, inferenceMs: Long) {
+    private fun writeSuccessResponse(
+        requestId: String,
+        content: String,
+        inferenceMs: Long,
+        estimate: LlamaCppEngine.CompletionEstimate?
+    ) {
         try {
             val responseDoc = JSONObject().apply {
                 put("_id", requestId)
@@ -244,6 +368,7 @@ class MeshRequestProcessor(
                 put("content", content)
                 put("model", MODEL_NAME)
                 put("inference_ms", inferenceMs)
+                if (estimate != null) put("estimated_ms", estimate.totalMs.toLong())
                 put("timestamp", System.currentTimeMillis() / 1000)
                 put("status", "completed")
             }
@@ -1,6 +1,7 @@
 package com.llamafarm.atmosphere.mesh
 
 import android.util.Log
+import com.llamafarm.atmosphere.inference.GgufMetadata
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
@@ -76,6 +77,17 @@ data class ModelCatalogEntry(
         return System.currentTimeMillis() - lastSeen > ttl
     }
     
+    /**
+     * GGUF header metadata, if the advertising peer included it
+     * (`metadata.gguf`, see [GgufMetadata.toJson]).
+     */
+    val gguf: GgufMetadata? by lazy {
+        when (val value = metadata["gguf"]) {
+            is JSONObject -> GgufMetadata.fromJson(value)
+            else -> null
+        }
+    }
+    
     /**
      * Get the best peer to download from.
      * Prefers: HTTP endpoint > low latency > high reliability.
@@ -4,6 +4,8 @@ import android.content.Context
 import android.util.Base64
 import android.util.Log
 import com.llamafarm.atmosphere.core.GossipManager
+import com.llamafarm.atmosphere.inference.GgufInspector
+import com.llamafarm.atmosphere.inference.LlamaCppEngine
 import com.llamafarm.atmosphere.inference.ModelManager
 import kotlinx.coroutines.*
 import kotlinx.coroutines.flow.*
@@ -13,7 +15,6 @@ import org.json.JSONObject
 import java.io.File
 import java.io.FileOutputStream
 import java.io.RandomAccessFile
-import java.security.MessageDigest
 import java.util.UUID
 import java.util.concurrent.ConcurrentHashMap
 import java.util.concurrent.TimeUnit
@@ -135,6 +136,15 @@ class ModelTransferService(
             return null
         }
         
+        // Don't spend the transfer on a model this device can't run
+        val estimate = catalogEntry.gguf?.estimateMemory(LlamaCppEngine.DEFAULT_CONTEXT_SIZE)
+        if (estimate != null && !GgufInspector.fitsInMemory(context, estimate)) {
+            val neededMb = estimate.totalBytes / (1024 * 1024)
+            Log.w(TAG, "Model $modelId needs ~$neededMb MB, not downloading")
+            updateDownloadState(modelId, DownloadState.Failed(modelId, "Needs ~$neededMb MB of RAM"))
+            return null
+        }
+        
         val requestId = UUID.randomUUID().toString()
         
         updateDownloadState(modelId, DownloadState.Preparing(modelId))
@@ -165,6 +175,8 @@ class ModelTransferService(
     
     /**
      * Download via direct HTTP (LAN peers).
+     * Large models go through [ParallelRangeDownloader] when llama-jni is
+     * available; otherwise (or if the peer ignores Range) a single stream.
      */
     private suspend fun downloadViaHttp(
         requestId: String,
@@ -176,84 +188,38 @@ class ModelTransferService(
         
         val destFile = File(modelsDir, "${catalogEntry.modelId}.${catalogEntry.format}")
         val tempFile = File(modelsDir, "${catalogEntry.modelId}.${catalogEntry.format}.tmp")
+        val rangesFile = RangeFileWriter.rangesFile(tempFile)
         
         try {
-            // Check for resume
-            val resumeFromByte = if (tempFile.exists()) tempFile.length() else 0L
-            
             val url = "$httpEndpoint/v1/models/download/${catalogEntry.modelId}"
-            val request = Request.Builder()
-                .url(url)
-                .addHeader("Range", "bytes=$resumeFromByte-")
-                .build()
             
-            val response = okHttpClient.newCall(request).execute()
+            val useRanged = RangeFileWriter.isAvailable &&
+                catalogEntry.sizeBytes >= 2L * ParallelRangeDownloader.DEFAULT_CHUNK_SIZE
             
-            if (!response.isSuccessful) {
-                throw Exception("HTTP ${response.code}: ${response.message}")
-            }
-            
-            val totalBytes = (response.body?.contentLength() ?: 0) + resumeFromByte
-            val inputStream = response.body?.byteStream()
-                ?: throw Exception("Empty response body")
-            
-            val outputStream = FileOutputStream(tempFile, resumeFromByte > 0)
-            
-            val buffer = ByteArray(65536)
-            var bytesRead: Int
-            var totalDownloaded = resumeFromByte
-            var lastProgressUpdate = System.currentTimeMillis()
-            val startTime = System.currentTimeMillis()
+            val rangedHash = if (useRanged) {
+                try {
+                    downloadRanged(url, modelId, catalogEntry.sizeBytes, tempFile)
+                } catch (e: RangeNotSupportedException) {
+                    Log.w(TAG, "${peer.nodeName} doesn't serve ranges, using a single stream")
+                    tempFile.delete()
+                    rangesFile.delete()
+                    null
+                }
+            } else null
             
-            while (inputStream.read(buffer).also { bytesRead = it } != -1) {
-                if (!isActive) {
-                    inputStream.close()
-                    outputStream.close()
+            val computedHash = rangedHash
+                ?: downloadSingleStream(url, modelId, tempFile, rangesFile)
+                ?: run {
                     updateDownloadState(modelId, DownloadState.Cancelled(modelId))
                     return@withContext
                 }
-                
-                outputStream.write(buffer, 0, bytesRead)
-                totalDownloaded += bytesRead
-                
-                // Update progress at most every 500ms
-                val now = System.currentTimeMillis()
-                if (now - lastProgressUpdate > 500) {
-                    val elapsedSeconds = (now - startTime) / 1000f
-                    val transferRateMbps = if (elapsedSeconds > 0) {
-                        ((totalDownloaded - resumeFromByte) * 8f / 1_000_000f) / elapsedSeconds
-                    } else 0f
-                    
-                    val remainingBytes = totalBytes - totalDownloaded
-                    val etaSeconds = if (transferRateMbps > 0) {
-                        (remainingBytes * 8f / 1_000_000f / transferRateMbps).toInt()
-                    } else 0
-                    
-                    val progress = DownloadProgress(
-                        modelId = modelId,
-                        bytesDownloaded = totalDownloaded,
-                        totalBytes = totalBytes,
-                        chunksReceived = (totalDownloaded / 65536).toInt(),
-                        totalChunks = (totalBytes / 65536).toInt() + 1,
-                        transferRateMbps = transferRateMbps,
-                        etaSeconds = etaSeconds
-                    )
-                    
-                    updateDownloadState(modelId, DownloadState.Downloading(progress))
-                    lastProgressUpdate = now
-                }
-            }
             
-            inputStream.close()
-            outputStream.close()
-            response.close()
-            
-            // Verify SHA-256
+            // Verify SHA-256 (already computed incrementally)
             updateDownloadState(modelId, DownloadState.Verifying(modelId))
             
-            val computedHash = computeSha256(tempFile)
             if (computedHash.lowercase() != catalogEntry.sha256.lowercase()) {
                 tempFile.delete()
+                rangesFile.delete()
                 throw Exception("SHA-256 verification failed: expected ${catalogEntry.sha256}, got $computedHash")
             }
             
@@ -273,6 +239,7 @@ class ModelTransferService(
                 put("version", catalogEntry.version)
                 put("downloaded_from", peer.nodeName)
                 put("downloaded_at", System.currentTimeMillis())
+                GgufInspector.read(destFile)?.let { put("gguf", it.toJson()) }
             }
             metadataFile.writeText(metadataJson.toString(2))
             
@@ -283,9 +250,16 @@ class ModelTransferService(
             // Update peer reliability (success)
             modelCatalog.updatePeerReliability(peer.nodeId, success = true)
             
+        } catch (e: CancellationException) {
+            // Ranged chunks already on disk are kept for the next attempt
+            updateDownloadState(modelId, DownloadState.Cancelled(modelId))
+            throw e
         } catch (e: Exception) {
             Log.e(TAG, "Download failed for $modelId: ${e.message}", e)
-            tempFile.delete()
+            // A ranged download keeps its completed chunks for resume
+            if (!rangesFile.exists()) {
+                tempFile.delete()
+            }
             updateDownloadState(modelId, DownloadState.Failed(modelId, e.message ?: "Unknown error"))
             
             // Update peer reliability (failure)
@@ -295,6 +269,134 @@ class ModelTransferService(
         }
     }
     
+    /**
+     * Fetch [totalBytes] as concurrent ranges into the preallocated [tempFile].
+     * Returns the whole-file SHA-256.
+     */
+    private suspend fun downloadRanged(
+        url: String,
+        modelId: String,
+        totalBytes: Long,
+        tempFile: File
+    ): String {
+        val startTime = System.currentTimeMillis()
+        var firstBytesDone = -1L
+        
+        val result = ParallelRangeDownloader(okHttpClient).download(url, tempFile, totalBytes) { done, total ->
+            if (firstBytesDone < 0) firstBytesDone = done
+            updateDownloadState(modelId, DownloadState.Downloading(
+                buildProgress(modelId, done, total, done - firstBytesDone, startTime)
+            ))
+        }
+        
+        Log.i(TAG, "Ranged download of $modelId: ${result.chunkHashes.size} chunks, " +
+            "${result.bytesFetched} bytes fetched in ${System.currentTimeMillis() - startTime}ms")
+        return result.sha256
+    }
+    
+    /**
+     * Stream the file with one request, resuming from the end of [tempFile].
+     * Returns the SHA-256, or null if cancelled.
+     */
+    private suspend fun downloadSingleStream(
+        url: String,
+        modelId: String,
+        tempFile: File,
+        rangesFile: File
+    ): String? {
+        // A preallocated file from a ranged attempt can't be resumed by length
+        if (rangesFile.exists()) {
+            tempFile.delete()
+            rangesFile.delete()
+        }
+        
+        // Check for resume
+        val resumeFromByte = if (tempFile.exists()) tempFile.length() else 0L
+        
+        val request = Request.Builder()
+            .url(url)
+            .addHeader("Range", "bytes=$resumeFromByte-")
+            .build()
+        
+        val response = okHttpClient.newCall(request).execute()
+        
+        if (!response.isSuccessful) {
+            response.close()
+            throw Exception("HTTP ${response.code}: ${response.message}")
+        }
+        
+        val totalBytes = (response.body?.contentLength() ?: 0) + resumeFromByte
+        val inputStream = response.body?.byteStream()
+            ?: throw Exception("Empty response body")
+        
+        // Hash while writing so verification completes with the last byte
+        Sha256Verifier().use { hasher ->
+            FileOutputStream(tempFile, resumeFromByte > 0).use { outputStream ->
+                if (resumeFromByte > 0) {
+                    hasher.updateFromFile(tempFile, resumeFromByte)
+                }
+                
+                val buffer = ByteArray(65536)
+                var bytesRead: Int
+                var totalDownloaded = resumeFromByte
+                var lastProgressUpdate = System.currentTimeMillis()
+                val startTime = System.currentTimeMillis()
+                
+                while (inputStream.read(buffer).also { bytesRead = it } != -1) {
+                    if (!currentCoroutineContext().isActive) {
+                        inputStream.close()
+                        return null
+                    }
+                    
+                    outputStream.write(buffer, 0, bytesRead)
+                    hasher.update(buffer, 0, bytesRead)
+                    totalDownloaded += bytesRead
+                    
+                    // Update progress at most every 500ms
+                    val now = System.currentTimeMillis()
+                    if (now - lastProgressUpdate > 500) {
+                        updateDownloadState(modelId, DownloadState.Downloading(
+                            buildProgress(modelId, totalDownloaded, totalBytes, totalDownloaded - resumeFromByte, startTime)
+                        ))
+                        lastProgressUpdate = now
+                    }
+                }
+            }
+            
+            inputStream.close()
+            response.close()
+            return hasher.digestHex()
+        }
+    }
+    
+    private fun buildProgress(
+        modelId: String,
+        bytesDownloaded: Long,
+        totalBytes: Long,
+        bytesThisSession: Long,
+        startTime: Long
+    ): DownloadProgress {
+        val elapsedSeconds = (System.currentTimeMillis() - startTime) / 1000f
+        val transferRateMbps = if (elapsedSeconds > 0) {
+            (bytesThisSession * 8f / 1_000_000f) / elapsedSeconds
+        } else 0f
+        
+        val remainingBytes = totalBytes - bytesDownloaded
+        val etaSeconds = if (transferRateMbps > 0) {
+            (remainingBytes * 8f / 1_000_000f / transferRateMbps).toInt()
+        } else 0
+        
+        return DownloadProgress(
+            modelId = modelId,
+            bytesDownloaded = bytesDownloaded,
+            totalBytes = totalBytes,
+            chunksReceived = (bytesDownloaded / 65536).toInt(),
+            totalChunks = (totalBytes / 65536).toInt() + 1,
+            transferRateMbps = transferRateMbps,
+            etaSeconds = etaSeconds
+        )
+    }
+    
     /**
      * LEGACY - WebSocket transfer removed. Use HTTP transfer only.
      */
@@ -368,19 +470,9 @@ class ModelTransferService(
     }
     
     /**
-     * Compute SHA-256 hash of a file.
+     * Compute SHA-256 hash of an existing file (native mmap hash when available).
      */
-    private fun computeSha256(file: File): String {
-        val digest = MessageDigest.getInstance("SHA-256")
-        file.inputStream().use { input ->
-            val buffer = ByteArray(8192)
-            var bytesRead: Int
-            while (input.read(buffer).also { bytesRead = it } != -1) {
-                digest.update(buffer, 0, bytesRead)
-            }
-        }
-        return digest.digest().joinToString("") { "%02x".format(it) }
-    }
+    fun computeSha256(file: File): String = Sha256Verifier.hashFile(file)
     
     /**
      * Update download state and emit to StateFlow.
@@ -0,0 +1,150 @@
+package com.llamafarm.atmosphere.mesh
+
+import android.util.Log
+import kotlinx.coroutines.*
+import kotlinx.coroutines.channels.Channel
+import okhttp3.OkHttpClient
+import okhttp3.Request
+import java.io.File
+import java.io.IOException
+import java.nio.ByteBuffer
+
+private const val TAG = "ParallelRangeDownloader"
+
+/**
+ * Thrown when the server ignores `Range` and answers with the whole body.
+ * Callers should fall back to a single-stream download.
+ */
+class RangeNotSupportedException(message: String) : IOException(message)
+
+/**
+ * Fetches a file as [parallelism] concurrent HTTP byte ranges written
+ * straight to their offsets through [RangeFileWriter].
+ *
+ * Each chunk is one `Range: bytes=start-end` request. Chunks survive a
+ * process restart, so calling [download] again on the same file only
+ * fetches what's missing. Works against any HTTP/1.1 server that honours
+ * single-range requests (a peer's `/v1/models/download` endpoint, or a
+ * local stand-in when testing), and takes the [OkHttpClient] to use.
+ */
+class ParallelRangeDownloader(
+    private val client: OkHttpClient,
+    private val parallelism: Int = DEFAULT_PARALLELISM,
+    private val chunkSize: Int = DEFAULT_CHUNK_SIZE
+) {
+
+    companion object {
+        const val DEFAULT_PARALLELISM = 4
+        const val DEFAULT_CHUNK_SIZE = 8 * 1024 * 1024
+        private const val BUFFER_SIZE = 256 * 1024
+        private const val MAX_CHUNK_ATTEMPTS = 3
+        private const val PROGRESS_INTERVAL_MS = 500L
+    }
+
+    /**
+     * Result of a completed transfer.
+     */
+    data class Result(
+        val sha256: String,
+        val chunkHashes: List<String?>,
+        val bytesFetched: Long
+    )
+
+    /**
+     * Download [totalBytes] from [url] into [file].
+     *
+     * [onProgress] is called with (bytes on disk, total) at most every 500ms.
+     * Throws [RangeNotSupportedException] if the server doesn't do ranges and
+     * [IOException] if a chunk keeps failing; completed chunks are kept for
+     * the next attempt either way.
+     */
+    suspend fun download(
+        url: String,
+        file: File,
+        totalBytes: Long,
+        onProgress: (Long, Long) -> Unit = { _, _ -> }
+    ): Result = withContext(Dispatchers.IO) {
+        RangeFileWriter(file, totalBytes, chunkSize).use { writer ->
+            val missing = writer.missingChunks()
+            val resumedBytes = writer.bytesDone()
+            Log.i(TAG, "Fetching ${missing.size} chunks of ${file.name} " +
+                "($resumedBytes/$totalBytes bytes already present, $parallelism streams)")
+
+            val queue = Channel<Int>(Channel.UNLIMITED)
+            missing.forEach { queue.trySend(it) }
+            queue.close()
+
+            coroutineScope {
+                val progress = launch {
+                    while (isActive) {
+                        onProgress(writer.bytesDone(), totalBytes)
+                        delay(PROGRESS_INTERVAL_MS)
+                    }
+                }
+
+                val workers = List(minOf(parallelism, missing.size)) {
+                    launch {
+                        // One direct buffer per stream: the native side pwrites from it in place
+                        val buffer = ByteBuffer.allocateDirect(BUFFER_SIZE)
+                        for (chunk in queue) {
+                            fetchChunk(url, writer, chunk, buffer)
+                        }
+                    }
+                }
+                workers.joinAll()
+                progress.cancel()
+            }
+
+            onProgress(totalBytes, totalBytes)
+            Result(
+                sha256 = writer.finish(),
+                chunkHashes = writer.chunkHashes(),
+                bytesFetched = totalBytes - resumedBytes
+            )
+        }
+    }
+
+    private suspend fun fetchChunk(url: String, writer: RangeFileWriter, chunk: Int, buffer: ByteBuffer) {
+        val start = writer.chunkOffset(chunk)
+        val end = start + writer.chunkLength(chunk) - 1
+
+        var lastError: IOException? = null
+        repeat(MAX_CHUNK_ATTEMPTS) { attempt ->
+            currentCoroutineContext().ensureActive()
+            try {
+                writer.beginChunk(chunk)
+                val request = Request.Builder()
+                    .url(url)
+                    .addHeader("Range", "bytes=$start-$end")
+                    .build()
+
+                client.newCall(request).execute().use { response ->
+                    if (response.code == 200) {
+                        throw RangeNotSupportedException("Server ignored Range header for $url")
+                    }
+                    if (response.code != 206) {
+                        throw IOException("HTTP ${response.code}: ${response.message}")
+                    }
+
+                    val source = response.body?.source() ?: throw IOException("Empty response body")
+                    while (true) {
+                        currentCoroutineContext().ensureActive()
+                        buffer.clear()
+                        val bytesRead = source.read(buffer)
+                        if (bytesRead == -1) break
+                        if (bytesRead > 0) writer.write(chunk, buffer, bytesRead)
+                    }
+                }
+
+                writer.completeChunk(chunk)
+                return
+            } catch (e: RangeNotSupportedException) {
+                throw e
+            } catch (e: IOException) {
+                Log.w(TAG, "Chunk $chunk attempt ${attempt + 1} failed: ${e.message}")
+                lastError = e
+            }
+        }
+        throw lastError ?: IOException("Chunk $chunk failed")
+    }
+}
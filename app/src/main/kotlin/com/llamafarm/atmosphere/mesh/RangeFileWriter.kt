@@ -0,0 +1,150 @@
+package com.llamafarm.atmosphere.mesh
+
+import android.util.Log
+import java.io.Closeable
+import java.io.File
+import java.io.IOException
+import java.nio.ByteBuffer
+
+/**
+ * Chunked, resumable download target backed by range_file.cpp in llama-jni.
+ *
+ * The file is preallocated to [totalBytes] and split into [chunkSize] chunks
+ * that can be written concurrently from different threads (one writer per
+ * chunk). Each chunk is hashed as it streams in; completed chunks and their
+ * hashes are persisted to `<file>.ranges` so a later [RangeFileWriter] on the
+ * same file only reports the chunks that are still [missingChunks].
+ *
+ * Usage:
+ * ```kotlin
+ * RangeFileWriter(tempFile, totalBytes, chunkSize).use { writer ->
+ *     for (chunk in writer.missingChunks()) {
+ *         writer.beginChunk(chunk)
+ *         writer.write(chunk, buffer, n)  // direct ByteBuffer, repeated
+ *         writer.completeChunk(chunk)
+ *     }
+ *     val sha256 = writer.finish()
+ * }
+ * ```
+ */
+class RangeFileWriter(
+    val file: File,
+    val totalBytes: Long,
+    val chunkSize: Int
+) : Closeable {
+
+    companion object {
+        private const val TAG = "RangeFileWriter"
+
+        val isAvailable: Boolean by lazy {
+            try {
+                System.loadLibrary("llama-jni")
+                true
+            } catch (e: UnsatisfiedLinkError) {
+                Log.i(TAG, "llama-jni not available, ranged downloads disabled")
+                false
+            }
+        }
+
+        /**
+         * Sidecar that records completed chunks for [file].
+         */
+        fun rangesFile(file: File): File = File(file.path + ".ranges")
+
+        // Native methods - range_file.cpp in llama-jni
+        @JvmStatic
+        private external fun nativeOpen(path: String, totalBytes: Long, chunkSize: Int): Long
+
+        @JvmStatic
+        private external fun nativeMissingChunks(handle: Long): IntArray
+
+        @JvmStatic
+        private external fun nativeChunkOffset(handle: Long, chunk: Int): Long
+
+        @JvmStatic
+        private external fun nativeChunkLength(handle: Long, chunk: Int): Int
+
+        @JvmStatic
+        private external fun nativeBeginChunk(handle: Long, chunk: Int)
+
+        @JvmStatic
+        private external fun nativeWrite(handle: Long, chunk: Int, buffer: ByteBuffer, length: Int): Int
+
+        @JvmStatic
+        private external fun nativeCompleteChunk(handle: Long, chunk: Int): String?
+
+        @JvmStatic
+        private external fun nativeChunkHashes(handle: Long): Array<String?>
+
+        @JvmStatic
+        private external fun nativeBytesDone(handle: Long): Long
+
+        @JvmStatic
+        private external fun nativeFinish(handle: Long): String?
+
+        @JvmStatic
+        private external fun nativeClose(handle: Long)
+    }
+
+    private var handle: Long = nativeOpen(file.absolutePath, totalBytes, chunkSize)
+
+    init {
+        if (handle == 0L) {
+            throw IOException("Failed to open ${file.absolutePath} for ranged download")
+        }
+    }
+
+    /**
+     * Chunk indices not yet completed (all of them for a fresh file).
+     */
+    fun missingChunks(): IntArray = nativeMissingChunks(handle)
+
+    fun chunkOffset(chunk: Int): Long = nativeChunkOffset(handle, chunk)
+
+    fun chunkLength(chunk: Int): Int = nativeChunkLength(handle, chunk)
+
+    /**
+     * Start (or restart after a failed attempt) writing [chunk] from its first byte.
+     */
+    fun beginChunk(chunk: Int) = nativeBeginChunk(handle, chunk)
+
+    /**
+     * Write the next [length] bytes of [chunk] from the start of a direct [buffer].
+     */
+    fun write(chunk: Int, buffer: ByteBuffer, length: Int) {
+        require(buffer.isDirect) { "RangeFileWriter needs a direct ByteBuffer" }
+        val result = nativeWrite(handle, chunk, buffer, length)
+        if (result != 0) {
+            throw IOException("Write to chunk $chunk failed ($result)")
+        }
+    }
+
+    /**
+     * Mark [chunk] durable and return its SHA-256.
+     */
+    fun completeChunk(chunk: Int): String {
+        return nativeCompleteChunk(handle, chunk)
+            ?: throw IOException("Chunk $chunk is incomplete or could not be synced")
+    }
+
+    /**
+     * SHA-256 of every chunk, null for chunks not completed yet.
+     */
+    fun chunkHashes(): List<String?> = nativeChunkHashes(handle).toList()
+
+    fun bytesDone(): Long = nativeBytesDone(handle)
+
+    /**
+     * Whole-file SHA-256 once every chunk is complete. Removes the sidecar.
+     */
+    fun finish(): String {
+        return nativeFinish(handle) ?: throw IOException("Download of ${file.name} is incomplete")
+    }
+
+    override fun close() {
+        if (handle != 0L) {
+            nativeClose(handle)
+            handle = 0L
+        }
+    }
+}
@@ -0,0 +1,132 @@
+package com.llamafarm.atmosphere.mesh
+
+import android.util.Log
+import java.io.Closeable
+import java.io.File
+import java.security.MessageDigest
+
+/**
+ * Incremental SHA-256 for model transfers.
+ *
+ * Backed by the native hasher in llama-jni (ARMv8 SHA2 / x86 SHA-NI when the
+ * CPU has them), falling back to [MessageDigest] if the library isn't
+ * available. Feed it bytes as they are written so verification is done the
+ * moment the last byte lands, instead of re-reading the file afterwards.
+ *
+ * Usage:
+ * ```kotlin
+ * Sha256Verifier().use { hasher ->
+ *     hasher.update(buffer, 0, bytesRead)
+ *     val hex = hasher.digestHex()
+ * }
+ * ```
+ */
+class Sha256Verifier : Closeable {
+
+    companion object {
+        private const val TAG = "Sha256Verifier"
+
+        private val nativeAvailable: Boolean by lazy {
+            try {
+                System.loadLibrary("llama-jni")
+                Log.i(TAG, "Native SHA-256 backend: ${nativeBackend()}")
+                true
+            } catch (e: UnsatisfiedLinkError) {
+                Log.i(TAG, "llama-jni not available, using MessageDigest")
+                false
+            }
+        }
+
+        /**
+         * Hash an existing file. The native path mmaps it rather than
+         * streaming it through a Java buffer.
+         */
+        fun hashFile(file: File): String {
+            if (nativeAvailable) {
+                nativeHashFile(file.absolutePath)?.let { return it }
+            }
+            return Sha256Verifier().use { hasher ->
+                hasher.updateFromFile(file, file.length())
+                hasher.digestHex()
+            }
+        }
+
+        // Native methods - sha256.cpp in llama-jni
+        @JvmStatic
+        private external fun nativeCreate(): Long
+
+        @JvmStatic
+        private external fun nativeUpdate(handle: Long, data: ByteArray, offset: Int, length: Int)
+
+        @JvmStatic
+        private external fun nativeUpdateFromFile(handle: Long, path: String, length: Long): Boolean
+
+        @JvmStatic
+        private external fun nativeFinish(handle: Long): String
+
+        @JvmStatic
+        private external fun nativeFree(handle: Long)
+
+        @JvmStatic
+        private external fun nativeHashFile(path: String): String?
+
+        @JvmStatic
+        private external fun nativeBackend(): String
+    }
+
+    private var handle: Long = if (nativeAvailable) nativeCreate() else 0L
+    private val fallback: MessageDigest? =
+        if (handle == 0L) MessageDigest.getInstance("SHA-256") else null
+
+    /**
+     * Feed [length] bytes of [data] starting at [offset].
+     */
+    fun update(data: ByteArray, offset: Int = 0, length: Int = data.size) {
+        if (handle != 0L) {
+            nativeUpdate(handle, data, offset, length)
+        } else {
+            fallback?.update(data, offset, length)
+        }
+    }
+
+    /**
+     * Feed the first [length] bytes of [file], e.g. the already-downloaded
+     * prefix when resuming a transfer.
+     */
+    fun updateFromFile(file: File, length: Long) {
+        if (handle != 0L) {
+            if (!nativeUpdateFromFile(handle, file.absolutePath, length)) {
+                throw java.io.IOException("Failed to hash ${file.absolutePath}")
+            }
+            return
+        }
+
+        file.inputStream().use { input ->
+            val buffer = ByteArray(65536)
+            var remaining = length
+            while (remaining > 0) {
+                val bytesRead = input.read(buffer, 0, minOf(buffer.size.toLong(), remaining).toInt())
+                if (bytesRead == -1) break
+                fallback?.update(buffer, 0, bytesRead)
+                remaining -= bytesRead
+            }
+        }
+    }
+
+    /**
+     * Finish and return the lowercase hex digest. The hasher can't be fed afterwards.
+     */
+    fun digestHex(): String {
+        if (handle != 0L) {
+            return nativeFinish(handle)
+        }
+        return fallback!!.digest().joinToString("") { "%02x".format(it) }
+    }
+
+    override fun close() {
+        if (handle != 0L) {
+            nativeFree(handle)
+            handle = 0L
+        }
+    }
+}
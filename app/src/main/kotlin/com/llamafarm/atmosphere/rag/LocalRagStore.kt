@@ -14,13 +14,22 @@ import java.util.concurrent.ConcurrentHashMap
  * have dedicated embedding models on-device yet. This provides surprisingly good
  * results for many use cases without requiring GPU-heavy embedding computation.
  * 
- * Future: Can be upgraded to use actual embeddings when available.
+ * When the llama-jni library is present, indexes are mirrored natively and
+ * [queryForContext] runs hybrid retrieval (BM25 + optional embeddings, fused
+ * with reciprocal-rank fusion) and token-budgeted packing in one JNI call.
  */
 class LocalRagStore {
     
     companion object {
         private const val TAG = "LocalRagStore"
         private const val DEFAULT_TOP_K = 3
+        private const val DEFAULT_CONTEXT_TOKEN_BUDGET = 1024
+        // Budget estimate for the Kotlin fallback, which has no tokenizer
+        private const val FALLBACK_CHARS_PER_TOKEN = 4
+        
+        // Fusion modes for nativeQueryForContext
+        const val FUSION_RRF = 0
+        const val FUSION_WEIGHTED = 1
         
         // BM25 parameters
         private const val K1 = 1.2
@@ -42,6 +51,41 @@ class LocalRagStore {
             "give", "day", "most", "us", "is", "are", "was", "were", "been",
             "has", "had", "did", "does", "doing", "am"
         )
+        
+        private val nativeAvailable: Boolean by lazy {
+            try {
+                System.loadLibrary("llama-jni")
+                true
+            } catch (e: UnsatisfiedLinkError) {
+                Log.i(TAG, "llama-jni not available, using Kotlin retrieval")
+                false
+            }
+        }
+        
+        // Native methods - hybrid retrieval in llama-jni (rag_native.cpp)
+        @JvmStatic
+        private external fun nativeCreateIndex(
+            indexId: String,
+            docIds: Array<String>,
+            contents: Array<String>,
+            embeddings: FloatArray?,
+            dim: Int
+        ): Int
+        
+        @JvmStatic
+        private external fun nativeDeleteIndex(indexId: String)
+        
+        @JvmStatic
+        private external fun nativeQueryForContext(
+            indexId: String,
+            query: String,
+            queryEmbedding: FloatArray?,
+            topK: Int,
+            fusionMode: Int,
+            bm25Weight: Float,
+            tokenBudget: Int,
+            rerankBudgetMs: Int
+        ): String?
     }
     
     /**
@@ -80,16 +124,22 @@ class LocalRagStore {
     // All indexes by ID
     private val indexes = ConcurrentHashMap<String, RagIndex>()
     
+    // Index IDs that are also registered with the native store
+    private val nativeIndexes = ConcurrentHashMap.newKeySet<String>()
+    
     /**
      * Create a new RAG index from documents.
      * 
      * @param indexId Unique ID for the index
      * @param documents List of documents to index
+     * @param embeddings Optional per-document embeddings (same order and dimension)
+     *                   enabling vector search in the native hybrid query
      * @return The created index
      */
     suspend fun createIndex(
         indexId: String, 
-        documents: List<Pair<String, String>>  // (id, content)
+        documents: List<Pair<String, String>>,  // (id, content)
+        embeddings: List<FloatArray>? = null
     ): RagIndex = withContext(Dispatchers.Default) {
         Log.i(TAG, "Creating index '$indexId' with ${documents.size} documents")
         
@@ -128,9 +178,46 @@ class LocalRagStore {
         Log.i(TAG, "Index '$indexId' created with ${index.documents.size} documents, " +
                    "${index.documentFrequencies.size} unique terms")
         
+        if (nativeAvailable) {
+            registerNativeIndex(indexId, documents, embeddings)
+        }
+        
         index
     }
     
+    private fun registerNativeIndex(
+        indexId: String,
+        documents: List<Pair<String, String>>,
+        embeddings: List<FloatArray>?
+    ) {
+        val dim = embeddings?.firstOrNull()?.size ?: 0
+        val flat = if (embeddings != null && embeddings.size == documents.size && dim > 0 &&
+                       embeddings.all { it.size == dim }) {
+            FloatArray(documents.size * dim).also { out ->
+                embeddings.forEachIndexed { i, vec -> vec.copyInto(out, i * dim) }
+            }
+        } else {
+            if (embeddings != null) {
+                Log.w(TAG, "Ignoring embeddings for '$indexId': count or dimension mismatch")
+            }
+            null
+        }
+        
+        val result = nativeCreateIndex(
+            indexId,
+            documents.map { it.first }.toTypedArray(),
+            documents.map { it.second }.toTypedArray(),
+            flat,
+            if (flat != null) dim else 0
+        )
+        if (result == 0) {
+            nativeIndexes.add(indexId)
+        } else {
+            nativeIndexes.remove(indexId)
+            Log.w(TAG, "Native index registration failed for '$indexId': $result")
+        }
+    }
+    
     /**
      * Create index from JSON array of documents.
      */
@@ -224,27 +311,68 @@ class LocalRagStore {
     
     /**
      * Query and format results as context for LLM.
+     * 
+     * On the native path this is a single JNI call: BM25 and vector search
+     * (when the index and [queryEmbedding] carry embeddings) run in parallel,
+     * are fused and deduplicated by document ID, and the packed context is
+     * truncated to [tokenBudget] tokens of the loaded model's tokenizer.
+     * A positive [rerankBudgetMs] rescores the fused candidates with the
+     * reranker loaded via [com.llamafarm.atmosphere.inference.LlamaCppEngine.loadReranker].
+     *
+     * The Kotlin fallback (no native index, or the native query failed) is
+     * BM25 only, with [tokenBudget] estimated at 4 characters per token.
      */
     suspend fun queryForContext(
         indexId: String,
         query: String,
-        topK: Int = DEFAULT_TOP_K
+        topK: Int = DEFAULT_TOP_K,
+        queryEmbedding: FloatArray? = null,
+        tokenBudget: Int = DEFAULT_CONTEXT_TOKEN_BUDGET,
+        fusionMode: Int = FUSION_RRF,
+        bm25Weight: Float = 0.5f,
+        rerankBudgetMs: Int = 0
     ): String {
+        if (indexId in nativeIndexes) {
+            val packed = withContext(Dispatchers.Default) {
+                nativeQueryForContext(
+                    indexId, query, queryEmbedding, topK, fusionMode, bm25Weight,
+                    tokenBudget, rerankBudgetMs
+                )
+            }
+            if (packed != null) {
+                return packed.ifEmpty { "No relevant information found." }
+            }
+            Log.w(TAG, "Native query failed for '$indexId', falling back to Kotlin")
+        }
+        if (queryEmbedding != null || rerankBudgetMs > 0) {
+            Log.d(TAG, "Kotlin fallback for '$indexId': BM25 only, vector fusion and reranking skipped")
+        }
+        
         val results = query(indexId, query, topK)
         
         if (results.isEmpty()) {
             return "No relevant information found."
         }
         
-        return results.mapIndexed { i, result ->
+        val context = results.mapIndexed { i, result ->
             "Document ${i + 1} (relevance: ${String.format("%.2f", result.score)}):\n${result.document.content}"
         }.joinToString("\n\n---\n\n")
+        
+        val maxChars = tokenBudget.coerceAtLeast(0) * FALLBACK_CHARS_PER_TOKEN
+        if (context.length <= maxChars) {
+            return context
+        }
+        Log.d(TAG, "Kotlin fallback context truncated to ~$tokenBudget tokens ($maxChars of ${context.length} chars)")
+        return context.take(maxChars)
     }
     
     /**
      * Delete an index.
      */
     fun deleteIndex(indexId: String): Boolean {
+        if (nativeIndexes.remove(indexId)) {
+            nativeDeleteIndex(indexId)
+        }
         val removed = indexes.remove(indexId)
         if (removed != null) {
             Log.i(TAG, "Deleted index '$indexId'")
@@ -31,6 +31,7 @@ import com.llamafarm.atmosphere.mesh.MeshRequestProcessor
 // import com.llamafarm.atmosphere.network.MeshMessage
 import com.llamafarm.atmosphere.router.SemanticRouter
 import com.llamafarm.atmosphere.router.RouteConstraints
+import com.llamafarm.atmosphere.inference.LlamaCppEngine
 import com.llamafarm.atmosphere.inference.LocalInferenceEngine
 import com.llamafarm.atmosphere.core.AtmosphereNative
 import com.llamafarm.atmosphere.transport.BleTransportManager
@@ -65,6 +66,12 @@ class AtmosphereService : Service() {
         private const val TAG = "AtmosphereService"
         private const val NOTIFICATION_ID = 1001
         private const val WAKELOCK_TAG = "Atmosphere:ServiceWakeLock"
+        // How long a remote request waits for its response; sent as timeout_ms
+        private const val MESH_REQUEST_TIMEOUT_MS = 30_000L
+        // What MeshRequestProcessor generates when a request names no max_tokens
+        private const val MESH_DEFAULT_MAX_TOKENS = 512
+        // Rough prompt size for peer selection, without the peer's tokenizer
+        private const val CHARS_PER_TOKEN = 4
 
         /**
          * Start the Atmosphere service.
@@ -300,6 +307,11 @@ class AtmosphereService : Service() {
     // Pending inference requests: requestId -> callback
     private val pendingRequests = ConcurrentHashMap<String, (String?, String?) -> Unit>()
     
+    // Capability each peer publishes its measured capacity on, by peer ID
+    // (updateInferenceCosts). A request to that peer names it as
+    // target_capability so the peer's MeshRequestProcessor serves it.
+    private val inferenceCapabilityIds = ConcurrentHashMap<String, String>()
+    
     // Persistence
     private lateinit var preferences: AtmospherePreferences
 
@@ -592,7 +604,7 @@ class AtmosphereService : Service() {
                     executeLocalInference(requestId, prompt, onResponse)
                 } else {
                     // Send to remote node
-                    sendRemoteInferenceRequest(requestId, decision.capability.nodeId, prompt, model, onResponse)
+                    sendRemoteInferenceRequest(requestId, inferencePeerFor(decision.capability, prompt), prompt, model, onResponse)
                 }
                 
             } catch (e: Exception) {
@@ -710,7 +722,10 @@ class AtmosphereService : Service() {
                     nodeId = decision.capability.nodeId
                 ))
                 
-                routeToCapability(requestId, decision.capability, messages, model, onResponse)
+                routeToCapability(
+                    requestId, decision.capability, messages, model, onResponse,
+                    remoteNodeId = inferencePeerFor(decision.capability, lastUserMessage)
+                )
                 
             } catch (e: Exception) {
                 Log.e(TAG, "Error in sendChatRequest", e)
@@ -723,14 +738,15 @@ class AtmosphereService : Service() {
     }
     
     /**
-     * Route to a specific capability — local or remote.
+     * Route to a specific capability — local or remote (on [remoteNodeId]).
      */
     private suspend fun routeToCapability(
         requestId: String,
         capability: CapabilityAnnouncement,
         messages: List<Map<String, String>>,
         model: String,
-        onResponse: (String?, String?) -> Unit
+        onResponse: (String?, String?) -> Unit,
+        remoteNodeId: String = capability.nodeId
     ) {
         val localNodeId = _nodeId.value
         val isLocal = capability.nodeId == localNodeId || capability.hops == 0
@@ -741,7 +757,57 @@ class AtmosphereService : Service() {
             }
             executeLocalInference(requestId, prompt, onResponse)
         } else {
-            sendRemoteChatRequest(requestId, capability.nodeId, messages, model, onResponse)
+            sendRemoteChatRequest(requestId, remoteNodeId, messages, model, onResponse)
+        }
+    }
+    
+    /**
+     * The peer to send a request for [capability]'s model to: whichever peer
+     * serving that model the native cost model expects to finish soonest,
+     * from the capacity peers publish (cost.inference). The capability's own
+     * node if no peer has measured the model. Requests to a peer that
+     * publishes capacity name its capability (target_capability), which its
+     * MeshRequestProcessor matches on along with target_node_id.
+     */
+    private fun inferencePeerFor(capability: CapabilityAnnouncement, prompt: String): String {
+        val peer = try {
+            nativeNode?.selectInferencePeer(
+                capability.modelActual, prompt.length / CHARS_PER_TOKEN, MESH_DEFAULT_MAX_TOKENS
+            )
+        } catch (e: UnsatisfiedLinkError) {
+            null
+        }
+        if (peer == null || peer == capability.nodeId) return capability.nodeId
+        // Only a peer whose request processor will pick the request up
+        if (peer !in inferenceCapabilityIds) return capability.nodeId
+        Log.i(TAG, "⚡ ${capability.modelActual}: peer $peer expected to finish before ${capability.nodeId}")
+        return peer
+    }
+    
+    // Feed peers' published capacity and the local engine's to the native
+    // node's cost model (see inferencePeerFor)
+    private fun updateInferenceCosts(capabilities: JSONArray, myPeerId: String) {
+        val node = nativeNode ?: return
+        try {
+            val peerDocs = JSONArray()
+            for (i in 0 until capabilities.length()) {
+                val doc = capabilities.getJSONObject(i)
+                val peerId = doc.optString("peer_id", doc.optString("source", ""))
+                if (peerId.isEmpty() || peerId == myPeerId) continue
+                peerDocs.put(doc)
+                val capabilityId = doc.optString("_id", "").ifEmpty { doc.optString("id", "") }
+                if (capabilityId.isNotEmpty() && doc.optJSONObject("cost")?.has("inference") == true) {
+                    inferenceCapabilityIds[peerId] = capabilityId
+                }
+            }
+            node.updatePeerCapabilities(peerDocs.toString())
+            LlamaCppEngine.getInstance(applicationContext).getInferenceCapacity()?.let {
+                node.updateInferenceCapacity(it.toJson().toString())
+            }
+        } catch (e: UnsatisfiedLinkError) {
+            // Older native library without the cost functions
+        } catch (e: Exception) {
+            Log.w(TAG, "Failed to update inference costs: ${e.message}")
         }
     }
     
@@ -820,18 +886,20 @@ class AtmosphereService : Service() {
                     val requestDoc = JSONObject().apply {
                         put("request_id", requestId)
                         put("target_node_id", targetNodeId)
+                        inferenceCapabilityIds[targetNodeId]?.let { put("target_capability", it) }
                         put("prompt", prompt)
                         put("model", model ?: "auto")
                         put("project_path", projectPath)
                         put("status", "pending")
                         put("timestamp", System.currentTimeMillis() / 1000.0)
+                        put("timeout_ms", MESH_REQUEST_TIMEOUT_MS)
                     }
                     
                     AtmosphereNative.insert(atmosphereHandle, "_requests", requestId, requestDoc.toString())
                     Log.i(TAG, "🔮 CRDT request inserted: $requestId")
                     
                     // Timeout: if no response within 30s, resolve with error
-                    delay(30_000)
+                    delay(MESH_REQUEST_TIMEOUT_MS)
                     val callback = pendingRequests.remove(requestId)
                     if (callback != null) {
                         Log.w(TAG, "🔮 CRDT inference request timed out: $requestId")
@@ -890,18 +958,20 @@ class AtmosphereService : Service() {
                 val requestDoc = JSONObject().apply {
                     put("request_id", requestId)
                     put("target_node_id", targetNodeId)
+                    inferenceCapabilityIds[targetNodeId]?.let { put("target_capability", it) }
                     put("messages", messagesJson)
                     put("model", model)
                     put("project_path", projectPath)
                     put("status", "pending")
                     put("timestamp", System.currentTimeMillis() / 1000.0)
+                    put("timeout_ms", MESH_REQUEST_TIMEOUT_MS)
                 }
                 
                 AtmosphereNative.insert(atmosphereHandle, "_requests", requestId, requestDoc.toString())
                 Log.i(TAG, "🔮 CRDT chat request inserted: $requestId")
                 
                 // Timeout: if no response within 30s, resolve with error
-                delay(30_000)
+                delay(MESH_REQUEST_TIMEOUT_MS)
                 val callback = pendingRequests.remove(requestId)
                 if (callback != null) {
                     Log.w(TAG, "🔮 CRDT chat request timed out: $requestId")
@@ -932,10 +1002,12 @@ class AtmosphereService : Service() {
                         val requestId = doc.optString("request_id", doc.optString("_id", ""))
                         if (requestId.isEmpty() || seen.contains(requestId)) continue
                         
+                        // Leave the callback to the timeout until the response is final
+                        val status = doc.optString("status", "")
+                        if (status !in setOf("completed", "complete", "error", "rejected")) continue
                         val callback = pendingRequests.remove(requestId) ?: continue
                         seen.add(requestId)
                         
-                        val status = doc.optString("status", "")
                         if (status == "completed" || status == "complete") {
                             // Extract response content — Mac writes full chat completion in "response"
                             val response = doc.opt("response")
@@ -957,6 +1029,10 @@ class AtmosphereService : Service() {
                             val error = doc.optString("error", "Unknown mesh error")
                             Log.w(TAG, "❌ CRDT error response for $requestId: $error")
                             callback(null, error)
+                        } else if (status == "rejected") {
+                            val error = meshRejectionError(doc)
+                            Log.w(TAG, "⏱️ CRDT request rejected for $requestId: $error")
+                            callback(null, error)
                         }
                     }
                 } catch (e: Exception) {
@@ -966,6 +1042,19 @@ class AtmosphereService : Service() {
         }
     }
     
+    // A peer declined the request because its completion estimate missed
+    // our timeout (MeshRequestProcessor admission); report the estimate
+    private fun meshRejectionError(doc: JSONObject): String {
+        val peer = doc.optString("peer_id", "unknown")
+        val reason = doc.optString("content", "request rejected")
+        val estimatedMs = doc.optLong("estimated_ms", -1)
+        return if (estimatedMs >= 0) {
+            "Mesh peer $peer declined the request: $reason (estimated ${estimatedMs}ms)"
+        } else {
+            "Mesh peer $peer declined the request: $reason"
+        }
+    }
+    
     /**
      * Send inference response back via CRDT mesh.
      */
@@ -1297,6 +1386,7 @@ class AtmosphereService : Service() {
                     try {
                         val capsJson = AtmosphereNative.query(atmosphereHandle, "_capabilities")
                         val capsArray = JSONArray(capsJson)
+                        updateInferenceCosts(capsArray, nodeId.take(16))
                         val caps = (0 until capsArray.length()).map { i ->
                             val obj = capsArray.getJSONObject(i)
                             buildMap<String, Any> {
@@ -1426,6 +1516,8 @@ class AtmosphereService : Service() {
                                 if (status == "error") {
                                     val error = doc.optString("error", content ?: "Unknown error")
                                     callback(null, error)
+                                } else if (status == "rejected") {
+                                    callback(null, meshRejectionError(doc))
                                 } else {
                                     callback(content, null)
                                 }
@@ -1,7 +1,8 @@
 //! Cost Collection
 //!
 //! Collects and calculates costs for executing tasks on a node.
-//! Uses platform metrics to determine current resource costs.
+//! Uses platform metrics to determine current resource costs, and the
+//! inference engine's measured capacity where the node runs one.
 
 use std::sync::Arc;
 use std::collections::HashMap;
@@ -11,6 +12,110 @@ use serde::{Deserialize, Serialize};
 use crate::metrics::PlatformMetrics;
 use crate::node::NodeId;
 
+/// Decode rate that costs 0.5; faster engines cost less
+const REFERENCE_DECODE_TOKENS_PER_S: f32 = 20.0;
+
+/// Below this much free KV cache a node can't take a typical request
+const MIN_KV_HEADROOM_TOKENS: u32 = 512;
+
+/// Cost of a factor nothing is known about
+const UNKNOWN_COST: f32 = 0.5;
+
+/// Capacity older than this is ignored: the node stopped publishing (left
+/// the mesh, or its engine was unloaded). Android republishes every 10 s.
+const INFERENCE_CAPACITY_TTL_MS: u64 = 30_000;
+
+fn now_ms() -> u64 {
+    std::time::SystemTime::now()
+        .duration_since(std::time::UNIX_EPOCH)
+        .map(|d| d.as_millis() as u64)
+        .unwrap_or(0)
+}
+
+fn unknown_cost() -> f32 {
+    UNKNOWN_COST
+}
+
+/// Measured inference capacity of a node for one model, as published by its
+/// inference engine (moving averages over recent requests). On Android this
+/// is `LlamaCppEngine.InferenceCapacity`, carried in the model capability
+/// document under `cost.inference`.
+#[derive(Debug, Clone, Default, PartialEq, Serialize, Deserialize)]
+pub struct InferenceCapacity {
+    /// Model the rates were measured on
+    pub model: String,
+
+    /// Prompt tokens prefilled per second
+    pub prefill_tokens_per_s: f32,
+
+    /// Tokens generated per second
+    pub decode_tokens_per_s: f32,
+
+    /// Generations running or waiting on the engine
+    #[serde(default)]
+    pub queue_depth: u32,
+
+    /// Free KV cache cells in the engine's context
+    #[serde(default)]
+    pub kv_headroom_tokens: u32,
+
+    /// Timestamp when this was measured (0 = unknown)
+    #[serde(default)]
+    pub timestamp_ms: u64,
+}
+
+impl InferenceCapacity {
+    /// Read the capacity from a capability document (`cost.inference`)
+    pub fn from_capability_json(doc: &serde_json::Value) -> Option<Self> {
+        let value = doc.get("cost")?.get("inference")?;
+        serde_json::from_value(value.clone()).ok()
+    }
+
+    /// Whether both rates have been measured
+    pub fn is_measured(&self) -> bool {
+        self.prefill_tokens_per_s > 0.0 && self.decode_tokens_per_s > 0.0
+    }
+
+    /// Whether this is recent enough to route on at `now_ms`. Capacity
+    /// without a timestamp is taken as current.
+    pub fn is_fresh(&self, now_ms: u64) -> bool {
+        self.timestamp_ms == 0 || now_ms.saturating_sub(self.timestamp_ms) <= INFERENCE_CAPACITY_TTL_MS
+    }
+
+    /// Estimated time to serve a request, in ms, counting the queued
+    /// generations as requests of the same size
+    pub fn estimated_ms(&self, prompt_tokens: u32, max_tokens: u32) -> Option<f32> {
+        if !self.is_measured() {
+            return None;
+        }
+        let request_s = prompt_tokens as f32 / self.prefill_tokens_per_s
+            + max_tokens as f32 / self.decode_tokens_per_s;
+        Some(request_s * (1 + self.queue_depth) as f32 * 1000.0)
+    }
+
+    /// Cost factor: 0.0 = fast and idle, 1.0 = slow, saturated or out of KV room
+    pub fn cost(&self) -> f32 {
+        if !self.is_measured() {
+            return UNKNOWN_COST;
+        }
+        if self.kv_headroom_tokens < MIN_KV_HEADROOM_TOKENS {
+            return 1.0;
+        }
+        // The decode rate is shared with everything queued
+        let effective = self.decode_tokens_per_s / (1 + self.queue_depth) as f32;
+        REFERENCE_DECODE_TOKENS_PER_S / (REFERENCE_DECODE_TOKENS_PER_S + effective)
+    }
+}
+
+/// Cost of the best measured model, if any was measured recently
+fn best_inference_cost(inference: &[InferenceCapacity], now_ms: u64) -> Option<f32> {
+    inference
+        .iter()
+        .filter(|c| c.is_measured() && c.is_fresh(now_ms))
+        .map(InferenceCapacity::cost)
+        .min_by(|a, b| a.partial_cmp(b).unwrap())
+}
+
 /// Cost metrics for a node
 #[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct NodeCost {
@@ -26,6 +131,14 @@ pub struct NodeCost {
     /// Network cost factor
     pub network_cost: f32,
 
+    /// Inference capacity cost factor, from the best measured model
+    #[serde(default = "unknown_cost")]
+    pub inference_cost: f32,
+
+    /// Measured inference capacity per model (empty without a local engine)
+    #[serde(default)]
+    pub inference: Vec<InferenceCapacity>,
+
     /// Combined weighted cost score
     pub total_cost: f32,
 
@@ -33,6 +146,29 @@ pub struct NodeCost {
     pub timestamp_ms: u64,
 }
 
+impl NodeCost {
+    /// Weighted battery, CPU, memory and network factors
+    pub fn device_cost(&self, weights: &CostWeights) -> f32 {
+        (self.battery_cost * weights.battery)
+            + (self.cpu_cost * weights.cpu)
+            + (self.memory_cost * weights.memory)
+            + (self.network_cost * weights.network)
+    }
+
+    /// Set the measured inference capacity and recompute the costs from it
+    fn apply_inference(&mut self, inference: Vec<InferenceCapacity>, weights: &CostWeights) {
+        let measured_cost = best_inference_cost(&inference, now_ms());
+        let device_cost = self.device_cost(weights);
+        self.inference = inference;
+        self.inference_cost = measured_cost.unwrap_or(UNKNOWN_COST);
+        // Measured capacity says more about serving a request than CPU load
+        self.total_cost = match measured_cost {
+            Some(cost) => device_cost * (1.0 - weights.inference) + cost * weights.inference,
+            None => device_cost,
+        };
+    }
+}
+
 impl Default for NodeCost {
     fn default() -> Self {
         Self {
@@ -40,6 +176,8 @@ impl Default for NodeCost {
             cpu_cost: 0.5,
             memory_cost: 0.5,
             network_cost: 0.5,
+            inference_cost: UNKNOWN_COST,
+            inference: Vec::new(),
             total_cost: 0.5,
             timestamp_ms: 0,
         }
@@ -53,6 +191,14 @@ pub struct CostWeights {
     pub cpu: f32,
     pub memory: f32,
     pub network: f32,
+    /// Share of the total taken by measured inference capacity when there
+    /// is some; the device factors above split the rest
+    #[serde(default = "default_inference_weight")]
+    pub inference: f32,
+}
+
+fn default_inference_weight() -> f32 {
+    0.5
 }
 
 impl Default for CostWeights {
@@ -62,6 +208,7 @@ impl Default for CostWeights {
             cpu: 0.25,
             memory: 0.2,
             network: 0.15,
+            inference: default_inference_weight(),
         }
     }
 }
@@ -76,6 +223,9 @@ pub struct CostCollector {
 
     /// Cached peer costs
     peer_costs: RwLock<HashMap<NodeId, NodeCost>>,
+
+    /// Local inference engine's measured capacity, by model
+    inference: RwLock<HashMap<String, InferenceCapacity>>,
 }
 
 impl CostCollector {
@@ -85,6 +235,7 @@ impl CostCollector {
             metrics,
             weights: RwLock::new(CostWeights::default()),
             peer_costs: RwLock::new(HashMap::new()),
+            inference: RwLock::new(HashMap::new()),
         }
     }
 
@@ -104,25 +255,23 @@ impl CostCollector {
         // Network cost (simplified - could be enhanced)
         let network_cost = 0.2; // Base network cost
 
-        // Calculate weighted total
-        let total_cost = (battery_cost * weights.battery)
-            + (cpu_cost * weights.cpu)
-            + (memory_cost * weights.memory)
-            + (network_cost * weights.network);
+        // Inference cost: the best model this node has measured
+        let mut inference: Vec<InferenceCapacity> =
+            self.inference.read().unwrap().values().cloned().collect();
+        inference.sort_by(|a, b| a.model.cmp(&b.model));
 
-        let timestamp_ms = std::time::SystemTime::now()
-            .duration_since(std::time::UNIX_EPOCH)
-            .map(|d| d.as_millis() as u64)
-            .unwrap_or(0);
+        let timestamp_ms = now_ms();
 
-        NodeCost {
+        let mut cost = NodeCost {
             battery_cost,
             cpu_cost,
             memory_cost,
             network_cost,
-            total_cost,
             timestamp_ms,
-        }
+            ..Default::default()
+        };
+        cost.apply_inference(inference, &weights);
+        cost
     }
 
     /// Calculate battery cost factor
@@ -174,6 +323,24 @@ impl CostCollector {
         self.weights.read().unwrap().clone()
     }
 
+    /// Publish the local inference engine's measured capacity for a model
+    pub fn update_inference_capacity(&self, capacity: InferenceCapacity) {
+        self.inference.write().unwrap().insert(capacity.model.clone(), capacity);
+    }
+
+    /// Forget a model's capacity (e.g. after it was unloaded)
+    pub fn remove_inference_capacity(&self, model: &str) {
+        self.inference.write().unwrap().remove(model);
+    }
+
+    /// Set a peer's measured inference capacity (e.g. from the `cost.inference`
+    /// of its capability documents), keeping its device factors if known
+    pub fn update_peer_inference(&self, node_id: NodeId, inference: Vec<InferenceCapacity>) {
+        let weights = self.weights.read().unwrap();
+        let mut peers = self.peer_costs.write().unwrap();
+        peers.entry(node_id).or_default().apply_inference(inference, &weights);
+    }
+
     /// Store a peer's cost information
     pub fn update_peer_cost(&self, node_id: NodeId, cost: NodeCost) {
         self.peer_costs.write().unwrap().insert(node_id, cost);
@@ -205,6 +372,30 @@ impl CostCollector {
             .min_by(|a, b| a.1.total_cost.partial_cmp(&b.1.total_cost).unwrap())
             .map(|(id, _)| *id)
     }
+
+    /// Find the peer expected to finish a request for `model` soonest, with
+    /// the estimate in ms. Peers that haven't measured the model, whose
+    /// capacity is stale, or that lack the KV room for the request are skipped.
+    pub fn find_fastest_peer_for_model(
+        &self,
+        model: &str,
+        prompt_tokens: u32,
+        max_tokens: u32,
+    ) -> Option<(NodeId, f32)> {
+        let now_ms = now_ms();
+        self.peer_costs
+            .read()
+            .unwrap()
+            .iter()
+            .filter_map(|(id, cost)| {
+                let capacity = cost.inference.iter().find(|c| c.model == model)?;
+                if !capacity.is_fresh(now_ms) || capacity.kv_headroom_tokens < prompt_tokens + max_tokens {
+                    return None;
+                }
+                Some((*id, capacity.estimated_ms(prompt_tokens, max_tokens)?))
+            })
+            .min_by(|a, b| a.1.partial_cmp(&b.1).unwrap())
+    }
 }
 
 impl std::fmt::Debug for CostCollector {
@@ -303,6 +494,7 @@ mod tests {
             cpu: 0.5,
             memory: 0.3,
             network: 0.1,
+            inference: 0.5,
         };
 
         collector.set_weights(new_weights.clone());
@@ -311,4 +503,201 @@ mod tests {
         assert!((weights.battery - 0.1).abs() < f32::EPSILON);
         assert!((weights.cpu - 0.5).abs() < f32::EPSILON);
     }
+
+    fn capacity(model: &str, decode_tokens_per_s: f32, queue_depth: u32) -> InferenceCapacity {
+        InferenceCapacity {
+            model: model.to_string(),
+            prefill_tokens_per_s: decode_tokens_per_s * 10.0,
+            decode_tokens_per_s,
+            queue_depth,
+            kv_headroom_tokens: 4096,
+            timestamp_ms: 0,
+        }
+    }
+
+    #[test]
+    fn test_inference_capacity_cost() {
+        let slow = capacity("llama", 5.0, 0);
+        let fast = capacity("llama", 40.0, 0);
+        let busy = capacity("llama", 40.0, 3);
+
+        assert!(fast.cost() < slow.cost());
+        assert!(busy.cost() > fast.cost());
+        assert!((capacity("llama", 20.0, 0).cost() - 0.5).abs() < f32::EPSILON);
+
+        // Out of KV room costs the most
+        let full = InferenceCapacity { kv_headroom_tokens: 100, ..fast.clone() };
+        assert!((full.cost() - 1.0).abs() < f32::EPSILON);
+
+        // Nothing measured yet
+        assert!((InferenceCapacity::default().cost() - UNKNOWN_COST).abs() < f32::EPSILON);
+    }
+
+    #[test]
+    fn test_estimated_ms() {
+        let idle = capacity("llama", 10.0, 0); // prefill 100 tok/s
+        // 100 prompt tokens = 1 s, 50 generated = 5 s
+        assert!((idle.estimated_ms(100, 50).unwrap() - 6000.0).abs() < 1.0);
+
+        // One generation ahead doubles it
+        let queued = capacity("llama", 10.0, 1);
+        assert!((queued.estimated_ms(100, 50).unwrap() - 12000.0).abs() < 1.0);
+
+        assert!(InferenceCapacity::default().estimated_ms(100, 50).is_none());
+    }
+
+    #[test]
+    fn test_local_cost_uses_inference_capacity() {
+        let fast = CostCollector::new(Arc::new(MockMetrics::default()));
+        let slow = CostCollector::new(Arc::new(MockMetrics::default()));
+        let device_only = fast.calculate_local_cost();
+        assert!((device_only.inference_cost - UNKNOWN_COST).abs() < f32::EPSILON);
+        assert!(device_only.inference.is_empty());
+
+        fast.update_inference_capacity(capacity("llama", 40.0, 0));
+        slow.update_inference_capacity(capacity("llama", 4.0, 0));
+        let fast_cost = fast.calculate_local_cost();
+        let slow_cost = slow.calculate_local_cost();
+
+        assert_eq!(fast_cost.inference.len(), 1);
+        assert!(fast_cost.inference_cost < slow_cost.inference_cost);
+        assert!(fast_cost.total_cost < slow_cost.total_cost);
+
+        // The best model counts
+        slow.update_inference_capacity(capacity("qwen", 40.0, 0));
+        assert!((slow.calculate_local_cost().inference_cost - fast_cost.inference_cost).abs() < f32::EPSILON);
+
+        slow.remove_inference_capacity("qwen");
+        slow.remove_inference_capacity("llama");
+        assert!((slow.calculate_local_cost().total_cost - device_only.total_cost).abs() < f32::EPSILON);
+    }
+
+    #[test]
+    fn test_lowest_cost_peer_follows_inference_capacity() {
+        let peer_fast = NodeId::new();
+        let peer_slow = NodeId::new();
+        let collector = CostCollector::new(Arc::new(MockMetrics::default()));
+
+        // Same device load, different engines
+        let fast = CostCollector::new(Arc::new(MockMetrics::default()));
+        fast.update_inference_capacity(capacity("llama", 30.0, 0));
+        let slow = CostCollector::new(Arc::new(MockMetrics::default()));
+        slow.update_inference_capacity(capacity("llama", 3.0, 0));
+
+        collector.update_peer_cost(peer_fast, fast.calculate_local_cost());
+        collector.update_peer_cost(peer_slow, slow.calculate_local_cost());
+        assert_eq!(collector.find_lowest_cost_peer(), Some(peer_fast));
+
+        // ...until the fast one is swamped
+        fast.update_inference_capacity(capacity("llama", 30.0, 20));
+        collector.update_peer_cost(peer_fast, fast.calculate_local_cost());
+        assert_eq!(collector.find_lowest_cost_peer(), Some(peer_slow));
+    }
+
+    #[test]
+    fn test_update_peer_inference() {
+        let collector = CostCollector::new(Arc::new(MockMetrics::default()));
+        let peer_fast = NodeId::new();
+        let peer_slow = NodeId::new();
+
+        // Device factors gossiped earlier are kept
+        let device = NodeCost { battery_cost: 0.1, cpu_cost: 0.1, ..Default::default() };
+        collector.update_peer_cost(peer_slow, device.clone());
+        collector.update_peer_inference(peer_slow, vec![capacity("llama", 3.0, 0)]);
+        collector.update_peer_inference(peer_fast, vec![capacity("llama", 30.0, 0)]);
+
+        let slow = collector.get_peer_cost(&peer_slow).unwrap();
+        assert!((slow.battery_cost - 0.1).abs() < f32::EPSILON);
+        assert_eq!(slow.inference.len(), 1);
+        assert_eq!(collector.find_lowest_cost_peer(), Some(peer_fast));
+
+        // Capacity withdrawn: back to the device cost alone
+        collector.update_peer_inference(peer_slow, Vec::new());
+        let slow = collector.get_peer_cost(&peer_slow).unwrap();
+        let weights = collector.get_weights();
+        assert!((slow.total_cost - device.device_cost(&weights)).abs() < f32::EPSILON);
+    }
+
+    #[test]
+    fn test_find_fastest_peer_for_model() {
+        let collector = CostCollector::new(Arc::new(MockMetrics::default()));
+        let peer_llama = NodeId::new();
+        let peer_qwen = NodeId::new();
+        let peer_full = NodeId::new();
+
+        let cost = |capacities: Vec<InferenceCapacity>| NodeCost { inference: capacities, ..Default::default() };
+        collector.update_peer_cost(peer_llama, cost(vec![capacity("llama", 10.0, 0)]));
+        collector.update_peer_cost(peer_qwen, cost(vec![capacity("qwen", 50.0, 0)]));
+        collector.update_peer_cost(
+            peer_full,
+            cost(vec![InferenceCapacity { kv_headroom_tokens: 64, ..capacity("llama", 50.0, 0) }]),
+        );
+
+        let (peer, ms) = collector.find_fastest_peer_for_model("llama", 100, 50).unwrap();
+        assert_eq!(peer, peer_llama);
+        assert!((ms - 6000.0).abs() < 1.0);
+        assert!(collector.find_fastest_peer_for_model("mistral", 100, 50).is_none());
+    }
+
+    #[test]
+    fn test_stale_capacity_is_ignored() {
+        let now = now_ms();
+        let fresh = InferenceCapacity { timestamp_ms: now - 1_000, ..capacity("llama", 10.0, 0) };
+        let stale = InferenceCapacity {
+            timestamp_ms: now - INFERENCE_CAPACITY_TTL_MS - 1_000,
+            ..capacity("llama", 50.0, 0)
+        };
+        assert!(fresh.is_fresh(now));
+        assert!(!stale.is_fresh(now));
+        assert!(capacity("llama", 10.0, 0).is_fresh(now));
+
+        // The faster peer stopped publishing long ago
+        let collector = CostCollector::new(Arc::new(MockMetrics::default()));
+        let peer_fresh = NodeId::new();
+        let peer_stale = NodeId::new();
+        collector.update_peer_inference(peer_fresh, vec![fresh]);
+        collector.update_peer_inference(peer_stale, vec![stale]);
+        let (peer, _) = collector.find_fastest_peer_for_model("llama", 100, 50).unwrap();
+        assert_eq!(peer, peer_fresh);
+
+        // ...and its cost falls back to the device factors alone
+        let stale_cost = collector.get_peer_cost(&peer_stale).unwrap();
+        assert!((stale_cost.inference_cost - UNKNOWN_COST).abs() < f32::EPSILON);
+        let weights = collector.get_weights();
+        assert!((stale_cost.total_cost - stale_cost.device_cost(&weights)).abs() < f32::EPSILON);
+    }
+
+    #[test]
+    fn test_capacity_from_capability_json() {
+        let doc = serde_json::json!({
+            "id": "local:llama-3.2-1b:default",
+            "cost": {
+                "local": true,
+                "inference": {
+                    "model": "Llama-3.2-1B-Instruct-Q4_K_M",
+                    "prefill_tokens_per_s": 180.5,
+                    "decode_tokens_per_s": 21.0,
+                    "queue_depth": 1,
+                    "kv_headroom_tokens": 3500,
+                    "timestamp_ms": 1700000000000u64
+                }
+            }
+        });
+        let capacity = InferenceCapacity::from_capability_json(&doc).unwrap();
+        assert_eq!(capacity.model, "Llama-3.2-1B-Instruct-Q4_K_M");
+        assert_eq!(capacity.queue_depth, 1);
+        assert!((capacity.decode_tokens_per_s - 21.0).abs() < f32::EPSILON);
+
+        assert!(InferenceCapacity::from_capability_json(&serde_json::json!({ "cost": {} })).is_none());
+    }
+
+    #[test]
+    fn test_node_cost_without_inference_fields() {
+        // Costs from peers that predate inference capacity
+        let json = r#"{"battery_cost":0.1,"cpu_cost":0.2,"memory_cost":0.3,
+                       "network_cost":0.2,"total_cost":0.2,"timestamp_ms":1}"#;
+        let cost: NodeCost = serde_json::from_str(json).unwrap();
+        assert!((cost.inference_cost - UNKNOWN_COST).abs() < f32::EPSILON);
+        assert!(cost.inference.is_empty());
+    }
 }
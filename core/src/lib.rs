@@ -13,7 +13,7 @@ pub mod metrics;
 pub mod node;
 
 pub use capability::{Capability, CapabilityRegistry};
-pub use cost::{CostCollector, NodeCost};
+pub use cost::{CostCollector, InferenceCapacity, NodeCost};
 pub use error::{AtmosphereError, Result};
 pub use intent::{Intent, IntentRouter, IntentStatus};
 pub use mesh::{GossipMessage, MeshClient, PeerInfo};
@@ -0,0 +1,51 @@
+#!/bin/bash
+# Compare llama-jni builds: binary size, exported symbols, relocations and
+# shared-library dependencies.
+#
+# Usage: scripts/measure-llama-jni.sh <lib dir> [<lib dir> ...]
+#   e.g. a default build's arm64-v8a output vs. a -DLLAMA_JNI_STATIC=ON one
+#
+# Uses llvm-readelf from $ANDROID_NDK_HOME when set, else readelf on PATH.
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <lib dir> [<lib dir> ...]"
+    exit 1
+fi
+
+READELF=readelf
+if [ -n "$ANDROID_NDK_HOME" ]; then
+    NDK_READELF=$(ls "$ANDROID_NDK_HOME"/toolchains/llvm/prebuilt/*/bin/llvm-readelf 2>/dev/null | head -1)
+    [ -n "$NDK_READELF" ] && READELF=$NDK_READELF
+fi
+
+for dir in "$@"; do
+    jni="$dir/libllama-jni.so"
+    if [ ! -f "$jni" ]; then
+        echo "❌ $jni not found"
+        continue
+    fi
+
+    echo "📦 $dir"
+
+    # Everything the engine has to map: llama-jni plus llama/ggml libraries
+    total=0
+    for lib in "$dir"/libllama*.so "$dir"/libggml*.so; do
+        [ -f "$lib" ] || continue
+        size=$(stat -c %s "$lib")
+        total=$((total + size))
+        printf "   %-40s %10d bytes\n" "$(basename "$lib")" "$size"
+    done
+    printf "   %-40s %10d bytes\n" "total" "$total"
+
+    exported=$($READELF --dyn-syms -W "$jni" | awk '$5 == "GLOBAL" && $7 != "UND"' | wc -l)
+    jni_exported=$($READELF --dyn-syms -W "$jni" | awk '$5 == "GLOBAL" && $7 != "UND" && $8 ~ /^Java_|^JNI_OnLoad/' | wc -l)
+    relocs=$($READELF -r -W "$jni" | grep -c "R_" || true)
+    needed=$($READELF -d -W "$jni" | grep NEEDED | sed 's/.*\[\(.*\)\]/\1/' | tr '\n' ' ')
+
+    echo "   exported symbols:   $exported ($jni_exported JNI)"
+    echo "   dynamic relocations: $relocs"
+    echo "   needed:             $needed"
+    echo
+done
@@ -0,0 +1,142 @@
+#!/bin/bash
+# Profile-guided optimization of llama-jni, driven by llama-jni-bench.
+#
+#   1. build a baseline (LLAMA_JNI_STATIC) and an instrumented build
+#   2. run the benchmark workload on the device with the instrumented build
+#   3. merge the profiles and rebuild with them
+#   4. benchmark baseline and PGO builds and write a speedup report
+#
+# Usage: scripts/pgo-llama-jni.sh [--model <gguf>] [--abi arm64-v8a]
+#            [--llama-cpp <dir>] [--build-root <dir>] [--runs N]
+#
+# Without --model a small random-weight model is generated with
+# llama-jni-tiny-gguf (built for the host). Needs $ANDROID_NDK_HOME and one
+# device on adb. Also run by the llama-jni-pgo CMake target. The report is
+# <build root>/pgo-report.md.
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SRC="$ROOT/app/src/main/cpp"
+
+MODEL=""
+ABI=arm64-v8a
+LLAMA_CPP="$ROOT/../llama.cpp"
+BUILD_ROOT="$ROOT/build/llama-jni-pgo"
+RUNS=5
+DEVICE_DIR=/data/local/tmp/llama-jni-pgo
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --model) MODEL=$2; shift 2 ;;
+        --abi) ABI=$2; shift 2 ;;
+        --llama-cpp) LLAMA_CPP=$2; shift 2 ;;
+        --build-root) BUILD_ROOT=$2; shift 2 ;;
+        --runs) RUNS=$2; shift 2 ;;
+        *) echo "Unknown option $1"; exit 1 ;;
+    esac
+done
+
+if [ -n "$MODEL" ] && [ ! -f "$MODEL" ]; then
+    echo "❌ Model not found: '$MODEL'"
+    exit 1
+fi
+if [ -z "$ANDROID_NDK_HOME" ]; then
+    echo "❌ ANDROID_NDK_HOME is not set"
+    exit 1
+fi
+if ! adb devices | grep -q "device$"; then
+    echo "❌ No Android device connected via ADB"
+    exit 1
+fi
+
+PROFDATA=$(ls "$ANDROID_NDK_HOME"/toolchains/llvm/prebuilt/*/bin/llvm-profdata 2>/dev/null | head -1)
+if [ -z "$PROFDATA" ]; then
+    echo "❌ llvm-profdata not found in $ANDROID_NDK_HOME"
+    exit 1
+fi
+
+mkdir -p "$BUILD_ROOT"
+PROFILE="$BUILD_ROOT/llama-jni.profdata"
+
+if [ -z "$MODEL" ]; then
+    MODEL="$BUILD_ROOT/tiny-llama-q8_0.gguf"
+    echo "🧪 Generating $(basename "$MODEL")"
+    "${CXX:-c++}" -std=c++17 -O2 -o "$BUILD_ROOT/llama-jni-tiny-gguf" "$SRC/tools/tiny_gguf.cpp"
+    "$BUILD_ROOT/llama-jni-tiny-gguf" --out "$MODEL" --layers 4 --embd 256 --ff 768 --vocab 4096
+fi
+
+# build <name> [extra cmake args...]
+build() {
+    local name=$1
+    shift
+    echo "🔨 Building $name"
+    cmake -S "$SRC" -B "$BUILD_ROOT/$name" \
+        -DCMAKE_TOOLCHAIN_FILE="$ANDROID_NDK_HOME/build/cmake/android.toolchain.cmake" \
+        -DANDROID_ABI="$ABI" -DANDROID_PLATFORM=android-28 \
+        -DCMAKE_BUILD_TYPE=Release \
+        -DLLAMA_CPP_DIR="$LLAMA_CPP" \
+        -DLLAMA_JNI_STATIC=ON -DLLAMA_JNI_BENCH=ON \
+        "$@" > "$BUILD_ROOT/$name.configure.log"
+    cmake --build "$BUILD_ROOT/$name" --target llama-jni-bench -j"$(nproc)" > "$BUILD_ROOT/$name.build.log"
+}
+
+# run <name> <runs> [env...]: benchmark a build on the device, pull metrics
+run() {
+    local name=$1 runs=$2
+    shift 2
+    local dir="$DEVICE_DIR/$name"
+    echo "📱 Running $name"
+    adb shell "rm -rf $dir && mkdir -p $dir"
+    adb push "$BUILD_ROOT/$name/libllama-jni.so" "$BUILD_ROOT/$name/llama-jni-bench" "$dir/" > /dev/null
+    adb shell "cd $dir && $* LD_LIBRARY_PATH=$dir ./llama-jni-bench --model $DEVICE_DIR/model.gguf \
+        --lib-dir $dir --runs $runs --out $dir/metrics.txt"
+    adb pull "$dir/metrics.txt" "$BUILD_ROOT/$name.metrics.txt" > /dev/null
+}
+
+echo "📤 Pushing $(basename "$MODEL")"
+adb shell "mkdir -p $DEVICE_DIR"
+adb push "$MODEL" "$DEVICE_DIR/model.gguf" > /dev/null
+
+build baseline
+build instrumented -DLLAMA_JNI_PGO=GENERATE
+
+# One short pass is enough for the profile; %m keeps one file per module
+run instrumented 1 "LLVM_PROFILE_FILE=$DEVICE_DIR/instrumented/profiles/%m.profraw"
+rm -rf "$BUILD_ROOT/profiles"
+adb pull "$DEVICE_DIR/instrumented/profiles" "$BUILD_ROOT/profiles" > /dev/null
+"$PROFDATA" merge -o "$PROFILE" "$BUILD_ROOT"/profiles/*.profraw
+echo "📊 Merged profile: $PROFILE"
+
+build pgo -DLLAMA_JNI_PGO=USE -DLLAMA_JNI_PGO_PROFILE="$PROFILE"
+
+run baseline "$RUNS"
+run pgo "$RUNS"
+
+# Speedup report: per metric, >1.00x means the PGO build is better
+REPORT="$BUILD_ROOT/pgo-report.md"
+{
+    echo "# llama-jni PGO report"
+    echo
+    echo "- Device: $(adb shell getprop ro.product.model | tr -d '\r') ($ABI)"
+    echo "- SoC: $(adb shell getprop ro.soc.model | tr -d '\r')"
+    echo "- Model: $(basename "$MODEL")"
+    echo "- Runs: $RUNS"
+    echo
+    echo "| Metric | Baseline | PGO | Speedup |"
+    echo "|--------|---------:|----:|--------:|"
+    awk '
+        NR == FNR { base[$1] = $2; next }
+        ($1 in base) && $1 != "generated_tokens" {
+            higher = ($1 ~ /_per_s$/)
+            speedup = 0
+            if (base[$1] > 0 && $2 > 0) speedup = higher ? $2 / base[$1] : base[$1] / $2
+            printf "| %s | %.2f | %.2f | %.2fx |\n", $1, base[$1], $2, speedup
+        }
+    ' "$BUILD_ROOT/baseline.metrics.txt" "$BUILD_ROOT/pgo.metrics.txt"
+} > "$REPORT"
+
+echo
+cat "$REPORT"
+echo
+echo "✅ Report written to $REPORT"